@@ -0,0 +1,117 @@
+/* See LICENSE file for copyright and license details. */
+/*
+ * Settings of the terminal core, in libst.a: both the X frontend and
+ * the null one in headless.c use them. The frontend's own are in
+ * config.h.
+ */
+
+#include <stddef.h>
+#include <wchar.h>
+
+#include "st.h"
+
+/* see shell in config.h for when utmp and scroll are run */
+char *utmp = NULL;
+/* scroll program: to enable use a string like "scroll" */
+char *scroll = NULL;
+char *stty_args = "stty raw pass8 nl -echo -iexten -cstopb 38400";
+
+/* identification sequence returned in DA and DECID */
+char *vtiden = "\033[?6c";
+
+/*
+ * word delimiter string
+ *
+ * More advanced example: L" `'\"()[]{}"
+ */
+wchar_t *worddelimiters = L" ";
+
+/* alt screens */
+int allowaltscreen = 1;
+
+/* allow certain non-interactive (insecure) window operations such as:
+   setting the clipboard text */
+int allowwindowops = 0;
+
+/*
+ * tty reads: under heavy output the read buffer grows up to ttybufmax
+ * bytes, and one wakeup keeps reading and parsing for at most
+ * ttyreadbudget ms before X events get their turn.
+ */
+unsigned int ttybufmax = 1 << 20;
+double ttyreadbudget = 5;
+
+/*
+ * longest time in ms a synchronized update (DECSET 2026) may hold back
+ * drawing before st shows whatever it has.
+ */
+unsigned int synctimeout = 150;
+
+/*
+ * scrollback: up to histsize lines, allocated as they scroll off the
+ * screen. if histbytes is not 0 the history takes up at most that many
+ * bytes, dropping its oldest lines to stay below.
+ */
+unsigned int histsize = 32768;
+size_t histbytes = 0;
+
+/*
+ * history lines further back than histhot are packed to a fraction of
+ * their size while st is idle, and expanded again as they are shown.
+ */
+unsigned int histhot = 1024;
+
+/*
+ * the scrollback shares one table of 65536 color pairs. when truecolor
+ * output fills it, stylesqueeze lets st drop low bits of 24-bit colors
+ * so that similar pairs merge; with 0 colors stay exact and new pairs
+ * get the closest ones in the table until old ones scroll away.
+ */
+int stylesqueeze = 0;
+
+/*
+ * history lines that fall off the histsize in memory are kept on disk in
+ * st's persist directory if histspill is set, up to histdiskbytes bytes
+ * (0: no limit) before the oldest go. lines on disk keep the width they
+ * were written at, a resize does not wrap them again, and they lose their
+ * shell integration marks (OSC 133), so prompt jumps stop at the disk.
+ * it is off by default as it writes the screen's text to disk; set it
+ * for long sessions whose output should not be lost.
+ */
+int histspill = 0;
+size_t histdiskbytes = 64 << 20;
+
+/*
+ * the scrollback search keeps an index of the history's trigrams, made
+ * while st is idle once the first search was typed, of up to
+ * searchindexbytes; 0 turns it off. The disk tier is not indexed.
+ */
+size_t searchindexbytes = 32 << 20;
+
+/* default TERM value */
+char *termname = "st-256color";
+
+/*
+ * spaces per tab
+ *
+ * When you are changing this value, don't forget to adapt the »it« value in
+ * the st.info and appropriately install the st.info in the environment where
+ * you use this st version.
+ *
+ *	it#$tabspaces,
+ *
+ * Secondly make sure your kernel is not expanding tabs. When running `stty
+ * -a` »tab0« should appear. You can tell the terminal to not expand tabs by
+ *  running following command:
+ *
+ *	stty tabs
+ */
+unsigned int tabspaces = 8;
+
+/*
+ * Default colors (colorname index in config.h)
+ * foreground, background, cursor
+ */
+unsigned int defaultfg = 256;
+unsigned int defaultbg = 257;
+unsigned int defaultcs = 258;
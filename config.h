@@ -16,39 +16,19 @@ static int borderpx = 2;
  * 5: value of shell in config.h
  */
 static char *shell = "/bin/sh";
-char *utmp = NULL;
-/* scroll program: to enable use a string like "scroll" */
-char *scroll = NULL;
-char *stty_args = "stty raw pass8 nl -echo -iexten -cstopb 38400";
+/* utmp, scroll and the other settings of the terminal core are in config.c */
 
 /* escape sequence emitted on standalone Right Shift press */
 static char *rightshiftseq = "\033]777;right-shift\a";
 
-/* identification sequence returned in DA and DECID */
-char *vtiden = "\033[?6c";
-
 /* Kerning / character bounding-box multipliers */
 static float cwscale = 1.0;
 static float chscale = 1.0;
 
-/*
- * word delimiter string
- *
- * More advanced example: L" `'\"()[]{}"
- */
-wchar_t *worddelimiters = L" ";
-
 /* selection timeouts (in milliseconds) */
 static unsigned int doubleclicktimeout = 300;
 static unsigned int tripleclicktimeout = 600;
 
-/* alt screens */
-int allowaltscreen = 1;
-
-/* allow certain non-interactive (insecure) window operations such as:
-   setting the clipboard text */
-int allowwindowops = 0;
-
 /*
  * draw latency range in ms - from new content/keypress/etc until drawing.
  * within this range, st draws when content stops arriving (idle). mostly it's
@@ -58,6 +38,12 @@ int allowwindowops = 0;
 static double minlatency = 2;
 static double maxlatency = 33;
 
+/*
+ * parse tty output on a separate thread. a flood of output then can't
+ * delay key handling or drawing, and a slow draw doesn't stop reading.
+ */
+static int threadedreader = 0;
+
 /*
  * blinking timeout (set to 0 to disable blinking) for the terminal blinking
  * attribute.
@@ -81,26 +67,6 @@ static unsigned int cursorthickness = 2;
  */
 static int bellvolume = 0;
 
-/* default TERM value */
-char *termname = "st-256color";
-
-/*
- * spaces per tab
- *
- * When you are changing this value, don't forget to adapt the »it« value in
- * the st.info and appropriately install the st.info in the environment where
- * you use this st version.
- *
- *	it#$tabspaces,
- *
- * Secondly make sure your kernel is not expanding tabs. When running `stty
- * -a` »tab0« should appear. You can tell the terminal to not expand tabs by
- *  running following command:
- *
- *	stty tabs
- */
-unsigned int tabspaces = 8;
-
 /* Terminal colors (16 first used in escape sequence) */
 static const char *colorname[] = {
 	/* 8 normal colors */
@@ -134,21 +100,21 @@ static const char *colorname[] = {
 	"#090d35", /* 261 → vimnav current line background */
 	"#1a1a00", /* 262 → debug prompt line bg (dark yellow tinge) */
 	"#ffe066", /* 263 → debug prompt line text (golden reflection) */
+	"#7a5c00", /* 264 → vimnav search match background */
 };
 
 
 /*
  * Default colors (colorname index)
- * foreground, background, cursor, reverse cursor
+ * foreground, background, cursor, reverse cursor; the first three are
+ * in config.c
  */
-unsigned int defaultfg = 256;
-unsigned int defaultbg = 257;
-unsigned int defaultcs = 258;
 static unsigned int defaultrcs = 259;
 unsigned int selectionbg = 260;
 unsigned int vimnav_curline_bg = 261;
 unsigned int debug_prompt_bg = 262;
 unsigned int debug_prompt_fg = 263;
+unsigned int searchbg = 264;
 
 /*
  * Default shape of cursor
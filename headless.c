@@ -0,0 +1,71 @@
+/* See LICENSE for license details. */
+/*
+ * Null frontend for libst.a: satisfies everything the terminal core
+ * expects from x.c and sshind.c without touching an X server; the
+ * settings come from config.c, as for st.
+ * Used by the replay benchmark; drawing goes through the whole core
+ * path and stops at xdrawline().
+ */
+
+#include <wchar.h>
+
+#include "st.h"
+#include "win.h"
+
+static int cursorshape = 2;
+static int winmode;
+
+void xbell(void) {}
+void xclipcopy(void) {}
+void clippaste(const Arg *arg) {}
+void xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og) {}
+void xdrawline(Line line, int x1, int y1, int x2) {}
+void xfinishdraw(void) {}
+void xscroll(int top, int bot, int n) {}
+void xshadowclear(void) {}
+void xloadcols(void) {}
+int xsetcolorname(int x, const char *name) { return 1; }
+void xseticontitle(char *p) {}
+void xsettitle(char *p) {}
+void xsetcwd(char *cwd) {}
+void xsetpointermotion(int set) {}
+void xsetsel(char *str) {}
+int xstartdraw(void) { return 1; }
+void xximspot(int x, int y) {}
+void xsetdwmsaveargv(const char *cmd) {}
+void sshind_show(const char *host) {}
+void sshind_hide(void) {}
+
+int
+xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+	*r = *g = *b = 0;
+	return 0;
+}
+
+int
+xgetcursor(void)
+{
+	return cursorshape;
+}
+
+void
+xsetmode(int set, unsigned int flags)
+{
+	MODBIT(winmode, set, flags);
+}
+
+int
+xgetmode(void)
+{
+	return winmode;
+}
+
+int
+xsetcursor(int cursor)
+{
+	if (!BETWEEN(cursor, 0, 7)) /* 7: st extension */
+		return 1;
+	cursorshape = cursor;
+	return 0;
+}
@@ -63,6 +63,8 @@ extern TermWindow win;
 extern DC dc;
 extern char *usedfont;
 extern double usedfontsize;
+int xcolorhold(const char *name, XftColor *col);
+void xcolorrelease(const XftColor *col);
 extern int debug_mode;
 #endif /* !NOTIF_TEST */
 
@@ -256,17 +258,14 @@ notif_parse_opts(NotifToast *t, const char *raw, const char **msg_out)
 				if (strcmp(key, "t") == 0) {
 					t->timeout_ms = atoi(val);
 				} else if (strcmp(key, "fg") == 0) {
-					XftColorAllocName(xw.dpy, xw.vis,
-					    xw.cmap, val, &t->pfg);
-					t->pflags |= NOTIF_PF_FG;
+					if (xcolorhold(val, &t->pfg))
+						t->pflags |= NOTIF_PF_FG;
 				} else if (strcmp(key, "bg") == 0) {
-					XftColorAllocName(xw.dpy, xw.vis,
-					    xw.cmap, val, &t->pbg);
-					t->pflags |= NOTIF_PF_BG;
+					if (xcolorhold(val, &t->pbg))
+						t->pflags |= NOTIF_PF_BG;
 				} else if (strcmp(key, "b") == 0) {
-					XftColorAllocName(xw.dpy, xw.vis,
-					    xw.cmap, val, &t->pborder);
-					t->pflags |= NOTIF_PF_BORDER;
+					if (xcolorhold(val, &t->pborder))
+						t->pflags |= NOTIF_PF_BORDER;
 				} else if (strcmp(key, "ts") == 0) {
 					ts = atof(val);
 					if (ts > 0) {
@@ -295,9 +294,9 @@ notif_load_shared(void)
 		return 0;
 	}
 
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, notif_fg_color, &notif.fg);
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, notif_bg_color, &notif.bg);
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, notif_border_color, &notif.border);
+	xcolorhold(notif_fg_color, &notif.fg);
+	xcolorhold(notif_bg_color, &notif.bg);
+	xcolorhold(notif_border_color, &notif.border);
 
 	notif.shared_loaded = 1;
 	return 1;
@@ -315,9 +314,9 @@ notif_free_shared(void)
 		notif.font = NULL;
 	}
 
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &notif.fg);
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &notif.bg);
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &notif.border);
+	xcolorrelease(&notif.fg);
+	xcolorrelease(&notif.bg);
+	xcolorrelease(&notif.border);
 
 	notif.shared_loaded = 0;
 }
@@ -349,11 +348,11 @@ notif_destroy_toast(NotifToast *t)
 		t->pfont = NULL;
 	}
 	if (t->pflags & NOTIF_PF_FG)
-		XftColorFree(xw.dpy, xw.vis, xw.cmap, &t->pfg);
+		xcolorrelease(&t->pfg);
 	if (t->pflags & NOTIF_PF_BG)
-		XftColorFree(xw.dpy, xw.vis, xw.cmap, &t->pbg);
+		xcolorrelease(&t->pbg);
 	if (t->pflags & NOTIF_PF_BORDER)
-		XftColorFree(xw.dpy, xw.vis, xw.cmap, &t->pborder);
+		xcolorrelease(&t->pborder);
 	t->pflags = 0;
 
 	t->active = 0;
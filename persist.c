@@ -9,61 +9,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "st.h"
+#include "term.h"
 #include "persist.h"
-
-/* Access to st.c internals (duplicated, suckless pattern) */
-#define HISTSIZE      (1 << 15)
-#define IS_SET(flag)  ((term.mode & (flag)) != 0)
-
-enum term_mode {
-	MODE_WRAP        = 1 << 0,
-	MODE_INSERT      = 1 << 1,
-	MODE_ALTSCREEN   = 1 << 2,
-};
-
-typedef struct {
-	Glyph attr;
-	int x;
-	int y;
-	char state;
-} TCursor;
-
-typedef struct {
-	int row;
-	int col;
-	int maxcol;
-	Line *line;
-	Line *alt;
-	Line hist[HISTSIZE];
-	int histi;
-	int scr;
-	int *dirty;
-	TCursor c;
-	int ocx;
-	int ocy;
-	int top;
-	int bot;
-	int mode;
-	int esc;
-	char trantbl[4];
-	int charset;
-	int icharset;
-	int *tabs;
-	Rune lastc;
-	int histn;
-} Term;
-
-extern Term term;
+#include "style.h"
 
 /* Declared in win.h, implemented in x.c */
 extern void xsetdwmsaveargv(const char *);
 
 #define PERSIST_MAGIC   "STHIST"
-#define PERSIST_VERSION 1
+#define PERSIST_VERSION 2
 
 typedef struct {
 	char magic[6];
@@ -75,6 +34,61 @@ typedef struct {
 	uint16_t pad;
 } PersistHeader;
 
+/*
+ * Version 2 follows the header with the style table, a uint32_t count
+ * and the Styles, and stores cells as Glyphs. Version 1 stored cells
+ * with their colors inline, as below.
+ */
+typedef struct {
+	uint32_t u;
+	uint16_t mode;
+	uint32_t fg;
+	uint32_t bg;
+} PersistGlyph1;
+
+/*
+ * Disk tier: history lines that fall out of memory are appended to
+ * scrollback-disk.data, each a DiskLine, its DiskSpans and its UTF-8
+ * text without trailing blanks, and their offsets to
+ * scrollback-disk.index. Both are read back through mmap, so looking at
+ * a line only pages in that line. Colors are stored as such, the style
+ * table is collected without looking at the disk. Past histdiskbytes the
+ * oldest lines are dropped, see persist_disk_trim().
+ */
+typedef struct {
+	uint32_t col;
+	uint32_t nspan;
+	uint32_t ntext;
+} DiskLine;
+
+typedef struct {
+	uint16_t len;
+	uint16_t mode;
+	uint32_t fg;
+	uint32_t bg;
+} DiskSpan;
+
+#define DISK_DATA       "scrollback-disk.data"
+#define DISK_INDEX      "scrollback-disk.index"
+#define DISK_BUFSIZ     (64 << 10)
+
+static struct {
+	int fd, idxfd;
+	int n;                  /* lines */
+	int nflushed;           /* lines written out */
+	uint64_t end;           /* bytes of data, with the buffered ones */
+	uchar *map;
+	size_t maplen;
+	uint64_t *idx;
+	size_t idxlen;          /* bytes mapped of the index */
+	uchar *buf;             /* data of the lines not written yet */
+	size_t buflen, bufsiz;
+	uint64_t *ibuf;         /* and their offsets */
+	int ibufsiz;
+	int failed;             /* could not be opened, don't try again */
+} disk = { .fd = -1, .idxfd = -1 };
+static char diskdir[PATH_MAX]; /* where the disk tier is */
+
 static char persistdir[PATH_MAX];
 static char persist_cwd_buf[PATH_MAX];
 static char persist_altcmd_buf[PATH_MAX];
@@ -124,13 +138,321 @@ rmdir_recursive(const char *path)
 	rmdir(path);
 }
 
+static int
+persist_write(int fd, const void *p, size_t n)
+{
+	const char *s = p;
+	ssize_t r;
+
+	while (n > 0) {
+		if ((r = write(fd, s, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		s += r;
+		n -= r;
+	}
+	return 0;
+}
+
+static void
+persist_disk_close(void)
+{
+	int failed = disk.failed;
+
+	if (disk.map)
+		munmap(disk.map, disk.maplen);
+	if (disk.idx)
+		munmap(disk.idx, disk.idxlen);
+	if (disk.fd >= 0)
+		close(disk.fd);
+	if (disk.idxfd >= 0)
+		close(disk.idxfd);
+	free(disk.buf);
+	free(disk.ibuf);
+	memset(&disk, 0, sizeof(disk));
+	disk.fd = disk.idxfd = -1;
+	disk.failed = failed;
+}
+
+/* write out the buffered lines of the disk tier */
+static void
+persist_disk_flush(void)
+{
+	int n = disk.n - disk.nflushed;
+
+	if (n == 0)
+		return;
+	if (persist_write(disk.fd, disk.buf, disk.buflen) < 0 ||
+			persist_write(disk.idxfd, disk.ibuf,
+				n * sizeof(*disk.ibuf)) < 0) {
+		/* its lines read back blank from now on */
+		fprintf(stderr, "[persist] disk tier: write: %s\n",
+				strerror(errno));
+		persist_disk_close();
+		return;
+	}
+	disk.buflen = 0;
+	disk.nflushed = disk.n;
+}
+
+/* open the disk tier in dir, keeping its first n lines */
+static int
+persist_disk_open(const char *dir, int n)
+{
+	char path[PATH_MAX];
+	uint64_t end;
+	struct stat st;
+
+	persist_disk_close();
+	if (dir != diskdir)
+		snprintf(diskdir, sizeof(diskdir), "%s", dir);
+	snprintf(path, sizeof(path), "%s/%s", dir, DISK_DATA);
+	disk.fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+	snprintf(path, sizeof(path), "%s/%s", dir, DISK_INDEX);
+	disk.idxfd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+	if (disk.fd < 0 || disk.idxfd < 0 || fstat(disk.idxfd, &st) < 0)
+		goto fail;
+
+	/* lines past n were saved again with the in-memory history */
+	n = MIN(n, st.st_size / (off_t)sizeof(end));
+	if (n < st.st_size / (off_t)sizeof(end)) {
+		if (pread(disk.idxfd, &end, sizeof(end),
+				n * sizeof(end)) != sizeof(end) ||
+				ftruncate(disk.fd, end) < 0)
+			goto fail;
+	}
+	if (ftruncate(disk.idxfd, n * sizeof(end)) < 0 ||
+			fstat(disk.fd, &st) < 0)
+		goto fail;
+	disk.n = disk.nflushed = n;
+	disk.end = st.st_size;
+	return 0;
+
+fail:
+	fprintf(stderr, "[persist] disk tier: %s: %s, history past histsize "
+			"is dropped\n", dir, strerror(errno));
+	persist_disk_close();
+	disk.failed = 1;
+	return -1;
+}
+
+/* map at least need bytes of fd, all of its siz */
+static int
+persist_disk_map(int fd, void **map, size_t *maplen, size_t need, size_t siz)
+{
+	void *p;
+
+	if (need <= *maplen)
+		return 0;
+	p = mmap(NULL, siz, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (*map)
+		munmap(*map, *maplen);
+	*map = p;
+	*maplen = siz;
+	return 0;
+}
+
+/* replace file name of the disk tier with the n bytes at p */
+static int
+persist_disk_replace(const char *name, const void *p, size_t n)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	int fd, ret;
+
+	snprintf(tmp, sizeof(tmp), "%s/%s.new", diskdir, name);
+	snprintf(path, sizeof(path), "%s/%s", diskdir, name);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+		return -1;
+	ret = persist_write(fd, p, n);
+	if (close(fd) < 0 || ret < 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Drop the oldest lines of the disk tier until its data takes at most
+ * three quarters of histdiskbytes, so that the next trim is far off. The
+ * lines kept are copied to new files that replace the old ones. Returns
+ * the number of lines dropped.
+ */
+static int
+persist_disk_trim(void)
+{
+	uint64_t base, *ix = NULL;
+	int i, k, n;
+
+	persist_disk_flush();
+	if (disk.fd < 0 || persist_disk_map(disk.idxfd, (void **)&disk.idx,
+				&disk.idxlen, disk.n * sizeof(*disk.idx),
+				disk.n * sizeof(*disk.idx)) < 0 ||
+			persist_disk_map(disk.fd, (void **)&disk.map,
+				&disk.maplen, disk.end, disk.end) < 0)
+		goto fail;
+	for (k = 0; k < disk.n &&
+			disk.end - disk.idx[k] > histdiskbytes / 4 * 3; k++)
+		;
+	base = k < disk.n ? disk.idx[k] : disk.end;
+	n = disk.n - k;
+
+	ix = xmalloc(MAX(n, 1) * sizeof(*ix));
+	for (i = 0; i < n; i++)
+		ix[i] = disk.idx[k + i] - base;
+	if (persist_disk_replace(DISK_DATA, disk.map + base,
+				disk.end - base) < 0 ||
+			persist_disk_replace(DISK_INDEX, ix,
+				n * sizeof(*ix)) < 0)
+		goto fail;
+	free(ix);
+
+	persist_disk_open(diskdir, n);
+	return k;
+
+fail:
+	/* its lines read back blank from now on */
+	fprintf(stderr, "[persist] disk tier: trim: %s\n", strerror(errno));
+	free(ix);
+	k = disk.n;
+	persist_disk_close();
+	return k;
+}
+
+/*
+ * Append a line to the disk tier. Returns how many of the oldest lines
+ * went to make room for it, or -1 if it could not be kept.
+ */
+int
+persist_spill(const Glyph *g, int col)
+{
+	DiskLine hdr = { col, 0, 0 };
+	DiskSpan sp;
+	Style sty;
+	uchar *p;
+	int i, end;
+
+	if (disk.fd < 0 && (disk.failed || !initialized ||
+			persist_disk_open(persistdir, 0) < 0)) {
+		if (!initialized && !disk.failed)
+			fprintf(stderr, "[persist] disk tier: no persist "
+					"directory, history past histsize is "
+					"dropped\n");
+		disk.failed = 1;
+		return -1;
+	}
+
+	if (disk.bufsiz - disk.buflen < sizeof(hdr) +
+			col * (sizeof(DiskSpan) + UTF_SIZ)) {
+		disk.bufsiz = MAX(2 * DISK_BUFSIZ, disk.buflen + sizeof(hdr) +
+				col * (sizeof(DiskSpan) + UTF_SIZ));
+		disk.buf = xrealloc(disk.buf, disk.bufsiz);
+	}
+	if (disk.n - disk.nflushed == disk.ibufsiz) {
+		disk.ibufsiz = MAX(2 * disk.ibufsiz, 256);
+		disk.ibuf = xrealloc(disk.ibuf,
+				disk.ibufsiz * sizeof(*disk.ibuf));
+	}
+
+	/* spans first, the header goes in front once they are counted */
+	p = disk.buf + disk.buflen + sizeof(hdr);
+	for (i = 0; i < col; i += sp.len) {
+		sty = styles[g[i].style];
+		sp = (DiskSpan){ 0, g[i].mode, sty.fg, sty.bg };
+		while (i + sp.len < col && sp.len < UINT16_MAX &&
+				g[i + sp.len].mode == g[i].mode &&
+				g[i + sp.len].style == g[i].style)
+			sp.len++;
+		memcpy(p, &sp, sizeof(sp));
+		p += sizeof(sp);
+		hdr.nspan++;
+	}
+	for (end = col; end > 0 && g[end-1].u == ' '; end--)
+		;
+	for (i = 0; i < end; i++) {
+		if (g[i].u < 0x80)
+			*p++ = g[i].u;
+		else
+			p += utf8encode(g[i].u, (char *)p);
+	}
+	hdr.ntext = p - (disk.buf + disk.buflen + sizeof(hdr)) -
+			hdr.nspan * sizeof(DiskSpan);
+	memcpy(disk.buf + disk.buflen, &hdr, sizeof(hdr));
+
+	disk.ibuf[disk.n - disk.nflushed] = disk.end;
+	disk.end += p - (disk.buf + disk.buflen);
+	disk.buflen = p - disk.buf;
+	disk.n++;
+	if (histdiskbytes && disk.end > histdiskbytes)
+		return persist_disk_trim();
+	if (disk.buflen >= DISK_BUFSIZ)
+		persist_disk_flush();
+	return 0;
+}
+
+int
+persist_unspill(int i, Glyph *g, int col)
+{
+	DiskLine hdr;
+	DiskSpan sp;
+	const uchar *p;
+	const char *t, *end;
+	uint64_t off, next;
+	int j, x, len;
+
+	if (i < 0 || i >= disk.n)
+		return -1;
+	/* its end is where the next line starts */
+	if (MIN(i + 2, disk.n) > disk.nflushed)
+		persist_disk_flush();
+	if (disk.fd < 0 || persist_disk_map(disk.idxfd, (void **)&disk.idx, &disk.idxlen,
+				MIN(i + 2, disk.n) * sizeof(*disk.idx),
+				disk.n * sizeof(*disk.idx)) < 0)
+		return -1;
+	off = disk.idx[i];
+	next = i + 1 < disk.n ? disk.idx[i+1] : disk.end;
+	if (next < off + sizeof(hdr) || persist_disk_map(disk.fd,
+				(void **)&disk.map, &disk.maplen, next,
+				disk.end) < 0)
+		return -1;
+
+	p = disk.map + off;
+	memcpy(&hdr, p, sizeof(hdr));
+	p += sizeof(hdr);
+	if (hdr.nspan * sizeof(sp) + hdr.ntext > next - off - sizeof(hdr))
+		return -1;
+	for (j = x = 0; j < (int)hdr.nspan; j++, p += sizeof(sp)) {
+		memcpy(&sp, p, sizeof(sp));
+		for (len = 0; len < sp.len && x < col; len++, x++) {
+			g[x].u = ' ';
+			g[x].mode = sp.mode;
+			g[x].style = stylenear(sp.fg, sp.bg);
+		}
+	}
+	for (; x < col; x++)
+		g[x] = (Glyph){ .u = ' ' };
+	t = (const char *)p;
+	end = t + hdr.ntext;
+	for (x = 0; t < end && x < col; x++) {
+		if ((uchar)*t < 0x80)
+			g[x].u = *t++;
+		else
+			t += MAX(utf8decode(t, &g[x].u, end - t), 1);
+	}
+	return 0;
+}
+
 static void
 persist_save_scrollback(void)
 {
 	char path[PATH_MAX];
 	FILE *f;
 	PersistHeader hdr;
-	int i, oldest;
+	uint32_t nstyles;
+	int i, histn;
 	Line *screen;
 
 	snprintf(path, sizeof(path), "%s/scrollback-history.save", persistdir);
@@ -145,22 +467,23 @@ persist_save_scrollback(void)
 	hdr.version = PERSIST_VERSION;
 	hdr.col = term.col;
 	hdr.row = term.row;
-	hdr.histi = term.histi;
-	hdr.histn = term.histn;
+	/* lines left at an earlier width are wrapped before they count */
+	thistwrap(INT_MAX);
+	/* the newest lines the header can count */
+	histn = MIN(term.histn, UINT16_MAX);
+	/* index of the newest line, as the history was once restored */
+	hdr.histi = histn > 0 ? histn - 1 : 0;
+	hdr.histn = histn;
 	hdr.pad = 0;
 	fwrite(&hdr, sizeof(hdr), 1, f);
 
-	/* Write history lines oldest to newest.
-	 * histi points to the most recently written line.
-	 * oldest = (histi - histn + 1 + HISTSIZE) % HISTSIZE */
-	if (term.histn > 0) {
-		oldest = (term.histi - term.histn + 1 + HISTSIZE) % HISTSIZE;
-		for (i = 0; i < term.histn; i++) {
-			int idx = (oldest + i) % HISTSIZE;
-			fwrite(term.hist[idx], sizeof(Glyph),
-					term.col, f);
-		}
-	}
+	nstyles = stylecount();
+	fwrite(&nstyles, sizeof(nstyles), 1, f);
+	fwrite(styles, sizeof(Style), nstyles, f);
+
+	/* Write history lines oldest to newest */
+	for (i = -histn; i < 0; i++)
+		fwrite(thline(i), sizeof(Glyph), term.col, f);
 
 	/* Write screen lines (main screen, not alt) */
 	screen = IS_SET(MODE_ALTSCREEN) ? term.alt : term.line;
@@ -170,6 +493,31 @@ persist_save_scrollback(void)
 	fclose(f);
 }
 
+/* read a line of n saved cells into l; map renumbers version 2 styles */
+static int
+persist_read_line(FILE *f, Line l, int n, int version, const ushort *map,
+		int nmap)
+{
+	PersistGlyph1 g;
+	int x;
+
+	if (version == 1) {
+		for (x = 0; x < n; x++) {
+			if (fread(&g, sizeof(g), 1, f) != 1)
+				return -1;
+			l[x].u = g.u;
+			l[x].mode = g.mode;
+			l[x].style = stylenear(g.fg, g.bg);
+		}
+		return 0;
+	}
+	if (fread(l, sizeof(Glyph), n, f) != (size_t)n)
+		return -1;
+	for (x = 0; x < n; x++)
+		l[x].style = l[x].style < nmap ? map[l[x].style] : 0;
+	return 0;
+}
+
 static void
 persist_save_generic(void)
 {
@@ -192,6 +540,10 @@ persist_save_generic(void)
 		fprintf(f, "altcmd=%s\n", persist_altcmd_buf);
 	if (persist_ephemeral)
 		fprintf(f, "ephemeral=1\n");
+	/* the disk tier stays where it is, the save counts its lines */
+	persist_disk_flush();
+	if (disk.n > 0)
+		fprintf(f, "disklines=%d\n", disk.n);
 	fclose(f);
 }
 
@@ -221,6 +573,36 @@ persist_sweep_orphans(const char *stdir)
 	closedir(d);
 }
 
+/*
+ * Take over the disk tier of a save in dir, its first n lines, for the
+ * instance about to start in our own persist directory.
+ */
+static int
+persist_disk_adopt(const char *dir, int n)
+{
+	const char *home, *file[] = { DISK_DATA, DISK_INDEX };
+	char target[PATH_MAX], from[PATH_MAX], to[PATH_MAX];
+	int i;
+
+	if (initialized) {
+		snprintf(target, sizeof(target), "%s", persistdir);
+	} else {
+		home = getenv("HOME");
+		if (!home)
+			home = "/tmp";
+		snprintf(target, sizeof(target), "%s/.runtime/st/st-%d",
+				home, (int)getpid());
+	}
+	mkdirp(target);
+	for (i = 0; i < (int)LEN(file) && n > 0; i++) {
+		snprintf(from, sizeof(from), "%s/%s", dir, file[i]);
+		snprintf(to, sizeof(to), "%s/%s", target, file[i]);
+		if (rename(from, to) < 0)
+			n = 0;
+	}
+	return persist_disk_open(target, n);
+}
+
 void
 persist_init(pid_t pid)
 {
@@ -249,6 +631,7 @@ persist_init(pid_t pid)
 	}
 
 	initialized = 1;
+	disk.failed = 0;  /* a new directory, try it */
 	fprintf(stderr, "[persist] initialized: %s\n", persistdir);
 }
 
@@ -281,8 +664,13 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 	FILE *f;
 	char line[PATH_MAX + 16];
 	PersistHeader hdr;
-	int i, histn, rows;
-	int cursor_y = -1;
+	Style sty;
+	ushort *map = NULL;
+	uint32_t nstyles = 0;
+	size_t cellsiz;
+	Line l;
+	int i, j, histn, rows;
+	int cursor_y = -1, disklines = 0;
 
 	/* Read generic data */
 	snprintf(path, sizeof(path), "%s/generic-data.save", dir);
@@ -302,10 +690,16 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 				persist_set_ephemeral(atoi(line + 10));
 				fprintf(stderr, "[persist] restore: ephemeral=%d\n",
 						persist_ephemeral);
+			} else if (strncmp(line, "disklines=", 10) == 0) {
+				disklines = atoi(line + 10);
 			}
 		}
 		fclose(f);
 	}
+	/* The disk tier holds the history older than the saved one */
+	if (histspill && disklines > 0)
+		persist_disk_adopt(dir, disklines);
+
 	/* Read scrollback history */
 	snprintf(path, sizeof(path), "%s/scrollback-history.save", dir);
 	f = fopen(path, "rb");
@@ -325,12 +719,29 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 		fclose(f);
 		goto cleanup;
 	}
-	if (hdr.version != PERSIST_VERSION) {
+	if (hdr.version != 1 && hdr.version != PERSIST_VERSION) {
 		fprintf(stderr, "[persist] restore: version %d != %d\n",
 				hdr.version, PERSIST_VERSION);
 		fclose(f);
 		goto cleanup;
 	}
+	cellsiz = hdr.version == 1 ? sizeof(PersistGlyph1) : sizeof(Glyph);
+
+	/* Intern the saved styles into ours */
+	if (hdr.version > 1) {
+		if (fread(&nstyles, sizeof(nstyles), 1, f) != 1 ||
+				nstyles > STYLEMAX) {
+			fprintf(stderr, "[persist] restore: bad style table\n");
+			fclose(f);
+			goto cleanup;
+		}
+		map = xmalloc(nstyles * sizeof(*map));
+		for (i = 0; i < (int)nstyles; i++) {
+			if (fread(&sty, sizeof(sty), 1, f) != 1)
+				sty = styles[0];
+			map[i] = stylenear(sty.fg, sty.bg);
+		}
+	}
 
 	/* Resize terminal to saved dimensions */
 	if (hdr.col != term.col || hdr.row != term.row)
@@ -342,21 +753,39 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 	if (out_row)
 		*out_row = hdr.row;
 
-	/* Read history lines into term.hist[0..histn-1] */
-	histn = hdr.histn;
-	if (histn > HISTSIZE)
-		histn = HISTSIZE;
+	/*
+	 * Read history lines, oldest first, to end right above the screen;
+	 * the oldest ones go to the disk tier if they don't all fit
+	 */
+	thistresize(hdr.histn);
+	histn = term.histn;
+	if (histspill && histn < hdr.histn &&
+			(disk.fd >= 0 || persist_disk_adopt(dir, 0) == 0)) {
+		l = xmalloc(hdr.col * sizeof(Glyph));
+		for (i = histn; i < hdr.histn; i++) {
+			if (persist_read_line(f, l, hdr.col, hdr.version,
+					map, nstyles) < 0)
+				break;
+			persist_spill(l, hdr.col);
+		}
+		free(l);
+	} else {
+		fseek(f, (long)(hdr.histn - histn) * hdr.col * cellsiz,
+				SEEK_CUR);
+	}
 	for (i = 0; i < histn; i++) {
-		if (fread(term.hist[i], sizeof(Glyph), hdr.col, f)
-				!= (size_t)hdr.col) {
+		if (persist_read_line(f, HLINE(i - histn), hdr.col,
+				hdr.version, map, nstyles) < 0) {
 			fprintf(stderr, "[persist] restore: short history "
 					"read at line %d\n", i);
-			histn = i;
+			/* move what was read down to the screen */
+			for (j = i - 1; j >= 0; j--)
+				memcpy(HLINE(j - i), HLINE(j - histn),
+						hdr.col * sizeof(Glyph));
+			thistresize(i);
 			break;
 		}
 	}
-	term.histi = histn > 0 ? histn - 1 : 0;
-	term.histn = histn;
 	term.scr = 0;
 
 	/* Read screen lines */
@@ -364,8 +793,8 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 	if (rows > term.row)
 		rows = term.row;
 	for (i = 0; i < rows; i++) {
-		if (fread(term.line[i], sizeof(Glyph), hdr.col, f)
-				!= (size_t)hdr.col) {
+		if (persist_read_line(f, term.line[i], hdr.col, hdr.version,
+				map, nstyles) < 0) {
 			fprintf(stderr, "[persist] restore: short screen "
 					"read at line %d\n", i);
 			break;
@@ -373,6 +802,7 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 	}
 
 	fclose(f);
+	free(map);
 
 	/* Restore cursor row so the new shell prompt overwrites the old one */
 	if (cursor_y >= 0 && cursor_y < term.row) {
@@ -383,6 +813,7 @@ persist_restore(const char *dir, int *out_col, int *out_row)
 	tfulldirt();
 
 cleanup:
+	term.histdisk = disk.n;
 	/* Delete consumed directory */
 	rmdir_recursive(dir);
 }
@@ -392,6 +823,7 @@ persist_cleanup(void)
 {
 	if (!initialized)
 		return;
+	persist_disk_close();
 	rmdir_recursive(persistdir);
 	initialized = 0;
 }
@@ -21,5 +21,8 @@ void persist_set_ephemeral(int val);
 int persist_is_ephemeral(void);
 const char *persist_get_dir(void);
 const char *persist_find_orphan(void);
+/* lines of the disk tier dropped to make room, -1 if g was not kept */
+int persist_spill(const Glyph *g, int col);
+int persist_unspill(int i, Glyph *g, int col);
 
 #endif /* PERSIST_H */
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# See LICENSE for license details.
+#
+# Generate width.c, the two-level column width table behind runewidth().
+#
+#   scripts/mkwidth.py > width.c
+#
+# Widths come from the Unicode database bundled with python:
+#   0  nonspacing/enclosing marks, format characters, conjoining jamo
+#   2  East Asian Wide/Fullwidth (this includes emoji presentation
+#      characters) and the unassigned parts of the CJK planes
+#   1  everything else, including controls and unassigned code points,
+#      which st has always drawn as a single cell
+
+import sys
+import unicodedata
+
+NRUNES = 0x110000
+BLOCK = 256
+
+# unassigned code points that EastAsianWidth.txt defaults to wide
+CJKRESERVED = (
+	(0x3400, 0x4dbf), (0x4e00, 0x9fff), (0xf900, 0xfaff),
+	(0x20000, 0x2fffd), (0x30000, 0x3fffd),
+)
+
+
+def width(u):
+	if u == 0x00ad:  # soft hyphen is visible
+		return 1
+	if 0x1160 <= u <= 0x11ff or u == 0x200b:
+		return 0
+	c = chr(u)
+	cat = unicodedata.category(c)
+	if cat in ("Mn", "Me", "Cf"):
+		return 0
+	if cat in ("Cs", "Co"):
+		return 1
+	if cat == "Cn":
+		return 2 if any(a <= u <= b for a, b in CJKRESERVED) else 1
+	if unicodedata.east_asian_width(c) in ("W", "F"):
+		return 2
+	return 1
+
+
+def main():
+	blocks = []
+	index = {}
+	stage1 = []
+	for base in range(0, NRUNES, BLOCK):
+		packed = bytearray(BLOCK // 4)
+		for i in range(BLOCK):
+			packed[i >> 2] |= width(base + i) << ((i & 3) * 2)
+		packed = bytes(packed)
+		if packed not in index:
+			index[packed] = len(blocks)
+			blocks.append(packed)
+		stage1.append(index[packed])
+
+	if len(blocks) > 256:
+		sys.exit("mkwidth: too many distinct blocks for a uchar index")
+
+	out = sys.stdout
+	out.write("/* See LICENSE for license details. */\n")
+	out.write("/* Generated by scripts/mkwidth.py from Unicode %s, do not edit. */\n\n"
+	          % unicodedata.unidata_version)
+	out.write('#include <wchar.h>\n\n#include "st.h"\n#include "width.h"\n\n')
+	out.write("/*\n * widthidx maps a rune's 256-rune block to one of the distinct blocks\n"
+	          " * in widthtab, which stores four 2-bit widths per byte.\n */\n")
+	out.write("static const uchar widthidx[%d] = {\n" % len(stage1))
+	for i in range(0, len(stage1), 16):
+		out.write("\t" + ", ".join("%3d" % v for v in stage1[i:i + 16]) + ",\n")
+	out.write("};\n\n")
+	out.write("static const uchar widthtab[%d][%d] = {\n" % (len(blocks), BLOCK // 4))
+	for b in blocks:
+		out.write("\t{\n")
+		for i in range(0, len(b), 16):
+			out.write("\t\t" + ", ".join("0x%02x" % v for v in b[i:i + 16]) + ",\n")
+		out.write("\t},\n")
+	out.write("};\n\n")
+	out.write("int\nrunewidth(Rune u)\n{\n"
+	          "\tif (u >= 0x%x)\n\t\treturn 1;\n"
+	          "\treturn widthtab[widthidx[u >> 8]][(u & 0xff) >> 2] >> ((u & 3) * 2) & 3;\n"
+	          "}\n" % NRUNES)
+
+
+if __name__ == "__main__":
+	main()
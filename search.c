@@ -0,0 +1,835 @@
+/* See LICENSE for license details. */
+/*
+ * Search of the screen and the history for vimnav, the trigram index
+ * that lets it skip most history lines, and the OSC 133 marks of the
+ * lines. The history lines are known here as y + histtotal, a number
+ * that stays with a line as the screen scrolls and is only given anew
+ * when a resize wraps the history again, see tsearchrenumber().
+ */
+
+#include <limits.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "st.h"
+#include "term.h"
+#include "search.h"
+
+#define TRIGRAMS		(1 << 16)
+#define TRIHASH(s)		(((uchar)(s)[0] << 16 | (uchar)(s)[1] << 8 | \
+				 (uchar)(s)[2]) * 2654435761u >> 16)
+
+/*
+ * The search vimnav reads a pattern for. Lines are looked at newest
+ * first, some at a time in tsearchstep(); the history lines that match
+ * go in hits[lo..hi), oldest first, as y + histtotal so that they stay
+ * put while the screen scrolls. The screen itself is looked at again
+ * every time. Whether a line matched is kept with it, in its LineInfo
+ * or Pack, and is good while searched is past both start and its gen.
+ */
+typedef struct {
+	int active;
+	int isre;              /* re is compiled, or else lit is all of it */
+	regex_t re;
+	char lit[256];         /* a string every match contains */
+	int litlen;
+	uint64_t start;        /* linegen when the pattern was set */
+	int col;               /* and term.col: a reflow starts over */
+	long *hits;
+	int lo, hi, siz;
+	long back;             /* next history line to look at, going back */
+	long fwd;              /* first one that went to the history since */
+} Search;
+
+/*
+ * Index of the history for the search: for every hash of three bytes of
+ * the text tsearchtext() makes, the lines that have them, oldest first,
+ * counted from base. It covers the lines lo..hi-1, as y + histtotal, of
+ * the history in memory, and is brought up to date while st is idle
+ * once there was a search; a search with a literal of three bytes or
+ * more only looks at the lines it names there.
+ */
+typedef struct {
+	uint32_t *y;
+	int n, siz;
+} Posting;
+
+typedef struct {
+	Posting *tab;          /* TRIGRAMS of them */
+	long lo, hi;
+	long base;
+	long swept;            /* lo when the lines it lost were last cleared */
+	size_t bytes;          /* what the postings take */
+	int col;               /* term.col it was made at, 0 to make it again */
+	int wanted;            /* a search was set, the index is worth making */
+} TriIndex;
+
+/*
+ * The history lines with marks, as y + histtotal in m[lo..hi), oldest
+ * first like the hits of the search; the lines back + 1 .. fwd - 1 have
+ * been looked at for them. Prompts and the rest are found in there with
+ * a binary search, and the screen is looked at again every time.
+ */
+typedef struct {
+	long a;
+	ushort mark;
+} Mark;
+
+typedef struct {
+	Mark *m;
+	int lo, hi, siz;
+	long back, fwd;
+	int col;               /* term.col they are for, 0 to start over */
+} Marks;
+
+static int tsearchlit(const char *, char *, int);
+static void tsearchrestart(void);
+static char *tsearchtext(Line, int);
+static char *tsearchpack(const Pack *);
+static int tsearchmatch(const char *, regmatch_t *, int);
+static int tsearchline(int);
+static void tsearchadd(long, int);
+static long tsearchnear(long, int);
+static void tindexreset(void);
+static void tindexline(long);
+static void tindexsweep(void);
+static int tindexhas(const Posting *, uint32_t);
+static long tindexprev(long, int *);
+static int tmarkseen(long);
+static void tmarkadd(long, ushort, int);
+static void tmarksync(void);
+
+static Search search;
+static TriIndex tidx;
+static Marks marks;
+static char *stext;               /* a line's text for the search */
+static int *smap;                 /* and the cell of each byte */
+static int stextsiz;
+
+/*
+ * The longest string of plain characters that every match of the
+ * extended regular expression pat contains, into lit. Returns whether
+ * pat is nothing but that string.
+ */
+int
+tsearchlit(const char *pat, char *lit, int siz)
+{
+	const char *p;
+	char run[256];
+	int n = 0, last = 0, best = 0, depth = 0, plain = 1;
+
+	lit[0] = '\0';
+	for (p = pat; ; p++) {
+		if (*p && *p == '\\' && p[1] && strchr("^.[]$()|*+?{}\\", p[1])) {
+			p++;
+			plain = 0;
+		} else if (*p && !strchr("^.[$()|*+?{\\", *p)) {
+			/* a plain character */
+		} else {
+			if (*p)
+				plain = 0;
+			/* what a repetition applies to may not be there */
+			if (*p == '*' || *p == '?' || *p == '{')
+				n = last;
+			if (n > best && depth == 0) {
+				memcpy(lit, run, n);
+				lit[best = n] = '\0';
+			}
+			n = last = 0;
+			if (!*p)
+				break;
+			switch (*p) {
+			case '|':
+				if (depth == 0) {
+					lit[0] = '\0';
+					return 0;
+				}
+				break;
+			case '(':
+				depth++;
+				break;
+			case '{':
+				while (p[1] && *p != '}')
+					p++;
+				break;
+			case ')':
+				depth = MAX(depth - 1, 0);
+				break;
+			case '\\':
+				p++;
+				break;
+			case '[':
+				/* ] first in the list is part of it */
+				p += (p[1] == '^') + 1;
+				p += (*p == ']');
+				while (*p && *p != ']') {
+					if (*p == '[' && p[1] && strchr(":=.", p[1]) &&
+					    strchr(p + 2, ']'))
+						p = strchr(p + 2, ']');
+					p++;
+				}
+				break;
+			}
+			if (!*p)
+				break;
+			continue;
+		}
+		if (depth > 0 || n == (int)sizeof(run) || n >= siz - 1)
+			continue;
+		/* a UTF-8 continuation byte stays with its character */
+		if ((*p & 0xc0) != 0x80)
+			last = n;
+		run[n++] = *p;
+	}
+	return plain;
+}
+
+/* set the search for pattern pat, or none; -1 if pat is not valid */
+int
+tsearch(const char *pat)
+{
+	if (search.isre)
+		regfree(&search.re);
+	search.isre = search.active = 0;
+	if (!pat || !*pat)
+		return 0;
+	if (!tsearchlit(pat, search.lit, sizeof(search.lit)) ||
+	    strcmp(pat, search.lit)) {
+		if (regcomp(&search.re, pat, REG_EXTENDED) != 0)
+			return -1;
+		search.isre = 1;
+	}
+	search.litlen = strlen(search.lit);
+	search.active = 1;
+	tidx.wanted = 1;
+	tsearchrestart();
+	return 0;
+}
+
+void
+tsearchrestart(void)
+{
+	search.start = ++linegen;
+	search.col = term.col;
+	search.lo = search.hi = search.siz / 2;
+	search.back = histtotal - 1;
+	search.fwd = histtotal;
+}
+
+/*
+ * The text of line l the search looks at, without the trailing blanks.
+ * With map, smap[] has the cell of every byte, and of the end.
+ */
+char *
+tsearchtext(Line l, int map)
+{
+	int x, i, k, end, n = 0;
+
+	if (stextsiz < term.col * UTF_SIZ + 1) {
+		stextsiz = term.col * UTF_SIZ + 1;
+		stext = xrealloc(stext, stextsiz);
+		smap = xrealloc(smap, stextsiz * sizeof(*smap));
+	}
+	for (end = term.col; end > 0 && l[end-1].u == ' '; end--)
+		;
+	for (x = 0; x < end; x++) {
+		if (!l[x].u)
+			continue;
+		if (l[x].u < 0x80) {
+			stext[n] = l[x].u;
+			k = 1;
+		} else {
+			k = utf8encode(l[x].u, stext + n);
+		}
+		for (i = 0; map && i < k; i++)
+			smap[n + i] = x;
+		n += k;
+	}
+	if (map)
+		smap[n] = MIN(end, term.col - 1);
+	stext[n] = '\0';
+	return stext;
+}
+
+/* the text of packed line p, the same as tsearchtext() makes of it */
+char *
+tsearchpack(const Pack *p)
+{
+	const char *t = (const char *)p->data + p->nspan * sizeof(PackSpan);
+	int i, n = 0;
+
+	if (stextsiz < p->ntext + 1) {
+		stextsiz = p->ntext + 1;
+		stext = xrealloc(stext, stextsiz);
+		smap = xrealloc(smap, stextsiz * sizeof(*smap));
+	}
+	/* the second cells of wide characters are the NULs */
+	for (i = 0; i < p->ntext; i++) {
+		if (t[i])
+			stext[n++] = t[i];
+	}
+	stext[n] = '\0';
+	return stext;
+}
+
+/* the first match in s, the string lit has to be in it before anything */
+int
+tsearchmatch(const char *s, regmatch_t *m, int eflags)
+{
+	const char *f = s;
+
+	if (search.litlen > 0 && !(f = strstr(s, search.lit)))
+		return 0;
+	if (search.isre)
+		return regexec(&search.re, s, 1, m, eflags) == 0;
+	m->rm_so = f - s;
+	m->rm_eo = m->rm_so + search.litlen;
+	return 1;
+}
+
+/* whether line y matches the search, known from before if it can be */
+int
+tsearchline(int y)
+{
+	regmatch_t m;
+	LineInfo *li;
+	Pack *p;
+	Line l;
+
+	if (y < -histwrapped && nwrapruns > 0)
+		thistwrap(-y);
+	if (y >= 0)
+		l = term.line[y];
+	else
+		l = y < -term.histn ? thline(y) : HLINE(y);
+	if (ISPACKED(l)) {
+		p = PACKOF(l);
+		if (p->searched < search.start) {
+			p->found = tsearchmatch(tsearchpack(p), &m, 0);
+			p->searched = linegen;
+		}
+		return p->found;
+	}
+	li = LINEINFO(l);
+	if (li->searched < search.start || li->searched < li->gen) {
+		li->found = tsearchmatch(tsearchtext(l, 0), &m, 0);
+		li->searched = linegen;
+	}
+	return li->found;
+}
+
+/* history line a, as y + histtotal, matched: the newest or the oldest */
+void
+tsearchadd(long a, int newest)
+{
+	int n = search.hi - search.lo, siz;
+	long *hits;
+
+	if (newest ? search.hi == search.siz : search.lo == 0) {
+		siz = MAX(2 * search.siz, 1024);
+		hits = xmalloc(siz * sizeof(*hits));
+		if (n > 0)
+			memcpy(hits + (siz - n) / 2, search.hits + search.lo,
+			       n * sizeof(*hits));
+		free(search.hits);
+		search.hits = hits;
+		search.siz = siz;
+		search.lo = (siz - n) / 2;
+		search.hi = search.lo + n;
+	}
+	if (newest)
+		search.hits[search.hi++] = a;
+	else
+		search.hits[--search.lo] = a;
+}
+
+/*
+ * Look at up to n more lines: first those that went to the history
+ * since the last time, then further back. Returns whether any are left.
+ */
+int
+tsearchstep(int n)
+{
+	if (!search.active)
+		return 0;
+	if (search.col != term.col)
+		tsearchrestart();
+	search.fwd = MAX(search.fwd, histtotal - term.histn - term.histdisk);
+	for (; search.fwd < histtotal && n > 0; search.fwd++, n--) {
+		if (tsearchline(search.fwd - histtotal))
+			tsearchadd(search.fwd, 1);
+	}
+	for (; search.back >= histtotal - term.histn - term.histdisk && n > 0;
+	     search.back--, n--) {
+		search.back = tindexprev(search.back, &n);
+		if (search.back >= histtotal - term.histn - term.histdisk &&
+		    tsearchline(search.back - histtotal))
+			tsearchadd(search.back, 0);
+	}
+	return search.fwd < histtotal ||
+	       search.back >= histtotal - term.histn - term.histdisk;
+}
+
+/*
+ * The nearest line before a, or after it for dir > 0, both as y +
+ * histtotal, that is known to match; LONG_MIN if there is none.
+ */
+long
+tsearchnear(long a, int dir)
+{
+	long b, old = histtotal - term.histn - term.histdisk;
+	int lo = search.lo, hi = search.hi, mid;
+
+	/* the first hit at or after a, or past it for dir > 0 */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (search.hits[mid] < a || (dir > 0 && search.hits[mid] == a))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (dir < 0) {
+		for (b = MIN(a - 1, histtotal + term.row - 1); b >= histtotal;
+		     b--) {
+			if (tsearchline(b - histtotal))
+				return b;
+		}
+		for (lo--; lo >= search.lo && search.hits[lo] >= old; lo--) {
+			if (tsearchline(search.hits[lo] - histtotal))
+				return search.hits[lo];
+		}
+	} else {
+		for (; lo < search.hi; lo++) {
+			if (search.hits[lo] >= old &&
+			    tsearchline(search.hits[lo] - histtotal))
+				return search.hits[lo];
+		}
+		for (b = MAX(a + 1, histtotal); b < histtotal + term.row; b++) {
+			if (tsearchline(b - histtotal))
+				return b;
+		}
+	}
+	return LONG_MIN;
+}
+
+/*
+ * The matches in line l, as up to n pairs of their first and last cell
+ * in m[]. Returns how many there are.
+ */
+int
+tsearchcells(Line l, int *m, int n)
+{
+	LineInfo *li = LINEINFO(l);
+	regmatch_t rm;
+	char *s;
+	int k, off, len, ef;
+
+	if (!search.active || (li->searched >= search.start &&
+	                       li->searched >= li->gen && !li->found))
+		return 0;
+	s = tsearchtext(l, 1);
+	len = strlen(s);
+	for (k = off = ef = 0; k < n && off <= len &&
+	     tsearchmatch(s + off, &rm, ef); k++, ef = REG_NOTBOL) {
+		m[2*k] = smap[off + rm.rm_so];
+		m[2*k+1] = smap[off + MAX(rm.rm_eo - 1, rm.rm_so)];
+		/* an empty match moves on by a character */
+		off += MAX(rm.rm_eo, rm.rm_so + 1);
+		while (off < len && (s[off] & 0xc0) == 0x80)
+			off++;
+	}
+	li->found = k > 0;
+	li->searched = linegen;
+	return k;
+}
+
+/*
+ * Find the match nearest to cell *x, *y (*y as for thline()) the way
+ * dir says, going round the ends, and put it in *x, *y. Returns 1, or 0
+ * if nothing matches, or -1 while it is not known yet.
+ */
+int
+tsearchnext(int *x, int *y, int dir)
+{
+	int m[2 * 64], n, i;
+	long b;
+
+	if (!search.active)
+		return 0;
+	if (search.col != term.col)
+		tsearchrestart();
+	/* what went to the history since is looked at first */
+	while (search.fwd < histtotal)
+		tsearchstep(histtotal - search.fwd);
+
+	n = tsearchcells(*y < 0 ? thline(*y) : term.line[*y], m, LEN(m) / 2);
+	for (i = dir < 0 ? n - 1 : 0; i >= 0 && i < n; i += dir < 0 ? -1 : 1) {
+		if (dir < 0 ? m[2*i] < *x : m[2*i] > *x) {
+			*x = m[2*i];
+			return 1;
+		}
+	}
+	b = tsearchnear(*y + histtotal, dir);
+	if (b == LONG_MIN && tsearchstep(0))
+		return -1;
+	if (b == LONG_MIN)
+		b = tsearchnear(dir < 0 ? histtotal + term.row : LONG_MIN, dir);
+	if (b == LONG_MIN)
+		return 0;
+	i = b - histtotal;
+	n = tsearchcells(i < 0 ? thline(i) : term.line[i], m, LEN(m) / 2);
+	if (n == 0)
+		return 0;
+	*y = i;
+	*x = m[dir < 0 ? 2 * (n-1) : 0];
+	return 1;
+}
+
+void
+tsearchrenumber(void)
+{
+	search.col = tidx.col = marks.col = 0;
+}
+
+/* start the index over, from the oldest history line */
+void
+tindexreset(void)
+{
+	int i;
+
+	for (i = 0; tidx.tab && i < TRIGRAMS; i++)
+		free(tidx.tab[i].y);
+	free(tidx.tab);
+	tidx.tab = xmalloc(TRIGRAMS * sizeof(Posting));
+	memset(tidx.tab, 0, TRIGRAMS * sizeof(Posting));
+	tidx.bytes = 0;
+	tidx.lo = tidx.hi = tidx.base = tidx.swept = histtotal - term.histn;
+	tidx.col = term.col;
+}
+
+/* put line a, as y + histtotal, in the index after all it has */
+void
+tindexline(long a)
+{
+	uint32_t v = a - tidx.base;
+	int y = a - histtotal, i, n;
+	Posting *q;
+	Line l;
+	char *s;
+
+	l = HLINE(y);
+	s = ISPACKED(l) ? tsearchpack(PACKOF(l)) : tsearchtext(l, 0);
+	for (n = strlen(s), i = 0; i + 3 <= n; i++) {
+		q = &tidx.tab[TRIHASH(s + i)];
+		if (q->n > 0 && q->y[q->n-1] == v)
+			continue;
+		if (q->n == q->siz) {
+			tidx.bytes += (MAX(2 * q->siz, 4) - q->siz) *
+			              sizeof(uint32_t);
+			q->siz = MAX(2 * q->siz, 4);
+			q->y = xrealloc(q->y, q->siz * sizeof(uint32_t));
+		}
+		q->y[q->n++] = v;
+	}
+}
+
+/* drop the lines before lo from the postings, and count from lo */
+void
+tindexsweep(void)
+{
+	uint32_t d = tidx.lo - tidx.base;
+	Posting *q;
+	int i, k, hi, mid;
+
+	for (q = tidx.tab; q < tidx.tab + TRIGRAMS; q++) {
+		for (k = 0, hi = q->n; k < hi; ) {
+			mid = (k + hi) / 2;
+			if (q->y[mid] < d)
+				k = mid + 1;
+			else
+				hi = mid;
+		}
+		for (i = k; i < q->n; i++)
+			q->y[i - k] = q->y[i] - d;
+		q->n -= k;
+		if (q->n == 0) {
+			tidx.bytes -= q->siz * sizeof(uint32_t);
+			free(q->y);
+			*q = (Posting){ 0 };
+		} else if (2 * q->n < q->siz) {
+			tidx.bytes -= (q->siz - q->n) * sizeof(uint32_t);
+			q->siz = q->n;
+			q->y = xrealloc(q->y, q->siz * sizeof(uint32_t));
+		}
+	}
+	tidx.base = tidx.swept = tidx.lo;
+}
+
+int
+tindexhas(const Posting *q, uint32_t v)
+{
+	int lo = 0, hi = q->n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (q->y[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < q->n && q->y[lo] == v;
+}
+
+/*
+ * Going back from line a, as y + histtotal, the newest line the index
+ * says may have the literal of the search in it, the one before the
+ * lines the index covers if none does, or a if it can't tell. The lines
+ * it goes past count against *n, and it stops at the last one when that
+ * runs out. The search still has to look at the line it gives.
+ */
+long
+tindexprev(long a, int *n)
+{
+	Posting *q[8], *t;
+	uint32_t v;
+	int nq = 0, i, j, hi;
+	const char *s;
+
+	if (tidx.col != term.col || a < tidx.lo || a >= tidx.hi)
+		return a;
+	/* the rarest of the trigrams of the literal go first */
+	for (s = search.lit; s[0] && s[1] && s[2]; s++) {
+		t = &tidx.tab[TRIHASH(s)];
+		for (j = 0; j < nq && q[j] != t; j++)
+			;
+		if (j < nq || (nq == LEN(q) && t->n >= q[nq-1]->n))
+			continue;
+		j = MIN(nq, LEN(q) - 1);
+		nq = MIN(nq + 1, LEN(q));
+		for (; j > 0 && q[j-1]->n > t->n; j--)
+			q[j] = q[j-1];
+		q[j] = t;
+	}
+	if (nq == 0)
+		return a;
+
+	for (i = 0, hi = q[0]->n, v = a - tidx.base; i < hi; ) {
+		j = (i + hi) / 2;
+		if (q[0]->y[j] <= v)
+			i = j + 1;
+		else
+			hi = j;
+	}
+	for (i--; i >= 0 && q[0]->y[i] >= tidx.lo - tidx.base; i--) {
+		for (j = 1; j < nq && tindexhas(q[j], q[0]->y[i]); j++)
+			;
+		if (j == nq || --*n <= 0)
+			return q[0]->y[i] + tidx.base;
+	}
+	return tidx.lo - 1;
+}
+
+/*
+ * Index up to n more history lines, within searchindexbytes, the oldest
+ * covered going first if it takes more. Returns whether lines are left.
+ */
+int
+tindexstep(int n)
+{
+	long old = histtotal - term.histn;
+
+	if (!searchindexbytes || !tidx.wanted)
+		return 0;
+	if (tidx.col != term.col) {
+		/* the lines have their numbers once they are wrapped again */
+		if (nwrapruns > 0) {
+			if (n > 0)
+				thistwrap(histwrapped + n);
+			return 1;
+		}
+		tindexreset();
+	}
+	tidx.lo = MAX(tidx.lo, old);
+	tidx.hi = MAX(tidx.hi, tidx.lo);
+	for (; tidx.hi < histtotal && n > 0; tidx.hi++, n--)
+		tindexline(tidx.hi);
+	while (tidx.bytes > searchindexbytes && tidx.lo < tidx.hi) {
+		tidx.lo += MAX((tidx.hi - tidx.lo) / 4, 1);
+		tindexsweep();
+	}
+	if (2 * (tidx.lo - tidx.swept) > tidx.hi - tidx.swept)
+		tindexsweep();
+	return tidx.hi < histtotal;
+}
+
+/*
+ * The marks of line l: those the shell gave it, and a prompt when it
+ * looks like one and guess is set or it is from before the shell
+ * started marking.
+ */
+ushort
+tlinemark(Line l, int guess)
+{
+	LineInfo *li = tlineinfo(l);
+
+	if (li->guess && (guess || !markgen || li->gen < markgen))
+		return li->mark | MARK_PROMPT;
+	return li->mark;
+}
+
+/* the marks of line y, as thline() numbers it */
+int
+tmark(int y)
+{
+	Line l;
+	int mark;
+
+	if (y >= 0)
+		return tlinemark(term.line[y], 0);
+	if (y < -histwrapped && nwrapruns > 0)
+		thistwrap(-y);
+	/* the disk tier only keeps the cells: the marks seen before, or a guess */
+	if (y < -term.histn) {
+		if ((mark = tmarkseen(y + histtotal)) >= 0)
+			return mark;
+		return tlinemark(thline(y), 1);
+	}
+	l = HLINE(y);
+	return ISPACKED(l) ? PACKOF(l)->mark : tlinemark(l, 0);
+}
+
+/* the marks of history line a, as y + histtotal, if looked at yet, or -1 */
+int
+tmarkseen(long a)
+{
+	int lo = marks.lo, hi = marks.hi, mid;
+
+	if (marks.col != term.col || a <= marks.back || a >= marks.fwd)
+		return -1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (marks.m[mid].a < a)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < marks.hi && marks.m[lo].a == a) ? marks.m[lo].mark : 0;
+}
+
+/* history line a, as y + histtotal, has a mark: the newest or the oldest */
+void
+tmarkadd(long a, ushort mark, int newest)
+{
+	int n = marks.hi - marks.lo, siz;
+	Mark *m;
+
+	if (newest ? marks.hi == marks.siz : marks.lo == 0) {
+		siz = MAX(2 * marks.siz, 256);
+		m = xmalloc(siz * sizeof(*m));
+		if (n > 0)
+			memcpy(m + (siz - n) / 2, marks.m + marks.lo,
+			       n * sizeof(*m));
+		free(marks.m);
+		marks.m = m;
+		marks.siz = siz;
+		marks.lo = (siz - n) / 2;
+		marks.hi = marks.lo + n;
+	}
+	if (newest)
+		marks.m[marks.hi++] = (Mark){ a, mark };
+	else
+		marks.m[--marks.lo] = (Mark){ a, mark };
+}
+
+/* let the marks go with the lines that left, add those that came */
+void
+tmarksync(void)
+{
+	long old = histtotal - term.histn - term.histdisk;
+	int mark;
+
+	if (marks.col != term.col) {
+		marks.col = term.col;
+		marks.lo = marks.hi = marks.siz / 2;
+		marks.back = histtotal - 1;
+		marks.fwd = histtotal;
+	}
+	while (marks.lo < marks.hi && marks.m[marks.lo].a < old)
+		marks.lo++;
+	marks.back = MAX(marks.back, old - 1);
+	for (marks.fwd = MAX(marks.fwd, old); marks.fwd < histtotal;
+	     marks.fwd++) {
+		if ((mark = tmark(marks.fwd - histtotal)))
+			tmarkadd(marks.fwd, mark, 1);
+	}
+}
+
+/*
+ * The line after *y, or before it if dir < 0, with one of the marks in
+ * mask goes in *y; returns 0 if there is none. The history is looked
+ * at once for its marks, further back only as far as it is asked for.
+ */
+int
+tmarknext(int *y, int dir, int mask)
+{
+	long a = *y + histtotal, b;
+	int lo, hi, mid, mark;
+
+	tmarksync();
+	if (dir > 0 && *y < -1 && !IS_SET(MODE_ALTSCREEN)) {
+		while (marks.back > a &&
+		       marks.back >= histtotal - term.histn - term.histdisk) {
+			b = marks.back--;
+			if ((mark = tmark(b - histtotal)))
+				tmarkadd(b, mark, 0);
+		}
+	}
+	for (lo = marks.lo, hi = marks.hi; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (marks.m[mid].a < a || (dir > 0 && marks.m[mid].a == a))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (dir < 0) {
+		for (b = MIN(*y, term.row) - 1; b >= 0; b--) {
+			if (tmark(b) & mask)
+				goto found;
+		}
+		if (IS_SET(MODE_ALTSCREEN))
+			return 0;
+		for (lo--; lo >= marks.lo; lo--) {
+			if (marks.m[lo].mark & mask) {
+				b = marks.m[lo].a - histtotal;
+				goto found;
+			}
+		}
+		while (marks.back >= histtotal - term.histn - term.histdisk) {
+			b = marks.back--;
+			if (!(mark = tmark(b - histtotal)))
+				continue;
+			tmarkadd(b, mark, 0);
+			if (b < a && mark & mask) {
+				b -= histtotal;
+				goto found;
+			}
+		}
+	} else {
+		for (; lo < marks.hi && !IS_SET(MODE_ALTSCREEN); lo++) {
+			if (marks.m[lo].mark & mask) {
+				b = marks.m[lo].a - histtotal;
+				goto found;
+			}
+		}
+		for (b = MAX(*y + 1, 0); b < term.row; b++) {
+			if (tmark(b) & mask)
+				goto found;
+		}
+	}
+	return 0;
+found:
+	*y = b;
+	return 1;
+}
@@ -0,0 +1,27 @@
+/* See LICENSE for license details. */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "st.h"  /* for Line */
+
+/* set the search for an extended regular expression, or none with NULL */
+int tsearch(const char *pat);
+/* look at up to n more history lines; returns whether any are left */
+int tsearchstep(int n);
+/* move *x, *y to the next match the way dir says; -1 if not known yet */
+int tsearchnext(int *x, int *y, int dir);
+/* the matches in line l, as up to n pairs of first and last cell in m */
+int tsearchcells(Line l, int *m, int n);
+/* the history lines were numbered anew, by a resize or a new size */
+void tsearchrenumber(void);
+/* bring the index of the history up to date by up to n lines */
+int tindexstep(int n);
+
+/* the marks of line y, as thline() numbers it, see MARK_PROMPT */
+int tmark(int y);
+ushort tlinemark(Line l, int guess);
+/* the next line from *y with one of the marks in mask the way dir says */
+int tmarknext(int *y, int dir, int mask);
+
+#endif /* SEARCH_H */
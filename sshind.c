@@ -60,6 +60,8 @@ extern TermWindow win;
 extern DC dc;
 extern char *usedfont;
 extern double usedfontsize;
+int xcolorhold(const char *name, XftColor *col);
+void xcolorrelease(const XftColor *col);
 #endif /* !SSHIND_TEST */
 
 /* SSH indicator overlay state */
@@ -141,9 +143,9 @@ sshind_show(const char *host)
 	                2 * sshind_padding + 2 * sshind_border_width;
 
 	/* Allocate colors */
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, sshind_fg_color, &sshind.fg);
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, sshind_bg_color, &sshind.bg);
-	XftColorAllocName(xw.dpy, xw.vis, xw.cmap, sshind_border_color, &sshind.border);
+	xcolorhold(sshind_fg_color, &sshind.fg);
+	xcolorhold(sshind_bg_color, &sshind.bg);
+	xcolorhold(sshind_border_color, &sshind.border);
 
 	/* Calculate position (top-right with margin) */
 	x = win.w - sshind.width - sshind_margin;
@@ -214,9 +216,9 @@ sshind_hide(void)
 	}
 
 	/* Free colors */
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &sshind.fg);
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &sshind.bg);
-	XftColorFree(xw.dpy, xw.vis, xw.cmap, &sshind.border);
+	xcolorrelease(&sshind.fg);
+	xcolorrelease(&sshind.bg);
+	xcolorrelease(&sshind.border);
 
 	sshind.active = 0;
 	sshind.host[0] = '\0';
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -12,15 +13,23 @@
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 #include <wchar.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "st.h"
+#include "term.h"
 #include "persist.h"
 #include "win.h"
 #include "vimnav.h"
+#include "style.h"
+#include "width.h"
+#include "search.h"
 
 /* X11 modifier masks (from X11/X.h) */
 #define ShiftMask   (1<<0)
@@ -38,32 +47,20 @@
 
 /* Arbitrary sizes */
 #define UTF_INVALID   0xFFFD
-#define UTF_SIZ       4
 #define ESC_BUF_SIZ   (128*UTF_SIZ)
 #define ESC_ARG_SIZ   16
 #define STR_BUF_SIZ   ESC_BUF_SIZ
 #define STR_ARG_SIZ   ESC_ARG_SIZ
-#define HISTSIZE      (1 << 15) 
+#define TTYWQ_SIZ     4096 /* a power of two, the ring masks with it */
 
 /* macros */
-#define IS_SET(flag)		((term.mode & (flag)) != 0)
 #define ISCONTROLC0(c)		(BETWEEN(c, 0, 0x1f) || (c) == 0x7f)
 #define ISCONTROLC1(c)		(BETWEEN(c, 0x80, 0x9f))
 #define ISCONTROL(c)		(ISCONTROLC0(c) || ISCONTROLC1(c))
 #define ISDELIM(u)		(u && wcschr(worddelimiters, u))
-#define TLINE(y)		((y) < term.scr ? term.hist[((y) + term.histi - \
-				term.scr + HISTSIZE + 1) % HISTSIZE] : \
-				term.line[(y) - term.scr])
-
-enum term_mode {
-	MODE_WRAP        = 1 << 0,
-	MODE_INSERT      = 1 << 1,
-	MODE_ALTSCREEN   = 1 << 2,
-	MODE_CRLF        = 1 << 3,
-	MODE_ECHO        = 1 << 4,
-	MODE_PRINT       = 1 << 5,
-	MODE_UTF8        = 1 << 6,
-};
+/* a cell nothing was written to, or one erased with the default colors */
+#define ISBLANK(g)		((g).u == ' ' && !(g).mode && !(g).style)
+#define LINETOUCH(l)		(LINEINFO(l)->gen = ++linegen)
 
 enum cursor_movement {
 	CURSOR_SAVE,
@@ -86,76 +83,72 @@ enum charset {
 	CS_FIN
 };
 
+/*
+ * Parser states, after the DEC/ANSI parser described by Paul Williams
+ * (https://vt100.net/emu/dec_ansi_parser). DCS, OSC, PM, APC, SOS and
+ * the old title sequence all collect into the same string state.
+ */
 enum escape_state {
-	ESC_START      = 1,
-	ESC_CSI        = 2,
-	ESC_STR        = 4,  /* DCS, OSC, PM, APC */
-	ESC_ALTCHARSET = 8,
-	ESC_STR_END    = 16, /* a final string was encountered */
-	ESC_TEST       = 32, /* Enter in test mode */
-	ESC_UTF8       = 64,
+	ESC_GROUND,
+	ESC_ESCAPE,
+	ESC_ESCINTER,   /* ESC with intermediates: charset, test, utf8 */
+	ESC_CSIENTRY,
+	ESC_CSIPARAM,
+	ESC_CSIINTER,
+	ESC_CSIIGNORE,  /* malformed CSI, skipped up to its final byte */
+	ESC_STR,        /* DCS, OSC, PM, APC, SOS */
+	ESC_STRESC,     /* ESC within a string, ST if followed by '\\' */
+	ESC_NSTATES
 };
 
-typedef struct {
-	Glyph attr; /* current char attributes */
-	int x;
-	int y;
-	char state;
-} TCursor;
-
-typedef struct {
-	int mode;
-	int type;
-	int snap;
-	/*
-	 * Selection variables:
-	 * nb – normalized coordinates of the beginning of the selection
-	 * ne – normalized coordinates of the end of the selection
-	 * ob – original coordinates of the beginning of the selection
-	 * oe – original coordinates of the end of the selection
-	 */
-	struct {
-		int x, y;
-	} nb, ne, ob, oe;
-
-	int alt;
-} Selection;
+/* parser input classes */
+enum escape_class {
+	CC_C0,      /* C0 controls, executed in any state */
+	CC_BEL,
+	CC_CAN,     /* CAN, SUB */
+	CC_ESC,
+	CC_DEL,
+	CC_INT,     /* intermediates 0x20 - 0x2f */
+	CC_PAR,     /* parameters 0 - 9 : ; */
+	CC_PRV,     /* private markers < = > ? */
+	CC_FIN,     /* finals 0x40 - 0x7e */
+	CC_CSI,     /* [ */
+	CC_STR,     /* ] P X ^ _ k */
+	CC_ST,      /* \ */
+	CC_PRINT,   /* everything from 0xa0 up */
+	CC_C1,
+	CC_C1CSI,
+	CC_C1STR,
+	CC_C1ST,
+	CC_IGNORE,  /* C1 code points in UTF-8 mode */
+	CC_NCLASSES
+};
 
-/* Internal representation of the screen */
-typedef struct {
-	int row;      /* nb row */
-	int col;      /* nb col */
-	int maxcol;   /* maximum nb col */
-	Line *line;   /* screen */
-	Line *alt;    /* alternate screen */
-	Line hist[HISTSIZE]; /* history buffer */
-	int histi;    /* history index */
-	int scr;      /* scroll back */
-	int *dirty;   /* dirtyness of lines */
-	TCursor c;    /* cursor */
-	int ocx;      /* old cursor col */
-	int ocy;      /* old cursor row */
-	int top;      /* top    scroll limit */
-	int bot;      /* bottom scroll limit */
-	int mode;     /* terminal mode flags */
-	int esc;      /* escape state flags */
-	char trantbl[4]; /* charset table translation */
-	int charset;  /* current charset */
-	int icharset; /* selected charset for sequence */
-	int *tabs;
-	Rune lastc;   /* last printed char outside of sequence, 0 if control */
-	int histn;    /* number of valid history lines (at end for ABI compat) */
-} Term;
+enum escape_action {
+	EA_NONE,
+	EA_PRINT,
+	EA_EXECUTE,
+	EA_CLEAR,
+	EA_COLLECT,
+	EA_PRIV,
+	EA_PARAM,
+	EA_ESCDISPATCH,
+	EA_CSIDISPATCH,
+	EA_STRSTART,
+	EA_STRPUT,
+	EA_STRDISPATCH,
+};
 
 /* CSI Escape sequence structs */
-/* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
+/* ESC '[' [[ [<priv>] <arg> [;]] [<inter>] <mode>] */
 typedef struct {
-	char buf[ESC_BUF_SIZ]; /* raw string */
+	char buf[ESC_BUF_SIZ]; /* raw string, for dumps */
 	size_t len;            /* raw string length */
-	char priv;
+	char priv;             /* private marker, '?' for DEC modes */
+	char inter;            /* first intermediate, also for ESC */
 	int arg[ESC_ARG_SIZ];
 	int narg;              /* nb of args */
-	char mode[2];
+	char mode[2];          /* final, or intermediate and final */
 } CSIEscape;
 
 /* STR Escape sequence structs */
@@ -169,17 +162,43 @@ typedef struct {
 	int narg;              /* nb of args */
 } STREscape;
 
+/*
+ * History lines wrapped at an earlier width, waiting for thistwrap():
+ * a run of them for each resize, the oldest runs first.
+ */
+typedef struct {
+	int n;                 /* lines */
+	int col;               /* width they were wrapped at */
+} WrapRun;
+
+/* rows top to bot of the screen shown moved up by n, down if n < 0 */
+typedef struct {
+	int top, bot, n;
+} Scroll;
+
+/* an expanded packed or disk tier line, see thline() */
+typedef struct {
+	Line key;              /* the packed line */
+	int disk;              /* or the disk tier line + 1 */
+	Line l;
+	unsigned long used;
+} PackCache;
+
 static void execsh(char *, char **);
 static void stty(char **);
 static void sigchld(int);
 static void ttywriteraw(const char *, size_t);
+static void ttyclosed(void);
+static ssize_t ttyfill(void);
+static void ttygrow(void);
+static void ttyparse(ssize_t);
+static void *ttyreader(void *);
 
 static void csidump(void);
 static void csihandle(void);
-static void csiparse(void);
 static void csireset(void);
 static void osc_color_response(int, int, int);
-static int eschandle(uchar);
+static void eschandle(uchar);
 static void strdump(void);
 static void strhandle(void);
 static void strparse(void);
@@ -201,16 +220,53 @@ static void tmoveato(int, int);
 static void tnewline(int);
 static void tputtab(int);
 static void tputc(Rune);
+static void tputchar(Rune);
+static void tstrput(Rune);
+static int tasciirun(const Rune *, int);
+static void tputascii(const Rune *, int);
+static int tputnewlines(const Rune *, int);
 static void treset(void);
 static void tscrollup(int, int, int);
-static void tscrolldown(int, int, int);
+static void tscrolldown(int, int);
+static void tscrolled(int, int, int);
+static void tsetring(int, Line);
+static void tsetline(int, Line);
+static void tsethead(int);
+static void tringreverse(int, int);
+static void tringreserve(int);
+static Line tlinenew(int);
+static Line tlinealloc(void);
+static int thistmax(int);
+static int thistroom(int);
+static Line thistspare(int, int);
+static void thistpush(int, int);
+static void tlinefree(Line);
+static void tspill(Line);
+static void thistdrop(int);
+static void twrapdrop(int);
+static Line thistunpack(int);
+static int trewrap(Line *, int, int, int, int *, int *);
+static void tscreenwrap(int);
+static void tgrow(int);
+static Line tlinegrow(Line, int);
+static uint32_t tpackhash(const uchar *, size_t, int);
+static void tpackrehash(int);
+static Line tpack(const Glyph *, int, ushort);
+static void tunpack(const Pack *, Glyph *, int);
+static Line texpand(Line, int);
+static void tpackstyles(uchar *, const ushort *);
+static void tpackcacheinit(int);
+static ushort tstyle(uint32_t, uint32_t);
+static void tstylegc(void);
+static void tstylevisit(Glyph *, int, uchar *, const ushort *);
+static void tdrawsearch(const char *);
 static void tsetattr(const int *, int);
 static void tsetchar(Rune, const Glyph *, int, int);
 static void tsetdirt(int, int);
 static void tsetscroll(int, int);
 static void tswapscreen(void);
 static void tsetmode(int, int, const int *, int);
-static int twrite(const char *, int, int);
+static int tgetmode(int, int);
 void tfulldirt(void);
 static void tcontrolcode(uchar );
 static void tdectest(char );
@@ -225,7 +281,7 @@ static void selnormalize(void);
 static void selscroll(int, int);
 static void selsnap(int *, int *, int);
 
-static size_t utf8decode(const char *, Rune *, size_t);
+static int utf8decodeblock(const char *, int, Rune *, int, int *);
 static Rune utf8decodebyte(char, size_t *);
 static char utf8encodebyte(Rune, size_t);
 static size_t utf8validate(Rune *, size_t);
@@ -241,14 +297,237 @@ Selection sel;   /* non-static for vimnav.c access */
 int debug_mode = 0;
 static CSIEscape csiescseq;
 static STREscape strescseq;
+static struct timespec syncstart; /* when MODE_SYNC was last set */
+static TCursor savedc[2];         /* DECSC, main and alternate screen */
+static Pack **packtab;            /* every Pack, by hash */
+static int packtabsiz, npacks;
+static PackCache *packcache;      /* expanded lines, least recently used go */
+static int npackcache;
+static unsigned long packclock;
+static int histpacked;            /* oldest history lines known packed */
+static WrapRun *wrapruns;         /* history lines not yet wrapped at col */
+static int wrapsiz;
+static Line *wrapped;             /* the lines trewrap() made */
+static int wrappedsiz;
+/* non-static for search.c access, see term.h */
+int nwrapruns;
+int histwrapped;
+uint64_t linegen;
+uint64_t markgen;
+long histtotal;
+static Scroll scrolls[16];        /* since the last draw(), for xscroll() */
+static int nscrolls;              /* -1 once more were lost */
+
+#define A(a, s)	(EA_##a << 4 | ESC_##s)
+
+/* class of the runes below 0xa0 */
+#define C0	CC_C0
+#define BEL	CC_BEL
+#define CAN	CC_CAN
+#define ESC	CC_ESC
+#define DEL	CC_DEL
+#define INT	CC_INT
+#define PAR	CC_PAR
+#define PRV	CC_PRV
+#define FIN	CC_FIN
+#define CSI	CC_CSI
+#define STR	CC_STR
+#define ST	CC_ST
+#define C1	CC_C1
+#define C1CSI	CC_C1CSI
+#define C1STR	CC_C1STR
+#define C1ST	CC_C1ST
+static const uchar escclass[0xa0] = {
+	/* 0x00 */ C0,    C0,    C0,    C0,    C0,    C0,    C0,    BEL,
+	/* 0x08 */ C0,    C0,    C0,    C0,    C0,    C0,    C0,    C0,
+	/* 0x10 */ C0,    C0,    C0,    C0,    C0,    C0,    C0,    C0,
+	/* 0x18 */ CAN,   C0,    CAN,   ESC,   C0,    C0,    C0,    C0,
+	/* 0x20 */ INT,   INT,   INT,   INT,   INT,   INT,   INT,   INT,
+	/* 0x28 */ INT,   INT,   INT,   INT,   INT,   INT,   INT,   INT,
+	/* 0x30 */ PAR,   PAR,   PAR,   PAR,   PAR,   PAR,   PAR,   PAR,
+	/* 0x38 */ PAR,   PAR,   PAR,   PAR,   PRV,   PRV,   PRV,   PRV,
+	/* 0x40 */ FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,
+	/* 0x48 */ FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,
+	/* 0x50 */ STR,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,
+	/* 0x58 */ STR,   FIN,   FIN,   CSI,   ST,    STR,   STR,   STR,
+	/* 0x60 */ FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,
+	/* 0x68 */ FIN,   FIN,   FIN,   STR,   FIN,   FIN,   FIN,   FIN,
+	/* 0x70 */ FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,
+	/* 0x78 */ FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   FIN,   DEL,
+	/* 0x80 */ C1,    C1,    C1,    C1,    C1,    C1,    C1,    C1,
+	/* 0x88 */ C1,    C1,    C1,    C1,    C1,    C1,    C1,    C1,
+	/* 0x90 */ C1STR, C1,    C1,    C1,    C1,    C1,    C1,    C1,
+	/* 0x98 */ C1STR, C1,    C1,    C1CSI, C1ST,  C1STR, C1STR, C1STR,
+};
+#undef C0
+#undef BEL
+#undef CAN
+#undef ESC
+#undef DEL
+#undef INT
+#undef PAR
+#undef PRV
+#undef FIN
+#undef CSI
+#undef STR
+#undef ST
+#undef C1
+#undef C1CSI
+#undef C1STR
+#undef C1ST
+
+/* transitions: action << 4 | next state, by state and input class */
+static const uchar esctrans[ESC_NSTATES][CC_NCLASSES] = {
+	[ESC_GROUND] = {
+		[CC_C0] = A(EXECUTE, GROUND),    [CC_BEL] = A(EXECUTE, GROUND),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(EXECUTE, GROUND),   [CC_INT] = A(PRINT, GROUND),
+		[CC_PAR] = A(PRINT, GROUND),     [CC_PRV] = A(PRINT, GROUND),
+		[CC_FIN] = A(PRINT, GROUND),     [CC_CSI] = A(PRINT, GROUND),
+		[CC_STR] = A(PRINT, GROUND),     [CC_ST] = A(PRINT, GROUND),
+		[CC_PRINT] = A(PRINT, GROUND),   [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(EXECUTE, GROUND),  [CC_IGNORE] = A(NONE, GROUND),
+	},
+	[ESC_ESCAPE] = {
+		[CC_C0] = A(EXECUTE, ESCAPE),    [CC_BEL] = A(EXECUTE, ESCAPE),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, ESCAPE),      [CC_INT] = A(COLLECT, ESCINTER),
+		[CC_PAR] = A(ESCDISPATCH, GROUND),
+		[CC_PRV] = A(ESCDISPATCH, GROUND),
+		[CC_FIN] = A(ESCDISPATCH, GROUND),
+		[CC_CSI] = A(NONE, CSIENTRY),    [CC_STR] = A(STRSTART, STR),
+		[CC_ST] = A(NONE, GROUND),
+		[CC_PRINT] = A(ESCDISPATCH, GROUND),
+		[CC_C1] = A(EXECUTE, GROUND),    [CC_C1CSI] = A(CLEAR, CSIENTRY),
+		[CC_C1STR] = A(STRSTART, STR),   [CC_C1ST] = A(NONE, GROUND),
+		[CC_IGNORE] = A(NONE, ESCAPE),
+	},
+	[ESC_ESCINTER] = {
+		[CC_C0] = A(EXECUTE, ESCINTER),  [CC_BEL] = A(EXECUTE, ESCINTER),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, ESCINTER),    [CC_INT] = A(COLLECT, ESCINTER),
+		[CC_PAR] = A(ESCDISPATCH, GROUND),
+		[CC_PRV] = A(ESCDISPATCH, GROUND),
+		[CC_FIN] = A(ESCDISPATCH, GROUND),
+		[CC_CSI] = A(ESCDISPATCH, GROUND),
+		[CC_STR] = A(ESCDISPATCH, GROUND),
+		[CC_ST] = A(ESCDISPATCH, GROUND),
+		[CC_PRINT] = A(ESCDISPATCH, GROUND),
+		[CC_C1] = A(EXECUTE, GROUND),    [CC_C1CSI] = A(CLEAR, CSIENTRY),
+		[CC_C1STR] = A(STRSTART, STR),   [CC_C1ST] = A(NONE, GROUND),
+		[CC_IGNORE] = A(NONE, ESCINTER),
+	},
+	[ESC_CSIENTRY] = {
+		[CC_C0] = A(EXECUTE, CSIENTRY),  [CC_BEL] = A(EXECUTE, CSIENTRY),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, CSIENTRY),    [CC_INT] = A(COLLECT, CSIINTER),
+		[CC_PAR] = A(PARAM, CSIPARAM),   [CC_PRV] = A(PRIV, CSIPARAM),
+		[CC_FIN] = A(CSIDISPATCH, GROUND),
+		[CC_CSI] = A(CSIDISPATCH, GROUND),
+		[CC_STR] = A(CSIDISPATCH, GROUND),
+		[CC_ST] = A(CSIDISPATCH, GROUND),
+		[CC_PRINT] = A(NONE, CSIIGNORE), [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(NONE, GROUND),     [CC_IGNORE] = A(NONE, CSIENTRY),
+	},
+	[ESC_CSIPARAM] = {
+		[CC_C0] = A(EXECUTE, CSIPARAM),  [CC_BEL] = A(EXECUTE, CSIPARAM),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, CSIPARAM),    [CC_INT] = A(COLLECT, CSIINTER),
+		[CC_PAR] = A(PARAM, CSIPARAM),   [CC_PRV] = A(NONE, CSIIGNORE),
+		[CC_FIN] = A(CSIDISPATCH, GROUND),
+		[CC_CSI] = A(CSIDISPATCH, GROUND),
+		[CC_STR] = A(CSIDISPATCH, GROUND),
+		[CC_ST] = A(CSIDISPATCH, GROUND),
+		[CC_PRINT] = A(NONE, CSIIGNORE), [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(NONE, GROUND),     [CC_IGNORE] = A(NONE, CSIPARAM),
+	},
+	[ESC_CSIINTER] = {
+		[CC_C0] = A(EXECUTE, CSIINTER),  [CC_BEL] = A(EXECUTE, CSIINTER),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, CSIINTER),    [CC_INT] = A(COLLECT, CSIINTER),
+		[CC_PAR] = A(NONE, CSIIGNORE),   [CC_PRV] = A(NONE, CSIIGNORE),
+		[CC_FIN] = A(CSIDISPATCH, GROUND),
+		[CC_CSI] = A(CSIDISPATCH, GROUND),
+		[CC_STR] = A(CSIDISPATCH, GROUND),
+		[CC_ST] = A(CSIDISPATCH, GROUND),
+		[CC_PRINT] = A(NONE, CSIIGNORE), [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(NONE, GROUND),     [CC_IGNORE] = A(NONE, CSIINTER),
+	},
+	[ESC_CSIIGNORE] = {
+		[CC_C0] = A(EXECUTE, CSIIGNORE), [CC_BEL] = A(EXECUTE, CSIIGNORE),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, CSIIGNORE),   [CC_INT] = A(NONE, CSIIGNORE),
+		[CC_PAR] = A(NONE, CSIIGNORE),   [CC_PRV] = A(NONE, CSIIGNORE),
+		[CC_FIN] = A(NONE, GROUND),      [CC_CSI] = A(NONE, GROUND),
+		[CC_STR] = A(NONE, GROUND),      [CC_ST] = A(NONE, GROUND),
+		[CC_PRINT] = A(NONE, CSIIGNORE), [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(NONE, GROUND),     [CC_IGNORE] = A(NONE, CSIIGNORE),
+	},
+	[ESC_STR] = {
+		[CC_C0] = A(STRPUT, STR),        [CC_BEL] = A(STRDISPATCH, GROUND),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, STRESC),
+		[CC_DEL] = A(STRPUT, STR),       [CC_INT] = A(STRPUT, STR),
+		[CC_PAR] = A(STRPUT, STR),       [CC_PRV] = A(STRPUT, STR),
+		[CC_FIN] = A(STRPUT, STR),       [CC_CSI] = A(STRPUT, STR),
+		[CC_STR] = A(STRPUT, STR),       [CC_ST] = A(STRPUT, STR),
+		[CC_PRINT] = A(STRPUT, STR),     [CC_C1] = A(EXECUTE, GROUND),
+		[CC_C1CSI] = A(CLEAR, CSIENTRY), [CC_C1STR] = A(STRSTART, STR),
+		[CC_C1ST] = A(STRDISPATCH, GROUND),
+		[CC_IGNORE] = A(NONE, STR),
+	},
+	/* as ESC_ESCAPE, the string is dropped unless this is ST */
+	[ESC_STRESC] = {
+		[CC_C0] = A(EXECUTE, STRESC),    [CC_BEL] = A(EXECUTE, STRESC),
+		[CC_CAN] = A(EXECUTE, GROUND),   [CC_ESC] = A(CLEAR, ESCAPE),
+		[CC_DEL] = A(NONE, STRESC),      [CC_INT] = A(COLLECT, ESCINTER),
+		[CC_PAR] = A(ESCDISPATCH, GROUND),
+		[CC_PRV] = A(ESCDISPATCH, GROUND),
+		[CC_FIN] = A(ESCDISPATCH, GROUND),
+		[CC_CSI] = A(NONE, CSIENTRY),    [CC_STR] = A(STRSTART, STR),
+		[CC_ST] = A(STRDISPATCH, GROUND),
+		[CC_PRINT] = A(ESCDISPATCH, GROUND),
+		[CC_C1] = A(EXECUTE, GROUND),    [CC_C1CSI] = A(CLEAR, CSIENTRY),
+		[CC_C1STR] = A(STRSTART, STR),   [CC_C1ST] = A(NONE, GROUND),
+		[CC_IGNORE] = A(NONE, STRESC),
+	},
+};
+#undef A
 static int iofd = 1;
 static int cmdfd;
 static pid_t pid;
 
+/* tty output not yet parsed, see ttyfill() */
+static char *ttybuf;
+static size_t ttybufsiz, ttybuflen;
+static int ttyfull, ttyerrno;
+
+/* ring of input not yet written to the tty, see ttywriteraw() */
+static char *ttywq;
+static size_t ttywqsiz, ttywqhead, ttywqlen;
+static size_t ttywqin;            /* bytes ever queued, see ttyqueued() */
+
+/* threaded reader, see ttythreadstart() */
+static int ttythreaded, ttythrdone;
+static pthread_t ttythr;
+static int ttywake[2];
+static pthread_mutex_t tmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcond = PTHREAD_COND_INITIALIZER;
+static unsigned long tticket, tserving;
+
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const uchar utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const Rune utfmin[UTF_SIZ + 1] = {       0,    0,  0x80,  0x800,  0x10000};
 static const Rune utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
+/* sequence length by the top five bits of the first byte, 0 if invalid */
+static const uchar utflen[32] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0
+};
 
 ssize_t
 xwrite(int fd, const char *s, size_t len)
@@ -323,6 +602,80 @@ utf8decode(const char *c, Rune *u, size_t clen)
 	return len;
 }
 
+/*
+ * Decode up to cap runes from the n bytes at s into u, which may be NULL
+ * to only count. Invalid input gives UTF_INVALID exactly as a sequence of
+ * utf8decode() calls would, and decoding stops before an incomplete
+ * sequence at the end of the input. The number of bytes consumed is
+ * stored in *nread.
+ */
+int
+utf8decodeblock(const char *s, int n, Rune *u, int cap, int *nread)
+{
+	const uchar *p = (const uchar *)s, *end = p + n;
+	int nr = 0, i, len;
+	Rune r;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+#endif
+
+	while (nr < cap && p < end) {
+#ifdef __SSE2__
+		/* widen 16 bytes at once while the input is plain ASCII */
+		while (end - p >= 16 && cap - nr >= 16 && *p < 0x80) {
+			v = _mm_loadu_si128((const __m128i *)p);
+			if (_mm_movemask_epi8(v))
+				break;
+			if (u) {
+				lo = _mm_unpacklo_epi8(v, zero);
+				hi = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128((__m128i *)(u + nr),
+				                 _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(u + nr + 4),
+				                 _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(u + nr + 8),
+				                 _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128((__m128i *)(u + nr + 12),
+				                 _mm_unpackhi_epi16(hi, zero));
+			}
+			p += 16;
+			nr += 16;
+		}
+		if (nr == cap || p == end)
+			break;
+#endif
+		if (*p < 0x80) {
+			r = *p++;
+		} else if ((len = utflen[*p >> 3]) == 0) {
+			r = UTF_INVALID;
+			p++;
+		} else {
+			r = *p & ~utfmask[len];
+			for (i = 1; i < len && p + i < end; i++) {
+				if ((p[i] & 0xC0) != 0x80)
+					break;
+				r = (r << 6) | (p[i] & 0x3F);
+			}
+			if (i < len) {
+				if (p + i == end)
+					break; /* incomplete, keep for the next read */
+				r = UTF_INVALID;
+			} else if (r < utfmin[len] || r > utfmax[len] ||
+			           BETWEEN(r, 0xD800, 0xDFFF)) {
+				r = UTF_INVALID;
+			}
+			p += i;
+		}
+		if (u)
+			u[nr] = r;
+		nr++;
+	}
+	*nread = p - (const uchar *)s;
+
+	return nr;
+}
+
 Rune
 utf8decodebyte(char c, size_t *i)
 {
@@ -425,15 +778,13 @@ selinit(void)
 int
 tlinelen(int y)
 {
-	int i = term.col;
-
-	if (TLINE(y)[i - 1].mode & ATTR_WRAP)
-		return i;
-
-	while (i > 0 && TLINE(y)[i - 1].u == ' ')
-		--i;
+	return tlineinfo(TLINE(y))->len;
+}
 
-	return i;
+int
+thlinelen(int y)
+{
+	return tlineinfo(thline(y))->len;
 }
 
 void
@@ -820,6 +1171,7 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 			    line, strerror(errno));
 		dup2(cmdfd, 0);
 		stty(args);
+		fcntl(cmdfd, F_SETFL, fcntl(cmdfd, F_GETFL) | O_NONBLOCK);
 		return cmdfd;
 	}
 
@@ -855,38 +1207,198 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 #endif
 		close(s);
 		cmdfd = m;
+		/* ttyread() drains until EAGAIN */
+		fcntl(cmdfd, F_SETFL, fcntl(cmdfd, F_GETFL) | O_NONBLOCK);
 		signal(SIGCHLD, sigchld);
 		break;
 	}
 	return cmdfd;
 }
 
-size_t
-ttyread(void)
+static void
+ttyclosed(void)
 {
-	static char buf[BUFSIZ];
-	static int buflen = 0;
-	int ret, written;
-
-	/* append read bytes to unprocessed bytes */
-	ret = read(cmdfd, buf+buflen, LEN(buf)-buflen);
-
-	switch (ret) {
-	case 0:
+	if (!ttyerrno) {
 		persist_save();
 		persist_cleanup();
 		exit(0);
-	case -1:
-		die("couldn't read from shell: %s\n", strerror(errno));
-	default:
-		buflen += ret;
-		written = twrite(buf, buflen, 0);
-		buflen -= written;
-		/* keep any incomplete UTF-8 byte sequence for the next call */
-		if (buflen > 0)
-			memmove(buf, buf + written, buflen);
-		return ret;
 	}
+	die("couldn't read from shell: %s\n", strerror(ttyerrno));
+}
+
+/*
+ * Read whatever the tty has into ttybuf. Returns the number of bytes
+ * read, -1 if nothing is available yet, or 0 once the tty is gone, in
+ * which case the caller should ttyclosed().
+ */
+static ssize_t
+ttyfill(void)
+{
+	ssize_t ret;
+
+	if (!ttybuf)
+		ttybuf = xmalloc(ttybufsiz = BUFSIZ);
+	ret = read(cmdfd, ttybuf+ttybuflen, ttybufsiz-ttybuflen);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return -1;
+		ttyerrno = errno;
+		return 0;
+	}
+	ttyfull = (size_t)ret == ttybufsiz - ttybuflen;
+	return ret;
+}
+
+/* double the read buffer, up to ttybufmax, while reads keep filling it */
+static void
+ttygrow(void)
+{
+	if (!ttyfull || ttybufsiz >= ttybufmax)
+		return;
+	ttybufsiz = MIN(ttybufsiz * 2, MAX(ttybufmax, BUFSIZ));
+	ttybuf = xrealloc(ttybuf, ttybufsiz);
+	ttyfull = 0;
+}
+
+static void
+ttyparse(ssize_t ret)
+{
+	int written;
+
+	/* append read bytes to unprocessed bytes */
+	ttybuflen += ret;
+	written = twrite(ttybuf, ttybuflen, 0);
+	ttybuflen -= written;
+	/* keep any incomplete UTF-8 byte sequence for the next call */
+	if (ttybuflen > 0)
+		memmove(ttybuf, ttybuf + written, ttybuflen);
+}
+
+/*
+ * Drain the tty until it would block or ttyreadbudget ms have passed,
+ * so that heavy output is parsed in large chunks but cannot hold off
+ * X events for long.
+ */
+size_t
+ttyread(void)
+{
+	struct timespec start, now;
+	char buf[64];
+	size_t total = 0;
+	ssize_t ret;
+
+	if (ttythreaded) {
+		/* the reader thread has parsed already, just clear its wakeups */
+		while (read(ttywake[0], buf, sizeof(buf)) > 0)
+			;
+		/* saving and exiting belong to this thread, not the reader */
+		if (ttythrdone)
+			ttyclosed();
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		ttygrow();
+		if ((ret = ttyfill()) == 0)
+			ttyclosed();
+		if (ret < 0)
+			break;
+		ttyparse(ret);
+		total += ret;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (TIMEDIFF(now, start) < ttyreadbudget);
+
+	return total;
+}
+
+/*
+ * The reader thread sticks to BUFSIZ reads: it has no select() per read
+ * to amortize, and a smaller chunk keeps each hold of the lock short.
+ * Once the tty is gone it wakes the frontend and ends; ttyread() then
+ * saves and exits on the frontend's thread.
+ */
+static void *
+ttyreader(void *unused)
+{
+	fd_set rfd;
+	ssize_t ret;
+
+	do {
+		if ((ret = ttyfill()) < 0) {
+			FD_ZERO(&rfd);
+			FD_SET(cmdfd, &rfd);
+			if (pselect(cmdfd+1, &rfd, NULL, NULL, NULL, NULL) >= 0
+					|| errno == EINTR)
+				continue;
+			ttyerrno = errno;
+			ret = 0;
+		}
+		tlock();
+		if (ret > 0)
+			ttyparse(ret);
+		else
+			ttythrdone = 1;
+		tunlock();
+		/* a full pipe already means a pending wakeup */
+		if (write(ttywake[1], "", 1) < 0 && errno != EAGAIN)
+			die("wakeup write failed: %s\n", strerror(errno));
+	} while (ret != 0);
+	return NULL;
+}
+
+/*
+ * Move tty reading and parsing onto its own thread. From then on the
+ * terminal state belongs to whoever holds tlock(): the reader takes it
+ * for each chunk it parses, the frontend for event handling and
+ * drawing. Returns a descriptor that becomes readable whenever new
+ * output has been parsed; the frontend watches it instead of the tty
+ * and calls ttyread() to acknowledge.
+ */
+int
+ttythreadstart(void)
+{
+	sigset_t all, old;
+
+	if (pipe(ttywake) < 0)
+		die("pipe failed: %s\n", strerror(errno));
+	fcntl(ttywake[0], F_SETFL, O_NONBLOCK);
+	fcntl(ttywake[1], F_SETFL, O_NONBLOCK);
+
+	ttythreaded = 1;
+	/* signal handlers keep running on the frontend thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if ((errno = pthread_create(&ttythr, NULL, ttyreader, NULL)))
+		die("pthread_create failed: %s\n", strerror(errno));
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return ttywake[0];
+}
+
+/* a ticket lock, so neither thread can starve the other */
+void
+tlock(void)
+{
+	unsigned long t;
+
+	if (!ttythreaded)
+		return;
+	pthread_mutex_lock(&tmtx);
+	for (t = tticket++; t != tserving; )
+		pthread_cond_wait(&tcond, &tmtx);
+	pthread_mutex_unlock(&tmtx);
+}
+
+void
+tunlock(void)
+{
+	if (!ttythreaded)
+		return;
+	pthread_mutex_lock(&tmtx);
+	tserving++;
+	pthread_cond_broadcast(&tcond);
+	pthread_mutex_unlock(&tmtx);
 }
 
 void
@@ -920,61 +1432,110 @@ ttywrite(const char *s, size_t n, int may_echo)
 	}
 }
 
+/*
+ * Queue output for the child. Nothing is written here: the frontend
+ * calls ttyflush() once per loop iteration, so key presses and replies
+ * arriving together go out in one syscall, and a child that is slow to
+ * read never blocks the caller.
+ */
 void
 ttywriteraw(const char *s, size_t n)
 {
-	fd_set wfd, rfd;
-	ssize_t r;
-	size_t lim = 256;
+	size_t siz, first, tail;
+	char *q;
 
-	/*
-	 * Remember that we are using a pty, which might be a modem line.
-	 * Writing too much will clog the line. That's why we are doing this
-	 * dance.
-	 * FIXME: Migrate the world to Plan 9.
-	 */
-	while (n > 0) {
-		FD_ZERO(&wfd);
-		FD_ZERO(&rfd);
-		FD_SET(cmdfd, &wfd);
-		FD_SET(cmdfd, &rfd);
+	if (n == 0)
+		return;
+	if (ttywqlen + n > ttywqsiz) {
+		for (siz = MAX(ttywqsiz, TTYWQ_SIZ); siz < ttywqlen + n; siz *= 2)
+			;
+		q = xmalloc(siz);
+		if (ttywqlen > 0) {
+			first = MIN(ttywqlen, ttywqsiz - ttywqhead);
+			memcpy(q, ttywq + ttywqhead, first);
+			memcpy(q + first, ttywq, ttywqlen - first);
+		}
+		free(ttywq);
+		ttywq = q;
+		ttywqsiz = siz;
+		ttywqhead = 0;
+	}
+
+	tail = (ttywqhead + ttywqlen) & (ttywqsiz - 1);
+	first = MIN(n, ttywqsiz - tail);
+	memcpy(ttywq + tail, s, first);
+	memcpy(ttywq, s + first, n - first);
+	ttywqlen += n;
+	ttywqin += n;
+}
+
+/* bytes queued so far, to tell ttyunqueue() which to take back */
+size_t
+ttyqueued(void)
+{
+	return ttywqin;
+}
+
+/*
+ * Take back the bytes queued from the from'th to the to'th as far as
+ * they were not written yet; what was queued after them stays. Returns
+ * how many were taken.
+ */
+size_t
+ttyunqueue(size_t from, size_t to)
+{
+	size_t out = ttywqin - ttywqlen, mask = ttywqsiz - 1, i, n;
+
+	from = MAX(from, out);
+	to = MIN(to, ttywqin);
+	if (to <= from)
+		return 0;
+	n = to - from;
+	for (i = to - out; i < ttywqlen; i++)
+		ttywq[(ttywqhead + i - n) & mask] = ttywq[(ttywqhead + i) & mask];
+	ttywqlen -= n;
+	ttywqin -= n;
+	return n;
+}
+
+/* write out as much queued output as the tty takes without blocking */
+void
+ttyflush(void)
+{
+	struct iovec iov[2];
+	size_t first;
+	ssize_t r;
 
-		/* Check if we can write. */
-		if (pselect(cmdfd+1, &rfd, &wfd, NULL, NULL, NULL) < 0) {
+	while (ttywqlen > 0) {
+		first = MIN(ttywqlen, ttywqsiz - ttywqhead);
+		iov[0].iov_base = ttywq + ttywqhead;
+		iov[0].iov_len = first;
+		iov[1].iov_base = ttywq;
+		iov[1].iov_len = ttywqlen - first;
+		if ((r = writev(cmdfd, iov, iov[1].iov_len ? 2 : 1)) < 0) {
 			if (errno == EINTR)
 				continue;
-			die("select failed: %s\n", strerror(errno));
-		}
-		if (FD_ISSET(cmdfd, &wfd)) {
-			/*
-			 * Only write the bytes written by ttywrite() or the
-			 * default of 256. This seems to be a reasonable value
-			 * for a serial line. Bigger values might clog the I/O.
-			 */
-			if ((r = write(cmdfd, s, (n < lim)? n : lim)) < 0)
-				goto write_error;
-			if (r < n) {
-				/*
-				 * We weren't able to write out everything.
-				 * This means the buffer is getting full
-				 * again. Empty it.
-				 */
-				if (n < lim)
-					lim = ttyread();
-				n -= r;
-				s += r;
-			} else {
-				/* All bytes have been written. */
-				break;
-			}
+			if (errno == EAGAIN)
+				return;
+			die("write error on tty: %s\n", strerror(errno));
 		}
-		if (FD_ISSET(cmdfd, &rfd))
-			lim = ttyread();
+		ttywqhead = (ttywqhead + r) & (ttywqsiz - 1);
+		ttywqlen -= r;
+	}
+
+	/* let go of the memory a large paste needed */
+	ttywqhead = 0;
+	if (ttywqsiz > 16 * TTYWQ_SIZ) {
+		free(ttywq);
+		ttywq = NULL;
+		ttywqsiz = 0;
 	}
-	return;
+}
 
-write_error:
-	die("write error on tty: %s\n", strerror(errno));
+size_t
+ttypending(void)
+{
+	return ttywqlen;
 }
 
 void
@@ -1000,13 +1561,11 @@ ttyhangup(void)
 int
 tattrset(int attr)
 {
-	int i, j;
+	int i;
 
-	for (i = 0; i < term.row-1; i++) {
-		for (j = 0; j < term.col-1; j++) {
-			if (term.line[i][j].mode & attr)
-				return 1;
-		}
+	for (i = 0; i < term.row; i++) {
+		if (tlineinfo(term.line[i])->attr & attr)
+			return 1;
 	}
 
 	return 0;
@@ -1033,15 +1592,11 @@ tsetdirt(int top, int bot)
 void
 tsetdirtattr(int attr)
 {
-	int i, j;
+	int i;
 
-	for (i = 0; i < term.row-1; i++) {
-		for (j = 0; j < term.col-1; j++) {
-			if (term.line[i][j].mode & attr) {
-				tsetdirt(i, i);
-				break;
-			}
-		}
+	for (i = 0; i < term.row; i++) {
+		if (tlineinfo(term.line[i])->attr & attr)
+			term.dirty[i] = 1;
 	}
 }
 
@@ -1054,14 +1609,13 @@ tfulldirt(void)
 void
 tcursor(int mode)
 {
-	static TCursor c[2];
 	int alt = IS_SET(MODE_ALTSCREEN);
 
 	if (mode == CURSOR_SAVE) {
-		c[alt] = term.c;
+		savedc[alt] = term.c;
 	} else if (mode == CURSOR_LOAD) {
-		term.c = c[alt];
-		tmoveto(c[alt].x, c[alt].y);
+		term.c = savedc[alt];
+		tmoveto(savedc[alt].x, savedc[alt].y);
 	}
 }
 
@@ -1072,8 +1626,7 @@ treset(void)
 
 	term.c = (TCursor){{
 		.mode = ATTR_NULL,
-		.fg = defaultfg,
-		.bg = defaultbg
+		.style = 0 /* defaultfg on defaultbg */
 	}, .x = 0, .y = 0, .state = CURSOR_DEFAULT};
 
 	memset(term.tabs, 0, term.col * sizeof(*term.tabs));
@@ -1096,7 +1649,8 @@ treset(void)
 void
 tnew(int col, int row)
 {
-	term = (Term){ .c = { .attr = { .fg = defaultfg, .bg = defaultbg } } };
+	term = (Term){ .c = { .attr = { .style = 0 } } };
+	styleinit(defaultfg, defaultbg);
 	tresize(col, row);
 	treset();
 }
@@ -1126,6 +1680,7 @@ kscrolldown(const Arg* a)
 	if (term.scr > 0) {
 		term.scr -= n;
 		selscroll(0, -n);
+		tscrolled(0, term.row-1, n);
 		tfulldirt();
 	}
 }
@@ -1138,168 +1693,980 @@ kscrollup(const Arg* a)
 	if (n < 0)
 		n = term.row + n;
 
-	if (term.scr <= HISTSIZE-n) {
+	n = MIN(n, term.histn + term.histdisk - term.scr);
+	if (n > 0) {
 		term.scr += n;
 		selscroll(0, n);
+		tscrolled(0, term.row-1, -n);
 		tfulldirt();
 	}
 }
 
+/* set line y of the main screen (see HLINE), in both halves of the ring */
 void
-tscrolldown(int orig, int n, int copyhist)
+tsetring(int y, Line l)
 {
-	int i;
-	Line temp;
-
-	LIMIT(n, 0, term.bot-orig+1);
+	int i = (term.head + y) & (term.ringsiz - 1);
 
-	if (copyhist) {
-		term.histi = (term.histi - 1 + HISTSIZE) % HISTSIZE;
-		temp = term.hist[term.histi];
-		term.hist[term.histi] = term.line[term.bot];
-		term.line[term.bot] = temp;
-	}
-
-	tsetdirt(orig, term.bot-n);
-	tclearregion(0, term.bot-n+1, term.col-1, term.bot);
+	term.ring[i] = term.ring[i + term.ringsiz] = l;
+}
 
-	for (i = term.bot; i >= orig+n; i--) {
-		temp = term.line[i];
-		term.line[i] = term.line[i-n];
-		term.line[i-n] = temp;
-	}
+/* set row y of the current screen */
+void
+tsetline(int y, Line l)
+{
+	if (IS_SET(MODE_ALTSCREEN))
+		term.line[y] = l;
+	else
+		tsetring(y, l);
+}
 
-	if (term.scr == 0)
-		selscroll(orig, n);
+void
+tsethead(int head)
+{
+	term.head = head & (term.ringsiz - 1);
+	if (IS_SET(MODE_ALTSCREEN))
+		term.alt = term.ring + term.head;
+	else
+		term.line = term.ring + term.head;
 }
 
+/* reverse the order of main screen lines a..b */
 void
-tscrollup(int orig, int n, int copyhist)
+tringreverse(int a, int b)
 {
-	int i;
 	Line temp;
 
-	LIMIT(n, 0, term.bot-orig+1);
-
-	if (copyhist) {
-		term.histi = (term.histi + 1) % HISTSIZE;
-		temp = term.hist[term.histi];
-		term.hist[term.histi] = term.line[orig];
-		term.line[orig] = temp;
-		if (term.histn < HISTSIZE)
-			term.histn++;
+	for (; a < b; a++, b--) {
+		temp = HLINE(a);
+		tsetring(a, HLINE(b));
+		tsetring(b, temp);
 	}
+}
 
-	if (term.scr > 0 && term.scr < HISTSIZE)
-		term.scr = MIN(term.scr + n, HISTSIZE-1);
-
-	tclearregion(0, orig, term.col-1, orig+n-1);
-	tsetdirt(orig+n, term.bot);
+/* make room in the ring for a history of n lines */
+void
+tringreserve(int n)
+{
+	int i, siz;
+	Line *ring;
 
-	for (i = orig; i <= term.bot-n; i++) {
-		temp = term.line[i];
-		term.line[i] = term.line[i+n];
-		term.line[i+n] = temp;
-	}
+	for (siz = term.ringsiz; siz < n + 2 * term.row; siz <<= 1)
+		;
+	if (siz == term.ringsiz)
+		return;
 
-	if (term.scr == 0)
-		selscroll(orig, -n);
+	ring = xmalloc(2 * siz * sizeof(Line));
+	memset(ring, 0, 2 * siz * sizeof(Line));
+	for (i = -term.histn; i < term.row; i++)
+		ring[i & (siz-1)] = HLINE(i);
+	memcpy(ring + siz, ring, siz * sizeof(Line));
+	free(term.ring);
+	term.ring = ring;
+	term.ringsiz = siz;
+	tsethead(0);
 }
 
-void
-selscroll(int orig, int n)
+/* a line of col cells, what is in them is up to the caller */
+Line
+tlinenew(int col)
 {
-	if (sel.ob.x == -1 || sel.alt != IS_SET(MODE_ALTSCREEN))
-		return;
+	LineInfo *li = xmalloc(sizeof(LineInfo) + col * sizeof(Glyph));
 
-	if (BETWEEN(sel.nb.y, orig, term.bot) != BETWEEN(sel.ne.y, orig, term.bot)) {
-		selclear();
-	} else if (BETWEEN(sel.nb.y, orig, term.bot)) {
-		sel.ob.y += n;
-		sel.oe.y += n;
-		if (sel.ob.y < term.top || sel.ob.y > term.bot ||
-		    sel.oe.y < term.top || sel.oe.y > term.bot) {
-			selclear();
-		} else {
-			selnormalize();
-		}
-	}
+	li->gen = ++linegen;
+	li->seen = li->gen - 1;
+	li->searched = 0;
+	li->mark = 0;
+	return (Line)(li + 1);
 }
 
-void
-tnewline(int first_col)
+/* a blank line as wide as the lines of the screens */
+Line
+tlinealloc(void)
 {
-	int y = term.c.y;
+	Line l = tlinenew(term.maxcol);
+	int x;
 
-	if (y == term.bot) {
-		tscrollup(term.top, 1, 1);
-	} else {
-		y++;
+	for (x = 0; x < term.maxcol; x++) {
+		l[x] = term.c.attr;
+		l[x].mode = 0;
+		l[x].u = ' ';
 	}
-	tmoveto(first_col ? 0 : term.c.x, y);
+	return l;
 }
 
-void
-csiparse(void)
+/* the LineInfo of l, brought up to date */
+LineInfo *
+tlineinfo(Line l)
 {
-	char *p = csiescseq.buf, *np;
-	long int v;
-	int sep = ';'; /* colon or semi-colon, but not both */
+	LineInfo *li = LINEINFO(l);
+	int x;
 
-	csiescseq.narg = 0;
-	if (*p == '?') {
-		csiescseq.priv = 1;
-		p++;
+	if (li->seen == li->gen && li->col == term.col)
+		return li;
+	li->attr = 0;
+	li->blank = 1;
+	for (x = 0; x < term.col; x++) {
+		li->attr |= l[x].mode;
+		li->blank &= ISBLANK(l[x]);
 	}
-
-	csiescseq.buf[csiescseq.len] = '\0';
-	while (p < csiescseq.buf+csiescseq.len) {
-		np = NULL;
-		v = strtol(p, &np, 10);
-		if (np == p)
-			v = 0;
-		if (v == LONG_MAX || v == LONG_MIN)
-			v = -1;
-		csiescseq.arg[csiescseq.narg++] = v;
-		p = np;
-		if (sep == ';' && *p == ':')
-			sep = ':'; /* allow override to colon once */
-		if (*p != sep || csiescseq.narg == ESC_ARG_SIZ)
-			break;
-		p++;
+	x = term.col;
+	if (!(l[x-1].mode & ATTR_WRAP)) {
+		while (x > 0 && l[x-1].u == ' ')
+			x--;
 	}
-	csiescseq.mode[0] = *p++;
-	csiescseq.mode[1] = (p < csiescseq.buf+csiescseq.len) ? *p : '\0';
+	li->len = x;
+	li->guess = vimnav_prompt_guess(l, x, term.col);
+	li->seen = li->gen;
+	li->col = term.col;
+	return li;
 }
 
-/* for absolute user moves, when decom is set */
-void
-tmoveato(int x, int y)
+/* most lines of col glyphs the history may hold */
+int
+thistmax(int col)
 {
-	tmoveto(x, y + ((term.c.state & CURSOR_ORIGIN) ? term.top: 0));
+	size_t max = MIN(histsize, HISTMAX);
+
+	if (histbytes > 0)
+		max = MIN(max, histbytes / (col * sizeof(Glyph)));
+	return max;
 }
 
-void
-tmoveto(int x, int y)
+/*
+ * Get ready for n more history lines: grow the ring if needed and
+ * return how many of the oldest lines have to go to stay in thistmax().
+ */
+int
+thistroom(int n)
 {
-	int miny, maxy;
+	int max = thistmax(term.maxcol);
 
-	if (term.c.state & CURSOR_ORIGIN) {
-		miny = term.top;
-		maxy = term.bot;
-	} else {
-		miny = 0;
-		maxy = term.row - 1;
-	}
-	term.c.state &= ~CURSOR_WRAPNEXT;
-	term.c.x = LIMIT(x, 0, term.col-1);
-	term.c.y = LIMIT(y, miny, maxy);
+	tringreserve(MIN(term.histn + n, max));
+	return MAX(term.histn + n - max, 0);
 }
 
-void
-tsetchar(Rune u, const Glyph *attr, int x, int y)
+/*
+ * Line i of the n the main screen needs when n rows go to the history,
+ * which by then runs from HLINE(-term.histn) to HLINE(n-1): one of the
+ * drop oldest of those, or a new line while the history still grows.
+ */
+Line
+thistspare(int i, int drop)
 {
-	static const char *vt100_0[62] = { /* 0x41 - 0x7e */
+	Line l;
+
+	if (i >= drop)
+		return tlinealloc();
+	l = HLINE(i - term.histn);
+	tsetring(i - term.histn, NULL);
+	tspill(l);
+	if (ISPACKED(l)) {
+		tlinefree(l);
+		l = tlinealloc();
+	}
+	return l;
+}
+
+/*
+ * Make the history n lines long, within thistmax(): its oldest lines go,
+ * or blank ones are put before them.
+ */
+void
+thistresize(int n)
+{
+	int i;
+
+	n = MIN(n, thistmax(term.maxcol));
+	for (i = n; i < term.histn; i++) {
+		tlinefree(HLINE(-i - 1));
+		tsetring(-i - 1, NULL);
+	}
+	tringreserve(n);
+	for (i = term.histn; i < n; i++)
+		tsetring(-i - 1, tlinealloc());
+	term.histn = n;
+	histpacked = 0;
+	histwrapped = n;
+	nwrapruns = 0;
+	tsearchrenumber();
+	term.scr = MIN(term.scr, n + term.histdisk);
+}
+
+/*
+ * Move rows orig..orig+n-1 of the current screen into the history and
+ * give the screen lines to put in their place.
+ * The main screen keeps its rows, it just starts n lines further on.
+ */
+void
+thistpush(int orig, int n)
+{
+	int i, y, drop, alt = IS_SET(MODE_ALTSCREEN);
+	Line l;
+
+	drop = thistroom(n);
+	/* the main screen rows that stay move up by n, last first */
+	for (y = term.row-1; y >= (alt ? 0 : orig+n); y--)
+		tsetring(n + y, HLINE(y));
+	if (alt) {
+		for (i = 0; i < n; i++)
+			tsetring(i, term.line[orig + i]);
+	} else if (orig > 0) {
+		/* the pushed rows go in front of the ones above them */
+		tringreverse(0, orig-1);
+		tringreverse(orig, orig+n-1);
+		tringreverse(0, orig+n-1);
+	}
+	for (i = 0; i < n; i++) {
+		l = thistspare(i, drop);
+		if (alt)
+			term.line[orig + i] = l;
+		else
+			tsetring(n + orig + i, l);
+	}
+	tsethead(term.head + n);
+	term.histn += n - drop;
+	histpacked = MAX(histpacked - drop, 0);
+	histwrapped += n;
+	histtotal += n;
+	twrapdrop(drop);
+}
+
+/* free a line, packed or not */
+void
+tlinefree(Line l)
+{
+	Pack *p, **pp;
+	int i;
+
+	if (!ISPACKED(l)) {
+		if (l)
+			free(LINEINFO(l));
+		return;
+	}
+	p = PACKOF(l);
+	if (--p->ref > 0)
+		return;
+	for (pp = &packtab[p->hash & (packtabsiz-1)]; *pp != p;
+	     pp = &(*pp)->next)
+		;
+	*pp = p->next;
+	npacks--;
+	for (i = 0; i < npackcache; i++) {
+		if (packcache[i].key == l) {
+			packcache[i].key = NULL;
+			packcache[i].used = 0;
+		}
+	}
+	free(p);
+}
+
+uint32_t
+tpackhash(const uchar *d, size_t n, int col)
+{
+	uint32_t h = 2166136261u ^ col;
+
+	while (n--)
+		h = (h ^ *d++) * 16777619u;
+	return h;
+}
+
+/* hash every Pack again into a table of siz chains */
+void
+tpackrehash(int siz)
+{
+	Pack **tab = xmalloc(siz * sizeof(*tab)), *p, *next;
+	int i;
+
+	memset(tab, 0, siz * sizeof(*tab));
+	for (i = 0; i < packtabsiz; i++) {
+		for (p = packtab[i]; p; p = next) {
+			next = p->next;
+			p->hash = tpackhash(p->data, p->nspan * sizeof(PackSpan)
+			                    + p->ntext, p->col);
+			p->next = tab[p->hash & (siz-1)];
+			tab[p->hash & (siz-1)] = p;
+		}
+	}
+	free(packtab);
+	packtab = tab;
+	packtabsiz = siz;
+}
+
+/* the packed form of col cells, shared with an equal line if there is one */
+Line
+tpack(const Glyph *g, int col, ushort mark)
+{
+	static uchar *buf;
+	static size_t bufsiz;
+	PackSpan *sp;
+	Pack *p;
+	uchar *t;
+	uint32_t h;
+	size_t len;
+	int i, nspan, end;
+
+	if (bufsiz < col * (sizeof(PackSpan) + UTF_SIZ)) {
+		bufsiz = col * (sizeof(PackSpan) + UTF_SIZ);
+		buf = xrealloc(buf, bufsiz);
+	}
+	sp = (PackSpan *)buf;
+	for (i = nspan = 0; i < col; i++) {
+		if (nspan > 0 && sp[nspan-1].mode == g[i].mode &&
+		    sp[nspan-1].style == g[i].style &&
+		    sp[nspan-1].len < USHRT_MAX) {
+			sp[nspan-1].len++;
+		} else {
+			sp[nspan++] = (PackSpan){ 1, g[i].mode, g[i].style };
+		}
+	}
+	for (end = col; end > 0 && g[end-1].u == ' '; end--)
+		;
+	t = (uchar *)(sp + nspan);
+	for (i = 0; i < end; i++) {
+		if (g[i].u < 0x80)
+			*t++ = g[i].u;
+		else
+			t += utf8encode(g[i].u, (char *)t);
+	}
+	len = t - buf;
+
+	h = tpackhash(buf, len, col);
+	for (p = packtabsiz ? packtab[h & (packtabsiz-1)] : NULL; p;
+	     p = p->next) {
+		if (p->hash == h && p->col == col && p->nspan == nspan &&
+		    p->mark == mark && !memcmp(p->data, buf, len) &&
+		    p->ntext == (int)(len - nspan * sizeof(PackSpan))) {
+			p->ref++;
+			return PACKLINE(p);
+		}
+	}
+
+	if (npacks >= packtabsiz)
+		tpackrehash(MAX(2 * packtabsiz, 256));
+	p = xmalloc(sizeof(*p) + len);
+	p->hash = h;
+	p->ref = 1;
+	p->col = col;
+	p->nspan = nspan;
+	p->ntext = len - nspan * sizeof(PackSpan);
+	p->searched = 0;
+	p->mark = mark;
+	memcpy(p->data, buf, len);
+	p->next = packtab[h & (packtabsiz-1)];
+	packtab[h & (packtabsiz-1)] = p;
+	npacks++;
+	return PACKLINE(p);
+}
+
+void
+tunpack(const Pack *p, Glyph *g, int col)
+{
+	const PackSpan *sp = (const PackSpan *)p->data;
+	const char *t = (const char *)(sp + p->nspan), *end = t + p->ntext;
+	int i, j, x;
+
+	for (i = x = 0; i < p->nspan; i++) {
+		for (j = 0; j < sp[i].len && x < col; j++, x++) {
+			g[x].u = ' ';
+			g[x].mode = sp[i].mode;
+			g[x].style = sp[i].style;
+		}
+	}
+	for (; x < col; x++)
+		g[x] = (Glyph){ .u = ' ' };
+	for (x = 0; t < end && x < col; x++) {
+		if ((uchar)*t < 0x80)
+			g[x].u = *t++;
+		else
+			t += MAX(utf8decode(t, &g[x].u, end - t), 1);
+	}
+}
+
+/*
+ * The cells of packed line l, or else of line disk - 1 of the disk tier,
+ * from the cache of expanded lines.
+ */
+Line
+texpand(Line l, int disk)
+{
+	PackCache *c, *lru = packcache;
+	int x;
+
+	for (c = packcache; c < packcache + npackcache; c++) {
+		if (c->l && (l ? c->key == l : c->disk == disk)) {
+			c->used = ++packclock;
+			return c->l;
+		}
+		if (c->used < lru->used)
+			lru = c;
+	}
+	if (!lru->l)
+		lru->l = tlinenew(term.maxcol);
+	LINETOUCH(lru->l);
+	LINEINFO(lru->l)->mark = l ? PACKOF(l)->mark : 0;
+	if (l) {
+		tunpack(PACKOF(l), lru->l, term.maxcol);
+	} else if (persist_unspill(disk - 1, lru->l, term.maxcol) < 0) {
+		for (x = 0; x < term.maxcol; x++)
+			lru->l[x] = (Glyph){ .u = ' ' };
+	}
+	lru->key = l;
+	lru->disk = l ? 0 : disk;
+	lru->used = ++packclock;
+	return lru->l;
+}
+
+/*
+ * Line y as HLINE() has it, a packed history line expanded and one left
+ * at an earlier width wrapped again first; the disk tier continues the
+ * history before HLINE(-term.histn).
+ *
+ * Wrapping again is not free of side effects: term.histn changes, and so
+ * do the lines further back than those wrapped already. A walk over the
+ * history should go from the newest line back, which leaves the lines
+ * it has passed where they were, and compare against term.histn afresh
+ * at each step rather than a copy taken at the start.
+ */
+Line
+thline(int y)
+{
+	Line l;
+
+	if (y < -histwrapped && nwrapruns > 0)
+		thistwrap(-y);
+	if (y < -term.histn)
+		return texpand(NULL, term.histdisk + term.histn + y + 1);
+	l = HLINE(y);
+	return ISPACKED(l) ? texpand(l, 0) : l;
+}
+
+/*
+ * Hand the oldest history line to the disk tier as it leaves memory. If
+ * the disk tier drops its oldest lines to make room, the expanded ones
+ * of those go from the cache: their numbers now belong to other lines.
+ */
+void
+tspill(Line l)
+{
+	PackCache *c;
+	int k;
+
+	if (!histspill || (k = persist_spill(ISPACKED(l) ? texpand(l, 0) : l,
+	                                     term.maxcol)) < 0)
+		return;
+	term.histdisk += 1 - k;
+	if (k == 0)
+		return;
+	for (c = packcache; c < packcache + npackcache; c++) {
+		if (c->l && !c->key) {
+			tlinefree(c->l);
+			*c = (PackCache){ 0 };
+		}
+	}
+	term.scr = MIN(term.scr, term.histn + term.histdisk);
+}
+
+/*
+ * Mark the styles packed lines use, or renumber them after stylekeep();
+ * the expanded lines of the cache go, disk tier ones too.
+ */
+void
+tpackstyles(uchar *used, const ushort *map)
+{
+	PackSpan *sp;
+	Pack *p;
+	int i, j;
+
+	for (i = 0; i < packtabsiz; i++) {
+		for (p = packtab[i]; p; p = p->next) {
+			sp = (PackSpan *)p->data;
+			for (j = 0; j < p->nspan; j++) {
+				if (map)
+					sp[j].style = map[sp[j].style];
+				else
+					used[sp[j].style] = 1;
+			}
+		}
+	}
+	if (map && packtabsiz)
+		tpackrehash(packtabsiz);
+	if (map)
+		tpackcacheinit(npackcache);
+}
+
+/* empty the cache of expanded lines and make room for n in it */
+void
+tpackcacheinit(int n)
+{
+	int i;
+
+	for (i = 0; i < npackcache; i++)
+		tlinefree(packcache[i].l);
+	packcache = xrealloc(packcache, n * sizeof(*packcache));
+	memset(packcache, 0, n * sizeof(*packcache));
+	npackcache = n;
+}
+
+/*
+ * Pack up to n of the history lines further back than histhot, oldest
+ * first. Returns whether some are left to pack.
+ */
+int
+thistcompact(int n)
+{
+	int y, end = -(int)MIN(histhot, (unsigned int)term.histn);
+	Line l;
+
+	for (y = histpacked - term.histn; y < end && n > 0;
+	     y++, histpacked++) {
+		l = HLINE(y);
+		if (ISPACKED(l))
+			continue;
+		tsetring(y, tpack(l, term.maxcol, tlinemark(l, 0)));
+		tlinefree(l);
+		n--;
+	}
+	return y < end;
+}
+
+/* let the n oldest history lines go, on to the disk tier */
+void
+thistdrop(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		tspill(HLINE(i - term.histn));
+		tlinefree(HLINE(i - term.histn));
+		tsetring(i - term.histn, NULL);
+	}
+	term.histn -= n;
+	histpacked = MAX(histpacked - n, 0);
+	twrapdrop(n);
+}
+
+/* the n oldest history lines are gone: from the runs first */
+void
+twrapdrop(int n)
+{
+	int k;
+
+	while (n > 0 && nwrapruns > 0) {
+		k = MIN(n, wrapruns[0].n);
+		wrapruns[0].n -= k;
+		n -= k;
+		if (wrapruns[0].n == 0)
+			memmove(wrapruns, wrapruns + 1,
+			        --nwrapruns * sizeof(*wrapruns));
+	}
+	histwrapped -= n;
+}
+
+/* history line y unpacked in its ring slot */
+Line
+thistunpack(int y)
+{
+	Line l = HLINE(y), g;
+
+	if (!ISPACKED(l))
+		return l;
+	g = tlinenew(term.maxcol);
+	tunpack(PACKOF(l), g, term.maxcol);
+	LINEINFO(g)->mark = PACKOF(l)->mark;
+	tlinefree(l);
+	tsetring(y, g);
+	return g;
+}
+
+/*
+ * Wrap the n rows of w cells in rows again at col: the rows of a logical
+ * line are those up to one without ATTR_WRAP on its last cell, less the
+ * ATTR_WRAPPAD blanks wide characters left at row ends. The new
+ * lines go to wrapped[], their number is returned. A cursor at *cy, *cx
+ * of rows, if cy is not NULL, is moved to the same cell in wrapped[].
+ */
+int
+trewrap(Line *rows, int n, int w, int col, int *cy, int *cx)
+{
+	int i, j, k, p, e, x, len, cur, nr = 0;
+	uint64_t gen;
+	ushort mark;
+	Line l;
+	Glyph *g;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && rows[j-1][w-1].mode & ATTR_WRAP; j++)
+			;
+		/* the marks go to its first row, the column only if it fits */
+		mark = LINEINFO(rows[i])->mark;
+		if ((mark & MARK_X) > col)
+			mark &= ~MARK_X;
+		gen = LINEINFO(rows[i])->gen;
+		for (k = i + 1; k < j; k++) {
+			mark |= LINEINFO(rows[k])->mark & ~MARK_X;
+			gen = MIN(gen, LINEINFO(rows[k])->gen);
+		}
+		for (e = w; e > 0 && ISBLANK(rows[j-1][e-1]); e--)
+			;
+		len = (j - 1 - i) * w + e;
+		cur = (cy && BETWEEN(*cy, i, j-1)) ? (*cy - i) * w + *cx : -1;
+		len = MAX(len, cur + 1);
+		for (p = 0, x = col, l = NULL; p < len || !l; p++) {
+			g = p < len ? &rows[i + p / w][p % w] : NULL;
+			/* a wide character goes to the next row whole */
+			if (x == col || (g && x > 0 && x == col - 1 &&
+			                 g->mode & ATTR_WIDE)) {
+				if (l && x < col)
+					l[col-1].mode |= ATTR_WRAPPAD;
+				if (l)
+					l[col-1].mode |= ATTR_WRAP;
+				if (nr == wrappedsiz) {
+					wrappedsiz = MAX(2 * wrappedsiz, 64);
+					wrapped = xrealloc(wrapped,
+					        wrappedsiz * sizeof(Line));
+				}
+				l = wrapped[nr++] = tlinenew(term.maxcol);
+				for (x = 0; x < term.maxcol; x++)
+					l[x] = (Glyph){ .u = ' ' };
+				x = 0;
+				LINEINFO(l)->mark = mark;
+				mark = 0;
+				/* still from before the shell marked, see tlinemark() */
+				if (gen < markgen) {
+					LINEINFO(l)->gen = gen;
+					LINEINFO(l)->seen = gen - 1;
+				}
+			}
+			if (!g)
+				break;
+			if (p == cur) {
+				*cy = nr - 1;
+				*cx = x;
+			} else if (g->mode & ATTR_WRAPPAD) {
+				/* not part of the line, the wide char after is */
+				continue;
+			}
+			l[x] = *g;
+			l[x++].mode &= ~(ATTR_WRAP|ATTR_WRAPPAD);
+		}
+	}
+	return nr;
+}
+
+/*
+ * Wrap the main screen again at col columns, as term.col goes to col.
+ * The logical line the top row is part of is taken from the history,
+ * and blank rows under the cursor are left out; what does not fit on
+ * the screen then goes to the history. The older history lines are
+ * only marked as wrapped at term.col, thline() wraps them when they are
+ * looked at.
+ */
+void
+tscreenwrap(int col)
+{
+	static Line *rows;
+	static int rowsiz;
+	TCursor *c = IS_SET(MODE_ALTSCREEN) ? &savedc[0] : &term.c;
+	int w = term.col, s, n, x, y, cy, cx, nr, extra;
+
+	LIMIT(c->x, 0, w-1);
+	LIMIT(c->y, 0, term.row-1);
+	for (s = 0; s > -histwrapped &&
+	     thistunpack(s - 1)[w-1].mode & ATTR_WRAP; s--)
+		;
+	for (n = term.row; n > c->y + 1; n--) {
+		for (x = 0; x < w && ISBLANK(HLINE(n-1)[x]); x++)
+			;
+		if (x < w)
+			break;
+	}
+	if (n - s > rowsiz) {
+		rowsiz = n - s;
+		rows = xrealloc(rows, rowsiz * sizeof(Line));
+	}
+	for (y = s; y < n; y++)
+		rows[y - s] = HLINE(y);
+	cy = c->y - s;
+	cx = c->x;
+	nr = trewrap(rows, n - s, w, col, &cy, &cx);
+	if (c->state & CURSOR_WRAPNEXT && cx < col - 1) {
+		c->state &= ~CURSOR_WRAPNEXT;
+		cx++;
+	}
+
+	for (y = s; y < term.row; y++) {
+		tlinefree(HLINE(y));
+		tsetring(y, NULL);
+	}
+	tsethead(term.head + s);
+	term.histn += s;
+	histwrapped += s;
+
+	/* the history left is all wrapped at w now */
+	if (histwrapped > 0 && nwrapruns > 0 &&
+	    wrapruns[nwrapruns-1].col == w) {
+		wrapruns[nwrapruns-1].n += histwrapped;
+	} else if (histwrapped > 0) {
+		if (nwrapruns == wrapsiz) {
+			wrapsiz = MAX(2 * wrapsiz, 8);
+			wrapruns = xrealloc(wrapruns, wrapsiz * sizeof(*wrapruns));
+		}
+		wrapruns[nwrapruns++] = (WrapRun){ histwrapped, w };
+	}
+	histwrapped = 0;
+	if (nwrapruns > 0 && wrapruns[nwrapruns-1].col == col)
+		histwrapped = wrapruns[--nwrapruns].n;
+
+	extra = MAX(nr - term.row, 0);
+	tringreserve(term.histn + extra);
+	for (y = 0; y < nr; y++)
+		tsetring(y, wrapped[y]);
+	for (; y < extra + term.row; y++) {
+		tsetring(y, tlinenew(term.maxcol));
+		for (x = 0; x < term.maxcol; x++)
+			HLINE(y)[x] = (Glyph){ .u = ' ' };
+	}
+	tsethead(term.head + extra);
+	term.histn += extra;
+	histwrapped += extra;
+	thistdrop(MAX(term.histn - thistmax(term.maxcol), 0));
+
+	c->x = cx;
+	c->y = cy - extra;
+	term.scr = MIN(term.scr, term.histn + term.histdisk);
+	selclear();
+}
+
+/*
+ * Wrap history lines left at an earlier width at term.col, from the
+ * newest back, until the newest need lines are; a batch of whole logical
+ * lines at a time takes their run's place in the ring.
+ */
+void
+thistwrap(int need)
+{
+	static Line *rows;
+	static int rowsiz;
+	WrapRun *r;
+	int a, e, y, m, nr, d;
+
+	while (histwrapped < need && nwrapruns > 0) {
+		r = &wrapruns[nwrapruns-1];
+		e = -histwrapped;
+		a = e - MIN(r->n, MAX(need - histwrapped, 256));
+		while (a > e - r->n &&
+		       thistunpack(a - 1)[r->col - 1].mode & ATTR_WRAP)
+			a--;
+		m = e - a;
+		if (m > rowsiz) {
+			rowsiz = m;
+			rows = xrealloc(rows, rowsiz * sizeof(Line));
+		}
+		for (y = a; y < e; y++)
+			rows[y - a] = thistunpack(y);
+		nr = trewrap(rows, m, r->col, term.col, NULL, NULL);
+		for (y = 0; y < m; y++)
+			tlinefree(rows[y]);
+		if ((r->n -= m) == 0)
+			nwrapruns--;
+
+		/*
+		 * The lines on the shorter side move to make room, or close
+		 * up: the older ones, or the newer ones and the screen.
+		 */
+		d = nr - m;
+		if (d > 0)
+			tringreserve(term.histn + d);
+		if (a + term.histn < term.row - e) {
+			if (d > 0) {
+				for (y = -term.histn; y < a; y++)
+					tsetring(y - d, HLINE(y));
+			} else {
+				for (y = a - 1; y >= -term.histn; y--)
+					tsetring(y - d, HLINE(y));
+			}
+			for (y = -term.histn; y < -term.histn - d; y++)
+				tsetring(y, NULL);
+		} else {
+			if (d > 0) {
+				for (y = term.row - 1; y >= e; y--)
+					tsetring(y + d, HLINE(y));
+			} else {
+				for (y = e; y < term.row; y++)
+					tsetring(y + d, HLINE(y));
+			}
+			for (y = term.row + d; y < term.row; y++)
+				tsetring(y, NULL);
+			tsethead(term.head + d);
+		}
+		for (y = 0; y < nr; y++)
+			tsetring(a - d + y, wrapped[y]);
+		term.histn += d;
+		histwrapped += nr;
+		histpacked = 0;
+		thistdrop(MAX(term.histn - thistmax(term.maxcol), 0));
+	}
+	term.scr = MIN(term.scr, term.histn + term.histdisk);
+}
+
+void
+tscrolldown(int orig, int n)
+{
+	int i;
+	Line temp;
+
+	LIMIT(n, 0, term.bot-orig+1);
+
+	if (term.scr == 0)
+		tscrolled(orig, term.bot, -n);
+	tsetdirt(orig, term.bot-n);
+	tclearregion(0, term.bot-n+1, term.col-1, term.bot);
+
+	for (i = term.bot; i >= orig+n; i--) {
+		temp = term.line[i];
+		tsetline(i, term.line[i-n]);
+		tsetline(i-n, temp);
+	}
+
+	if (term.scr == 0)
+		selscroll(orig, n);
+}
+
+void
+tscrollup(int orig, int n, int copyhist)
+{
+	int i, drop;
+	Line temp;
+
+	LIMIT(n, 0, term.bot-orig+1);
+
+	/* the history shown stays where it is */
+	if (term.scr > 0)
+		term.scr += n;
+	else
+		tscrolled(orig, term.bot, n);
+
+	/*
+	 * The whole main screen scrolls into the history: its top rows
+	 * already are where the history goes, so only the head moves and
+	 * the bottom rows get spare lines.
+	 */
+	if (copyhist && orig == 0 && term.bot == term.row-1 &&
+	    !IS_SET(MODE_ALTSCREEN)) {
+		drop = thistroom(n);
+		for (i = 0; i < n; i++)
+			tsetring(term.row + i, thistspare(i, drop));
+		tsethead(term.head + n);
+		term.histn += n - drop;
+		histpacked = MAX(histpacked - drop, 0);
+		histwrapped += n;
+		histtotal += n;
+		twrapdrop(drop);
+		term.scr = MIN(term.scr, term.histn + term.histdisk);
+
+		if (term.scr == 0)
+			selscroll(0, -n);
+		tclearregion(0, term.row-n, term.col-1, term.row-1);
+		tsetdirt(0, term.row-n-1);
+		return;
+	}
+
+	if (copyhist)
+		thistpush(orig, n);
+	term.scr = MIN(term.scr, term.histn + term.histdisk);
+
+	tclearregion(0, orig, term.col-1, orig+n-1);
+	tsetdirt(orig+n, term.bot);
+
+	for (i = orig; i <= term.bot-n; i++) {
+		temp = term.line[i];
+		tsetline(i, term.line[i+n]);
+		tsetline(i+n, temp);
+	}
+
+	if (term.scr == 0)
+		selscroll(orig, -n);
+}
+
+void
+selscroll(int orig, int n)
+{
+	if (sel.ob.x == -1 || sel.alt != IS_SET(MODE_ALTSCREEN))
+		return;
+
+	if (BETWEEN(sel.nb.y, orig, term.bot) != BETWEEN(sel.ne.y, orig, term.bot)) {
+		selclear();
+	} else if (BETWEEN(sel.nb.y, orig, term.bot)) {
+		sel.ob.y += n;
+		sel.oe.y += n;
+		if (sel.ob.y < term.top || sel.ob.y > term.bot ||
+		    sel.oe.y < term.top || sel.oe.y > term.bot) {
+			selclear();
+		} else {
+			selnormalize();
+		}
+	}
+}
+
+/* note for draw() that rows top to bot moved up by n */
+void
+tscrolled(int top, int bot, int n)
+{
+	Scroll *s = &scrolls[MAX(nscrolls - 1, 0)];
+
+	if (nscrolls < 0 || n == 0)
+		return;
+	if (nscrolls > 0 && s->top == top && s->bot == bot) {
+		s->n += n;
+	} else if (nscrolls < LEN(scrolls)) {
+		scrolls[nscrolls++] = (Scroll){ .top = top, .bot = bot, .n = n };
+	} else {
+		nscrolls = -1;
+	}
+}
+
+void
+tnewline(int first_col)
+{
+	int y = term.c.y;
+
+	if (y == term.bot) {
+		tscrollup(term.top, 1, 1);
+	} else {
+		y++;
+	}
+	tmoveto(first_col ? 0 : term.c.x, y);
+}
+
+/* for absolute user moves, when decom is set */
+void
+tmoveato(int x, int y)
+{
+	tmoveto(x, y + ((term.c.state & CURSOR_ORIGIN) ? term.top: 0));
+}
+
+void
+tmoveto(int x, int y)
+{
+	int miny, maxy;
+
+	if (term.c.state & CURSOR_ORIGIN) {
+		miny = term.top;
+		maxy = term.bot;
+	} else {
+		miny = 0;
+		maxy = term.row - 1;
+	}
+	term.c.state &= ~CURSOR_WRAPNEXT;
+	term.c.x = LIMIT(x, 0, term.col-1);
+	term.c.y = LIMIT(y, miny, maxy);
+}
+
+void
+tsetchar(Rune u, const Glyph *attr, int x, int y)
+{
+	static const char *vt100_0[62] = { /* 0x41 - 0x7e */
 		"↑", "↓", "→", "←", "█", "▚", "☃", /* A - G */
 		0, 0, 0, 0, 0, 0, 0, 0, /* H - O */
 		0, 0, 0, 0, 0, 0, 0, 0, /* P - W */
@@ -1328,6 +2695,7 @@ tsetchar(Rune u, const Glyph *attr, int x, int y)
 	}
 
 	term.dirty[y] = 1;
+	LINETOUCH(term.line[y]);
 	term.line[y][x] = *attr;
 	term.line[y][x].u = u;
 }
@@ -1350,12 +2718,15 @@ tclearregion(int x1, int y1, int x2, int y2)
 
 	for (y = y1; y <= y2; y++) {
 		term.dirty[y] = 1;
+		LINETOUCH(term.line[y]);
+		/* a line cleared whole is not the one the shell marked */
+		if (x1 == 0 && x2 >= term.col - 1)
+			LINEINFO(term.line[y])->mark = 0;
 		for (x = x1; x <= x2; x++) {
 			gp = &term.line[y][x];
 			if (selected(x, y))
 				selclear();
-			gp->fg = term.c.attr.fg;
-			gp->bg = term.c.attr.bg;
+			gp->style = term.c.attr.style;
 			gp->mode = 0;
 			gp->u = ' ';
 		}
@@ -1400,7 +2771,7 @@ void
 tinsertblankline(int n)
 {
 	if (BETWEEN(term.c.y, term.top, term.bot))
-		tscrolldown(term.c.y, n, 0);
+		tscrolldown(term.c.y, n);
 }
 
 void
@@ -1460,11 +2831,81 @@ tdefcolor(const int *attr, int *npar, int l)
 	return idx;
 }
 
+/*
+ * Style of a cell with fg on bg. When the table is full, the styles no
+ * cell uses any more are dropped, and with stylesqueeze truecolor gives
+ * up precision until similar ones merge; if that frees nothing the cell
+ * gets the closest colors there are.
+ */
+ushort
+tstyle(uint32_t fg, uint32_t bg)
+{
+	int s;
+
+	if ((s = stylefind(fg, bg)) < 0) {
+		tstylegc();
+		s = stylenear(fg, bg);
+	}
+	return s;
+}
+
+/* mark the styles of n glyphs in used, or renumber them with map */
+void
+tstylevisit(Glyph *g, int n, uchar *used, const ushort *map)
+{
+	Glyph *end = g + n;
+
+	if (map) {
+		for (; g < end; g++)
+			g->style = map[g->style];
+	} else {
+		for (; g < end; g++)
+			used[g->style] = 1;
+	}
+}
+
+void
+tstylegc(void)
+{
+	uchar *used = xmalloc(STYLEMAX);
+	ushort *map = xmalloc(STYLEMAX * sizeof(*map)), *m = NULL;
+	Line *alt = IS_SET(MODE_ALTSCREEN) ? term.line : term.alt;
+	int y, pass;
+
+	memset(used, 0, STYLEMAX);
+	for (pass = 0; pass < 2; pass++) {
+		for (y = -term.histn; y < term.row; y++) {
+			if (ISPACKED(HLINE(y)))
+				continue;
+			tstylevisit(HLINE(y), term.maxcol, used, m);
+			if (m)
+				LINETOUCH(HLINE(y));
+		}
+		tpackstyles(used, m);
+		for (y = 0; y < term.row; y++) {
+			tstylevisit(alt[y], term.maxcol, used, m);
+			if (m)
+				LINETOUCH(alt[y]);
+		}
+		tstylevisit(&term.c.attr, 1, used, m);
+		tstylevisit(&savedc[0].attr, 1, used, m);
+		tstylevisit(&savedc[1].attr, 1, used, m);
+		if (!m)
+			stylekeep(used, m = map, stylesqueeze);
+	}
+	free(used);
+	free(map);
+	/* what was drawn holds the old numbers */
+	xshadowclear();
+	tfulldirt();
+}
+
 void
 tsetattr(const int *attr, int l)
 {
 	int i;
 	int32_t idx;
+	Style c = styles[term.c.attr.style];
 
 	for (i = 0; i < l; i++) {
 		switch (attr[i]) {
@@ -1478,8 +2919,8 @@ tsetattr(const int *attr, int l)
 				ATTR_REVERSE    |
 				ATTR_INVISIBLE  |
 				ATTR_STRUCK     );
-			term.c.attr.fg = defaultfg;
-			term.c.attr.bg = defaultbg;
+			c.fg = defaultfg;
+			c.bg = defaultbg;
 			break;
 		case 1:
 			term.c.attr.mode |= ATTR_BOLD;
@@ -1530,17 +2971,17 @@ tsetattr(const int *attr, int l)
 			break;
 		case 38:
 			if ((idx = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.fg = idx;
+				c.fg = idx;
 			break;
 		case 39: /* set foreground color to default */
-			term.c.attr.fg = defaultfg;
+			c.fg = defaultfg;
 			break;
 		case 48:
 			if ((idx = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.bg = idx;
+				c.bg = idx;
 			break;
 		case 49: /* set background color to default */
-			term.c.attr.bg = defaultbg;
+			c.bg = defaultbg;
 			break;
 		case 58:
 			/* This starts a sequence to change the color of
@@ -1550,13 +2991,13 @@ tsetattr(const int *attr, int l)
 			break;
 		default:
 			if (BETWEEN(attr[i], 30, 37)) {
-				term.c.attr.fg = attr[i] - 30;
+				c.fg = attr[i] - 30;
 			} else if (BETWEEN(attr[i], 40, 47)) {
-				term.c.attr.bg = attr[i] - 40;
+				c.bg = attr[i] - 40;
 			} else if (BETWEEN(attr[i], 90, 97)) {
-				term.c.attr.fg = attr[i] - 90 + 8;
+				c.fg = attr[i] - 90 + 8;
 			} else if (BETWEEN(attr[i], 100, 107)) {
-				term.c.attr.bg = attr[i] - 100 + 8;
+				c.bg = attr[i] - 100 + 8;
 			} else {
 				fprintf(stderr,
 					"erresc(default): gfx attr %d unknown\n",
@@ -1566,6 +3007,7 @@ tsetattr(const int *attr, int l)
 			break;
 		}
 	}
+	term.c.attr.style = tstyle(c.fg, c.bg);
 }
 
 void
@@ -1671,6 +3113,11 @@ tsetmode(int priv, int set, const int *args, int narg)
 			case 2004: /* 2004: bracketed paste mode */
 				xsetmode(set, MODE_BRCKTPASTE);
 				break;
+			case 2026: /* 2026: synchronized update */
+				MODBIT(term.mode, set, MODE_SYNC);
+				if (set)
+					clock_gettime(CLOCK_MONOTONIC, &syncstart);
+				break;
 			/* Not implemented mouse modes. See comments there. */
 			case 1001: /* mouse highlight mode; can hang the
 				      terminal by design when implemented. */
@@ -1713,12 +3160,87 @@ tsetmode(int priv, int set, const int *args, int narg)
 	}
 }
 
+/*
+ * DECRQM state of a mode: 0 not recognized, 1 set, 2 reset,
+ * 4 permanently reset.
+ */
+int
+tgetmode(int priv, int mode)
+{
+	int xmode = xgetmode(), set;
+
+	if (priv) {
+		switch (mode) {
+		case 1:    set = xmode & MODE_APPCURSOR; break;
+		case 5:    set = xmode & MODE_REVERSE; break;
+		case 6:    set = term.c.state & CURSOR_ORIGIN; break;
+		case 7:    set = IS_SET(MODE_WRAP); break;
+		case 25:   set = !(xmode & MODE_HIDE); break;
+		case 9:    set = xmode & MODE_MOUSEX10; break;
+		case 1000: set = xmode & MODE_MOUSEBTN; break;
+		case 1002: set = xmode & MODE_MOUSEMOTION; break;
+		case 1003: set = xmode & MODE_MOUSEMANY; break;
+		case 1006: set = xmode & MODE_MOUSESGR; break;
+		case 1034: set = xmode & MODE_8BIT; break;
+		case 2004: set = xmode & MODE_BRCKTPASTE; break;
+		case 2026: set = IS_SET(MODE_SYNC); break;
+		case 47:
+		case 1047:
+		case 1049:
+			if (!allowaltscreen)
+				return 4;
+			set = IS_SET(MODE_ALTSCREEN);
+			break;
+		case 2: case 3: case 4: case 8: case 12: case 18: case 19:
+		case 42: case 1001: case 1004: case 1005: case 1015:
+			return 4;
+		default:
+			return 0;
+		}
+	} else {
+		switch (mode) {
+		case 2:  set = xmode & MODE_KBDLOCK; break;
+		case 4:  set = IS_SET(MODE_INSERT); break;
+		case 12: set = !IS_SET(MODE_ECHO); break;
+		case 20: set = IS_SET(MODE_CRLF); break;
+		default: return 0;
+		}
+	}
+	return set ? 1 : 2;
+}
+
+/*
+ * Milliseconds a synchronized update may still hold back drawing, 0 if
+ * none is in progress. An application that never ends its update gets
+ * the mode reset after synctimeout ms.
+ */
+int
+tsyncleft(void)
+{
+	struct timespec now;
+	double left;
+
+	if (!IS_SET(MODE_SYNC))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = synctimeout - TIMEDIFF(now, syncstart);
+	if (left <= 0) {
+		term.mode &= ~MODE_SYNC;
+		return 0;
+	}
+	return (int)left + 1;
+}
+
 void
 csihandle(void)
 {
 	char buf[40];
 	int len;
 
+	/* only DEC private sequences are understood */
+	if (csiescseq.priv && csiescseq.priv != '?')
+		goto unknown;
+
 	switch (csiescseq.mode[0]) {
 	default:
 	unknown:
@@ -1871,7 +3393,7 @@ csihandle(void)
 		break;
 	case 'T': /* SD -- Scroll <n> line down */
 		DEFAULT(csiescseq.arg[0], 1);
-		tscrolldown(term.top, csiescseq.arg[0], 0);
+		tscrolldown(term.top, csiescseq.arg[0]);
 		break;
 	case 'L': /* IL -- Insert <n> blank lines */
 		DEFAULT(csiescseq.arg[0], 1);
@@ -1951,6 +3473,18 @@ csihandle(void)
 			goto unknown;
 		}
 		break;
+	case '$':
+		switch (csiescseq.mode[1]) {
+		case 'p': /* DECRQM -- Request mode */
+			len = snprintf(buf, sizeof(buf), "\033[%s%d;%d$y",
+			               csiescseq.priv ? "?" : "", csiescseq.arg[0],
+			               tgetmode(csiescseq.priv, csiescseq.arg[0]));
+			ttywrite(buf, len, 0);
+			break;
+		default:
+			goto unknown;
+		}
+		break;
 	}
 }
 
@@ -1981,7 +3515,11 @@ csidump(void)
 void
 csireset(void)
 {
-	memset(&csiescseq, 0, sizeof(csiescseq));
+	memset(csiescseq.arg, 0, sizeof(csiescseq.arg));
+	csiescseq.narg = 1;
+	csiescseq.len = 0;
+	csiescseq.priv = 0;
+	csiescseq.inter = 0;
 }
 
 void
@@ -2014,13 +3552,13 @@ strhandle(void)
 {
 	char *p = NULL, *dec;
 	int j, narg, par;
+	Line l;
 	const struct { int idx; char *str; } osc_table[] = {
 		{ defaultfg, "foreground" },
 		{ defaultbg, "background" },
 		{ defaultcs, "cursor" }
 	};
 
-	term.esc &= ~(ESC_STR_END|ESC_STR);
 	strparse();
 	par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
 
@@ -2108,6 +3646,30 @@ strhandle(void)
 				tfulldirt();
 			}
 			return;
+		case 133: /* semantic prompt marks */
+			if (narg < 2)
+				break;
+			l = term.line[term.c.y];
+			switch (strescseq.args[1][0]) {
+			case 'A': /* prompt starts */
+				LINEINFO(l)->mark |= MARK_PROMPT;
+				break;
+			case 'B': /* command starts */
+				LINEINFO(l)->mark &= ~MARK_X;
+				LINEINFO(l)->mark |= MIN(term.c.x + 1, MARK_X);
+				break;
+			case 'C': /* output starts */
+				LINEINFO(l)->mark |= MARK_OUTPUT;
+				break;
+			case 'D': /* command finished */
+				LINEINFO(l)->mark |= MARK_END;
+				break;
+			default:
+				return;
+			}
+			if (!markgen)
+				markgen = linegen;
+			return;
 		case 777: /* st custom: vim-mode and cursor notifications */
 			if (narg >= 3 && !strcmp(strescseq.args[1], "vim-mode")) {
 				if (!strcmp(strescseq.args[2], "enter"))
@@ -2159,6 +3721,7 @@ strhandle(void)
 	case 'P': /* DCS -- Device Control String */
 	case '_': /* APC -- Application Program Command */
 	case '^': /* PM -- Privacy Message */
+	case 'X': /* SOS -- Start Of String */
 		return;
 	}
 
@@ -2357,6 +3920,9 @@ tstrsequence(uchar c)
 	case 0x9f:   /* APC -- Application Program Command */
 		c = '_';
 		break;
+	case 0x98:   /* SOS -- Start Of String */
+		c = 'X';
+		break;
 	case 0x9e:   /* PM -- Privacy Message */
 		c = '^';
 		break;
@@ -2366,7 +3932,34 @@ tstrsequence(uchar c)
 	}
 	strreset();
 	strescseq.type = c;
-	term.esc |= ESC_STR;
+}
+
+void
+tstrput(Rune u)
+{
+	char c[UTF_SIZ];
+	size_t len;
+
+	if (u < 127 || !IS_SET(MODE_UTF8)) {
+		c[0] = u;
+		len = 1;
+	} else {
+		len = utf8encode(u, c);
+	}
+
+	if (strescseq.len+len >= strescseq.siz) {
+		/*
+		 * Strings grow until they are terminated; the parser
+		 * leaves this state on CAN, SUB, ESC, BEL or a C1 control.
+		 */
+		if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
+			return;
+		strescseq.siz *= 2;
+		strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
+	}
+
+	memmove(&strescseq.buf[strescseq.len], c, len);
+	strescseq.len += len;
 }
 
 void
@@ -2389,17 +3982,7 @@ tcontrolcode(uchar ascii)
 		tnewline(IS_SET(MODE_CRLF));
 		return;
 	case '\a':   /* BEL */
-		if (term.esc & ESC_STR_END) {
-			/* backwards compatibility to xterm */
-			strhandle();
-		} else {
-			xbell();
-		}
-		break;
-	case '\033': /* ESC */
-		csireset();
-		term.esc &= ~(ESC_CSI|ESC_ALTCHARSET|ESC_TEST);
-		term.esc |= ESC_START;
+		xbell();
 		return;
 	case '\016': /* SO (LS1 -- Locking shift 1) */
 	case '\017': /* SI (LS0 -- Locking shift 0) */
@@ -2409,8 +3992,7 @@ tcontrolcode(uchar ascii)
 		tsetchar('?', &term.c.attr, term.c.x, term.c.y);
 		/* FALLTHROUGH */
 	case '\030': /* CAN */
-		csireset();
-		break;
+		return;
 	case '\005': /* ENQ (IGNORED) */
 	case '\000': /* NUL (IGNORED) */
 	case '\021': /* XON (IGNORED) */
@@ -2446,61 +4028,52 @@ tcontrolcode(uchar ascii)
 	case 0x95:   /* TODO: MW */
 	case 0x96:   /* TODO: SPA */
 	case 0x97:   /* TODO: EPA */
-	case 0x98:   /* TODO: SOS */
 	case 0x99:   /* TODO: SGCI */
 		break;
 	case 0x9a:   /* DECID -- Identify Terminal */
 		ttywrite(vtiden, strlen(vtiden), 0);
 		break;
-	case 0x9b:   /* TODO: CSI */
-	case 0x9c:   /* TODO: ST */
+	case 0x9c:   /* ST -- String Terminator, outside of a string */
 		break;
-	case 0x90:   /* DCS -- Device Control String */
-	case 0x9d:   /* OSC -- Operating System Command */
-	case 0x9e:   /* PM -- Privacy Message */
-	case 0x9f:   /* APC -- Application Program Command */
-		tstrsequence(ascii);
-		return;
+	/* CSI, DCS, OSC, PM, APC and SOS are handled by the parser */
 	}
-	/* only CAN, SUB, \a and C1 chars interrupt a sequence */
-	term.esc &= ~(ESC_STR_END|ESC_STR);
 }
 
 /*
- * returns 1 when the sequence is finished and it hasn't to read
- * more characters for this sequence, otherwise 0
+ * Final byte of an ESC sequence. Sequences introducing CSI or a string
+ * never get here, the parser switches state for them.
  */
-int
+void
 eschandle(uchar ascii)
 {
-	switch (ascii) {
-	case '[':
-		term.esc |= ESC_CSI;
-		return 0;
+	switch (csiescseq.inter) {
+	case 0:
+		break;
+	case '(': /* GZD4 -- set primary charset G0 */
+	case ')': /* G1D4 -- set secondary charset G1 */
+	case '*': /* G2D4 -- set tertiary charset G2 */
+	case '+': /* G3D4 -- set quaternary charset G3 */
+		term.icharset = csiescseq.inter - '(';
+		tdeftran(ascii);
+		return;
 	case '#':
-		term.esc |= ESC_TEST;
-		return 0;
+		tdectest(ascii);
+		return;
 	case '%':
-		term.esc |= ESC_UTF8;
-		return 0;
-	case 'P': /* DCS -- Device Control String */
-	case '_': /* APC -- Application Program Command */
-	case '^': /* PM -- Privacy Message */
-	case ']': /* OSC -- Operating System Command */
-	case 'k': /* old title set compatibility */
-		tstrsequence(ascii);
-		return 0;
+		tdefutf8(ascii);
+		return;
+	default:
+		fprintf(stderr, "erresc: unknown sequence ESC %c 0x%02X '%c'\n",
+			csiescseq.inter, (uchar) ascii,
+			isprint(ascii)? ascii:'.');
+		return;
+	}
+
+	switch (ascii) {
 	case 'n': /* LS2 -- Locking shift 2 */
 	case 'o': /* LS3 -- Locking shift 3 */
 		term.charset = 2 + (ascii - 'n');
 		break;
-	case '(': /* GZD4 -- set primary charset G0 */
-	case ')': /* G1D4 -- set secondary charset G1 */
-	case '*': /* G2D4 -- set tertiary charset G2 */
-	case '+': /* G3D4 -- set quaternary charset G3 */
-		term.icharset = ascii - '(';
-		term.esc |= ESC_ALTCHARSET;
-		return 0;
 	case 'D': /* IND -- Linefeed */
 		if (term.c.y == term.bot) {
 			tscrollup(term.top, 1, 1);
@@ -2516,7 +4089,7 @@ eschandle(uchar ascii)
 		break;
 	case 'M': /* RI -- Reverse index */
 		if (term.c.y == term.top) {
-			tscrolldown(term.top, 1, 1);
+			tscrolldown(term.top, 1);
 		} else {
 			tmoveto(term.c.x, term.c.y-1);
 		}
@@ -2542,130 +4115,122 @@ eschandle(uchar ascii)
 	case '8': /* DECRC -- Restore Cursor */
 		tcursor(CURSOR_LOAD);
 		break;
-	case '\\': /* ST -- String Terminator */
-		if (term.esc & ESC_STR_END)
-			strhandle();
-		break;
 	default:
 		fprintf(stderr, "erresc: unknown sequence ESC 0x%02X '%c'\n",
 			(uchar) ascii, isprint(ascii)? ascii:'.');
 		break;
 	}
-	return 1;
 }
 
 void
 tputc(Rune u)
 {
 	char c[UTF_SIZ];
-	int control;
-	int width, len;
-	Glyph *gp;
-
-	control = ISCONTROL(u);
-	if (u < 127 || !IS_SET(MODE_UTF8)) {
-		c[0] = u;
-		width = len = 1;
-	} else {
-		len = utf8encode(u, c);
-		if (!control && (width = wcwidth(u)) == -1)
-			width = 1;
-	}
+	int t, len, *arg;
 
-	if (IS_SET(MODE_PRINT))
+	if (IS_SET(MODE_PRINT)) {
+		if (u < 127 || !IS_SET(MODE_UTF8)) {
+			c[0] = u;
+			len = 1;
+		} else {
+			len = utf8encode(u, c);
+		}
 		tprinter(c, len);
+	}
 
-	/*
-	 * STR sequence must be checked before anything else
-	 * because it uses all following characters until it
-	 * receives a ESC, a SUB, a ST or any other C1 control
-	 * character.
-	 */
-	if (term.esc & ESC_STR) {
-		if (u == '\a' || u == 030 || u == 032 || u == 033 ||
-		   ISCONTROLC1(u)) {
-			term.esc &= ~(ESC_START|ESC_STR);
-			term.esc |= ESC_STR_END;
-			goto check_control_code;
-		}
-
-		if (strescseq.len+len >= strescseq.siz) {
-			/*
-			 * Here is a bug in terminals. If the user never sends
-			 * some code to stop the str or esc command, then st
-			 * will stop responding. But this is better than
-			 * silently failing with unknown characters. At least
-			 * then users will report back.
-			 *
-			 * In the case users ever get fixed, here is the code:
-			 */
-			/*
-			 * term.esc = 0;
-			 * strhandle();
-			 */
-			if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
-				return;
-			strescseq.siz *= 2;
-			strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
-		}
+	if (u >= 0xa0)
+		t = CC_PRINT;
+	else if (u >= 0x80 && IS_SET(MODE_UTF8))
+		t = CC_IGNORE; /* in UTF-8 mode C1 controls are not handled */
+	else
+		t = escclass[u];
+	t = esctrans[term.esc][t];
 
-		memmove(&strescseq.buf[strescseq.len], c, len);
-		strescseq.len += len;
-		return;
-	}
+	/* set the state first, actions may print (REP) or reset it */
+	term.esc = t & 0xf;
 
-check_control_code:
-	/*
-	 * Actions of control codes must be performed as soon they arrive
-	 * because they can be embedded inside a control sequence, and
-	 * they must not cause conflicts with sequences.
-	 */
-	if (control) {
-		/* in UTF-8 mode ignore handling C1 control characters */
-		if (IS_SET(MODE_UTF8) && ISCONTROLC1(u))
-			return;
-		tcontrolcode(u);
+	switch (t >> 4) {
+	case EA_NONE:
+		break;
+	case EA_PRINT:
+		tputchar(u);
+		break;
+	case EA_EXECUTE:
 		/*
-		 * control codes are not shown ever
+		 * Actions of control codes must be performed as soon they
+		 * arrive because they can be embedded inside a control
+		 * sequence. Control codes are never shown.
 		 */
+		tcontrolcode(u);
 		if (!term.esc)
 			term.lastc = 0;
-		return;
-	} else if (term.esc & ESC_START) {
-		if (term.esc & ESC_CSI) {
-			csiescseq.buf[csiescseq.len++] = u;
-			if (BETWEEN(u, 0x40, 0x7E)
-					|| csiescseq.len >= \
-					sizeof(csiescseq.buf)-1) {
-				term.esc = 0;
-				csiparse();
-				csihandle();
-			}
-			return;
-		} else if (term.esc & ESC_UTF8) {
-			tdefutf8(u);
-		} else if (term.esc & ESC_ALTCHARSET) {
-			tdeftran(u);
-		} else if (term.esc & ESC_TEST) {
-			tdectest(u);
-		} else {
-			if (!eschandle(u))
-				return;
-			/* sequence already finished */
+		break;
+	case EA_CLEAR:
+		csireset();
+		break;
+	case EA_PRIV:
+		csiescseq.priv = u;
+		goto collect;
+	case EA_COLLECT:
+		if (!csiescseq.inter)
+			csiescseq.inter = u;
+		goto collect;
+	case EA_PARAM:
+		if (u == ';' || u == ':') {
+			csiescseq.narg++;
+		} else if (csiescseq.narg <= ESC_ARG_SIZ) {
+			arg = &csiescseq.arg[csiescseq.narg - 1];
+			if (*arg >= 0)
+				*arg = (*arg > (INT_MAX - 9) / 10) ?
+				       -1 : *arg * 10 + (u - '0');
 		}
-		term.esc = 0;
-		/*
-		 * All characters which form part of a sequence are not
-		 * printed
-		 */
-		return;
+	collect:
+		if (csiescseq.len < sizeof(csiescseq.buf) - 1)
+			csiescseq.buf[csiescseq.len++] = u;
+		break;
+	case EA_ESCDISPATCH:
+		eschandle(u);
+		break;
+	case EA_CSIDISPATCH:
+		if (csiescseq.len < sizeof(csiescseq.buf) - 1)
+			csiescseq.buf[csiescseq.len++] = u;
+		csiescseq.narg = MIN(csiescseq.narg, ESC_ARG_SIZ);
+		csiescseq.mode[0] = csiescseq.inter ? csiescseq.inter : u;
+		csiescseq.mode[1] = csiescseq.inter ? u : '\0';
+		csihandle();
+		break;
+	case EA_STRSTART:
+		tstrsequence(u);
+		break;
+	case EA_STRPUT:
+		tstrput(u);
+		break;
+	case EA_STRDISPATCH:
+		strhandle();
+		if (ISCONTROL(u)) /* BEL or 8-bit ST */
+			term.lastc = 0;
+		break;
 	}
+}
+
+void
+tputchar(Rune u)
+{
+	int width;
+	Glyph *gp;
+
+	if (u < 127 || !IS_SET(MODE_UTF8))
+		width = 1;
+	else
+		width = runewidth(u);
+
 	if (selected(term.c.x, term.c.y))
 		selclear();
 
 	gp = &term.line[term.c.y][term.c.x];
 	if (IS_SET(MODE_WRAP) && (term.c.state & CURSOR_WRAPNEXT)) {
 		gp->mode |= ATTR_WRAP;
+		LINETOUCH(term.line[term.c.y]);
 		tnewline(1);
 		gp = &term.line[term.c.y][term.c.x];
 	}
@@ -2676,10 +4241,15 @@ check_control_code:
 	}
 
 	if (term.c.x+width > term.col) {
-		if (IS_SET(MODE_WRAP))
+		/* the line goes on, for tscreenwrap() and selections */
+		if (IS_SET(MODE_WRAP)) {
+			gp = &term.line[term.c.y][term.col-1];
+			gp->mode |= ATTR_WRAP | (gp->u == ' ' ? ATTR_WRAPPAD : 0);
+			LINETOUCH(term.line[term.c.y]);
 			tnewline(1);
-		else
+		} else {
 			tmoveto(term.col - width, term.c.y);
+		}
 		gp = &term.line[term.c.y][term.c.x];
 	}
 
@@ -2704,53 +4274,261 @@ check_control_code:
 	}
 }
 
+/*
+ * Length of the run of printable ASCII (0x20 - 0x7e) at the start of u.
+ */
 int
-twrite(const char *buf, int buflen, int show_ctrl)
+tasciirun(const Rune *u, int n)
 {
-	int charsize;
-	Rune u;
-	int n;
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i lo = _mm_set1_epi32(0x1f), hi = _mm_set1_epi32(0x7f);
+	__m128i m[4];
+	uint mask;
+	int j;
+
+	/* compare 16 runes, narrowing the four masks to one byte mask */
+	for (; i + 16 <= n; i += 16) {
+		for (j = 0; j < 4; j++) {
+			m[j] = _mm_loadu_si128((const __m128i *)(u + i + 4*j));
+			m[j] = _mm_and_si128(_mm_cmpgt_epi32(m[j], lo),
+			                     _mm_cmplt_epi32(m[j], hi));
+		}
+		mask = _mm_movemask_epi8(_mm_packs_epi16(
+		           _mm_packs_epi32(m[0], m[1]),
+		           _mm_packs_epi32(m[2], m[3])));
+		if (mask != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
+#endif
+	while (i < n && BETWEEN(u[i], 0x20, 0x7e))
+		i++;
+
+	return i;
+}
+
+/*
+ * Write a run of printable ASCII in the ground state. This is what
+ * tputc() would do for each byte, but a row at a time: the glyphs are
+ * stored in one go and the row is marked dirty once.
+ */
+void
+tputascii(const Rune *s, int n)
+{
+	Glyph *gp;
+	int i, len;
+
+	if (IS_SET(MODE_INSERT) || IS_SET(MODE_PRINT) || !IS_SET(MODE_WRAP) ||
+	    term.trantbl[term.charset] == CS_GRAPHIC0) {
+		while (n-- > 0)
+			tputc(*s++);
+		return;
+	}
+
+	while (n > 0) {
+		/* as tputchar(): the cell is checked before the line wraps */
+		if (selected(term.c.x, term.c.y))
+			selclear();
+		if (term.c.state & CURSOR_WRAPNEXT) {
+			term.line[term.c.y][term.c.x].mode |= ATTR_WRAP;
+			LINETOUCH(term.line[term.c.y]);
+			tnewline(1);
+		}
+		len = MIN(n, term.col - term.c.x);
+
+		/*
+		 * selected() depends on the line contents and tsetchar()
+		 * breaks up the wide characters written over one cell at a
+		 * time: let tputc() do those rows.
+		 */
+		gp = &term.line[term.c.y][term.c.x];
+		for (i = 0; i < len; i++) {
+			if (gp[i].mode & (ATTR_WIDE|ATTR_WDUMMY))
+				break;
+		}
+		if (i < len ||
+		    (sel.ob.x != -1 && BETWEEN(term.c.y, sel.nb.y, sel.ne.y))) {
+			for (i = 0; i < len; i++)
+				tputc(s[i]);
+			s += len;
+			n -= len;
+			continue;
+		}
+
+		for (i = 0; i < len; i++) {
+			gp[i] = term.c.attr;
+			gp[i].u = s[i];
+		}
+		term.dirty[term.c.y] = 1;
+		LINETOUCH(term.line[term.c.y]);
+		term.lastc = s[len-1];
+
+		if (term.c.x+len < term.col) {
+			tmoveto(term.c.x+len, term.c.y);
+		} else {
+			term.c.x = term.col - 1;
+			term.c.state |= CURSOR_WRAPNEXT;
+		}
+		s += len;
+		n -= len;
+	}
+}
+
+/*
+ * Line feeds, and carriage returns between them, with the cursor on
+ * the bottom margin. The region scrolls once for the whole run instead
+ * of once per line. Returns the number of runes consumed.
+ */
+int
+tputnewlines(const Rune *s, int n)
+{
+	int i, k = 0, m, x = term.c.x;
+
+	for (i = 0; i < n; i++) {
+		if (s[i] == '\n') {
+			k++;
+			if (IS_SET(MODE_CRLF))
+				x = 0;
+		} else if (s[i] == '\r') {
+			x = 0;
+		} else {
+			break;
+		}
+	}
+	for (; k > 0; k -= m) {
+		m = MIN(k, term.bot - term.top + 1);
+		tscrollup(term.top, m, 1);
+	}
+	tmoveto(x, term.c.y);
+	term.lastc = 0;
+
+	return i;
+}
 
-	for (n = 0; n < buflen; n += charsize) {
-		if (IS_SET(MODE_UTF8)) {
-			/* process a complete utf8 char */
-			charsize = utf8decode(buf + n, &u, buflen - n);
-			if (charsize == 0)
+int
+twrite(const char *buf, int buflen, int show_ctrl)
+{
+	Rune ubuf[1024], u;
+	int n, nb, nr, i, run, utf8;
+
+	for (n = 0; n < buflen; n += nb) {
+		utf8 = IS_SET(MODE_UTF8);
+		if (utf8) {
+			nr = utf8decodeblock(buf + n, buflen - n, ubuf,
+			                     LEN(ubuf), &nb);
+			/* keep an incomplete utf8 char for the next call */
+			if (nr == 0)
 				break;
 		} else {
-			u = buf[n] & 0xFF;
-			charsize = 1;
-		}
-		if (show_ctrl && ISCONTROL(u)) {
-			if (u & 0x80) {
-				u &= 0x7f;
-				tputc('^');
-				tputc('[');
-			} else if (u != '\n' && u != '\r' && u != '\t') {
-				u ^= 0x40;
-				tputc('^');
+			nr = nb = MIN(buflen - n, LEN(ubuf));
+			for (i = 0; i < nr; i++)
+				ubuf[i] = buf[n + i] & 0xFF;
+		}
+
+		for (i = 0; i < nr; i += run) {
+			if (!term.esc && (run = tasciirun(ubuf + i, nr - i))) {
+				tputascii(ubuf + i, run);
+				continue;
+			}
+			if (!term.esc && ubuf[i] == '\n' && term.c.y == term.bot &&
+			    !IS_SET(MODE_PRINT)) {
+				run = tputnewlines(ubuf + i, nr - i);
+				continue;
+			}
+			run = 1;
+			u = ubuf[i];
+			if (show_ctrl && ISCONTROL(u)) {
+				if (u & 0x80) {
+					u &= 0x7f;
+					tputc('^');
+					tputc('[');
+				} else if (u != '\n' && u != '\r' && u != '\t') {
+					u ^= 0x40;
+					tputc('^');
+				}
+			}
+			tputc(u);
+			if (IS_SET(MODE_UTF8) != utf8) {
+				/* the encoding changed, decode the rest again */
+				if (utf8)
+					utf8decodeblock(buf + n, nb, NULL, i + 1, &nb);
+				else
+					nb = i + 1;
+				break;
 			}
 		}
-		tputc(u);
 	}
 	return n;
 }
 
+/*
+ * Widen every line to col cells, the history and both screens: lines
+ * never get narrower, term.maxcol is how wide all of them are.
+ */
+void
+tgrow(int col)
+{
+	Line *altbuf = IS_SET(MODE_ALTSCREEN) ? term.line : term.alt;
+	int i, *bp;
+
+	for (i = -term.histn; i < term.row; i++)
+		tsetring(i, tlinegrow(HLINE(i), col));
+	for (i = 0; i < term.row; i++)
+		altbuf[i] = tlinegrow(altbuf[i], col);
+
+	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
+	bp = term.tabs + term.maxcol;
+	memset(bp, 0, sizeof(*term.tabs) * (col - term.maxcol));
+	while (--bp > term.tabs && !*bp)
+		/* nothing */ ;
+	for (bp += tabspaces; bp < term.tabs + col; bp += tabspaces)
+		*bp = 1;
+
+	term.maxcol = col;
+	/* the expanded lines of the cache are too narrow now */
+	if (npackcache > 0)
+		tpackcacheinit(npackcache);
+}
+
+/* line l, packed or not, widened to col cells */
+Line
+tlinegrow(Line l, int col)
+{
+	Line g;
+	int x;
+
+	if (ISPACKED(l)) {
+		g = tlinenew(col);
+		tunpack(PACKOF(l), g, term.maxcol);
+		tlinefree(l);
+	} else {
+		g = (Line)((LineInfo *)xrealloc(LINEINFO(l),
+		        sizeof(LineInfo) + col * sizeof(Glyph)) + 1);
+		LINETOUCH(g);
+	}
+	for (x = term.maxcol; x < col; x++) {
+		g[x] = term.c.attr;
+		g[x].u = ' ';
+	}
+	return g;
+}
+
 void
 tresize(int col, int row)
 {
-	int i, j;
+	int i, k, siz, histn, drop;
 	int tmp;
-	int minrow, mincol;
-	int *bp;
+	int minrow;
+	int alt = IS_SET(MODE_ALTSCREEN);
+	Line *ring, *altbuf;
 	TCursor c;
 
 	tmp = col;
+	nscrolls = -1;
 	if (!term.maxcol)
 		term.maxcol = term.col;
 	col = MAX(col, term.maxcol);
 	minrow = MIN(row, term.row);
-	mincol = MIN(col, term.maxcol);
 
 	if (col < 1 || row < 1) {
 		fprintf(stderr,
@@ -2758,63 +4536,80 @@ tresize(int col, int row)
 		return;
 	}
 
+	if (col > term.maxcol)
+		tgrow(col);
+	/* logical lines wrap again at the new width, see tscreenwrap() */
+	if (term.ring && tmp != term.col) {
+		tscreenwrap(tmp);
+		/* which numbers the history lines anew */
+		tsearchrenumber();
+	}
+
 	/*
-	 * slide screen to keep cursor where we expect it -
-	 * tscrollup would work here, but we can optimize to
-	 * memmove because we're freeing the earlier lines
+	 * slide screen to keep cursor where we expect it: the rows going
+	 * off the top become history on the main screen and are freed on
+	 * the alternate one
 	 */
-	for (i = 0; i <= term.c.y - row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
-	}
+	k = MAX(term.c.y - row + 1, 0);
+	altbuf = alt ? term.line : term.alt;
+	for (i = 0; i < k; i++)
+		tlinefree(altbuf[i]);
 	/* ensure that both src and dst are not NULL */
-	if (i > 0) {
-		memmove(term.line, term.line + i, row * sizeof(Line));
-		memmove(term.alt, term.alt + i, row * sizeof(Line));
-	}
-	for (i += row; i < term.row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
-	}
-
-	/* resize to new height */
-	term.line = xrealloc(term.line, row * sizeof(Line));
-	term.alt  = xrealloc(term.alt,  row * sizeof(Line));
-	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
-	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
+	if (k > 0)
+		memmove(altbuf, altbuf + k, row * sizeof(Line));
+	for (i = k + row; i < term.row; i++)
+		tlinefree(altbuf[i]);
 
-	for (i = 0; i < HISTSIZE; i++) {
-		term.hist[i] = xrealloc(term.hist[i], col * sizeof(Glyph));
-		for (j = mincol; j < col; j++) {
-			term.hist[i][j] = term.c.attr;
-			term.hist[i][j].u = ' ';
+	/*
+	 * lay the main screen and its history out in a ring sized for the
+	 * new height; thistpush() needs row slots of room past the screen
+	 */
+	histn = MIN(term.histn + k, thistmax(col));
+	drop = term.histn + k - histn;
+	for (siz = 1; siz < histn + 2 * row; siz <<= 1)
+		;
+	ring = xmalloc(2 * siz * sizeof(Line));
+	memset(ring, 0, 2 * siz * sizeof(Line));
+	if (term.ring) {
+		for (i = -histn; i < row && i + k < term.row; i++)
+			ring[i & (siz-1)] = HLINE(i + k);
+		for (i = 0; i < drop; i++) {
+			tspill(HLINE(i - term.histn));
+			tlinefree(HLINE(i - term.histn));
 		}
+		for (i = row + k; i < term.row; i++)
+			tlinefree(HLINE(i));
+		free(term.ring);
 	}
+	term.histn = histn;
+	term.scr = MIN(term.scr, histn + term.histdisk);
+	histpacked = 0;
+	histwrapped += k;
+	histtotal += k;
+	twrapdrop(drop);
 
-	/* resize each row to new width, zero-pad if needed */
-	for (i = 0; i < minrow; i++) {
-		term.line[i] = xrealloc(term.line[i], col * sizeof(Glyph));
-		term.alt[i]  = xrealloc(term.alt[i],  col * sizeof(Glyph));
-	}
+	/* resize to new height */
+	altbuf = xrealloc(altbuf, row * sizeof(Line));
+	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
 
 	/* allocate any new rows */
-	for (/* i = minrow */; i < row; i++) {
-		term.line[i] = xmalloc(col * sizeof(Glyph));
-		term.alt[i] = xmalloc(col * sizeof(Glyph));
+	for (i = minrow; i < row; i++) {
+		ring[i] = tlinenew(col);
+		altbuf[i] = tlinenew(col);
 	}
-	if (col > term.maxcol) {
-		bp = term.tabs + term.maxcol;
+	memcpy(ring + siz, ring, siz * sizeof(Line));
+
+	term.ring = ring;
+	term.ringsiz = siz;
+	term.head = 0;
+	term.line = alt ? altbuf : ring;
+	term.alt = alt ? ring : altbuf;
 
-		memset(bp, 0, sizeof(*term.tabs) * (col - term.maxcol));
-		while (--bp > term.tabs && !*bp)
-			/* nothing */ ;
-		for (bp += tabspaces; bp < term.tabs + col; bp += tabspaces)
-			*bp = 1;
-	}
 	/* update terminal size */
 	term.col = tmp;
-	term.maxcol = col;
 	term.row = row;
+	/* room for a screen of packed history and a look around it */
+	tpackcacheinit(2 * row);
 	/* reset scrolling region */
 	tsetscroll(0, row-1);
 	/* make use of the LIMIT in tmoveto */
@@ -2822,9 +4617,6 @@ tresize(int col, int row)
 	/* Clearing both screens (it makes dirty all lines) */
 	c = term.c;
 	for (i = 0; i < 2; i++) {
-		if (mincol < col && 0 < minrow) {
-			tclearregion(mincol, 0, col - 1, minrow - 1);
-		}
 		if (0 < col && minrow < row) {
 			tclearregion(0, minrow, col - 1, row - 1);
 		}
@@ -2854,11 +4646,43 @@ drawregion(int x1, int y1, int x2, int y2)
 	}
 }
 
+/* the pattern vimnav reads, over the bottom row */
+void
+tdrawsearch(const char *s)
+{
+	static Line l;
+	static int col;
+	Rune u;
+	size_t n;
+	int x;
+
+	if (col < term.col) {
+		tlinefree(l);
+		l = tlinenew(col = term.col);
+	}
+	for (x = 0; *s && x < term.col; x++, s += n) {
+		if (!(n = utf8decode(s, &u, UTF_SIZ)))
+			break;
+		l[x] = (Glyph){ .u = u };
+	}
+	for (; x < term.col; x++)
+		l[x] = (Glyph){ .u = ' ' };
+	/* the pattern is not a match */
+	LINEINFO(l)->searched = ++linegen;
+	LINEINFO(l)->found = 0;
+	xdrawline(l, 0, term.row - 1, term.col);
+	term.dirty[term.row - 1] = 1;
+}
+
 void
 draw(void)
 {
-	int cx = term.c.x, ocx = term.ocx, ocy = term.ocy;
+	const char *s;
+	int i, cx = term.c.x, ocx = term.ocx, ocy = term.ocy;
 
+	/* keep showing the last frame until the update is complete */
+	if (tsyncleft() > 0)
+		return;
 	if (!xstartdraw())
 		return;
 
@@ -2874,7 +4698,13 @@ draw(void)
 	if (term.line[term.c.y][cx].mode & ATTR_WDUMMY)
 		cx--;
 
+	/* move what was drawn along, for drawregion() to find it in place */
+	for (i = 0; i < nscrolls; i++)
+		xscroll(scrolls[i].top, scrolls[i].bot, scrolls[i].n);
+	nscrolls = 0;
 	drawregion(0, 0, term.col, term.row);
+	if ((s = vimnav_search_prompt()))
+		tdrawsearch(s);
 
 	if (tisvimnav()) {
 		/* Draw vim navigation cursor */
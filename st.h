@@ -15,8 +15,7 @@
 #define DIVCEIL(n, d)		(((n) + ((d) - 1)) / (d))
 #define DEFAULT(a, b)		(a) = (a) ? (a) : (b)
 #define LIMIT(x, a, b)		(x) = (x) < (a) ? (a) : (x) > (b) ? (b) : (x)
-#define ATTRCMP(a, b)		((a).mode != (b).mode || (a).fg != (b).fg || \
-				(a).bg != (b).bg)
+#define ATTRCMP(a, b)		((a).mode != (b).mode || (a).style != (b).style)
 #define TIMEDIFF(t1, t2)	((t1.tv_sec-t2.tv_sec)*1000 + \
 				(t1.tv_nsec-t2.tv_nsec)/1E6)
 #define MODBIT(x, set, bit)	((set) ? ((x) |= (bit)) : ((x) &= ~(bit)))
@@ -24,6 +23,9 @@
 #define TRUECOLOR(r,g,b)	(1 << 24 | (r) << 16 | (g) << 8 | (b))
 #define IS_TRUECOL(x)		(1 << 24 & (x))
 
+#define UTF_SIZ			4
+#define HISTMAX			((1 << 29) - 1)  /* most history lines, INT_MAX / 4 */
+
 enum glyph_attribute {
 	ATTR_NULL       = 0,
 	ATTR_BOLD       = 1 << 0,
@@ -38,6 +40,8 @@ enum glyph_attribute {
 	ATTR_WIDE       = 1 << 9,
 	ATTR_WDUMMY     = 1 << 10,
 	ATTR_SELECTED   = 1 << 11,
+	ATTR_FOUND      = 1 << 12,
+	ATTR_WRAPPAD    = 1 << 13, /* left blank by a wide char that wrapped */
 	ATTR_BOLD_FAINT = ATTR_BOLD | ATTR_FAINT,
 };
 
@@ -57,6 +61,14 @@ enum selection_snap {
 	SNAP_LINE = 2
 };
 
+/* what OSC 133 marked a line as, see tmark() */
+enum line_mark {
+	MARK_PROMPT     = 1 << 15,  /* A: a prompt starts on it */
+	MARK_OUTPUT     = 1 << 14,  /* C: the output of a command starts */
+	MARK_END        = 1 << 13,  /* D: the command finished */
+	MARK_X          = (1 << 13) - 1,  /* B: the column input starts at, +1 */
+};
+
 typedef unsigned char uchar;
 typedef unsigned int uint;
 typedef unsigned long ulong;
@@ -64,12 +76,16 @@ typedef unsigned short ushort;
 
 typedef uint_least32_t Rune;
 
+typedef struct {
+	uint32_t fg;      /* foreground  */
+	uint32_t bg;      /* background  */
+} Style;
+
 #define Glyph Glyph_
 typedef struct {
 	Rune u;           /* character code */
 	ushort mode;      /* attribute flags */
-	uint32_t fg;      /* foreground  */
-	uint32_t bg;      /* background  */
+	ushort style;     /* colors, an index into styles[] (see style.h) */
 } Glyph;
 
 typedef Glyph *Line;
@@ -96,13 +112,25 @@ void toggleprinter(const Arg *);
 int tattrset(int);
 int tisaltscreen(void);
 int tlinelen(int);
+void tlock(void);
+void tunlock(void);
 void tfulldirt(void);
 void tnew(int, int);
 void tresize(int, int);
+void thistresize(int);
+int thistcompact(int);
+void thistwrap(int);
 void tsetdirtattr(int);
+int twrite(const char *, int, int);
+int tsyncleft(void);
 void ttyhangup(void);
 int ttynew(const char *, char *, const char *, char **);
 size_t ttyread(void);
+void ttyflush(void);
+size_t ttypending(void);
+size_t ttyqueued(void);
+size_t ttyunqueue(size_t, size_t);
+int ttythreadstart(void);
 void ttyresize(int, int);
 void ttywrite(const char *, size_t, int);
 
@@ -138,6 +166,7 @@ void notif_resize(void);
 int notif_active(void);
 int notif_check_timeout(struct timespec *now);
 
+size_t utf8decode(const char *, Rune *, size_t);
 size_t utf8encode(Rune, char *);
 
 void *xmalloc(size_t);
@@ -154,6 +183,16 @@ extern int allowaltscreen;
 extern int allowwindowops;
 extern char *termname;
 extern unsigned int tabspaces;
+extern unsigned int ttybufmax;
+extern double ttyreadbudget;
+extern unsigned int synctimeout;
+extern unsigned int histsize;
+extern size_t histbytes;
+extern unsigned int histhot;
+extern int histspill;
+extern size_t histdiskbytes;
+extern int stylesqueeze;
+extern size_t searchindexbytes;
 extern unsigned int defaultfg;
 extern unsigned int defaultbg;
 extern unsigned int defaultcs;
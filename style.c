@@ -0,0 +1,214 @@
+/* See LICENSE for license details. */
+/*
+ * Style table: the distinct foreground/background pairs in use, so that
+ * a cell stores a 16-bit index instead of two 32-bit colors. Lookups go
+ * through an open-addressed hash of twice the table's capacity.
+ *
+ * Truecolor output can use more pairs than that, a gradient in the
+ * scrollback easily does. Colors stay exact unless the caller of
+ * stylekeep() asks to squeeze: then, while the table is over a quarter
+ * full, 24-bit colors lose a bit per channel until the pairs that become
+ * equal merge it below that; the bits come back once it has all but
+ * emptied. Should the table still fill up, stylenear() gives truecolor
+ * the nearest entry of the 256-color palette, or of the table itself.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "st.h"
+#include "style.h"
+
+Style *styles;
+static int nstyles, stylecap;
+static int *stylehash; /* style index + 1, 0 for a free slot */
+static int stylebits = 8; /* bits kept of each truecolor channel */
+
+static uint32_t
+stylequant(uint32_t c)
+{
+	uint32_t m = 0xff << (8 - stylebits) & 0xff;
+
+	return IS_TRUECOL(c) ? c & (1 << 24 | m << 16 | m << 8 | m) : c;
+}
+
+static uint32_t
+stylehashof(uint32_t fg, uint32_t bg)
+{
+	return ((uint64_t)fg << 32 | bg) * 0x9e3779b97f4a7c15ULL >> 32;
+}
+
+static void
+stylerehash(void)
+{
+	int i, j, mask = 2 * stylecap - 1;
+
+	free(stylehash);
+	stylehash = xmalloc(2 * stylecap * sizeof(*stylehash));
+	memset(stylehash, 0, 2 * stylecap * sizeof(*stylehash));
+	for (i = 0; i < nstyles; i++) {
+		j = stylehashof(styles[i].fg, styles[i].bg) & mask;
+		while (stylehash[j])
+			j = (j + 1) & mask;
+		stylehash[j] = i + 1;
+	}
+}
+
+void
+styleinit(uint32_t fg, uint32_t bg)
+{
+	if (!styles) {
+		stylecap = 256;
+		styles = xmalloc(stylecap * sizeof(*styles));
+	}
+	styles[0] = (Style){ fg, bg };
+	nstyles = 1;
+	stylebits = 8;
+	stylerehash();
+}
+
+int
+stylefind(uint32_t fg, uint32_t bg)
+{
+	int i, mask = 2 * stylecap - 1;
+	Style *s;
+
+	fg = stylequant(fg);
+	bg = stylequant(bg);
+	for (i = stylehashof(fg, bg) & mask; stylehash[i]; i = (i + 1) & mask) {
+		s = &styles[stylehash[i] - 1];
+		if (s->fg == fg && s->bg == bg)
+			return stylehash[i] - 1;
+	}
+	if (nstyles == STYLEMAX)
+		return -1;
+
+	if (nstyles == stylecap) {
+		stylecap *= 2;
+		styles = xrealloc(styles, stylecap * sizeof(*styles));
+		styles[nstyles++] = (Style){ fg, bg };
+		stylerehash();
+	} else {
+		styles[nstyles++] = (Style){ fg, bg };
+		stylehash[i] = nstyles;
+	}
+	return nstyles - 1;
+}
+
+/* the RGB of truecolor or of palette entries 16 to 255; 0 for others */
+static int
+stylergb(uint32_t c, int *rgb)
+{
+	int i;
+
+	if (IS_TRUECOL(c)) {
+		rgb[0] = c >> 16 & 0xff;
+		rgb[1] = c >> 8 & 0xff;
+		rgb[2] = c & 0xff;
+	} else if (BETWEEN(c, 16, 231)) {
+		for (i = 0, c -= 16; i < 3; i++, c /= 6)
+			rgb[2 - i] = c % 6 ? 55 + 40 * (c % 6) : 0;
+	} else if (BETWEEN(c, 232, 255)) {
+		rgb[0] = rgb[1] = rgb[2] = 8 + 10 * (c - 232);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static int
+styledist(uint32_t a, uint32_t b)
+{
+	int x[3], y[3], i, d = 0;
+
+	if (a == b)
+		return 0;
+	if (!stylergb(a, x) || !stylergb(b, y))
+		return 3 * 256 * 256;
+	for (i = 0; i < 3; i++)
+		d += (x[i] - y[i]) * (x[i] - y[i]);
+	return d;
+}
+
+/* the 6x6x6 cube or gray ramp entry nearest to c, if truecolor */
+static uint32_t
+stylepalette(uint32_t c)
+{
+	int rgb[3], i, cube = 0, gray;
+
+	if (!IS_TRUECOL(c))
+		return c;
+	stylergb(c, rgb);
+	/* the cube's levels are 0, 95, 135, ... 255 */
+	for (i = 0; i < 3; i++) {
+		cube = cube * 6 + (rgb[i] < 48 ? 0 :
+		                   rgb[i] < 115 ? 1 : (rgb[i] - 35) / 40);
+	}
+	gray = (rgb[0] + rgb[1] + rgb[2]) / 3;
+	gray = 232 + MIN(MAX(gray - 3, 0) / 10, 23);
+	return styledist(c, 16 + cube) <= styledist(c, gray) ? 16 + cube : gray;
+}
+
+int
+stylenear(uint32_t fg, uint32_t bg)
+{
+	int i, d, s, best = INT_MAX;
+
+	if ((s = stylefind(fg, bg)) >= 0 ||
+	    (s = stylefind(stylepalette(fg), stylepalette(bg))) >= 0)
+		return s;
+	for (i = s = 0; i < nstyles && best > 0; i++) {
+		d = styledist(fg, styles[i].fg) + styledist(bg, styles[i].bg);
+		if (d < best) {
+			best = d;
+			s = i;
+		}
+	}
+	return s;
+}
+
+int
+stylecount(void)
+{
+	return nstyles;
+}
+
+static void
+stylereadd(const uchar *used, ushort *map)
+{
+	int i, n = nstyles;
+
+	/* re-add in order, stylefind() never gets past i */
+	nstyles = 0;
+	memset(stylehash, 0, 2 * stylecap * sizeof(*stylehash));
+	for (i = 0; i < n; i++) {
+		if (i == 0 || !used || used[i])
+			map[i] = stylefind(styles[i].fg, styles[i].bg);
+	}
+}
+
+void
+stylekeep(const uchar *used, ushort *map, int squeeze)
+{
+	ushort *remap = NULL;
+	int i, n = nstyles;
+
+	stylereadd(used, map);
+	if (nstyles < STYLEMAX / 64 && stylebits < 8) {
+		stylebits++;
+		return;
+	}
+	/* squeeze well below the limit so the next collection is far off */
+	while (squeeze && nstyles > STYLEMAX / 4 && stylebits > 2) {
+		if (!remap)
+			remap = xmalloc(STYLEMAX * sizeof(*remap));
+		stylebits--;
+		stylereadd(NULL, remap);
+		for (i = 0; i < n; i++) {
+			if (i == 0 || used[i])
+				map[i] = remap[map[i]];
+		}
+	}
+	free(remap);
+}
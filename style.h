@@ -0,0 +1,32 @@
+/* See LICENSE for license details. */
+
+#ifndef STYLE_H
+#define STYLE_H
+
+#include "st.h"  /* for Style */
+
+/* a Glyph's style is a ushort */
+#define STYLEMAX	(1 << 16)
+
+/* the interned color pairs, indexed by Glyph.style */
+extern Style *styles;
+
+/* forget all styles; style 0 becomes fg on bg */
+void styleinit(uint32_t fg, uint32_t bg);
+/*
+ * index of the style fg on bg, added if new; -1 if the table is full.
+ * 24-bit colors may come back with less precision after a squeezing
+ * stylekeep(), see style.c.
+ */
+int stylefind(uint32_t fg, uint32_t bg);
+/* as stylefind(), but the closest style there is if the table is full */
+int stylenear(uint32_t fg, uint32_t bg);
+int stylecount(void);
+/*
+ * drop the styles not marked in used (0 stays) and merge the ones that
+ * became equal; map gets the new indices. If squeeze is set and the
+ * table stays crowded, truecolor loses precision to merge more.
+ */
+void stylekeep(const uchar *used, ushort *map, int squeeze);
+
+#endif /* STYLE_H */
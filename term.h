@@ -0,0 +1,165 @@
+/* See LICENSE for license details. */
+/* Terminal state shared by st.c and the modules working on its screen */
+
+#ifndef TERM_H
+#define TERM_H
+
+#include "st.h"
+
+#define IS_SET(flag)		((term.mode & (flag)) != 0)
+/* main screen row y, history for y < 0 (-1 is the most recent line) */
+#define HLINE(y)		(term.ring[(term.head + (y)) & (term.ringsiz - 1)])
+/* row y of the screen as shown, scrolled back by term.scr */
+#define TLINE(y)		((y) < term.scr ? thline((y) - term.scr) : \
+				term.line[(y) - term.scr])
+/* a packed history line sits in the ring as its Pack with the low bit set */
+#define ISPACKED(l)		((uintptr_t)(l) & 1)
+#define PACKOF(l)		((Pack *)((uintptr_t)(l) & ~(uintptr_t)1))
+#define PACKLINE(p)		((Line)((uintptr_t)(p) | 1))
+/* the LineInfo every unpacked line has in front of its cells */
+#define LINEINFO(l)		((LineInfo *)(l) - 1)
+
+enum term_mode {
+	MODE_WRAP        = 1 << 0,
+	MODE_INSERT      = 1 << 1,
+	MODE_ALTSCREEN   = 1 << 2,
+	MODE_CRLF        = 1 << 3,
+	MODE_ECHO        = 1 << 4,
+	MODE_PRINT       = 1 << 5,
+	MODE_UTF8        = 1 << 6,
+	MODE_SYNC        = 1 << 7,
+};
+
+typedef struct {
+	Glyph attr; /* current char attributes */
+	int x;
+	int y;
+	char state;
+} TCursor;
+
+typedef struct {
+	int mode;
+	int type;
+	int snap;
+	/*
+	 * Selection variables:
+	 * nb – normalized coordinates of the beginning of the selection
+	 * ne – normalized coordinates of the end of the selection
+	 * ob – original coordinates of the beginning of the selection
+	 * oe – original coordinates of the end of the selection
+	 */
+	struct {
+		int x, y;
+	} nb, ne, ob, oe;
+
+	int alt;
+} Selection;
+
+/*
+ * Internal representation of the screen
+ *
+ * History and the main screen are one ring of ringsiz lines: the screen
+ * is the row lines from head on, the history the histn lines before it.
+ * Only those histn + row slots hold a line, the others are NULL: history
+ * lines are allocated as they first scroll off, and the ring doubles as
+ * the history grows. The pointer array is mirrored, ring[i] ==
+ * ring[i + ringsiz], so that the main screen is a plain array at
+ * ring + head. line and alt are swapped with the alternate screen, which
+ * is kept outside the ring.
+ *
+ * History lines older than histhot are packed when st is idle, see
+ * thistcompact(); HLINE() then holds a tagged pointer, see ISPACKED(),
+ * and thline() gives the cells of any line. Lines that fall
+ * off the history go on to the disk tier (see persist.c), where thline()
+ * finds them before HLINE(-histn). A resize wraps the screen again at
+ * once, the history when thline() gets to it (see tscreenwrap()), so
+ * histn can change as older lines are looked at.
+ *
+ * st.c keeps what it needs to know of a line, like its length, in a
+ * header in front of the cells and looks at them again only once they
+ * have changed; code outside st.c does not allocate lines, and writes
+ * only to those nothing has been read from yet.
+ */
+typedef struct {
+	int row;      /* nb row */
+	int col;      /* nb col */
+	int maxcol;   /* maximum nb col */
+	Line *line;   /* screen */
+	Line *alt;    /* alternate screen */
+	Line *ring;   /* history and main screen */
+	int ringsiz;  /* ring size, a power of two */
+	int head;     /* ring index of the first main screen row */
+	int histn;    /* number of valid history lines */
+	int histdisk; /* history lines before those, in the disk tier */
+	int scr;      /* scroll back */
+	int *dirty;   /* dirtyness of lines */
+	TCursor c;    /* cursor */
+	int ocx;      /* old cursor col */
+	int ocy;      /* old cursor row */
+	int top;      /* top    scroll limit */
+	int bot;      /* bottom scroll limit */
+	int mode;     /* terminal mode flags */
+	int esc;      /* escape state flags */
+	char trantbl[4]; /* charset table translation */
+	int charset;  /* current charset */
+	int icharset; /* selected charset for sequence */
+	int *tabs;
+	Rune lastc;   /* last printed char outside of sequence, 0 if control */
+} Term;
+
+/*
+ * Cold history line: the cells as runs of equal mode and style followed
+ * by the UTF-8 text, the trailing blanks left out. Equal lines share one
+ * Pack, found through a hash table of all of them.
+ */
+typedef struct {
+	ushort len;
+	ushort mode;
+	ushort style;
+} PackSpan;
+
+typedef struct Pack Pack;
+struct Pack {
+	Pack *next;            /* hash chain */
+	uint32_t hash;
+	int ref;               /* history lines sharing it */
+	int col;               /* cells */
+	int nspan;             /* PackSpans at the start of data */
+	int ntext;             /* bytes of text after them */
+	uint64_t searched;     /* see LineInfo */
+	int found;
+	ushort mark;           /* tlinemark() of the line */
+	uchar data[];
+};
+
+/*
+ * What readers would otherwise scan a line's cells for. Writers only
+ * move gen on with LINETOUCH(); tlineinfo() looks at the cells again
+ * when it is asked and the rest is not for that gen, or for term.col.
+ */
+typedef struct {
+	uint64_t gen;          /* changes whenever the cells do */
+	uint64_t seen;         /* gen the fields below are for */
+	uint64_t searched;     /* linegen when the search looked at it */
+	short col;             /* term.col they are for */
+	short len;             /* see tlinelen() */
+	ushort attr;           /* the modes of the cells OR-ed */
+	ushort mark;           /* what the shell marked it as, see tmark() */
+	uchar blank;           /* every cell ISBLANK() */
+	uchar found;           /* the search matched it then */
+	uchar guess;           /* vimnav_prompt_guess() */
+} LineInfo;
+
+extern Term term;
+extern Selection sel;
+extern uint64_t linegen;     /* last LineInfo gen handed out */
+extern uint64_t markgen;     /* linegen when the shell first marked */
+extern long histtotal;       /* lines that ever went to the history */
+extern int histwrapped;      /* newest history lines wrapped at col */
+extern int nwrapruns;        /* resizes thistwrap() has yet to catch up on */
+
+Line thline(int);
+int thlinelen(int);
+LineInfo *tlineinfo(Line);
+
+#endif /* TERM_H */
@@ -0,0 +1,366 @@
+/* See LICENSE for license details. */
+/*
+ * Replay throughput benchmark for the headless terminal core.
+ *
+ *   tests/bench [-c cols] [-r rows] [-t seconds] [file...]
+ *
+ * Without files it replays a set of generated streams shaped like common
+ * workloads. Files are raw pty output, e.g. recorded with `st -o file`.
+ * Each stream is fed to twrite() in BUFSIZ chunks the way ttyread() does,
+ * with a draw() every 64 KiB, until the time budget is spent.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "st.h"
+
+#define STREAMSIZ	(4 << 20)
+#define DRAWEVERY	(64 << 10)
+
+typedef struct {
+	const char *name;
+	char *buf;
+	size_t len, cap;
+} Stream;
+
+/* allocation counting, see -Wl,--wrap in the Makefile */
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+static unsigned long nallocs;
+
+void *
+__wrap_malloc(size_t n)
+{
+	nallocs++;
+	return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t n, size_t sz)
+{
+	nallocs++;
+	return __real_calloc(n, sz);
+}
+
+void *
+__wrap_realloc(void *p, size_t n)
+{
+	nallocs++;
+	return __real_realloc(p, n);
+}
+
+static int ttyin[2];
+static int cols = 120, rows = 40;
+static unsigned long long rs = 0x9e3779b97f4a7c15ULL;
+
+static unsigned
+rnd(void)
+{
+	rs ^= rs << 13;
+	rs ^= rs >> 7;
+	rs ^= rs << 17;
+	return rs >> 11;
+}
+
+static void
+sput(Stream *s, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(s->buf + s->len, s->cap - s->len, fmt, ap);
+		va_end(ap);
+		if ((size_t)n < s->cap - s->len)
+			break;
+		s->buf = xrealloc(s->buf, s->cap *= 2);
+	}
+	s->len += n;
+}
+
+static Stream
+snew(const char *name)
+{
+	Stream s = { name, xmalloc(STREAMSIZ), 0, STREAMSIZ };
+	return s;
+}
+
+/* cat of an application log, with the odd coloured level */
+static Stream
+genlog(void)
+{
+	static const char *lvl[] = {
+		"INFO", "INFO", "INFO", "DEBUG", "\033[33mWARN\033[0m",
+		"\033[1;31mERROR\033[0m",
+	};
+	Stream s = snew("log");
+	unsigned n = 0;
+
+	while (s.len < STREAMSIZ) {
+		sput(&s, "2026-10-17T12:%02u:%02u.%03u %s [worker-%u] "
+		     "GET /api/v1/items/%u status=200 dur=%ums bytes=%u\r\n",
+		     n / 60 % 60, n % 60, rnd() % 1000, lvl[rnd() % LEN(lvl)],
+		     rnd() % 16, rnd(), rnd() % 500, rnd() % 65536);
+		n++;
+	}
+	return s;
+}
+
+/* vim scrolling a source file one line at a time */
+static Stream
+genvim(void)
+{
+	Stream s = snew("vim");
+	unsigned n = 0;
+
+	sput(&s, "\033[?1049h\033[H\033[2J\033[1;%dr", rows - 1);
+	while (s.len < STREAMSIZ) {
+		sput(&s, "\033[%d;1H\n\033[%d;1H", rows - 1, rows - 1);
+		sput(&s, "\033[33m%5u \033[0m\033[38;5;81mstatic\033[0m "
+		     "\033[38;5;118mint\033[0m\n\r", n);
+		sput(&s, "\033[%d;1H\033[K\033[1;%dr\033[%d;1H", rows - 1, rows - 1,
+		     rows - 1);
+		sput(&s, "\033[33m%5u \033[0m\tfor (i = 0; i < %u; i++) "
+		     "\033[38;5;244m/* %08x */\033[0m", n, rnd() % 100, rnd());
+		sput(&s, "\033[%d;1H\033[7m st.c [+]%*u,1%10s\033[0m\033[%d;7H",
+		     rows, cols - 24, n, "", rows - 1);
+		n++;
+	}
+	sput(&s, "\033[r\033[?1049l");
+	return s;
+}
+
+/* htop redrawing its meters and process list */
+static Stream
+genhtop(void)
+{
+	Stream s = snew("htop");
+	int y, i, w;
+
+	sput(&s, "\033[?1049h\033[?25l");
+	while (s.len < STREAMSIZ) {
+		sput(&s, "\033[H");
+		for (y = 0; y < 4; y++) {
+			w = rnd() % 40;
+			sput(&s, "\033[%d;3H\033[36m%d\033[39m\033[1m[\033[0m", y + 1, y);
+			for (i = 0; i < 40; i++)
+				sput(&s, "%s|", i < w ? "\033[32m" : "\033[30;1m");
+			sput(&s, "\033[0m%5.1f%%\033[1m]\033[0m", w * 2.5);
+		}
+		sput(&s, "\033[6;1H\033[30;42m  PID USER      PRI  NI  VIRT   RES"
+		     "   SHR S CPU%% MEM%%   TIME+  Command\033[K\033[0m");
+		for (y = 7; y <= rows; y++) {
+			sput(&s, "\033[%d;1H%s%5u \033[33muser\033[0m      20   0 "
+			     "\033[36m%5uM\033[0m %5u  %4u S %4.1f %4.1f %2u:%02u.%02u "
+			     "\033[1m/usr/bin/proc\033[0m --flag=%u\033[K", y,
+			     y == 7 ? "\033[30;46m" : "", rnd() % 99999,
+			     rnd() % 4096, rnd() % 99999, rnd() % 9999,
+			     (rnd() % 1000) / 10.0, (rnd() % 1000) / 10.0,
+			     rnd() % 60, rnd() % 60, rnd() % 100, rnd() % 10);
+		}
+	}
+	sput(&s, "\033[?25h\033[?1049l");
+	return s;
+}
+
+/* a full-screen 24-bit colour gradient, one SGR per cell */
+static Stream
+gentruecolor(void)
+{
+	Stream s = snew("truecolor");
+	unsigned f = 0;
+	int x, y;
+
+	while (s.len < STREAMSIZ) {
+		sput(&s, "\033[H");
+		for (y = 0; y < rows; y++) {
+			for (x = 0; x < cols; x++) {
+				sput(&s, "\033[48;2;%u;%u;%um ", (x * 255 / cols + f) & 0xff,
+				     (y * 255 / rows) & 0xff, f & 0xff);
+			}
+			sput(&s, "\033[0m\r\n");
+		}
+		f += 7;
+	}
+	return s;
+}
+
+/* UTF-8 heavy output: CJK, box drawing, combining marks and emoji */
+static Stream
+gencjk(void)
+{
+	static const char *words[] = {
+		"\xe4\xb8\xad\xe6\x96\x87", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+		"\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4", "\xe2\x94\x80\xe2\x94\x82",
+		"e\xcc\x81t\xc3\xa9", "\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80",
+		"ascii",
+	};
+	Stream s = snew("cjk");
+	int i;
+
+	while (s.len < STREAMSIZ) {
+		for (i = 0; i < 12; i++)
+			sput(&s, "%s ", words[rnd() % LEN(words)]);
+		sput(&s, "\r\n");
+	}
+	return s;
+}
+
+static Stream
+readstream(const char *path)
+{
+	Stream s = { path, NULL, 0, 0 };
+	ssize_t r;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		die("bench: open %s: %s\n", path, strerror(errno));
+	do {
+		if (s.len == s.cap)
+			s.buf = xrealloc(s.buf, s.cap = s.cap ? s.cap * 2 : BUFSIZ);
+		if ((r = read(fd, s.buf + s.len, s.cap - s.len)) < 0)
+			die("bench: read %s: %s\n", path, strerror(errno));
+		s.len += r;
+	} while (r > 0);
+	close(fd);
+	return s;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/* throw away whatever the core answered to queries in the stream */
+static void
+drainreplies(void)
+{
+	char buf[BUFSIZ];
+
+	while (read(ttyin[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+static void
+replay(const Stream *s)
+{
+	char buf[BUFSIZ];
+	size_t off = 0, sincedraw = 0;
+	int n, buflen = 0, written;
+
+	twrite("\033c", 2, 0);
+	while (off < s->len) {
+		n = MIN(sizeof(buf) - buflen, s->len - off);
+		memcpy(buf + buflen, s->buf + off, n);
+		off += n;
+		buflen += n;
+		written = twrite(buf, buflen, 0);
+		buflen -= written;
+		if (buflen > 0)
+			memmove(buf, buf + written, buflen);
+		if ((sincedraw += n) >= DRAWEVERY) {
+			draw();
+			sincedraw = 0;
+		}
+		ttyflush();
+		drainreplies();
+	}
+	draw();
+}
+
+static void
+bench(const Stream *s, double budget)
+{
+	double start, elapsed;
+	unsigned long allocs;
+	size_t lines = 0, i;
+	int passes = 0;
+
+	for (i = 0; i < s->len; i++)
+		lines += s->buf[i] == '\n';
+
+	replay(s); /* warm up */
+	allocs = nallocs;
+	start = now();
+	do {
+		replay(s);
+		passes++;
+		elapsed = now() - start;
+	} while (elapsed < budget);
+	allocs = nallocs - allocs;
+
+	printf("%-12s %10.1f %14.0f %12.2f\n", s->name,
+	       s->len * passes / elapsed / (1 << 20),
+	       lines * passes / elapsed,
+	       allocs / (s->len * passes / (double)(1 << 20)));
+}
+
+static void
+usage(const char *argv0)
+{
+	die("usage: %s [-c cols] [-r rows] [-t seconds] [file...]\n", argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Stream s;
+	double budget = 1.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:r:t:")) != -1) {
+		switch (opt) {
+		case 'c': cols = atoi(optarg); break;
+		case 'r': rows = atoi(optarg); break;
+		case 't': budget = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (cols < 1 || rows < 1)
+		usage(argv[0]);
+
+	/*
+	 * ttywrite() answers queries on fd 0; point it at a pipe we can
+	 * drain so that replies neither block nor reach our terminal.
+	 */
+	if (pipe(ttyin) < 0 || dup2(ttyin[1], 0) < 0)
+		die("bench: pipe: %s\n", strerror(errno));
+	fcntl(ttyin[0], F_SETFL, O_NONBLOCK);
+	fcntl(ttyin[1], F_SETFL, O_NONBLOCK);
+
+	tnew(cols, rows);
+	selinit();
+
+	printf("%dx%d, %.1fs per stream\n", cols, rows, budget);
+	printf("%-12s %10s %14s %12s\n", "stream", "MB/s", "lines/s", "allocs/MB");
+	if (optind < argc) {
+		for (; optind < argc; optind++) {
+			s = readstream(argv[optind]);
+			bench(&s, budget);
+			free(s.buf);
+		}
+		return 0;
+	}
+
+	s = genlog(); bench(&s, budget); free(s.buf);
+	s = genvim(); bench(&s, budget); free(s.buf);
+	s = genhtop(); bench(&s, budget); free(s.buf);
+	s = gentruecolor(); bench(&s, budget); free(s.buf);
+	s = gencjk(); bench(&s, budget); free(s.buf);
+
+	return 0;
+}
@@ -10,15 +10,13 @@
 #include "mocks.h"
 #include "../vimnav.h"
 
-#define TLINE(y)	((y) < term.scr ? term.hist[((y) + term.histi - \
-			term.scr + HISTSIZE + 1) % HISTSIZE] : \
-			term.line[(y) - term.scr])
-
 /* Global mock state */
 Term term;
 Selection sel;
 wchar_t *worddelimiters = L" \t";
+unsigned int histsize = 32768;
 MockState mock_state;
+static ushort *mock_marks;  /* as y + histsize, NULL until a line has some */
 
 void
 mock_reset(void)
@@ -28,6 +26,15 @@ mock_reset(void)
 	/* Note: don't reset vimnav here - only in mock_term_init */
 }
 
+/* set main screen line y (see HLINE) in both halves of the ring */
+static void
+mock_set_ring(int y, Line l)
+{
+	int i = (term.head + y) & (term.ringsiz - 1);
+
+	term.ring[i] = term.ring[i + term.ringsiz] = l;
+}
+
 void
 mock_term_init(int rows, int cols)
 {
@@ -35,26 +42,27 @@ mock_term_init(int rows, int cols)
 
 	memset(&term, 0, sizeof(term));
 	memset(&vimnav, 0, sizeof(vimnav));
+	free(mock_marks);
+	mock_marks = NULL;
 	term.row = rows;
 	term.col = cols;
 	term.maxcol = cols;
 	term.top = 0;
 	term.bot = rows - 1;
 
-	/* Allocate lines */
-	term.line = malloc(rows * sizeof(Line));
+	/* Allocate the ring: history and screen lines, as tresize() does */
+	for (term.ringsiz = 1; term.ringsiz < histsize + 2 * rows; )
+		term.ringsiz <<= 1;
+	term.ring = calloc(2 * term.ringsiz, sizeof(Line));
+	for (i = -(int)histsize; i < rows; i++)
+		mock_set_ring(i, calloc(cols, sizeof(Glyph)));
+	term.line = term.ring;
 	term.dirty = malloc(rows * sizeof(int));
 
-	for (i = 0; i < rows; i++) {
-		term.line[i] = calloc(cols, sizeof(Glyph));
+	for (i = 0; i < rows; i++)
 		term.dirty[i] = 1;
-	}
 
-	/* Allocate history buffer */
-	for (i = 0; i < HISTSIZE; i++) {
-		term.hist[i] = calloc(cols, sizeof(Glyph));
-	}
-	term.histi = 0;
+	term.histn = 0;
 	term.scr = 0;
 
 	/* Initialize cursor at origin */
@@ -69,11 +77,11 @@ mock_term_free(void)
 {
 	int i;
 
-	if (term.line) {
-		for (i = 0; i < term.row; i++) {
-			free(term.line[i]);
-		}
-		free(term.line);
+	if (term.ring) {
+		for (i = 0; i < term.ringsiz; i++)
+			free(term.ring[i]);
+		free(term.ring);
+		term.ring = NULL;
 		term.line = NULL;
 	}
 
@@ -82,13 +90,16 @@ mock_term_free(void)
 		term.dirty = NULL;
 	}
 
-	/* Free history buffer */
-	for (i = 0; i < HISTSIZE; i++) {
-		if (term.hist[i]) {
-			free(term.hist[i]);
-			term.hist[i] = NULL;
-		}
-	}
+	free(mock_marks);
+	mock_marks = NULL;
+}
+
+void
+mock_set_mark(int y, int mark)
+{
+	if (!mock_marks)
+		mock_marks = calloc(histsize + term.row, sizeof(*mock_marks));
+	mock_marks[y + histsize] = mark;
 }
 
 void
@@ -118,9 +129,10 @@ mock_set_hist(int idx, const char *content)
 {
 	int i;
 	int len;
+	Line line;
 
-	idx = (idx + HISTSIZE) % HISTSIZE;
-	if (!term.hist[idx])
+	line = HLINE(-1 - (term.histn - idx + histsize) % histsize);
+	if (!line)
 		return;
 
 	len = strlen(content);
@@ -128,16 +140,38 @@ mock_set_hist(int idx, const char *content)
 		len = term.col;
 
 	/* Clear line first */
-	memset(term.hist[idx], 0, term.col * sizeof(Glyph));
+	memset(line, 0, term.col * sizeof(Glyph));
 
 	/* Set content */
 	for (i = 0; i < len; i++) {
-		term.hist[idx][i].u = content[i];
+		line[i].u = content[i];
 	}
 }
 
 /* Stub implementations of st.c functions */
 
+/* the mock history is never packed */
+Line
+thline(int y)
+{
+	return HLINE(y);
+}
+
+int
+thlinelen(int y)
+{
+	Line line = thline(y);
+	int i = term.col;
+
+	if (!line)
+		return 0;
+	/* unwritten mock cells are 0 */
+	while (i > 0 && (line[i - 1].u == ' ' || line[i - 1].u == 0))
+		--i;
+
+	return i;
+}
+
 int
 tlinelen(int y)
 {
@@ -161,6 +195,106 @@ tlinelen(int y)
 	return i;
 }
 
+int
+tmark(int y)
+{
+	if (mock_marks)
+		return mock_marks[y + histsize];
+	return vimnav_prompt_guess(HLINE(y), thlinelen(y), term.col) ?
+	       MARK_PROMPT : 0;
+}
+
+/* the mock history is looked at line by line */
+int
+tmarknext(int *y, int dir, int mask)
+{
+	int yy;
+
+	for (yy = *y + dir; yy >= -term.histn && yy < term.row; yy += dir) {
+		if (tmark(yy) & mask) {
+			*y = yy;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* A literal search over the mock lines, all of them known at once */
+static char mock_pattern[256];
+
+int
+tsearch(const char *pat)
+{
+	snprintf(mock_pattern, sizeof(mock_pattern), "%s", pat ? pat : "");
+	return 0;
+}
+
+int
+tsearchstep(int n)
+{
+	(void)n;
+	return 0;
+}
+
+/* Column of the match in line y nearest to x the way dir says, or -1 */
+static int
+mock_search_line(int y, int x, int dir)
+{
+	Line line = HLINE(y);
+	int i, j, len = strlen(mock_pattern), found = -1;
+
+	for (i = 0; i + len <= term.col; i++) {
+		for (j = 0; j < len && line[i + j].u == (Rune)mock_pattern[j]; j++)
+			;
+		if (j < len)
+			continue;
+		if (dir > 0 && i > x)
+			return i;
+		if (dir < 0 && i < x)
+			found = i;
+	}
+	return found;
+}
+
+int
+tsearchnext(int *x, int *y, int dir)
+{
+	int n = term.histn + term.row;
+	int i, yy, mx;
+
+	if (!mock_pattern[0])
+		return 0;
+	for (i = 0; i <= n; i++) {
+		/* Around the ends and back to the start line */
+		yy = ((*y + term.histn + i * dir) % n + n) % n - term.histn;
+		mx = mock_search_line(yy, i == 0 ? *x : (dir > 0 ? -1 : term.col), dir);
+		if (mx >= 0) {
+			*x = mx;
+			*y = yy;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t
+utf8encode(Rune u, char *c)
+{
+	if (u < 0x80) {
+		c[0] = u;
+		return 1;
+	}
+	if (u < 0x800) {
+		c[0] = 0xc0 | (u >> 6);
+		c[1] = 0x80 | (u & 0x3f);
+		return 2;
+	}
+	c[0] = 0xe0 | (u >> 12);
+	c[1] = 0x80 | ((u >> 6) & 0x3f);
+	c[2] = 0x80 | (u & 0x3f);
+	return 3;
+}
+
 void
 tfulldirt(void)
 {
@@ -297,8 +431,8 @@ kscrollup(const Arg *a)
 	mock_state.last_kscrollup.n = n;
 
 	term.scr += n;
-	if (term.scr > HISTSIZE - 1)
-		term.scr = HISTSIZE - 1;
+	if (term.scr > (int)histsize - 1)
+		term.scr = histsize - 1;
 	tfulldirt();
 }
 
@@ -391,7 +525,7 @@ void
 tscrollup(int orig, int n, int copyhist)
 {
 	int i;
-	Line temp;
+	Line temp, spare;
 
 	mock_state.tscrollup_calls++;
 
@@ -400,11 +534,18 @@ tscrollup(int orig, int n, int copyhist)
 	if (n < 0)
 		n = 0;
 
-	if (copyhist && term.hist[0]) {
-		term.histi = (term.histi + 1) % HISTSIZE;
-		temp = term.hist[term.histi];
-		term.hist[term.histi] = term.line[orig];
-		term.line[orig] = temp;
+	/* Push line orig into history, reusing the oldest history line */
+	if (copyhist && term.ring) {
+		temp = term.line[orig];
+		spare = HLINE(-(int)histsize);
+		mock_set_ring(-(int)histsize, NULL);
+		for (i = term.row - 1; i >= 0; i--)
+			mock_set_ring(i + 1, i == orig ? spare : HLINE(i));
+		mock_set_ring(0, temp);
+		term.head = (term.head + 1) & (term.ringsiz - 1);
+		term.line = term.ring + term.head;
+		if (term.histn < (int)histsize)
+			term.histn++;
 	}
 
 	/* Clear the region */
@@ -416,8 +557,8 @@ tscrollup(int orig, int n, int copyhist)
 	/* Scroll lines up */
 	for (i = orig; i <= term.bot - n && term.line[i]; i++) {
 		temp = term.line[i];
-		term.line[i] = term.line[i + n];
-		term.line[i + n] = temp;
+		mock_set_ring(i, term.line[i + n]);
+		mock_set_ring(i + n, temp);
 	}
 }
 
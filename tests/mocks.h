@@ -5,67 +5,11 @@
 #define MOCKS_H
 
 #include "../st.h"
+#include "../term.h"
 #include "../vimnav.h"
-
-/* Terminal mode flags from st.c */
-enum term_mode {
-	MODE_WRAP        = 1 << 0,
-	MODE_INSERT      = 1 << 1,
-	MODE_ALTSCREEN   = 1 << 2,
-	MODE_CRLF        = 1 << 3,
-	MODE_ECHO        = 1 << 4,
-	MODE_PRINT       = 1 << 5,
-	MODE_UTF8        = 1 << 6,
-};
-
-/* Cursor structure */
-typedef struct {
-	Glyph attr;
-	int x;
-	int y;
-	char state;
-} TCursor;
-
-/* Selection structure */
-typedef struct {
-	int mode;
-	int type;
-	int snap;
-	struct {
-		int x, y;
-	} nb, ne, ob, oe;
-	int alt;
-} Selection;
-
-/* Terminal structure (minimal for testing) */
-#define HISTSIZE (1 << 15)
-typedef struct {
-	int row;
-	int col;
-	int maxcol;
-	Line *line;
-	Line *alt;
-	Line hist[HISTSIZE];
-	int histi;
-	int scr;
-	int *dirty;
-	TCursor c;
-	int ocx;
-	int ocy;
-	int top;
-	int bot;
-	int mode;
-	int esc;
-	char trantbl[4];
-	int charset;
-	int icharset;
-	int *tabs;
-	Rune lastc;
-} Term;
+#include "../search.h"
 
 /* Mock globals */
-extern Term term;
-extern Selection sel;
 extern wchar_t *worddelimiters;
 
 /* Mock function call tracking */
@@ -105,9 +49,14 @@ void mock_term_free(void);
 /* Set line content for testing */
 void mock_set_line(int y, const char *content);
 
-/* Set history line content for testing */
+/* Set history line content for testing, idx counting up to the
+ * newest line at term.histn */
 void mock_set_hist(int idx, const char *content);
 
+/* Give line y (see HLINE) the marks of OSC 133; once any line has
+ * some, prompts are no longer guessed */
+void mock_set_mark(int y, int mark);
+
 /* Terminal scroll/clear functions (implemented in mocks for testing) */
 void tscrollup(int orig, int n, int copyhist);
 void tclearregion(int x1, int y1, int x2, int y2);
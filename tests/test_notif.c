@@ -91,6 +91,8 @@ static struct {
 	int xdestroywindow_calls;
 	int xftfontopen_calls;
 	int xftfontclose_calls;
+	int colorhold_calls;
+	int colorrelease_calls;
 	GC last_copyarea_gc;
 } x11_track;
 
@@ -204,15 +206,16 @@ void XftTextExtentsUtf8(Display *dpy, XftFont *font, const FcChar8 *string,
 	extents->xOff = len * 8;  /* Mock: 8 pixels per character */
 }
 
-int XftColorAllocName(Display *dpy, Visual *visual, Colormap cmap,
-                      const char *name, XftColor *result) {
-	(void)dpy; (void)visual; (void)cmap; (void)name;
-	result->pixel = 0;
+int xcolorhold(const char *name, XftColor *col) {
+	(void)name;
+	x11_track.colorhold_calls++;
+	col->pixel = 0;
 	return 1;
 }
 
-void XftColorFree(Display *dpy, Visual *visual, Colormap cmap, XftColor *color) {
-	(void)dpy; (void)visual; (void)cmap; (void)color;
+void xcolorrelease(const XftColor *col) {
+	(void)col;
+	x11_track.colorrelease_calls++;
 }
 
 XftDraw *XftDrawCreate(Display *dpy, Drawable drawable, Visual *visual,
@@ -677,6 +680,7 @@ TEST(notif_pertost_resources_freed)
 {
 	init_mock_xwindow();
 
+	reset_x11_track();
 	notif_show("fg=#ff0000\x1f" "ts=20\x1f" "\x1e" "resource test");
 	ASSERT(notif.toasts[0].pflags & NOTIF_PF_FG);
 	ASSERT(notif.toasts[0].pflags & NOTIF_PF_FONT);
@@ -686,6 +690,9 @@ TEST(notif_pertost_resources_freed)
 	/* After hide, all toasts destroyed, pflags should be cleared */
 	ASSERT_EQ(0, notif.count);
 	ASSERT_EQ(0, notif.toasts[0].pflags);
+	/* every cached colour taken (shared + per-toast fg) is given back */
+	ASSERT_EQ(4, x11_track.colorhold_calls);
+	ASSERT_EQ(x11_track.colorhold_calls, x11_track.colorrelease_calls);
 }
 
 /* Test: multiple options combined with message */
@@ -12,45 +12,14 @@
 
 #include "test.h"
 #include "../st.h"
+#include "../term.h"
 #include "../persist.h"
-
-/* Duplicate Term definition from st.c (suckless pattern).
- * Must match the layout in st.c exactly. */
-#define HISTSIZE (1 << 15)
-
-typedef struct {
-	Glyph attr;
-	int x;
-	int y;
-	char state;
-} TCursor;
-
-typedef struct {
-	int row;
-	int col;
-	int maxcol;
-	Line *line;
-	Line *alt;
-	Line hist[HISTSIZE];
-	int histi;
-	int scr;
-	int *dirty;
-	TCursor c;
-	int ocx;
-	int ocy;
-	int top;
-	int bot;
-	int mode;
-	int esc;
-	char trantbl[4];
-	int charset;
-	int icharset;
-	int *tabs;
-	Rune lastc;
-	int histn;
-} Term;
+#include "../style.h"
 
 Term term;
+unsigned int histsize = 32768;
+int histspill = 1;
+size_t histdiskbytes = 0;
 
 /* Stubs for st.h functions */
 void die(const char *errstr, ...) { (void)errstr; }
@@ -61,6 +30,7 @@ void tfulldirt(void) {}
 void redraw(void) {}
 void draw(void) {}
 size_t utf8encode(Rune u, char *c) { (void)u; (void)c; return 0; }
+size_t utf8decode(const char *c, Rune *u, size_t n) { (void)c; (void)n; *u = 0xFFFD; return 1; }
 void kscrolldown(const Arg *a) { (void)a; }
 void kscrollup(const Arg *a) { (void)a; }
 void printscreen(const Arg *a) { (void)a; }
@@ -111,53 +81,30 @@ void xsetdwmsaveargv(const char *argv)
 	snprintf(mock_dwm_argv, sizeof(mock_dwm_argv), "%s", argv);
 }
 
-/* Mock tresize */
-void tresize(int col, int row)
-{
-	int i;
-
-	for (i = 0; i < term.row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
-	}
-	free(term.line);
-	free(term.alt);
-	free(term.dirty);
-	free(term.tabs);
-
-	term.col = col;
-	term.row = row;
-	term.line = calloc(row, sizeof(Line));
-	term.alt = calloc(row, sizeof(Line));
-	term.dirty = calloc(row, sizeof(int));
-	term.tabs = calloc(col, sizeof(int));
-	for (i = 0; i < row; i++) {
-		term.line[i] = calloc(col, sizeof(Glyph));
-		term.alt[i] = calloc(col, sizeof(Glyph));
-	}
-	for (i = 0; i < HISTSIZE; i++)
-		term.hist[i] = realloc(term.hist[i], col * sizeof(Glyph));
-}
-
 /* Helpers */
 static void
 setup_term(int col, int row)
 {
-	int i;
+	int i, j;
 
 	memset(&term, 0, sizeof(term));
 	term.col = col;
 	term.row = row;
-	term.line = calloc(row, sizeof(Line));
+	styleinit(256, 257);
+	for (term.ringsiz = 1; term.ringsiz < histsize + 2 * row; )
+		term.ringsiz <<= 1;
+	term.ring = calloc(2 * term.ringsiz, sizeof(Line));
+	for (i = -(int)histsize; i < row; i++) {
+		j = i & (term.ringsiz - 1);
+		term.ring[j] = term.ring[j + term.ringsiz] =
+			calloc(col, sizeof(Glyph));
+	}
+	term.line = term.ring;
 	term.alt = calloc(row, sizeof(Line));
 	term.dirty = calloc(row, sizeof(int));
 	term.tabs = calloc(col, sizeof(int));
-	for (i = 0; i < row; i++) {
-		term.line[i] = calloc(col, sizeof(Glyph));
+	for (i = 0; i < row; i++)
 		term.alt[i] = calloc(col, sizeof(Glyph));
-	}
-	for (i = 0; i < HISTSIZE; i++)
-		term.hist[i] = calloc(col, sizeof(Glyph));
 }
 
 static void
@@ -165,19 +112,42 @@ cleanup_term(void)
 {
 	int i;
 
-	for (i = 0; i < term.row; i++) {
-		free(term.line[i]);
+	for (i = 0; i < term.ringsiz; i++)
+		free(term.ring[i]);
+	free(term.ring);
+	for (i = 0; i < term.row; i++)
 		free(term.alt[i]);
-	}
-	free(term.line);
 	free(term.alt);
 	free(term.dirty);
 	free(term.tabs);
-	for (i = 0; i < HISTSIZE; i++)
-		free(term.hist[i]);
 	memset(&term, 0, sizeof(term));
 }
 
+/* Mock tresize */
+void tresize(int col, int row)
+{
+	cleanup_term();
+	setup_term(col, row);
+}
+
+/* Mock thistresize: setup_term() allocates every history line */
+void thistresize(int n)
+{
+	term.histn = MIN(n, (int)histsize);
+}
+
+/* the mock history is never packed */
+Line thline(int y)
+{
+	return HLINE(y);
+}
+
+/* nor left at an earlier width */
+void thistwrap(int need)
+{
+	(void)need;
+}
+
 static char testdir[PATH_MAX];
 
 static void
@@ -254,13 +224,12 @@ TEST(full_roundtrip)
 	term.c.y = 2;
 	term.c.x = 5;
 	term.histn = 2;
-	term.histi = 1;
-	term.hist[0][0].u = 'X';
-	term.hist[0][0].fg = 42;
-	term.hist[1][0].u = 'Y';
-	term.hist[1][0].fg = 84;
+	HLINE(-2)[0].u = 'X';
+	HLINE(-2)[0].style = stylefind(42, 257);
+	HLINE(-1)[0].u = 'Y';
+	HLINE(-1)[0].style = stylefind(84, 257);
 	term.line[0][0].u = '$';
-	term.line[0][0].fg = 256;
+	term.line[0][0].style = stylefind(256, 0);
 
 	/* Save via persist module */
 	setup_testdir();
@@ -297,9 +266,11 @@ TEST(full_roundtrip)
 		system(cmd);
 	}
 
-	/* Reset */
+	/* Reset, with other styles taking the saved indices */
 	cleanup_term();
 	setup_term(8, 3);
+	stylefind(1, 2);
+	stylefind(3, 4);
 	persist_set_cwd(NULL);
 
 	/* Restore */
@@ -310,14 +281,15 @@ TEST(full_roundtrip)
 
 	/* Verify history */
 	ASSERT_EQ(2, term.histn);
-	ASSERT_EQ('X', (int)term.hist[0][0].u);
-	ASSERT_EQ(42, (int)term.hist[0][0].fg);
-	ASSERT_EQ('Y', (int)term.hist[1][0].u);
-	ASSERT_EQ(84, (int)term.hist[1][0].fg);
+	ASSERT_EQ('X', (int)HLINE(-2)[0].u);
+	ASSERT_EQ(42, (int)styles[HLINE(-2)[0].style].fg);
+	ASSERT_EQ('Y', (int)HLINE(-1)[0].u);
+	ASSERT_EQ(84, (int)styles[HLINE(-1)[0].style].fg);
 
 	/* Verify screen */
 	ASSERT_EQ('$', (int)term.line[0][0].u);
-	ASSERT_EQ(256, (int)term.line[0][0].fg);
+	ASSERT_EQ(256, (int)styles[term.line[0][0].style].fg);
+	ASSERT_EQ(0, (int)styles[term.line[0][0].style].bg);
 
 	/* Verify cursor position */
 	ASSERT_EQ(2, term.c.y);
@@ -336,9 +308,9 @@ TEST(empty_history_roundtrip)
 
 	/* Screen content only, no history */
 	term.line[0][0].u = 'A';
-	term.line[0][0].fg = 100;
+	term.line[0][0].style = stylefind(100, 257);
 	term.line[1][0].u = 'B';
-	term.line[1][0].fg = 200;
+	term.line[1][0].style = stylefind(200, 257);
 
 	setup_testdir();
 	persist_init(99998);
@@ -358,9 +330,9 @@ TEST(empty_history_roundtrip)
 	persist_restore(restoredir, NULL, NULL);
 
 	ASSERT_EQ('A', (int)term.line[0][0].u);
-	ASSERT_EQ(100, (int)term.line[0][0].fg);
+	ASSERT_EQ(100, (int)styles[term.line[0][0].style].fg);
 	ASSERT_EQ('B', (int)term.line[1][0].u);
-	ASSERT_EQ(200, (int)term.line[1][0].fg);
+	ASSERT_EQ(200, (int)styles[term.line[1][0].style].fg);
 	ASSERT_EQ(0, term.histn);
 
 	persist_cleanup();
@@ -368,6 +340,238 @@ TEST(empty_history_roundtrip)
 	cleanup_testdir();
 }
 
+TEST(smaller_history_keeps_newest)
+{
+	char restoredir[PATH_MAX];
+
+	setup_term(10, 3);
+	term.histn = 3;
+	HLINE(-3)[0].u = 'X';
+	HLINE(-2)[0].u = 'Y';
+	HLINE(-1)[0].u = 'Z';
+	term.line[0][0].u = 'A';
+
+	setup_testdir();
+	persist_init(99997);
+	persist_save();
+
+	snprintf(restoredir, sizeof(restoredir), "%s/restore", testdir);
+	{
+		char cmd[PATH_MAX * 2 + 16];
+		snprintf(cmd, sizeof(cmd), "cp -r '%s' '%s'",
+				persist_get_dir(), restoredir);
+		system(cmd);
+	}
+
+	/* Restore into a terminal keeping only two lines of history */
+	cleanup_term();
+	histsize = 2;
+	setup_term(10, 3);
+
+	persist_restore(restoredir, NULL, NULL);
+
+	ASSERT_EQ(2, term.histn);
+	ASSERT_EQ('Y', (int)HLINE(-2)[0].u);
+	ASSERT_EQ('Z', (int)HLINE(-1)[0].u);
+	ASSERT_EQ('A', (int)term.line[0][0].u);
+
+	/* the line that didn't fit went to the disk tier */
+	{
+		Glyph g[10];
+
+		ASSERT_EQ(1, term.histdisk);
+		ASSERT_EQ(0, persist_unspill(0, g, 10));
+		ASSERT_EQ('X', (int)g[0].u);
+	}
+
+	persist_cleanup();
+	cleanup_term();
+	cleanup_testdir();
+	histsize = 32768;
+}
+
+/* === Disk tier === */
+
+static void
+spill_text(const char *s, int fg)
+{
+	Glyph g[10];
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		g[i].u = *s ? *s++ : ' ';
+		g[i].mode = i == 9 ? ATTR_WRAP : 0;
+		g[i].style = stylefind(fg, 257);
+	}
+	ASSERT_EQ(0, persist_spill(g, 10));
+}
+
+TEST(disk_tier_roundtrip)
+{
+	Glyph g[12];
+	int i;
+
+	setup_term(10, 3);
+	ASSERT_EQ(-1, persist_spill(term.line[0], 10));
+	persist_init(99960);
+	for (i = 0; i < 5000; i++)
+		spill_text(i % 2 ? "odd" : "even line", i % 256);
+
+	/* some were written out, the others are still buffered */
+	for (i = 0; i < 5000; i++) {
+		ASSERT_EQ(0, persist_unspill(i, g, 12));
+		ASSERT_EQ(i % 2 ? 'o' : 'e', (int)g[0].u);
+	}
+	ASSERT_EQ(0, persist_unspill(4999, g, 12));
+	ASSERT_EQ('o', (int)g[0].u);
+	ASSERT_EQ(' ', (int)g[3].u);
+	ASSERT_EQ(ATTR_WRAP, (int)g[9].mode);
+	ASSERT_EQ(4999 % 256, (int)styles[g[9].style].fg);
+	/* cells past the saved ones are blank */
+	ASSERT_EQ(' ', (int)g[11].u);
+	ASSERT_EQ(0, (int)g[11].mode);
+
+	ASSERT_EQ(0, persist_unspill(0, g, 12));
+	ASSERT_EQ('e', (int)g[0].u);
+	ASSERT_EQ('e', (int)g[8].u);
+	ASSERT_EQ(0, (int)styles[g[0].style].fg);
+	ASSERT_EQ(-1, persist_unspill(5000, g, 12));
+
+	persist_cleanup();
+	ASSERT_EQ(-1, persist_unspill(0, g, 12));
+	cleanup_term();
+}
+
+TEST(disk_tier_capped)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	Glyph g[10];
+	int i, j, k, n = 0;
+
+	setup_term(10, 3);
+	persist_init(99963);
+	histdiskbytes = 4096;
+	for (i = 0; i < 2000; i++) {
+		for (j = 0; j < 10; j++)
+			g[j] = (Glyph){ .u = '0' + (i + j) % 10 };
+		k = persist_spill(g, 10);
+		ASSERT(k >= 0 && k <= n + 1);
+		n += 1 - k;
+	}
+	histdiskbytes = 0;
+
+	/* the newest lines are kept, numbered from the oldest of them */
+	ASSERT(n > 0 && n < 2000);
+	for (i = 0; i < n; i++) {
+		ASSERT_EQ(0, persist_unspill(i, g, 10));
+		ASSERT_EQ('0' + (2000 - n + i) % 10, (int)g[0].u);
+	}
+	ASSERT_EQ(-1, persist_unspill(n, g, 10));
+	persist_save();
+	snprintf(path, sizeof(path), "%s/scrollback-disk.data",
+			persist_get_dir());
+	ASSERT(stat(path, &st) == 0);
+	ASSERT(st.st_size <= 4096);
+
+	persist_cleanup();
+	cleanup_term();
+}
+
+TEST(disk_tier_restored)
+{
+	char restoredir[PATH_MAX], path[PATH_MAX];
+	struct stat st;
+	Glyph g[10];
+
+	setup_term(10, 3);
+	setup_testdir();
+	persist_init(99961);
+	spill_text("one", 1);
+	spill_text("two", 2);
+	persist_save();
+	/* spilled after the save, still in its in-memory history */
+	spill_text("three", 3);
+	persist_unspill(2, g, 10);
+
+	snprintf(restoredir, sizeof(restoredir), "%s/restore", testdir);
+	{
+		char cmd[PATH_MAX * 2 + 16];
+		snprintf(cmd, sizeof(cmd), "cp -r '%s' '%s'",
+				persist_get_dir(), restoredir);
+		system(cmd);
+	}
+	persist_cleanup();
+	cleanup_term();
+	setup_term(10, 3);
+
+	/* the restore takes the files over instead of copying them */
+	persist_init(99962);
+	persist_restore(restoredir, NULL, NULL);
+	ASSERT_EQ(2, term.histdisk);
+	snprintf(path, sizeof(path), "%s/scrollback-disk.data",
+			persist_get_dir());
+	ASSERT(stat(path, &st) == 0);
+	ASSERT(stat(restoredir, &st) != 0);
+
+	ASSERT_EQ(0, persist_unspill(1, g, 10));
+	ASSERT_EQ('t', (int)g[0].u);
+	ASSERT_EQ('w', (int)g[1].u);
+	ASSERT_EQ(2, (int)styles[g[0].style].fg);
+	ASSERT_EQ(-1, persist_unspill(2, g, 10));
+
+	/* and go on appending after the kept lines */
+	spill_text("four", 4);
+	ASSERT_EQ(0, persist_unspill(2, g, 10));
+	ASSERT_EQ('f', (int)g[0].u);
+
+	persist_cleanup();
+	cleanup_term();
+	cleanup_testdir();
+}
+
+TEST(version1_file_restored)
+{
+	char restoredir[PATH_MAX], path[PATH_MAX];
+	struct {
+		char magic[6];
+		uint16_t version, col, row, histi, histn, pad;
+	} hdr = { "", 1, 2, 1, 0, 1, 0 };
+	struct {
+		uint32_t u;
+		uint16_t mode;
+		uint32_t fg, bg;
+	} cells[4] = {
+		{ 'H', 0, 42, 257 }, { 'i', 0, 256, 257 },
+		{ '$', 1, 256, 7 }, { ' ', 0, 256, 257 },
+	};
+	FILE *f;
+
+	memcpy(hdr.magic, "STHIST", 6);
+	setup_testdir();
+	snprintf(restoredir, sizeof(restoredir), "%s/v1", testdir);
+	mkdir(restoredir, 0700);
+	snprintf(path, sizeof(path), "%s/scrollback-history.save", restoredir);
+	f = fopen(path, "wb");
+	ASSERT(f != NULL);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(cells, sizeof(cells[0]), 4, f);
+	fclose(f);
+
+	setup_term(2, 1);
+	persist_restore(restoredir, NULL, NULL);
+
+	ASSERT_EQ(1, term.histn);
+	ASSERT_EQ('H', (int)HLINE(-1)[0].u);
+	ASSERT_EQ(42, (int)styles[HLINE(-1)[0].style].fg);
+	ASSERT_EQ('$', (int)term.line[0][0].u);
+	ASSERT_EQ(1, (int)term.line[0][0].mode);
+	ASSERT_EQ(7, (int)styles[term.line[0][0].style].bg);
+
+	cleanup_term();
+	cleanup_testdir();
+}
+
 TEST(cursor_y_restored)
 {
 	char restoredir[PATH_MAX];
@@ -448,9 +652,6 @@ TEST(register_sets_dwm_argv)
 
 /* === Altcmd tracking tests === */
 
-/* MODE_ALTSCREEN = 1 << 2 */
-#define MODE_ALTSCREEN (1 << 2)
-
 TEST(altcmd_set_and_get)
 {
 	persist_set_altcmd("htop");
@@ -750,10 +951,19 @@ TEST_SUITE(save_restore)
 {
 	RUN_TEST(full_roundtrip);
 	RUN_TEST(empty_history_roundtrip);
+	RUN_TEST(smaller_history_keeps_newest);
+	RUN_TEST(version1_file_restored);
 	RUN_TEST(cursor_y_restored);
 	RUN_TEST(bad_magic_skipped);
 }
 
+TEST_SUITE(disk_tier)
+{
+	RUN_TEST(disk_tier_roundtrip);
+	RUN_TEST(disk_tier_capped);
+	RUN_TEST(disk_tier_restored);
+}
+
 TEST_SUITE(altcmd)
 {
 	RUN_TEST(altcmd_set_and_get);
@@ -791,6 +1001,7 @@ main(void)
 
 	RUN_SUITE(cwd);
 	RUN_SUITE(save_restore);
+	RUN_SUITE(disk_tier);
 	RUN_SUITE(altcmd);
 	RUN_SUITE(save_cmd);
 	RUN_SUITE(ephemeral);
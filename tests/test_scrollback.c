@@ -8,14 +8,6 @@
 #include "test.h"
 #include "mocks.h"
 
-/* TLINE macro for accessing history/screen lines */
-#define TLINE(y)		((y) < term.scr ? term.hist[((y) + term.histi - \
-				term.scr + HISTSIZE + 1) % HISTSIZE] : \
-				term.line[(y) - term.scr])
-
-/* IS_SET macro */
-#define IS_SET(flag)		((term.mode & (flag)) != 0)
-
 /* Helper to set a line with content */
 static void
 set_line_content(int y, const char *text)
@@ -43,14 +35,16 @@ get_line_first_char(int y)
 	return term.line[y][0].u;
 }
 
-/* Helper to get first char from history line */
+/* Helper to get first char from history line, idx counting up to the
+ * newest line at term.histn */
 static Rune
 get_hist_first_char(int idx)
 {
-	idx = (idx + HISTSIZE) % HISTSIZE;
-	if (!term.hist[idx])
+	Line line = HLINE(-1 - (term.histn - idx + histsize) % histsize);
+
+	if (!line)
 		return 0;
-	return term.hist[idx][0].u;
+	return line[0].u;
 }
 
 /*
@@ -113,8 +107,8 @@ TEST(old_clear_loses_content)
 	ASSERT_EQ(' ', get_line_first_char(0));
 	ASSERT_EQ(' ', get_line_first_char(4));
 
-	/* History should be empty (histi still 0, no content saved) */
-	ASSERT_EQ(0, term.histi);
+	/* History should be empty (histn still 0, no content saved) */
+	ASSERT_EQ(0, term.histn);
 
 	mock_term_free();
 }
@@ -141,10 +135,10 @@ TEST(fixed_clear_preserves_content)
 	/* Screen should be cleared */
 
 	/* History should have lines 0-3 (4 lines), prompt skipped */
-	ASSERT_EQ(4, term.histi);
+	ASSERT_EQ(4, term.histn);
 
 	/* Check that output was saved to history (prompt was NOT saved) */
-	/* Most recent (histi=4) has what was Line 3 */
+	/* Most recent (histn=4) has what was Line 3 */
 	ASSERT_EQ('L', get_hist_first_char(4));  /* Line 3 */
 	ASSERT_EQ('L', get_hist_first_char(3));  /* Line 2 */
 	ASSERT_EQ('L', get_hist_first_char(2));  /* Line 1 */
@@ -172,8 +166,8 @@ TEST(altscreen_clear_no_history)
 	ASSERT_EQ(' ', get_line_first_char(0));
 	ASSERT_EQ(' ', get_line_first_char(1));
 
-	/* History should NOT be touched (histi still 0) */
-	ASSERT_EQ(0, term.histi);
+	/* History should NOT be touched (histn still 0) */
+	ASSERT_EQ(0, term.histn);
 
 	mock_term_free();
 }
@@ -190,7 +184,7 @@ TEST(multiple_clears_accumulate)
 
 	/* First clear - saves lines 0-1, skips line 2 */
 	ed_clear_all_fixed();
-	ASSERT_EQ(2, term.histi);
+	ASSERT_EQ(2, term.histn);
 
 	/* Second set: 2 output lines + 1 prompt */
 	set_line_content(0, "DDD");
@@ -199,7 +193,7 @@ TEST(multiple_clears_accumulate)
 
 	/* Second clear - saves lines 0-1, skips line 2 */
 	ed_clear_all_fixed();
-	ASSERT_EQ(4, term.histi);
+	ASSERT_EQ(4, term.histn);
 
 	/* History should have both output sets (not prompts) */
 	/* Most recent: E, D (indices 4, 3) */
@@ -227,7 +221,7 @@ TEST(small_output_only_saves_content)
 	ed_clear_all_fixed();
 
 	/* Only output lines should be saved (not empty lines, not prompt) */
-	ASSERT_EQ(2, term.histi);
+	ASSERT_EQ(2, term.histn);
 
 	/* Check output content was saved (prompt was NOT saved) */
 	ASSERT_EQ('2', get_hist_first_char(2));  /* Line 1 content */
@@ -245,7 +239,7 @@ TEST(empty_screen_no_history)
 	/* Clear should not save anything */
 	ed_clear_all_fixed();
 
-	ASSERT_EQ(0, term.histi);
+	ASSERT_EQ(0, term.histn);
 
 	mock_term_free();
 }
@@ -260,16 +254,16 @@ TEST(spam_clear_no_prompt_accumulation)
 
 	/* Clear multiple times - should NOT save the prompt each time */
 	ed_clear_all_fixed();
-	ASSERT_EQ(0, term.histi);  /* Nothing saved - only prompt, no output */
+	ASSERT_EQ(0, term.histn);  /* Nothing saved - only prompt, no output */
 
 	/* Simulate prompt being redrawn */
 	set_line_content(0, "% ");
 
 	ed_clear_all_fixed();
-	ASSERT_EQ(0, term.histi);  /* Still nothing - just prompts */
+	ASSERT_EQ(0, term.histn);  /* Still nothing - just prompts */
 
 	ed_clear_all_fixed();
-	ASSERT_EQ(0, term.histi);  /* Still nothing */
+	ASSERT_EQ(0, term.histn);  /* Still nothing */
 
 	mock_term_free();
 }
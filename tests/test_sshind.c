@@ -183,15 +183,14 @@ void XftTextExtentsUtf8(Display *dpy, XftFont *font, const FcChar8 *string,
 	extents->xOff = 100;
 }
 
-int XftColorAllocName(Display *dpy, Visual *visual, Colormap cmap,
-                      const char *name, XftColor *result) {
-	(void)dpy; (void)visual; (void)cmap; (void)name;
-	result->pixel = 0;
+int xcolorhold(const char *name, XftColor *col) {
+	(void)name;
+	col->pixel = 0;
 	return 1;
 }
 
-void XftColorFree(Display *dpy, Visual *visual, Colormap cmap, XftColor *color) {
-	(void)dpy; (void)visual; (void)cmap; (void)color;
+void xcolorrelease(const XftColor *col) {
+	(void)col;
 }
 
 XftDraw *XftDrawCreate(Display *dpy, Drawable drawable, Visual *visual,
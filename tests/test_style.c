@@ -0,0 +1,180 @@
+/* See LICENSE for license details. */
+/* Unit tests for the style table */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "style.h"
+
+void *xmalloc(size_t len) { return malloc(len); }
+void *xrealloc(void *p, size_t len) { return realloc(p, len); }
+
+TEST(style_default_is_zero)
+{
+	styleinit(256, 257);
+	ASSERT_EQ(1, stylecount());
+	ASSERT_EQ(0, stylefind(256, 257));
+	ASSERT_EQ(256, (int)styles[0].fg);
+	ASSERT_EQ(257, (int)styles[0].bg);
+}
+
+TEST(style_same_pair_same_index)
+{
+	int a, b;
+
+	styleinit(256, 257);
+	a = stylefind(1, 257);
+	b = stylefind(256, 1);
+	ASSERT(a > 0 && b > 0 && a != b);
+	ASSERT_EQ(a, stylefind(1, 257));
+	ASSERT_EQ(b, stylefind(256, 1));
+	ASSERT_EQ(3, stylecount());
+}
+
+TEST(style_table_grows)
+{
+	uint32_t i;
+
+	styleinit(256, 257);
+	for (i = 0; i < 10000; i++)
+		ASSERT_EQ((int)i + 1, stylefind(TRUECOLOR(0, 0, 0) + i, 0));
+	for (i = 0; i < 10000; i++) {
+		ASSERT_EQ((int)(TRUECOLOR(0, 0, 0) + i),
+				(int)styles[stylefind(TRUECOLOR(0, 0, 0) + i, 0)].fg);
+	}
+	ASSERT_EQ(10001, stylecount());
+}
+
+TEST(style_full_table)
+{
+	uint32_t i;
+
+	styleinit(256, 257);
+	for (i = 1; i < STYLEMAX; i++)
+		stylefind(i, i);
+	ASSERT_EQ(STYLEMAX, stylecount());
+	ASSERT_EQ(-1, stylefind(0, 0));
+	ASSERT_EQ(7, stylefind(7, 7));
+}
+
+TEST(style_near_when_full)
+{
+	uint32_t i;
+	int red, s;
+
+	styleinit(256, 257);
+	red = stylefind(196, 257);
+	for (i = 0; stylecount() < STYLEMAX; i++)
+		stylefind(TRUECOLOR(0, 0, 0) + i, 257);
+	ASSERT_EQ(-1, stylefind(TRUECOLOR(250, 5, 5), 257));
+	/* the palette entry for it, if that pair is there */
+	ASSERT_EQ(red, stylenear(TRUECOLOR(250, 5, 5), 257));
+	/* else the closest pair */
+	s = stylenear(TRUECOLOR(1, 2, 3), 257);
+	ASSERT_EQ((int)TRUECOLOR(0, 2, 3), (int)styles[s].fg);
+	ASSERT_EQ(257, (int)styles[s].bg);
+	ASSERT_EQ(7, stylenear(TRUECOLOR(0, 0, 5), 257));
+}
+
+TEST(style_keep_renumbers)
+{
+	static uchar used[STYLEMAX];
+	static ushort map[STYLEMAX];
+	int a, b, c;
+
+	styleinit(256, 257);
+	a = stylefind(1, 1);
+	b = stylefind(2, 2);
+	c = stylefind(3, 3);
+	memset(used, 0, sizeof(used));
+	used[c] = 1;
+	stylekeep(used, map, 0);
+
+	ASSERT_EQ(2, stylecount());
+	ASSERT_EQ(0, (int)map[0]);
+	ASSERT_EQ(1, (int)map[c]);
+	ASSERT_EQ(3, (int)styles[map[c]].fg);
+	ASSERT_EQ(1, stylefind(3, 3));
+	/* dropped pairs come back as new styles */
+	ASSERT_EQ(2, stylefind(1, 1));
+	(void)a;
+	(void)b;
+}
+
+TEST(style_crowded_table_merges)
+{
+	static uchar used[STYLEMAX];
+	static ushort map[STYLEMAX];
+	uint32_t i;
+	int a, b;
+
+	styleinit(256, 257);
+	for (i = 0; i < 160 * 256; i++)
+		stylefind(TRUECOLOR(0, 0, 0) + i, 257);
+	a = stylefind(TRUECOLOR(0, 0, 4), 257);
+	b = stylefind(TRUECOLOR(0, 0, 5), 257);
+	memset(used, 1, sizeof(used));
+	stylekeep(used, map, 1);
+
+	/* one bit less per channel: 160x256 green/blue pairs become 80x128 */
+	ASSERT_EQ(1 + 80 * 128, stylecount());
+	ASSERT_EQ((int)map[a], (int)map[b]);
+	ASSERT_EQ((int)TRUECOLOR(0, 0, 4), (int)styles[map[b]].fg);
+	ASSERT_EQ((int)map[a], stylefind(TRUECOLOR(0, 0, 5), 257));
+	ASSERT_EQ(0, (int)map[0]);
+
+	/* precision comes back once the table has emptied */
+	memset(used, 0, sizeof(used));
+	stylekeep(used, map, 1);
+	ASSERT_EQ(1, stylecount());
+	ASSERT(stylefind(TRUECOLOR(0, 0, 5), 257) !=
+			stylefind(TRUECOLOR(0, 0, 4), 257));
+}
+
+TEST(style_crowded_table_stays_exact)
+{
+	static uchar used[STYLEMAX];
+	static ushort map[STYLEMAX];
+	uint32_t i;
+	int a, b;
+
+	styleinit(256, 257);
+	for (i = 0; i < 160 * 256; i++)
+		stylefind(TRUECOLOR(0, 0, 0) + i, 257);
+	a = stylefind(TRUECOLOR(0, 0, 4), 257);
+	b = stylefind(TRUECOLOR(0, 0, 5), 257);
+	memset(used, 1, sizeof(used));
+	stylekeep(used, map, 0);
+
+	/* without squeezing nothing merges */
+	ASSERT_EQ(1 + 160 * 256, stylecount());
+	ASSERT((int)map[a] != (int)map[b]);
+	ASSERT_EQ((int)TRUECOLOR(0, 0, 5), (int)styles[map[b]].fg);
+	ASSERT_EQ((int)map[b], stylefind(TRUECOLOR(0, 0, 5), 257));
+}
+
+/* Test suite */
+TEST_SUITE(style)
+{
+	RUN_TEST(style_default_is_zero);
+	RUN_TEST(style_same_pair_same_index);
+	RUN_TEST(style_table_grows);
+	RUN_TEST(style_full_table);
+	RUN_TEST(style_near_when_full);
+	RUN_TEST(style_keep_renumbers);
+	RUN_TEST(style_crowded_table_merges);
+	RUN_TEST(style_crowded_table_stays_exact);
+}
+
+int
+main(void)
+{
+	printf("st style test suite\n");
+	printf("========================================\n");
+
+	RUN_SUITE(style);
+
+	return test_summary();
+}
@@ -0,0 +1,1180 @@
+/* See LICENSE for license details. */
+/*
+ * Tests of the terminal core against the null frontend: bytes go
+ * through twrite() and the real parser, screen, history and search.
+ * st.c and search.c are included for their static state, like sshind.c
+ * and notif.c in their tests.
+ */
+
+#include "../st.c"
+#include "../search.c"
+
+#include "test.h"
+
+static unsigned long long rs = 1;
+
+static unsigned
+rnd(void)
+{
+	rs ^= rs << 13;
+	rs ^= rs >> 7;
+	rs ^= rs << 17;
+	return (unsigned)(rs >> 11);
+}
+
+static void
+feed(const char *s)
+{
+	twrite(s, strlen(s), 0);
+}
+
+/* a fresh col by row terminal */
+static void
+setup(int col, int row)
+{
+	selinit();
+	tnew(col, row);
+	/* and no history state left from the one before */
+	thistresize(0);
+	tsearch(NULL);
+	tidx.wanted = 0;
+	markgen = 0;
+}
+
+/* row y of the screen (negative: history) as UTF-8, trailing blanks cut */
+static char *
+rowtext(int y)
+{
+	static char buf[1024];
+	Line l = y < 0 ? thline(y) : TLINE(y);
+	int x, n = 0, end = 0;
+
+	for (x = 0; x < term.col; x++) {
+		if (l[x].mode & ATTR_WDUMMY)
+			continue;
+		n += utf8encode(l[x].u ? l[x].u : ' ', buf + n);
+		if (l[x].u != ' ' && l[x].u)
+			end = n;
+	}
+	buf[end] = '\0';
+	return buf;
+}
+
+/*
+ * History and screen as logical lines, one per '\n', without blanks at
+ * their ends or blank lines at the end: what a resize must keep.
+ */
+static char *
+logical(void)
+{
+	static char buf[1 << 16], text[2048][128];
+	static int wrap[2048];
+	Line l;
+	int y, x, i, n = 0, len = 0;
+
+	/* from the newest back, thline() may wrap older lines again */
+	for (y = term.row - 1; y >= -term.histn && n < (int)LEN(text); y--) {
+		l = y < 0 ? thline(y) : term.line[y];
+		for (x = i = 0; x < term.col; x++) {
+			if (!(l[x].mode & (ATTR_WDUMMY|ATTR_WRAPPAD)))
+				i += utf8encode(l[x].u, text[n] + i);
+		}
+		text[n][i] = '\0';
+		wrap[n++] = l[term.col-1].mode & ATTR_WRAP;
+	}
+	while (n-- > 0) {
+		len += sprintf(buf + len, "%s", text[n]);
+		if (wrap[n])
+			continue;
+		while (len > 0 && buf[len-1] == ' ')
+			len--;
+		buf[len++] = '\n';
+	}
+	while (len > 0 && buf[len-1] == '\n')
+		len--;
+	buf[len] = '\0';
+	return buf;
+}
+
+/* the replies queued for the tty since the last call */
+static char *
+reply(void)
+{
+	static char buf[256];
+	size_t i;
+
+	for (i = 0; i < ttywqlen && i < sizeof(buf) - 1; i++)
+		buf[i] = ttywq[(ttywqhead + i) % ttywqsiz];
+	buf[i] = '\0';
+	ttywqhead = ttywqlen = 0;
+	return buf;
+}
+
+/* the screen's glyphs, to compare two runs */
+static Glyph *
+snapshot(void)
+{
+	Glyph *g = xmalloc(term.row * term.col * sizeof(Glyph));
+	int y;
+
+	for (y = 0; y < term.row; y++)
+		memcpy(&g[y * term.col], term.line[y], term.col * sizeof(Glyph));
+	return g;
+}
+
+TEST(ascii_run_over_wide_chars)
+{
+	setup(20, 4);
+	feed("\033[H中文字\033[1;4H\033[2Xhel");
+	/* 'l' breaks up the wide char its cell was the dummy of */
+	ASSERT_STR_EQ("中文h l", rowtext(0));
+}
+
+TEST(ascii_run_same_as_one_rune_at_a_time)
+{
+	static const char *bits[] = {
+		"中文字", "文", "é", "\033[2X", "\033[X", "\033[H", "\033[3;7H",
+		"\033[1;18H", "\033[1;4H", "\033[2;5H", "\033[D",
+		"\r\n", "\r", "\033[K", "\033[31m", "\033[0m", "\033[4h",
+		"\033[4l", "\033[?7l", "\033[?7h", "\033[2P", "\033[3@",
+	};
+	static char buf[1 << 14];
+	Glyph *a;
+	Rune u;
+	int i, k, n, len, seed;
+
+	for (seed = 1; seed <= 200; seed++) {
+		rs = seed;
+		for (len = 0; len < (int)sizeof(buf) - 64;) {
+			if (rnd() % 3) {
+				n = 1 + rnd() % 12;
+				for (i = 0; i < n; i++)
+					buf[len++] = 0x20 + rnd() % 95;
+			} else {
+				k = rnd() % LEN(bits);
+				memcpy(buf + len, bits[k], strlen(bits[k]));
+				len += strlen(bits[k]);
+			}
+		}
+
+		setup(23, 7);
+		twrite(buf, len, 0);
+		a = snapshot();
+
+		/* the same through tputc(), one rune at a time */
+		setup(23, 7);
+		for (i = 0; i < len; i += n) {
+			n = utf8decode(buf + i, &u, len - i);
+			tputc(u);
+		}
+
+		for (i = 0; i < term.row; i++)
+			ASSERT(!memcmp(&a[i * term.col], term.line[i],
+					term.col * sizeof(Glyph)));
+		free(a);
+	}
+}
+
+/* write s after text, through twrite() or a rune at a time, over a selection */
+static Glyph *
+selwrite(const char *text, int x0, int y0, int x1, int y1, const char *s,
+         int fast, int *kept)
+{
+	setup(23, 7);
+	feed(text);
+	selstart(x0, y0, 0);
+	selextend(x1, y1, SEL_REGULAR, 0);
+	if (fast) {
+		twrite(s, strlen(s), 0);
+	} else {
+		while (*s)
+			tputc(*s++);
+	}
+	*kept = sel.ob.x != -1;
+	return snapshot();
+}
+
+TEST(ascii_run_same_as_one_rune_at_a_time_over_selection)
+{
+	static const struct {
+		int x0, y0, x1, y1;
+	} sels[] = {
+		{ 0, 0, 22, 0 }, { 20, 0, 22, 0 }, { 5, 0, 3, 1 },
+		{ 0, 1, 10, 1 }, { 0, 2, 5, 3 }, { 22, 0, 0, 1 },
+	};
+	/* the first row is full, the cursor waits to wrap on its last cell */
+	static const char *text = "abcdefghijklmnopqrstuvw";
+	Glyph *a, *b;
+	int i, y, kepta, keptb;
+
+	for (i = 0; i < (int)LEN(sels); i++) {
+		a = selwrite(text, sels[i].x0, sels[i].y0, sels[i].x1,
+		             sels[i].y1, "xyz", 1, &kepta);
+		b = selwrite(text, sels[i].x0, sels[i].y0, sels[i].x1,
+		             sels[i].y1, "xyz", 0, &keptb);
+		ASSERT_EQ(keptb, kepta);
+		for (y = 0; y < term.row; y++)
+			ASSERT(!memcmp(&a[y * term.col], &b[y * term.col],
+					term.col * sizeof(Glyph)));
+		free(a);
+		free(b);
+	}
+}
+
+TEST(decode_block_same_as_decode)
+{
+	static const char *bits[] = {
+		"é", "中", "😀", "\xc3", "\xe4\xb8", "\xff", "\xed\xa0\x80",
+		"\xc0\xaf", "\xf4\x90\x80\x80", "\x80",
+	};
+	static char buf[4096];
+	static Rune a[4096], b[128];
+	Rune u;
+	int i, k, n, len, na, nb, nr, seed;
+
+	for (seed = 1; seed <= 200; seed++) {
+		rs = seed;
+		for (len = 0; len < (int)sizeof(buf) - 48;) {
+			if (rnd() % 2) {
+				n = rnd() % 40;
+				for (i = 0; i < n; i++)
+					buf[len++] = 0x20 + rnd() % 95;
+			} else {
+				k = rnd() % LEN(bits);
+				memcpy(buf + len, bits[k], strlen(bits[k]));
+				len += strlen(bits[k]);
+			}
+		}
+
+		/* a rune at a time, up to an incomplete one at the end */
+		for (i = na = 0; i < len && (n = utf8decode(buf + i, &u, len - i)); i += n)
+			a[na++] = u;
+
+		/* in blocks of any size */
+		for (i = k = 0; i < len; i += nb, k += nr) {
+			nr = utf8decodeblock(buf + i, len - i, b,
+			                     1 + rnd() % 100, &nb);
+			if (nr == 0)
+				break;
+			ASSERT(k + nr <= na);
+			ASSERT(!memcmp(b, a + k, nr * sizeof(Rune)));
+		}
+		ASSERT_EQ(na, k);
+	}
+}
+
+TEST(parse_cup_and_sgr)
+{
+	setup(20, 5);
+	feed("\033[31;1mab\033[3;5Hc\033[m");
+	ASSERT_STR_EQ("ab", rowtext(0));
+	ASSERT_EQ(ATTR_BOLD, term.line[0][0].mode);
+	ASSERT_EQ(1, (int)styles[term.line[0][0].style].fg);
+	ASSERT_EQ('c', (int)term.line[2][4].u);
+	ASSERT_EQ(0, (int)term.c.attr.mode);
+}
+
+TEST(parse_control_inside_csi)
+{
+	/* the BS is done at once, the sequence goes on after it */
+	setup(20, 5);
+	feed("abc\033[5\bGx");
+	ASSERT_STR_EQ("abc x", rowtext(0));
+}
+
+TEST(parse_can_and_esc_abort)
+{
+	setup(20, 5);
+	feed("\033[31\030x");
+	ASSERT_EQ(0, (int)term.line[0][0].style);
+	feed("\033[31\033[32my");
+	ASSERT_EQ(2, (int)styles[term.line[0][1].style].fg);
+	ASSERT_STR_EQ("xy", rowtext(0));
+}
+
+TEST(parse_strings_are_not_printed)
+{
+	setup(20, 5);
+	feed("\033]0;title\aa\033]2;x\033\\b\033P1$qm\033\\c\033_apc\033\\d");
+	ASSERT_STR_EQ("abcd", rowtext(0));
+}
+
+TEST(parse_charset_rep_and_big_params)
+{
+	setup(20, 5);
+	feed("\033(0q\033(Bq");
+	ASSERT_STR_EQ("─q", rowtext(0));
+	feed("\r\na\033[3b");
+	ASSERT_STR_EQ("aaaa", rowtext(1));
+	/* a parameter too big for an int neither wraps nor escapes the screen */
+	feed("\033[99999C\033[99999999999999999999Dz");
+	ASSERT_EQ('z', (int)term.line[1][19].u);
+}
+
+TEST(parse_c1_controls_without_utf8)
+{
+	setup(20, 5);
+	feed("\033%@\x9b" "3Cx");
+	ASSERT_STR_EQ("   x", rowtext(0));
+	feed("\033%G");
+	ASSERT(IS_SET(MODE_UTF8));
+}
+
+TEST(decrqm_replies)
+{
+	setup(20, 5);
+	reply();
+	feed("\033[?2026$p");
+	ASSERT_STR_EQ("\033[?2026;2$y", reply());
+	feed("\033[?7$p\033[4$p");
+	ASSERT_STR_EQ("\033[?7;1$y\033[4;2$y", reply());
+	feed("\033[4h\033[4$p");
+	ASSERT_STR_EQ("\033[4;1$y", reply());
+	feed("\033[?9999$p\033[?1049$p\033[?1004$p");
+	ASSERT_STR_EQ("\033[?9999;0$y\033[?1049;2$y\033[?1004;4$y", reply());
+}
+
+TEST(sync_update_mode)
+{
+	setup(20, 5);
+	reply();
+	feed("\033[?2026h");
+	ASSERT(tsyncleft() > 0);
+	feed("\033[?2026$p");
+	ASSERT_STR_EQ("\033[?2026;1$y", reply());
+	feed("\033[?2026l");
+	ASSERT_EQ(0, tsyncleft());
+}
+
+TEST(reader_thread_leaves_exit_to_frontend)
+{
+	int p[2], fd, done;
+
+	setup(20, 5);
+	ASSERT(pipe(p) == 0);
+	cmdfd = p[0];
+	fcntl(cmdfd, F_SETFL, O_NONBLOCK);
+	ASSERT_EQ(2, (int)write(p[1], "hi", 2));
+	close(p[1]);
+
+	fd = ttythreadstart();
+	/* the reader parses what is left and ends without exiting */
+	ASSERT(pthread_join(ttythr, NULL) == 0);
+	tlock();
+	done = ttythrdone;
+	tunlock();
+	ASSERT(done);
+	ASSERT_STR_EQ("hi", rowtext(0));
+
+	ttythreaded = ttythrdone = 0;
+	close(fd);
+	close(ttywake[1]);
+	close(cmdfd);
+}
+
+TEST(read_drains_and_grows)
+{
+	static char in[6 * BUFSIZ];
+	int p[2], i;
+
+	setup(20, 5);
+	free(ttybuf);
+	ttybuf = NULL;
+	ttybufsiz = ttybuflen = 0;
+	for (i = 0; i < (int)sizeof(in); i++)
+		in[i] = 'a' + i % 26;
+	ASSERT(pipe(p) == 0);
+	cmdfd = p[0];
+	fcntl(cmdfd, F_SETFL, O_NONBLOCK);
+	/* only EAGAIN ends the reads here, however slow the machine */
+	ttyreadbudget = 1e6;
+
+	/* one call takes it all, the buffer doubling while reads fill it */
+	ASSERT_EQ((int)sizeof(in), (int)write(p[1], in, sizeof(in)));
+	ASSERT_EQ((int)sizeof(in), (int)ttyread());
+	ASSERT_EQ(4 * BUFSIZ, (int)ttybufsiz);
+	ASSERT_EQ(0, (int)ttybuflen);
+	/* and an empty tty would block, it is not closed */
+	ASSERT_EQ(0, (int)ttyread());
+
+	/* no further than ttybufmax */
+	free(ttybuf);
+	ttybuf = NULL;
+	ttybufsiz = 0;
+	ttybufmax = 2 * BUFSIZ;
+	ASSERT_EQ((int)sizeof(in), (int)write(p[1], in, sizeof(in)));
+	ASSERT_EQ((int)sizeof(in), (int)ttyread());
+	ASSERT_EQ(2 * BUFSIZ, (int)ttybufsiz);
+	ttybufmax = 1 << 20;
+	ttyreadbudget = 5;
+
+	close(p[0]);
+	close(p[1]);
+}
+
+TEST(write_queue_wraps_and_grows)
+{
+	static char in[12000], out[12000];
+	int p[2], i, n = 0;
+
+	free(ttywq);
+	ttywq = NULL;
+	ttywqsiz = ttywqhead = ttywqlen = 0;
+
+	for (i = 0; i < (int)sizeof(in); i++)
+		in[i] = 'a' + i % 26;
+	ttywriteraw(in, 0);
+	ASSERT(ttywq == NULL);
+	ttywriteraw(in, 4000);
+	/* a short write took the first 3000, the rest wraps around */
+	ttywqhead = 3000;
+	ttywqlen -= 3000;
+	ttywriteraw(in + 4000, 2000);
+	ASSERT_EQ(TTYWQ_SIZ, (int)ttywqsiz);
+	ASSERT(ttywqhead + ttywqlen > ttywqsiz);
+	/* growing keeps the wrapped bytes in order */
+	ttywriteraw(in + 6000, 6000);
+
+	ASSERT(pipe(p) == 0);
+	cmdfd = p[1];
+	ttyflush();
+	ASSERT_EQ(0, (int)ttypending());
+	close(p[1]);
+	while ((i = read(p[0], out + n, sizeof(out) - n)) > 0)
+		n += i;
+	close(p[0]);
+	ASSERT_EQ(9000, n);
+	ASSERT(!memcmp(in + 3000, out, n));
+}
+
+TEST(write_queue_takes_back)
+{
+	static char in[10000], out[10000];
+	size_t a, b;
+	int p[2], i, n = 0;
+
+	free(ttywq);
+	ttywq = NULL;
+	ttywqsiz = ttywqhead = ttywqlen = 0;
+	for (i = 0; i < (int)sizeof(in); i++)
+		in[i] = 'a' + i % 26;
+
+	/* the first 3000 were written, the next wrap around the ring */
+	ttywriteraw(in, 5000);
+	ttywqhead = 3000;
+	ttywqlen -= 3000;
+	a = ttyqueued();
+	ttywriteraw(in + 5000, 4000);
+	b = ttyqueued();
+	ttywriteraw("end", 3);
+	ASSERT(ttywqhead + ttywqlen > ttywqsiz);
+	ASSERT_EQ(4000, (int)ttyunqueue(a, b));
+	/* what went out can't come back */
+	ASSERT_EQ(0, (int)ttyunqueue(a - 5000, a - 2000));
+	ASSERT_EQ(1000, (int)ttyunqueue(a - 2000, a - 1000));
+	ASSERT_EQ(1003, (int)ttypending());
+
+	ASSERT(pipe(p) == 0);
+	cmdfd = p[1];
+	ttyflush();
+	close(p[1]);
+	while ((i = read(p[0], out + n, sizeof(out) - n)) > 0)
+		n += i;
+	close(p[0]);
+	ASSERT_EQ(1003, n);
+	ASSERT(!memcmp(in + 4000, out, 1000));
+	ASSERT(!memcmp("end", out + 1000, 3));
+}
+
+/* an n by n screen with a different truecolor pair in every cell */
+static void
+gradient(int n)
+{
+	char buf[64];
+	int i;
+
+	setup(n, n);
+	feed("\033[?7l");
+	for (i = 0; i < n * n; i++) {
+		snprintf(buf, sizeof(buf), "\033[%d;%dH\033[38;2;0;%d;%dmx",
+		         1 + i / n, 1 + i % n, i >> 8 & 0xff, i & 0xff);
+		feed(buf);
+	}
+}
+
+TEST(style_gc_keeps_exact_colors)
+{
+	stylesqueeze = 0;
+	gradient(200);
+	tstylegc();
+	ASSERT(stylecount() > 40000);
+	ASSERT_EQ((int)TRUECOLOR(0, 0, 5),
+	          (int)styles[term.line[0][5].style].fg);
+	ASSERT_EQ((int)TRUECOLOR(0, 156, 63),
+	          (int)styles[term.line[199][199].style].fg);
+}
+
+TEST(style_full_table_keeps_colors)
+{
+	Style s;
+
+	/* one pair more than fit, with each in use */
+	stylesqueeze = 0;
+	gradient(256);
+	ASSERT_EQ(STYLEMAX, stylecount());
+	ASSERT_EQ((int)TRUECOLOR(0, 255, 253),
+	          (int)styles[term.line[255][253].style].fg);
+	/* the last gets the closest there is, not the default colors */
+	s = styles[term.line[255][255].style];
+	ASSERT(IS_TRUECOL(s.fg));
+	ASSERT((s.fg & 0xffff) >= 0xfefe);
+	ASSERT_EQ(defaultbg, s.bg);
+}
+
+TEST(style_gc_squeezes_if_asked)
+{
+	stylesqueeze = 1;
+	gradient(200);
+	tstylegc();
+	stylesqueeze = 0;
+	ASSERT(stylecount() <= STYLEMAX / 4);
+	ASSERT_EQ((int)term.line[0][4].style, (int)term.line[0][5].style);
+}
+
+TEST(pack_round_trip)
+{
+	static const Rune u[] = { 'a', 'z', ' ', 0xe9, 0x4e2d, 0x1f600 };
+	Glyph g[80], h[80];
+	Line l;
+	int i, seed;
+
+	setup(80, 5);
+	for (seed = 1; seed <= 200; seed++) {
+		rs = seed;
+		for (i = 0; i < 80; i++) {
+			g[i].u = u[rnd() % LEN(u)];
+			g[i].mode = rnd() % 3 ? 0 : 1 << rnd() % 12;
+			g[i].style = rnd() % 4 ? 0 : rnd() % 8;
+		}
+		l = tpack(g, 80, seed & 7);
+		ASSERT(ISPACKED(l));
+		ASSERT_EQ(seed & 7, (int)PACKOF(l)->mark);
+		tunpack(PACKOF(l), h, 80);
+		ASSERT(!memcmp(g, h, sizeof(g)));
+		tlinefree(l);
+	}
+}
+
+TEST(pack_shares_equal_lines)
+{
+	Glyph g[40];
+	Line a, b;
+	int i;
+
+	setup(40, 5);
+	for (i = 0; i < 40; i++)
+		g[i] = (Glyph){ .u = i < 5 ? 'x' : ' ' };
+	a = tpack(g, 40, 0);
+	b = tpack(g, 40, 0);
+	ASSERT(a == b);
+	ASSERT_EQ(2, (int)PACKOF(a)->ref);
+	/* a different mark is a different line */
+	b = tpack(g, 40, 1);
+	ASSERT(a != b);
+	tlinefree(a);
+	tlinefree(a);
+	tlinefree(b);
+}
+
+TEST(pack_history_reads_the_same)
+{
+	static char want[100][64];
+	unsigned int hot = histhot;
+	char buf[64];
+	int y, n;
+
+	setup(30, 5);
+	for (y = 0; y < 100; y++) {
+		snprintf(buf, sizeof(buf), "\033[3%dmline %d 中文\r\n", y % 8, y);
+		feed(buf);
+	}
+	n = term.histn;
+	ASSERT(n > 90);
+	for (y = -n; y < 0; y++)
+		strcpy(want[y + n], rowtext(y));
+
+	histhot = 4;
+	while (thistcompact(7))
+		;
+	histhot = hot;
+	ASSERT(ISPACKED(HLINE(-n)));
+	ASSERT(ISPACKED(HLINE(-5)));
+	ASSERT(!ISPACKED(HLINE(-4)));
+	for (y = -n; y < 0; y++) {
+		ASSERT_STR_EQ(want[y + n], rowtext(y));
+		ASSERT_EQ((y + n) % 8,
+		          (int)styles[thline(y)[0].style].fg);
+	}
+
+	/* scrolling back into it expands lines in place */
+	ASSERT(!ISPACKED(thistunpack(-n)));
+	ASSERT_STR_EQ(want[0], rowtext(-n));
+}
+
+TEST(disk_tier_capped_history)
+{
+	unsigned int hs = histsize;
+	size_t db = histdiskbytes;
+	char buf[32];
+	int y, n, sp = histspill, err = dup(STDERR_FILENO);
+
+	histsize = 20;
+	histspill = 1;
+	histdiskbytes = 8192;
+	/* it sends stderr to its log, keep ours */
+	persist_init(getpid());
+	dup2(err, STDERR_FILENO);
+	close(err);
+	setup(30, 5);
+	for (y = 0; y < 3000; y++) {
+		snprintf(buf, sizeof(buf), "line %d\r\n", y);
+		feed(buf);
+	}
+	n = term.histn + term.histdisk;
+	ASSERT(term.histdisk > 0 && n < 3000);
+	/* the history runs on from the disk into memory without a gap */
+	for (y = -n; y < 0; y++) {
+		snprintf(buf, sizeof(buf), "line %d", 2996 + y);
+		ASSERT_STR_EQ(buf, rowtext(y));
+	}
+	persist_cleanup();
+	histsize = hs;
+	histspill = sp;
+	histdiskbytes = db;
+}
+
+TEST(resize_joins_over_wide_char_pad)
+{
+	setup(10, 5);
+	/* 中 does not fit the last column and goes on to the next row */
+	feed("abcdefghi中文\r\n");
+	ASSERT_STR_EQ("abcdefghi", rowtext(0));
+	ASSERT_STR_EQ("中文", rowtext(1));
+	tresize(20, 5);
+	ASSERT_STR_EQ("abcdefghi中文", rowtext(0));
+	tresize(10, 5);
+	tresize(20, 5);
+	ASSERT_STR_EQ("abcdefghi中文", rowtext(0));
+	tresize(6, 5);
+	ASSERT_STR_EQ("abcdef", rowtext(0));
+	ASSERT_STR_EQ("ghi中", rowtext(1));
+	ASSERT_STR_EQ("文", rowtext(2));
+	tresize(20, 5);
+	ASSERT_STR_EQ("abcdefghi中文", rowtext(0));
+}
+
+TEST(resize_round_trips)
+{
+	static const char *bits[] = {
+		"中", "文字", "é", " ", "  ", "\r\n", "\r\n\r\n",
+	};
+	static const int widths[] = { 7, 31, 4, 12, 60, 9 };
+	static char want[1 << 16], buf[4096];
+	int i, k, n, len, seed;
+
+	for (seed = 1; seed <= 40; seed++) {
+		rs = seed;
+		for (len = 0; len < (int)sizeof(buf) - 32;) {
+			if (rnd() % 3) {
+				n = 1 + rnd() % 20;
+				for (i = 0; i < n; i++)
+					buf[len++] = 0x21 + rnd() % 94;
+			} else {
+				k = rnd() % LEN(bits);
+				memcpy(buf + len, bits[k], strlen(bits[k]));
+				len += strlen(bits[k]);
+			}
+		}
+		setup(13, 8);
+		twrite(buf, len, 0);
+		strcpy(want, logical());
+		for (i = 0; i < (int)LEN(widths); i++) {
+			tresize(widths[i], 8);
+			ASSERT_STR_EQ(want, logical());
+		}
+		tresize(13, 8);
+		ASSERT_STR_EQ(want, logical());
+	}
+}
+
+/* whether a cell on the screen blinks, the long way */
+static int
+blinking(void)
+{
+	int x, y;
+
+	for (y = 0; y < term.row; y++) {
+		for (x = 0; x < term.col; x++) {
+			if (term.line[y][x].mode & ATTR_BLINK)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* whether the LineInfo of l says what its cells do */
+static int
+infook(Line l)
+{
+	LineInfo *li = tlineinfo(l);
+	int x, attr = 0, blank = 1, len = term.col;
+
+	for (x = 0; x < term.col; x++) {
+		attr |= l[x].mode;
+		blank &= ISBLANK(l[x]);
+	}
+	if (!(l[term.col-1].mode & ATTR_WRAP)) {
+		while (len > 0 && l[len-1].u == ' ')
+			len--;
+	}
+	return li->attr == attr && li->blank == blank && li->len == len;
+}
+
+TEST(lineinfo_follows_writes)
+{
+	static const char *bits[] = {
+		"中文", "\033[1m", "\033[5m", "\033[7m", "\033[0m", "\033[41m",
+		"\033[2X", "\033[3@", "\033[2P", "\033[L", "\033[M", "\033[K",
+		"\033[1K", "\033[J", "\033[2;5r", "\033[r", "\033[S", "\033[T",
+		"\033[H", "\033[4;9H", "\r\n", "\033[?5h", "\033[?5l", "\033#8",
+		"\033[1;30H", "\033[4h", "\033[4l", "  ",
+	};
+	char buf[64];
+	int i, k, n, y, seed, len;
+
+	for (seed = 1; seed <= 50; seed++) {
+		rs = seed;
+		setup(30, 6);
+		for (i = 0; i < 400; i++) {
+			if (rnd() % 2) {
+				n = 1 + rnd() % 12;
+				for (len = 0; len < n; len++)
+					buf[len] = 0x21 + rnd() % 94;
+				buf[len] = '\0';
+				feed(buf);
+			} else {
+				k = rnd() % LEN(bits);
+				feed(bits[k]);
+			}
+			if (i % 97 == 0)
+				tresize(20 + rnd() % 20, 6);
+			for (y = 0; y < term.row; y++)
+				ASSERT(infook(term.line[y]));
+			ASSERT_EQ(!!tattrset(ATTR_BLINK), !!blinking());
+		}
+		for (y = -1; y >= -term.histn; y--) {
+			ASSERT(infook(thline(y)));
+			ASSERT_EQ(tlineinfo(thline(y))->len, thlinelen(y));
+		}
+	}
+}
+
+/* the line of a search stays good while linegen goes past 32 bits */
+TEST(lineinfo_gen_past_32_bits)
+{
+	int m[8], i;
+
+	setup(20, 4);
+	linegen = UINT32_MAX - 8;
+	ASSERT_EQ(0, tsearch("foo"));
+	feed("bar");
+	ASSERT_EQ(0, tsearchcells(term.line[0], m, 4));
+	for (i = 0; i < 16; i++)
+		feed("\033[2Hbaz");
+	feed("\033[Hfoo");
+	ASSERT_EQ(1, tsearchcells(term.line[0], m, 4));
+	ASSERT_EQ(0, m[0]);
+	ASSERT_EQ(2, m[1]);
+	feed("\033[Hbar");
+	ASSERT_EQ(0, tsearchcells(term.line[0], m, 4));
+	tsearch(NULL);
+}
+
+/* the rows with a match, oldest first, as tsearchnext() goes to them */
+static int
+found(int *ys, int max)
+{
+	int x = -1, y = -term.histn - term.histdisk, fx, fy, n = 0, r, i;
+
+	while (tsearchstep(4096))
+		;
+	if ((r = tsearchnext(&x, &y, 1)) <= 0)
+		return r;
+	fx = x;
+	fy = y;
+	for (i = 0; i < 8 * max; i++) {
+		if ((n == 0 || ys[n-1] != y) && n < max)
+			ys[n++] = y;
+		if (tsearchnext(&x, &y, 1) != 1)
+			return -1;
+		if (x == fx && y == fy)
+			return n;
+	}
+	return -1;
+}
+
+/* the same, with a plain scan of every row */
+static int
+scanned(const char *pat, int *ys, int max)
+{
+	regex_t re;
+	int y, n = 0;
+
+	regcomp(&re, pat, REG_EXTENDED | REG_NOSUB);
+	for (y = -term.histn - term.histdisk; y < term.row && n < max; y++) {
+		if (regexec(&re, rowtext(y), 0, NULL, 0) == 0)
+			ys[n++] = y;
+	}
+	regfree(&re);
+	return n;
+}
+
+/* the search finds what a plain scan does, for each of pats */
+static int
+searchok(const char **pats, int npats)
+{
+	static int a[4096], b[4096];
+	int i, n;
+
+	for (i = 0; i < npats; i++) {
+		if (tsearch(pats[i]) != 0)
+			return 0;
+		n = found(a, LEN(a));
+		if (n != scanned(pats[i], b, LEN(b)) ||
+		    memcmp(a, b, MAX(n, 0) * sizeof(*a)))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+words(int nlines)
+{
+	static const char *w[] = {
+		"foo", "bar", "baz", "qux", "foobar", "ab", "abc", "中文",
+	};
+	char buf[128];
+	int i, k, n;
+
+	for (i = 0; i < nlines; i++) {
+		for (n = 0, k = 1 + rnd() % 5; k > 0; k--)
+			n += snprintf(buf + n, sizeof(buf) - n, "%s%s",
+			              w[rnd() % LEN(w)], k > 1 ? " " : "");
+		snprintf(buf + n, sizeof(buf) - n, "\r\n");
+		feed(buf);
+	}
+}
+
+static const char *pats[] = {
+	"foo", "oba", "bar baz", "ba[rz] qux", "^abc", "qux$", "fo+b",
+	"中文 ab", "x", "zzz",
+};
+
+TEST(search_index_same_as_scan)
+{
+	unsigned int hot = histhot;
+	size_t ib = searchindexbytes;
+
+	rs = 7;
+	setup(40, 5);
+	words(800);
+	histhot = 50;
+	while (thistcompact(64))
+		;
+	histhot = hot;
+
+	/* nothing is indexed before the first search */
+	ASSERT_EQ(0, tindexstep(4096));
+	searchindexbytes = 0;
+	ASSERT(searchok(pats, LEN(pats)));
+
+	searchindexbytes = 1 << 20;
+	ASSERT(tindexstep(16));
+	while (tindexstep(4096))
+		;
+	ASSERT(tidx.bytes > 0);
+	ASSERT_EQ(histtotal - term.histn, tidx.lo);
+	ASSERT_EQ(histtotal, tidx.hi);
+	ASSERT(searchok(pats, LEN(pats)));
+
+	/* more lines than it has room for: the oldest are scanned */
+	words(100);
+	searchindexbytes = 2048;
+	while (tindexstep(4096))
+		;
+	ASSERT(tidx.lo > histtotal - term.histn);
+	ASSERT(searchok(pats, LEN(pats)));
+
+	/* and a resize numbers the lines anew */
+	tresize(33, 5);
+	while (tindexstep(4096))
+		;
+	ASSERT_EQ(33, tidx.col);
+	ASSERT(searchok(pats, LEN(pats)));
+	searchindexbytes = ib;
+}
+
+TEST(search_index_leaves_disk_tier)
+{
+	static const char *disk[] = { "foo", "needle", "abc", "qux$" };
+	unsigned int hs = histsize;
+	size_t ib = searchindexbytes;
+	int sp = histspill, err = dup(STDERR_FILENO);
+
+	histsize = 100;
+	histspill = 1;
+	/* it sends stderr to its log, keep ours */
+	persist_init(getpid());
+	dup2(err, STDERR_FILENO);
+	close(err);
+	rs = 11;
+	setup(30, 5);
+	words(150);
+	feed("a needle\r\n");
+	words(300);
+	ASSERT(term.histdisk > 0);
+
+	searchindexbytes = 1 << 20;
+	tsearch("needle");
+	while (tindexstep(4096))
+		;
+	ASSERT_EQ(histtotal - term.histn, tidx.lo);
+	ASSERT(searchok(disk, LEN(disk)));
+	persist_cleanup();
+	histsize = hs;
+	histspill = sp;
+	searchindexbytes = ib;
+}
+
+/* a prompt the shell marked, the command and a line of its output */
+static void
+prompt(int k)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "\033]133;A\a$ \033]133;B\acmd %d\r\n"
+	         "\033]133;C\aout %d\r\n", k, k);
+	feed(buf);
+}
+
+/* the prompts from the cursor back are cmd k-1 .. 0, and no more */
+static int
+promptsok(int k)
+{
+	char want[32];
+	int y = term.c.y;
+
+	while (tmarknext(&y, -1, MARK_PROMPT)) {
+		snprintf(want, sizeof(want), "$ cmd %d", --k);
+		if (k < 0 || strcmp(want, rowtext(y)) ||
+		    (tmark(y) & MARK_X) != 3 || !(tmark(y + 1) & MARK_OUTPUT))
+			return 0;
+	}
+	return k == 0;
+}
+
+TEST(marks_follow_scroll_and_clear)
+{
+	unsigned int hot = histhot;
+	int k, y;
+
+	setup(30, 6);
+	for (k = 0; k < 40; k++)
+		prompt(k);
+	feed("\033]133;A\a$ ");
+	ASSERT(promptsok(40));
+
+	/* clear(1) moves the screen to the history, the marks go with it */
+	feed("\033[H\033[2J\033]133;A\a$ ");
+	for (y = 0; y < term.row; y++)
+		ASSERT_EQ(y == term.c.y ? MARK_PROMPT : 0, tmark(y));
+	ASSERT(promptsok(40));
+
+	/* packed lines keep them */
+	histhot = 4;
+	while (thistcompact(16))
+		;
+	histhot = hot;
+	ASSERT(ISPACKED(HLINE(-term.histn)));
+	ASSERT(promptsok(40));
+
+	/* and going forward finds them in order, the one typed at last */
+	y = -term.histn - 1;
+	for (k = 0; tmarknext(&y, 1, MARK_PROMPT) && y < term.c.y; k++)
+		;
+	ASSERT_EQ(40, k);
+	ASSERT_EQ(term.c.y, y);
+}
+
+/* lines that look like a prompt are one only if from before the marks */
+TEST(marks_past_32_bit_gens)
+{
+	int i;
+
+	setup(30, 14);
+	linegen = UINT32_MAX - 4;
+	feed("$ old\r\n");
+	for (i = 0; i < 8; i++)
+		feed("x\r\n");
+	feed("\033]133;A\a$ one\r\n$ two\r\n");
+	ASSERT(markgen > UINT32_MAX);
+	ASSERT_STR_EQ("$ old", rowtext(0));
+	ASSERT_EQ(MARK_PROMPT, tmark(0));
+	ASSERT_EQ(MARK_PROMPT, tmark(9));
+	ASSERT_STR_EQ("$ two", rowtext(10));
+	ASSERT_EQ(0, tmark(10));
+
+	/* and a resize keeps them so */
+	tresize(20, 14);
+	ASSERT_EQ(MARK_PROMPT, tmark(0));
+	ASSERT_EQ(0, tmark(10));
+}
+
+TEST(scrolls_are_noted_for_the_blit)
+{
+	int i;
+
+	setup(10, 5);
+	nscrolls = 0;
+	feed("a\r\nb\r\nc\r\nd\r\ne\r\nf\r\ng");
+	ASSERT_EQ(1, nscrolls);
+	ASSERT_EQ(0, scrolls[0].top);
+	ASSERT_EQ(4, scrolls[0].bot);
+	ASSERT_EQ(2, scrolls[0].n);
+
+	/* a scroll region is a move of its own */
+	feed("\033[2;4r\033[4H\n\033[r");
+	ASSERT_EQ(2, nscrolls);
+	ASSERT_EQ(1, scrolls[1].top);
+	ASSERT_EQ(3, scrolls[1].bot);
+	ASSERT_EQ(1, scrolls[1].n);
+
+	/* the view moved back into the history, then part of the way */
+	kscrollup(&(Arg){ .i = 2 });
+	kscrolldown(&(Arg){ .i = 1 });
+	ASSERT_EQ(3, nscrolls);
+	ASSERT_EQ(-1, scrolls[2].n);
+	ASSERT_EQ(1, term.scr);
+
+	/* output while scrolled back moves nothing that is shown */
+	feed("\033[5H\nh");
+	ASSERT_EQ(3, nscrolls);
+	ASSERT_EQ(2, term.scr);
+	kscrolldown(&(Arg){ .i = 2 });
+	ASSERT_EQ(3, nscrolls);
+	ASSERT_EQ(1, scrolls[2].n);
+
+	/* more moves than are kept: draw() does it all again */
+	for (i = 0; i < (int)LEN(scrolls); i++)
+		feed("\033[2;4r\033[4H\n\033[r\033[5H\n");
+	ASSERT_EQ(-1, nscrolls);
+	draw();
+	ASSERT_EQ(0, nscrolls);
+}
+
+TEST_SUITE(write)
+{
+	RUN_TEST(ascii_run_over_wide_chars);
+	RUN_TEST(ascii_run_same_as_one_rune_at_a_time);
+	RUN_TEST(ascii_run_same_as_one_rune_at_a_time_over_selection);
+	RUN_TEST(decode_block_same_as_decode);
+}
+
+TEST_SUITE(parse)
+{
+	RUN_TEST(parse_cup_and_sgr);
+	RUN_TEST(parse_control_inside_csi);
+	RUN_TEST(parse_can_and_esc_abort);
+	RUN_TEST(parse_strings_are_not_printed);
+	RUN_TEST(parse_charset_rep_and_big_params);
+	RUN_TEST(parse_c1_controls_without_utf8);
+}
+
+TEST_SUITE(modes)
+{
+	RUN_TEST(decrqm_replies);
+	RUN_TEST(sync_update_mode);
+}
+
+TEST_SUITE(style)
+{
+	RUN_TEST(style_gc_keeps_exact_colors);
+	RUN_TEST(style_full_table_keeps_colors);
+	RUN_TEST(style_gc_squeezes_if_asked);
+}
+
+TEST_SUITE(pack)
+{
+	RUN_TEST(pack_round_trip);
+	RUN_TEST(pack_shares_equal_lines);
+	RUN_TEST(pack_history_reads_the_same);
+	RUN_TEST(disk_tier_capped_history);
+}
+
+TEST_SUITE(resize)
+{
+	RUN_TEST(resize_joins_over_wide_char_pad);
+	RUN_TEST(resize_round_trips);
+}
+
+TEST_SUITE(lineinfo)
+{
+	RUN_TEST(lineinfo_follows_writes);
+	RUN_TEST(lineinfo_gen_past_32_bits);
+}
+
+TEST_SUITE(search)
+{
+	RUN_TEST(search_index_same_as_scan);
+	RUN_TEST(search_index_leaves_disk_tier);
+}
+
+TEST_SUITE(marks)
+{
+	RUN_TEST(marks_follow_scroll_and_clear);
+	RUN_TEST(marks_past_32_bit_gens);
+}
+
+TEST_SUITE(scroll)
+{
+	RUN_TEST(scrolls_are_noted_for_the_blit);
+}
+
+TEST_SUITE(tty)
+{
+	RUN_TEST(reader_thread_leaves_exit_to_frontend);
+	RUN_TEST(read_drains_and_grows);
+	RUN_TEST(write_queue_wraps_and_grows);
+	RUN_TEST(write_queue_takes_back);
+}
+
+int
+main(void)
+{
+	printf("st terminal core test suite\n");
+	printf("========================================\n");
+
+	RUN_SUITE(write);
+	RUN_SUITE(parse);
+	RUN_SUITE(modes);
+	RUN_SUITE(style);
+	RUN_SUITE(pack);
+	RUN_SUITE(resize);
+	RUN_SUITE(lineinfo);
+	RUN_SUITE(search);
+	RUN_SUITE(marks);
+	RUN_SUITE(scroll);
+	RUN_SUITE(tty);
+
+	return test_summary();
+}
@@ -1730,7 +1730,7 @@ TEST(vimnav_scroll_up_after_clear)
 	/* All screen lines are empty (default from mock_term_init) */
 
 	/* Set up history with content - simulate what Ctrl+L would have saved */
-	term.histi = 3;  /* History has 3 lines */
+	term.histn = 3;  /* History has 3 lines */
 	mock_set_hist(1, "output line 1");
 	mock_set_hist(2, "output line 2");
 	mock_set_hist(3, "output line 3");
@@ -1746,11 +1746,14 @@ TEST(vimnav_scroll_up_after_clear)
 	vimnav.savedx = 0;
 
 	/* Try to scroll up with 'k' - should work because history has content */
+	mock_reset();
 	int handled = vimnav_handle_key('k', 0);
 	ASSERT_EQ(1, handled);
 
 	/* term.scr should have increased (scrolled into history) */
 	ASSERT(term.scr > 0);
+	/* through kscrollup(), so the scroll blit sees it */
+	ASSERT_EQ(1, mock_state.kscrollup_calls);
 
 	vimnav_exit();
 	mock_term_free();
@@ -1762,7 +1765,7 @@ TEST(vimnav_ctrl_u_after_clear)
 	mock_term_init(24, 80);
 
 	/* All screen lines empty, history has content */
-	term.histi = 5;
+	term.histn = 5;
 	mock_set_hist(1, "history 1");
 	mock_set_hist(2, "history 2");
 	mock_set_hist(3, "history 3");
@@ -1779,11 +1782,13 @@ TEST(vimnav_ctrl_u_after_clear)
 	vimnav.savedx = 0;
 
 	/* Ctrl+u should scroll up */
+	mock_reset();
 	int handled = vimnav_handle_key('u', 4);  /* 4 = ControlMask */
 	ASSERT_EQ(1, handled);
 
-	/* Should have scrolled */
+	/* Should have scrolled, through kscrollup() */
 	ASSERT(term.scr > 0);
+	ASSERT_EQ(1, mock_state.kscrollup_calls);
 
 	vimnav_exit();
 	mock_term_free();
@@ -1795,7 +1800,7 @@ TEST(vimnav_scroll_stops_at_empty_history)
 	mock_term_init(24, 80);
 
 	/* Screen empty, history also empty (no content ever saved) */
-	term.histi = 0;
+	term.histn = 0;
 	/* All history lines are blank (default from init) */
 
 	term.c.x = 0;
@@ -1828,7 +1833,7 @@ TEST(vimnav_scroll_reaches_oldest_history)
 	 * hist[2] = "file1"
 	 * hist[3] = "file2"
 	 */
-	term.histi = 3;
+	term.histn = 3;
 	mock_set_hist(1, "% ls");
 	mock_set_hist(2, "file1");
 	mock_set_hist(3, "file2");
@@ -2928,7 +2933,7 @@ TEST(vimnav_forced_k_no_history_scroll_altscreen)
 	term.mode |= MODE_ALTSCREEN;
 
 	/* Put some content in history so it would scroll if allowed */
-	term.histi = 5;
+	term.histn = 5;
 	for (int i = 1; i <= 5; i++)
 		mock_set_hist(i, "old history line");
 
@@ -3312,6 +3317,71 @@ TEST(vimnav_close_brace_ignores_percent_in_output)
 	mock_term_free();
 }
 
+/* Test: { goes by the shell's prompt marks when it sends them */
+TEST(vimnav_open_brace_uses_prompt_marks)
+{
+	mock_term_init(24, 80);
+	mock_set_line(3, "> first");
+	mock_set_line(4, "$ looks like a prompt");
+	mock_set_line(5, "output");
+	mock_set_line(20, "> prompt");
+	mock_set_mark(3, MARK_PROMPT | 3);
+	mock_set_mark(4, MARK_OUTPUT);
+	mock_set_mark(20, MARK_PROMPT | 3);
+
+	term.c.x = 2;
+	term.c.y = 20;
+	term.scr = 0;
+	vimnav.zsh_cursor = 0;
+
+	vimnav_enter();
+	vimnav.y = 5;
+	vimnav.x = 0;
+	vimnav.savedx = 0;
+
+	ASSERT_EQ(1, vimnav_handle_key('{', 0));
+	ASSERT_EQ(3, vimnav.y);  /* "$ " in the output is not a prompt */
+
+	ASSERT_EQ(1, vimnav_handle_key('}', 0));
+	ASSERT_EQ(20, vimnav.y);
+	/* the command starts where OSC 133;B said, not after "> " */
+	ASSERT_EQ(2, vimnav.x);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
+/* Test: go selects the lines the last command wrote */
+TEST(vimnav_go_selects_last_output)
+{
+	mock_term_init(24, 80);
+	mock_set_line(3, "$ make");
+	mock_set_line(4, "cc -c st.c");
+	mock_set_line(5, "cc -o st st.o");
+	mock_set_line(6, "$ ");
+	mock_set_mark(3, MARK_PROMPT | 3);
+	mock_set_mark(4, MARK_OUTPUT);
+	mock_set_mark(6, MARK_PROMPT | MARK_END | 3);
+
+	term.c.x = 2;
+	term.c.y = 6;
+	term.scr = 0;
+	vimnav.zsh_cursor = 0;
+
+	vimnav_enter();
+	ASSERT_EQ(1, vimnav_handle_key('g', 0));
+	ASSERT_EQ(1, vimnav_handle_key('o', 0));
+
+	ASSERT_EQ(3, vimnav.mode);  /* VIMNAV_VISUAL_LINE */
+	ASSERT_EQ(4, vimnav.anchor_abs_y);
+	ASSERT_EQ(5, vimnav.y);
+	ASSERT_EQ(4, mock_state.last_selstart.y);
+	ASSERT_EQ(5, mock_state.last_selextend.y);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
 /* Regression: { and } should preserve the cursor column (savedx). */
 TEST(vimnav_prompt_jump_preserves_savedx)
 {
@@ -3408,7 +3478,7 @@ TEST(vimnav_ctrl_y_no_scroll_no_cursor_move)
 	mock_term_init(24, 80);
 
 	/* No history content at all */
-	term.histi = 0;
+	term.histn = 0;
 	mock_set_line(23, "% prompt");
 
 	term.c.x = 0;
@@ -3559,6 +3629,176 @@ TEST(vimnav_ctrl_percent_scrolled_uses_full_screen)
 	mock_term_free();
 }
 
+/* === Search (/, ?, n, N) tests === */
+
+static void
+type_keys(const char *s)
+{
+	while (*s)
+		vimnav_handle_key((unsigned char)*s++, 0);
+}
+
+/* Test: / jumps forward to the next match while the pattern is typed */
+TEST(vimnav_search_slash_jumps_forward)
+{
+	mock_term_init(24, 80);
+	mock_set_line(3, "foo");
+	mock_set_line(8, "bar foo");
+	term.c.x = 0;
+	term.c.y = 23;
+	term.scr = 0;
+
+	vimnav_enter();
+	vimnav.y = 5;
+	vimnav.x = 0;
+	vimnav.savedx = 0;
+
+	ASSERT_EQ(1, vimnav_handle_key('/', 0));
+	type_keys("fo");
+	ASSERT_EQ(8, vimnav.y);
+	ASSERT_EQ(4, vimnav.x);
+	ASSERT_STR_EQ("/fo", vimnav_search_prompt());
+
+	ASSERT_EQ(1, vimnav_handle_key(0xff0d, 0));  /* Return */
+	ASSERT(vimnav_search_prompt() == NULL);
+	ASSERT_EQ(8, vimnav.y);
+	ASSERT_EQ(4, vimnav.x);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
+/* Test: ? searches backward, n keeps the direction and N reverses it */
+TEST(vimnav_search_question_n_N)
+{
+	mock_term_init(24, 80);
+	mock_set_line(3, "foo");
+	mock_set_line(8, "bar foo");
+	term.c.x = 0;
+	term.c.y = 23;
+	term.scr = 0;
+
+	vimnav_enter();
+	vimnav.y = 10;
+	vimnav.x = 0;
+	vimnav.savedx = 0;
+
+	vimnav_handle_key('?', 0);
+	type_keys("foo");
+	vimnav_handle_key(0xff0d, 0);
+	ASSERT_EQ(8, vimnav.y);
+	ASSERT_EQ(4, vimnav.x);
+
+	ASSERT_EQ(1, vimnav_handle_key('n', 0));
+	ASSERT_EQ(3, vimnav.y);
+	ASSERT_EQ(0, vimnav.x);
+
+	ASSERT_EQ(1, vimnav_handle_key('N', 0));
+	ASSERT_EQ(8, vimnav.y);
+	ASSERT_EQ(4, vimnav.x);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
+/* Test: Escape while typing puts the cursor back where it was */
+TEST(vimnav_search_escape_restores_cursor)
+{
+	mock_term_init(24, 80);
+	mock_set_line(8, "bar foo");
+	term.c.x = 0;
+	term.c.y = 23;
+	term.scr = 0;
+
+	vimnav_enter();
+	vimnav.y = 5;
+	vimnav.x = 2;
+	vimnav.savedx = 2;
+
+	vimnav_handle_key('/', 0);
+	type_keys("foo");
+	ASSERT_EQ(8, vimnav.y);
+
+	ASSERT_EQ(1, vimnav_handle_key(0xff1b, 0));  /* Escape */
+	ASSERT(vimnav_search_prompt() == NULL);
+	ASSERT_EQ(5, vimnav.y);
+	ASSERT_EQ(2, vimnav.x);
+	ASSERT_EQ(1, vimnav.mode);  /* Still in VIMNAV_NORMAL */
+
+	/* No pattern left: n is not a search */
+	ASSERT_EQ(0, vimnav_handle_key('n', 0));
+
+	vimnav_exit();
+	mock_term_free();
+}
+
+/* Test: BackSpace edits the pattern and leaves the search once empty */
+TEST(vimnav_search_backspace)
+{
+	mock_term_init(24, 80);
+	mock_set_line(8, "fox");
+	mock_set_line(12, "foo");
+	term.c.x = 0;
+	term.c.y = 23;
+	term.scr = 0;
+
+	vimnav_enter();
+	vimnav.y = 5;
+	vimnav.x = 0;
+	vimnav.savedx = 0;
+
+	vimnav_handle_key('/', 0);
+	type_keys("foo");
+	ASSERT_EQ(12, vimnav.y);
+
+	vimnav_handle_key(0xff08, 0);  /* BackSpace */
+	ASSERT_STR_EQ("/fo", vimnav_search_prompt());
+	ASSERT_EQ(8, vimnav.y);
+
+	vimnav_handle_key(0xff08, 0);
+	vimnav_handle_key(0xff08, 0);
+	ASSERT_STR_EQ("/", vimnav_search_prompt());
+	ASSERT_EQ(5, vimnav.y);
+
+	vimnav_handle_key(0xff08, 0);
+	ASSERT(vimnav_search_prompt() == NULL);
+	ASSERT_EQ(1, vimnav.mode);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
+/* Test: a match in the history scrolls it to the middle of the screen */
+TEST(vimnav_search_scrolls_to_history_match)
+{
+	mock_term_init(24, 80);
+	term.histn = 100;
+	mock_set_hist(30, "the needle");
+	term.c.x = 0;
+	term.c.y = 23;
+	term.scr = 0;
+
+	vimnav_enter();
+	vimnav.y = 10;
+	vimnav.x = 0;
+	vimnav.savedx = 0;
+
+	vimnav_handle_key('?', 0);
+	type_keys("needle");
+	/* hist index 30 of 100 is line -71 */
+	ASSERT_EQ(12 + 71, term.scr);
+	ASSERT_EQ(12, vimnav.y);
+	ASSERT_EQ(4, vimnav.x);
+
+	/* Escape goes back to the screen it started from */
+	vimnav_handle_key(0xff1b, 0);
+	ASSERT_EQ(0, term.scr);
+	ASSERT_EQ(10, vimnav.y);
+
+	vimnav_exit();
+	mock_term_free();
+}
+
 /* Test suite */
 TEST_SUITE(vimnav)
 {
@@ -3684,6 +3924,8 @@ TEST_SUITE(vimnav)
 	RUN_TEST(vimnav_close_brace_no_next_prompt_goes_to_current);
 	RUN_TEST(vimnav_open_brace_ignores_percent_in_output);
 	RUN_TEST(vimnav_close_brace_ignores_percent_in_output);
+	RUN_TEST(vimnav_open_brace_uses_prompt_marks);
+	RUN_TEST(vimnav_go_selects_last_output);
 	RUN_TEST(vimnav_prompt_jump_preserves_savedx);
 	RUN_TEST(vimnav_prompt_jump_clamps_to_line_length);
 
@@ -3695,6 +3937,12 @@ TEST_SUITE(vimnav)
 	RUN_TEST(vimnav_ctrl_minus_jumps_to_bottom);
 	RUN_TEST(vimnav_ctrl_percent_respects_prompt);
 	RUN_TEST(vimnav_ctrl_percent_scrolled_uses_full_screen);
+	/* Search tests */
+	RUN_TEST(vimnav_search_slash_jumps_forward);
+	RUN_TEST(vimnav_search_question_n_N);
+	RUN_TEST(vimnav_search_escape_restores_cursor);
+	RUN_TEST(vimnav_search_backspace);
+	RUN_TEST(vimnav_search_scrolls_to_history_match);
 }
 
 /* === Prompt line range tests === */
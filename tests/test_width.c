@@ -0,0 +1,101 @@
+/* See LICENSE for license details. */
+/* Unit tests for the generated rune width table */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "test.h"
+#include "width.h"
+
+/* reference widths, picked from the places wcwidth() tends to disagree */
+static const struct {
+	Rune u;
+	int width;
+} reference[] = {
+	{ 0x0041, 1 },  /* LATIN CAPITAL LETTER A */
+	{ 0x00A0, 1 },  /* NO-BREAK SPACE */
+	{ 0x00AD, 1 },  /* SOFT HYPHEN is visible */
+	{ 0x00E9, 1 },  /* LATIN SMALL LETTER E WITH ACUTE */
+	{ 0x0301, 0 },  /* COMBINING ACUTE ACCENT */
+	{ 0x0488, 0 },  /* COMBINING CYRILLIC HUNDRED THOUSANDS SIGN (Me) */
+	{ 0x05D0, 1 },  /* HEBREW LETTER ALEF */
+	{ 0x0E31, 0 },  /* THAI CHARACTER MAI HAN-AKAT */
+	{ 0x1100, 2 },  /* HANGUL CHOSEONG KIYEOK */
+	{ 0x1160, 0 },  /* HANGUL JUNGSEONG FILLER */
+	{ 0x11A8, 0 },  /* HANGUL JONGSEONG KIYEOK */
+	{ 0x200B, 0 },  /* ZERO WIDTH SPACE */
+	{ 0x200D, 0 },  /* ZERO WIDTH JOINER */
+	{ 0x2500, 1 },  /* BOX DRAWINGS LIGHT HORIZONTAL */
+	{ 0x2588, 1 },  /* FULL BLOCK */
+	{ 0x231A, 2 },  /* WATCH (emoji presentation) */
+	{ 0x2764, 1 },  /* HEAVY BLACK HEART (text presentation) */
+	{ 0x3000, 2 },  /* IDEOGRAPHIC SPACE */
+	{ 0x3042, 2 },  /* HIRAGANA LETTER A */
+	{ 0x4E2D, 2 },  /* CJK UNIFIED IDEOGRAPH-4E2D */
+	{ 0xAC00, 2 },  /* HANGUL SYLLABLE GA */
+	{ 0xE000, 1 },  /* private use */
+	{ 0xFE0F, 0 },  /* VARIATION SELECTOR-16 */
+	{ 0xFF21, 2 },  /* FULLWIDTH LATIN CAPITAL LETTER A */
+	{ 0xFF61, 1 },  /* HALFWIDTH IDEOGRAPHIC FULL STOP */
+	{ 0xFEFF, 0 },  /* ZERO WIDTH NO-BREAK SPACE */
+	{ 0x1F600, 2 }, /* GRINNING FACE */
+	{ 0x1F680, 2 }, /* ROCKET */
+	{ 0x1F3FB, 2 }, /* EMOJI MODIFIER FITZPATRICK TYPE-1-2 */
+	{ 0x20000, 2 }, /* CJK UNIFIED IDEOGRAPH-20000 */
+	{ 0x2FFFD, 2 }, /* unassigned, CJK plane */
+	{ 0xE0001, 0 }, /* LANGUAGE TAG */
+	{ 0xE0100, 0 }, /* VARIATION SELECTOR-17 */
+	{ 0x10FFFF, 1 },
+	{ 0x110000, 1 }, /* past the end of Unicode */
+};
+
+TEST(width_reference)
+{
+	size_t i;
+
+	for (i = 0; i < LEN(reference); i++) {
+		if (runewidth(reference[i].u) != reference[i].width)
+			printf("\n    U+%04X ", (unsigned)reference[i].u);
+		ASSERT_EQ(reference[i].width, runewidth(reference[i].u));
+	}
+}
+
+TEST(width_ascii_is_single)
+{
+	Rune u;
+
+	for (u = 0x20; u < 0x7f; u++)
+		ASSERT_EQ(1, runewidth(u));
+}
+
+TEST(width_in_range)
+{
+	Rune u;
+	int w;
+
+	for (u = 0; u < 0x110000; u++) {
+		w = runewidth(u);
+		ASSERT(w >= 0 && w <= 2);
+	}
+}
+
+/* Test suite */
+TEST_SUITE(width)
+{
+	RUN_TEST(width_reference);
+	RUN_TEST(width_ascii_is_single);
+	RUN_TEST(width_in_range);
+}
+
+int
+main(void)
+{
+	printf("st width test suite\n");
+	printf("========================================\n");
+
+	RUN_SUITE(width);
+
+	return test_summary();
+}
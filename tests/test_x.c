@@ -0,0 +1,783 @@
+/* See LICENSE for license details. */
+/*
+ * Tests of the caches, drawing bookkeeping and paste pipeline of the X
+ * frontend. x.c is included for its static state and linked against the
+ * real Xlib and Xft, with no display: the few calls that would need one
+ * are replaced below by ones that count what they were asked to do.
+ */
+
+#define main stmain
+#include "../x.c"
+#undef main
+
+#include <fcntl.h>
+
+#include "test.h"
+
+static int nindex;              /* XftCharIndex() calls */
+static int nalloc, nfree;       /* colours allocated and freed */
+static uchar freed[1 << 16];    /* by pixel */
+static XRectangle copies[64];   /* XCopyArea() calls, by destination */
+static int ncopy;
+static XRectangle rects[64];    /* XftDrawRect() calls */
+static int nrects;
+static struct {
+	int x, len;
+} runs[64];                     /* XftDrawGlyphFontSpec() calls */
+static int nruns;
+static struct {
+	Atom type;
+	char *data;
+	size_t len;
+} prop;                         /* the selection, as the owner put it */
+static int nfetch, ndelete;     /* XGetWindowProperty(), XDeleteProperty() */
+static int ttyout[2];           /* what ttyflush() wrote */
+static char out[1 << 20];
+static size_t nout;
+
+#define INCRATOM	1
+#define PROPATOM	2
+
+FT_UInt
+XftCharIndex(Display *dpy, XftFont *pub, FcChar32 ucs4)
+{
+	nindex++;
+	return ucs4 + 1;
+}
+
+Bool
+XftColorAllocValue(Display *dpy, Visual *visual, Colormap cmap,
+                   const XRenderColor *color, XftColor *result)
+{
+	result->pixel = ++nalloc;
+	result->color = *color;
+	return True;
+}
+
+void
+XftColorFree(Display *dpy, Visual *visual, Colormap cmap, XftColor *color)
+{
+	nfree++;
+	freed[color->pixel] = 1;
+}
+
+int
+XCopyArea(Display *dpy, Drawable src, Drawable dst, GC gc, int sx, int sy,
+          unsigned int w, unsigned int h, int dx, int dy)
+{
+	if (ncopy < LEN(copies))
+		copies[ncopy] = (XRectangle){ dx, dy, w, h };
+	ncopy++;
+	return 0;
+}
+
+int
+XSetForeground(Display *dpy, GC gc, unsigned long pixel)
+{
+	return 0;
+}
+
+void
+XftDrawRect(XftDraw *draw, const XftColor *color, int x, int y,
+            unsigned int width, unsigned int height)
+{
+	if (nrects < LEN(rects))
+		rects[nrects] = (XRectangle){ x, y, width, height };
+	nrects++;
+}
+
+void
+XftDrawGlyphFontSpec(XftDraw *draw, const XftColor *color,
+                     const XftGlyphFontSpec *glyphs, int len)
+{
+	if (nruns < LEN(runs)) {
+		runs[nruns].x = glyphs[0].x;
+		runs[nruns].len = len;
+	}
+	nruns++;
+}
+
+Atom
+XInternAtom(Display *dpy, const char *name, Bool only)
+{
+	return strcmp(name, "INCR") ? PROPATOM + 1 : INCRATOM;
+}
+
+int
+XGetWindowProperty(Display *dpy, Window w, Atom p, long ofs, long len,
+                   Bool del, Atom req, Atom *type, int *format,
+                   unsigned long *nitems, unsigned long *rem,
+                   unsigned char **data)
+{
+	size_t o = MIN(ofs * 4, prop.len), n = MIN(len * 4, prop.len - o);
+
+	nfetch++;
+	*type = prop.type;
+	*format = 8;
+	*nitems = n;
+	*rem = prop.len - o - n;
+	*data = xmalloc(n + 1);
+	memcpy(*data, prop.data + o, n);
+	return Success;
+}
+
+int
+XDeleteProperty(Display *dpy, Window w, Atom p)
+{
+	ndelete++;
+	return 0;
+}
+
+Bool
+XftDrawSetClipRectangles(XftDraw *draw, int xorigin, int yorigin,
+                         const XRectangle *r, int n)
+{
+	return True;
+}
+
+Bool
+XftDrawSetClip(XftDraw *draw, Region r)
+{
+	return True;
+}
+
+/* a frontend with cells of 8 by 16 pixels and nothing drawn yet */
+static void
+setup(void)
+{
+	win.cw = 8;
+	win.ch = 16;
+	win.w = 800;
+	win.h = 600;
+	dc.font.ascent = 12;
+	xglyphcacheclear();
+	nindex = 0;
+	memset(colcache, 0, sizeof(colcache));
+	colclock = 0;
+	memset(freed, 0, sizeof(freed));
+	nalloc = nfree = 0;
+	ndamage = damagearea = ncopy = 0;
+}
+
+static int
+rectis(const XRectangle *r, int x, int y, int w, int h)
+{
+	return r->x == x && r->y == y && r->width == w && r->height == h;
+}
+
+/* a col by row window to draw lines into, with nothing drawn yet */
+static void
+drawsetup(int col, int row)
+{
+	static Color col0[512];
+
+	setup();
+	win.tw = col * win.cw;
+	win.th = row * win.ch;
+	dc.col = col0;
+	dc.collen = LEN(col0);
+	styleinit(defaultfg, defaultbg);
+	xw.specbuf = xrealloc(xw.specbuf, col * sizeof(GlyphFontSpec));
+	xshadowresize(col, row);
+	selinit();
+}
+
+static void
+setline(Glyph *l, const char *s, int n)
+{
+	int x;
+
+	for (x = 0; x < n; x++)
+		l[x] = (Glyph){ .u = s[x] ? s[x] : ' ' };
+}
+
+/* draw row y of l, and which of its cells were drawn as '#' */
+static char *
+drawn(Glyph *l, int y)
+{
+	static char buf[64];
+	XRectangle *r;
+	int x;
+
+	nrects = nruns = 0;
+	xdrawline(l, 0, y, shadowcol);
+	memset(buf, '.', shadowcol);
+	buf[shadowcol] = '\0';
+	for (r = rects; r < &rects[MIN(nrects, LEN(rects))]; r++) {
+		/* the borders are cleared along with the cells */
+		if (r->y != borderpx + y * win.ch || r->height != win.ch ||
+		    r->x < borderpx || r->x >= borderpx + win.tw)
+			continue;
+		for (x = 0; x < r->width / win.cw; x++)
+			buf[(r->x - borderpx) / win.cw + x] = '#';
+	}
+	return buf;
+}
+
+/* the selection is now s, n bytes of it, or an INCR transfer */
+static void
+setprop(Atom type, char *s, size_t n)
+{
+	prop.type = type;
+	prop.data = s;
+	prop.len = n;
+}
+
+/* let the child read what was queued for it */
+static void
+ttydrain(void)
+{
+	ssize_t n;
+
+	ttyflush();
+	while ((n = read(ttyout[0], out + nout, sizeof(out) - nout)) > 0)
+		nout += n;
+}
+
+/* a tty that ttyflush() writes to, and nothing pasted yet */
+static void
+pastesetup(void)
+{
+	/* cmdfd is 0 while no tty was opened */
+	if (pipe(ttyout) < 0 || dup2(ttyout[1], 0) < 0)
+		die("pipe: %s\n", strerror(errno));
+	fcntl(0, F_SETFL, O_NONBLOCK);
+	fcntl(ttyout[0], F_SETFL, O_NONBLOCK);
+	/* and not what a test before left behind */
+	paste.state = PASTE_IDLE;
+	paste.off = paste.len = 0;
+	win.mode &= ~MODE_BRCKTPASTE;
+	do {
+		nout = 0;
+		ttydrain();
+	} while (ttypending() > 0);
+	nout = 0;
+	nfetch = ndelete = 0;
+}
+
+static void
+pastenotify(int type)
+{
+	XEvent e = { .type = type };
+
+	if (type == SelectionNotify)
+		e.xselection.property = PROPATOM;
+	else
+		e.xproperty.atom = PROPATOM;
+	selnotify(&e);
+}
+
+static XRenderColor
+rgb(int i)
+{
+	return (XRenderColor){
+		.red = i * 257, .green = i * 7, .blue = i * 13, .alpha = 0xffff
+	};
+}
+
+/* the set of the cache colour c goes in */
+static int
+colset(XRenderColor c)
+{
+	Color *p = xcolorfind(&c, 0);
+
+	return (ColorCache *)p - &colcache[0][0];
+}
+
+/* n colours that go in the same set as rgb(0) */
+static void
+sameset(XRenderColor *c, int n)
+{
+	int i, k, set;
+
+	setup();
+	set = colset(rgb(0)) / COLWAYS;
+	for (i = k = 0; k < n; i++) {
+		memset(colcache, 0, sizeof(colcache));
+		if (colset(rgb(i)) / COLWAYS == set)
+			c[k++] = rgb(i);
+	}
+	setup();
+}
+
+TEST(glyph_cache_keeps_each_style)
+{
+	GlyphCache *gc;
+	Rune u;
+	int i;
+
+	setup();
+	gc = xglyphcache('a', FRC_NORMAL);
+	ASSERT_EQ(0, gc->font);
+	gc->font = 1;
+	gc->glyph = 42;
+	ASSERT(xglyphcache('a', FRC_NORMAL) == gc);
+	ASSERT_EQ(42, (int)xglyphcache('a', FRC_NORMAL)->glyph);
+	ASSERT_EQ(0, xglyphcache('a', FRC_BOLD)->font);
+
+	/* the runes past the BMP go in the hash, which grows */
+	for (i = 0; i < 1000; i++) {
+		gc = xglyphcache(0x1f600 + i, i % 4);
+		ASSERT_EQ(0, gc->font);
+		gc->font = 2 + i % 7;
+		gc->glyph = i;
+	}
+	for (i = 0; i < 1000; i++) {
+		gc = xglyphcache(0x1f600 + i, i % 4);
+		ASSERT_EQ(2 + i % 7, gc->font);
+		ASSERT_EQ(i, (int)gc->glyph);
+		ASSERT_EQ(0, xglyphcache(0x1f600 + i, (i + 1) % 4)->font);
+	}
+
+	xglyphcacheclear();
+	ASSERT_EQ(0, xglyphcache('a', FRC_NORMAL)->font);
+	ASSERT_EQ(0, xglyphcache(0x1f600, 0)->font);
+
+	/* and once the gen goes round, the tables are cleared for real */
+	for (u = 'b'; u < 'z'; u++)
+		xglyphcache(u, FRC_ITALIC)->font = 1;
+	gcgen = USHRT_MAX;
+	xglyphcache('a', FRC_ITALIC)->font = 1;
+	xglyphcacheclear();
+	ASSERT_EQ(1, gcgen);
+	for (u = 'a'; u < 'z'; u++)
+		ASSERT_EQ(0, xglyphcache(u, FRC_ITALIC)->font);
+}
+
+TEST(glyph_cache_spares_xft)
+{
+	static const Rune text[] = { 'h', 'e', 'l', 'l', 'o', ' ', 0x4e2d };
+	XftGlyphFontSpec a[16], b[16];
+	Glyph g[16];
+	int i, n, k;
+
+	setup();
+	for (i = n = 0; i < LEN(text); i++, n++) {
+		g[n] = (Glyph){ .u = text[i] };
+		if (text[i] == 0x4e2d) {
+			g[n].mode = ATTR_WIDE;
+			g[++n] = (Glyph){ .mode = ATTR_WDUMMY };
+		}
+	}
+	k = xmakeglyphfontspecs(a, g, n, 0, 0);
+	ASSERT_EQ(7, k);
+	/* each rune once, the second 'l' from the cache */
+	ASSERT_EQ(6, nindex);
+	ASSERT_EQ(borderpx + 8 * 6, a[6].x);
+
+	ASSERT_EQ(k, xmakeglyphfontspecs(b, g, n, 0, 0));
+	ASSERT_EQ(6, nindex);
+	for (i = 0; i < k; i++) {
+		ASSERT_EQ(a[i].glyph, b[i].glyph);
+		ASSERT_EQ(a[i].x, b[i].x);
+		ASSERT_EQ(a[i].y, b[i].y);
+	}
+
+	/* new fonts: it asks again */
+	xglyphcacheclear();
+	xmakeglyphfontspecs(b, g, n, 0, 0);
+	ASSERT_EQ(12, nindex);
+}
+
+TEST(color_cache_hits)
+{
+	XRenderColor c = rgb(1), d = rgb(2);
+	Color *p;
+
+	setup();
+	p = xcolorrgb(&c);
+	ASSERT_EQ(1, nalloc);
+	ASSERT(p == xcolorrgb(&c));
+	ASSERT(p != xcolorrgb(&d));
+	ASSERT(p == xcolorrgb(&c));
+	ASSERT_EQ(2, nalloc);
+	ASSERT_EQ(c.red, p->color.red);
+	ASSERT_EQ(c.blue, p->color.blue);
+}
+
+TEST(color_cache_evicts_the_oldest)
+{
+	XRenderColor c[COLWAYS + 1], d;
+	unsigned long pix[COLWAYS + 1];
+	int i;
+
+	sameset(c, LEN(c));
+	for (i = 0; i < COLWAYS; i++)
+		pix[i] = xcolorrgb(&c[i])->pixel;
+	ASSERT_EQ(COLWAYS, nalloc);
+	/* a full set gives up its least recently used colour */
+	xcolorrgb(&c[0]);
+	pix[COLWAYS] = xcolorrgb(&c[COLWAYS])->pixel;
+	ASSERT_EQ(1, nfree);
+	ASSERT(freed[pix[1]]);
+	for (i = 2; i <= COLWAYS; i++)
+		ASSERT_EQ(pix[i], xcolorrgb(&c[i])->pixel);
+	ASSERT_EQ(pix[0], xcolorrgb(&c[0])->pixel);
+	ASSERT_EQ(COLWAYS + 1, nalloc);
+
+	/* and however many come, only the cache's worth stay allocated */
+	for (i = 0; i < 5000; i++) {
+		d = rgb(i);
+		xcolorrgb(&d);
+	}
+	ASSERT(nalloc - nfree <= COLSETS * COLWAYS + COLWAYS);
+	ASSERT(nfree > 0);
+}
+
+TEST(color_cache_keeps_held_colors)
+{
+	XRenderColor c[COLWAYS + 1];
+	unsigned long pix[COLWAYS];
+	Color *p;
+	int i;
+
+	sameset(c, LEN(c));
+	for (i = 0; i < COLWAYS; i++)
+		pix[i] = xcolorfind(&c[i], 1)->pixel;
+	/* no room: the colour is for this draw only */
+	for (i = 0; i < 3 * COLWAYS; i++) {
+		p = xcolorrgb(&c[COLWAYS]);
+		ASSERT_EQ(c[COLWAYS].red, p->color.red);
+	}
+	for (i = 0; i < COLWAYS; i++) {
+		ASSERT(!freed[pix[i]]);
+		ASSERT_EQ(pix[i], xcolorrgb(&c[i])->pixel);
+	}
+
+	/* a released one can go */
+	xcolorrelease(xcolorrgb(&c[1]));
+	for (i = 0; i < 2 * COLWAYS; i++)
+		xcolorrgb(&c[COLWAYS]);
+	ASSERT(freed[pix[1]]);
+	ASSERT(!freed[pix[0]] && !freed[pix[2]] && !freed[pix[3]]);
+}
+
+TEST(damage_joins_runs_and_rows)
+{
+	setup();
+	xdamage(10, 0, 8, 16);
+	xdamage(18, 0, 16, 16);
+	xdamage(26, 0, 8, 16);
+	ASSERT_EQ(1, ndamage);
+	ASSERT(rectis(&damage[0], 10, 0, 24, 16));
+
+	/* a row as wide goes with the one above */
+	xdamage(10, 16, 24, 16);
+	ASSERT_EQ(1, ndamage);
+	ASSERT(rectis(&damage[0], 10, 0, 24, 32));
+	/* once it has become as wide */
+	xdamage(10, 32, 8, 16);
+	ASSERT_EQ(2, ndamage);
+	xdamage(18, 32, 16, 16);
+	ASSERT_EQ(1, ndamage);
+	ASSERT(rectis(&damage[0], 10, 0, 24, 48));
+
+	xdamage(400, 300, 8, 16);
+	xdamage(400, 300, 0, 16);
+	ASSERT_EQ(2, ndamage);
+	xfinishdraw();
+	ASSERT_EQ(2, ncopy);
+	ASSERT(rectis(&copies[0], 10, 0, 24, 48));
+	ASSERT(rectis(&copies[1], 400, 300, 8, 16));
+	ASSERT_EQ(0, ndamage);
+	ASSERT_EQ(0, damagearea);
+}
+
+TEST(damage_falls_back_to_full_copy)
+{
+	int i;
+
+	/* half of the window */
+	setup();
+	xdamage(0, 0, 800, 290);
+	ASSERT(damagearea > 0);
+	xdamage(0, 400, 800, 20);
+	ASSERT_EQ(-1, damagearea);
+	xdamage(0, 500, 8, 8);
+	xfinishdraw();
+	ASSERT_EQ(1, ncopy);
+	ASSERT(rectis(&copies[0], 0, 0, 800, 600));
+
+	/* more rectangles than are copied one by one */
+	setup();
+	for (i = 0; i < DAMAGEMAX; i++)
+		xdamage(i * 20, i * 16, 8, 16);
+	ASSERT_EQ(DAMAGEMAX, ndamage);
+	xdamage(700, 0, 8, 16);
+	ASSERT_EQ(-1, damagearea);
+	xfinishdraw();
+	ASSERT_EQ(1, ncopy);
+	ASSERT(rectis(&copies[0], 0, 0, 800, 600));
+}
+
+TEST(damage_waits_for_unlock_if_threaded)
+{
+	setup();
+	threadedreader = 1;
+	xdamage(10, 0, 8, 16);
+	xfinishdraw();
+	xdamage(10, 32, 8, 16);
+	xfinishdraw();
+	threadedreader = 0;
+	/* the frames are kept to copy outside the terminal lock */
+	ASSERT_EQ(0, ncopy);
+	xshow();
+	ASSERT_EQ(2, ncopy);
+	ASSERT(rectis(&copies[1], 10, 32, 8, 16));
+	xshow();
+	ASSERT_EQ(2, ncopy);
+}
+
+TEST(shadow_draws_only_changes)
+{
+	Glyph l[10];
+
+	drawsetup(10, 3);
+	setline(l, "hello wrld", 10);
+	ASSERT_STR_EQ("##########", drawn(l, 0));
+	ASSERT_EQ(1, nruns);
+	ASSERT_EQ(10, runs[0].len);
+	ASSERT_STR_EQ("..........", drawn(l, 0));
+	ASSERT_EQ(0, nruns);
+	/* the other rows have their own shadow */
+	ASSERT_STR_EQ("##########", drawn(l, 1));
+
+	l[7].u = 'o';
+	ASSERT_STR_EQ(".......#..", drawn(l, 0));
+	ASSERT_EQ(1, nruns);
+	ASSERT_EQ(borderpx + 7 * win.cw, runs[0].x);
+	l[2].u = l[3].u = 'L';
+	l[8].u = 'd';
+	ASSERT_STR_EQ("..##....#.", drawn(l, 0));
+	ASSERT_EQ(2, nruns);
+	ASSERT_EQ(2, runs[0].len);
+	ASSERT_EQ(borderpx + 8 * win.cw, runs[1].x);
+
+	/* blank cells are their background alone */
+	l[1].u = l[2].u = l[3].u = ' ';
+	ASSERT_STR_EQ(".###......", drawn(l, 0));
+	ASSERT_EQ(0, nruns);
+
+	/* a change of attributes is a change */
+	l[0].mode = ATTR_UNDERLINE;
+	ASSERT_STR_EQ("#.........", drawn(l, 0));
+	ASSERT_STR_EQ("..........", drawn(l, 0));
+}
+
+TEST(shadow_draws_wide_chars_whole)
+{
+	Glyph l[10];
+
+	drawsetup(10, 3);
+	setline(l, "ab", 10);
+	l[5] = (Glyph){ .u = 0x4e2d, .mode = ATTR_WIDE };
+	l[6] = (Glyph){ .mode = ATTR_WDUMMY };
+	ASSERT_STR_EQ("##########", drawn(l, 0));
+
+	l[5].u = 0x6587;
+	ASSERT_STR_EQ(".....##...", drawn(l, 0));
+	ASSERT_EQ(1, nruns);
+	ASSERT_EQ(1, runs[0].len);
+	/* the cell after it went blank with it */
+	l[5] = (Glyph){ .u = 'x' };
+	l[6] = (Glyph){ .u = ' ' };
+	ASSERT_STR_EQ(".....##...", drawn(l, 0));
+}
+
+TEST(shadow_redraws_when_told)
+{
+	Glyph l[10];
+
+	drawsetup(10, 3);
+	setline(l, "blink here", 10);
+	l[9].mode = ATTR_BLINK;
+	ASSERT_STR_EQ("##########", drawn(l, 0));
+	/* blinking cells change without a change of glyph */
+	ASSERT_STR_EQ(".........#", drawn(l, 0));
+
+	/* the cursor went over cell 3 */
+	xshadowdrop(3, 0);
+	ASSERT_STR_EQ("...#.....#", drawn(l, 0));
+	xshadowclear();
+	ASSERT_STR_EQ("##########", drawn(l, 0));
+}
+
+TEST(shadow_follows_scrolls)
+{
+	Glyph a[10], b[10], c[10];
+
+	drawsetup(10, 3);
+	setline(a, "first", 10);
+	setline(b, "second", 10);
+	setline(c, "third", 10);
+	drawn(a, 0);
+	drawn(b, 1);
+	drawn(c, 2);
+
+	/* up by one: the rows below are copied up, not drawn again */
+	ncopy = 0;
+	xscroll(0, 2, 1);
+	ASSERT_EQ(1, ncopy);
+	ASSERT(rectis(&copies[0], borderpx, borderpx, 80, 32));
+	ASSERT_STR_EQ("..........", drawn(b, 0));
+	ASSERT_STR_EQ("..........", drawn(c, 1));
+
+	/* down by one within rows 1 to 2 */
+	xscroll(1, 2, -1);
+	ASSERT_EQ(2, ncopy);
+	ASSERT(rectis(&copies[1], borderpx, borderpx + 32, 80, 16));
+	ASSERT_STR_EQ("..........", drawn(c, 2));
+	ASSERT_STR_EQ("..........", drawn(b, 0));
+
+	/* by the whole region or more there is nothing to copy */
+	xscroll(0, 2, 3);
+	xscroll(0, 3, 1);
+	ASSERT_EQ(2, ncopy);
+}
+
+TEST(paste_keeps_pace_with_the_child)
+{
+	static char sel[600 << 10];
+	size_t i;
+
+	for (i = 0; i < sizeof(sel); i++)
+		sel[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+	pastesetup();
+	setprop(XA_STRING, sel, sizeof(sel));
+	win.mode |= MODE_BRCKTPASTE;
+
+	/* no more than a queue's worth goes out before the child reads */
+	pastenotify(SelectionNotify);
+	ASSERT_EQ(1, nfetch);
+	ASSERT(ttypending() < PASTEQUEUE + PASTECHUNK);
+	ASSERT(paste.state != PASTE_IDLE);
+	while (paste.state != PASTE_IDLE) {
+		ttydrain();
+		pastepump();
+		ASSERT(ttypending() < PASTEQUEUE + PASTECHUNK);
+	}
+	ttydrain();
+	win.mode &= ~MODE_BRCKTPASTE;
+
+	/* all of it, once bracketed, with \n as \r */
+	ASSERT_EQ(sizeof(sel) + 12, nout);
+	ASSERT(!memcmp(out, "\033[200~", 6));
+	ASSERT(!memcmp(out + nout - 6, "\033[201~", 6));
+	for (i = 0; i < sizeof(sel) && out[6 + i] == (sel[i] == '\n' ? '\r' :
+	     sel[i]); i++)
+		;
+	ASSERT_EQ(sizeof(sel), i);
+	ASSERT_EQ(sizeof(sel) / PASTEFETCH + 1, nfetch);
+	ASSERT_EQ(1, ndelete);
+	close(ttyout[0]);
+	close(ttyout[1]);
+}
+
+TEST(paste_follows_incr_and_aborts)
+{
+	static char big[100 << 10];
+	size_t sent;
+
+	pastesetup();
+	setprop(INCRATOM, NULL, 0);
+	pastenotify(SelectionNotify);
+	ASSERT_EQ(PASTE_WAIT, paste.state);
+	/* the owner is asked for each chunk once the last one is read */
+	ASSERT_EQ(1, ndelete);
+	setprop(XA_STRING, "one\n", 4);
+	pastenotify(PropertyNotify);
+	ASSERT_EQ(PASTE_WAIT, paste.state);
+	ASSERT_EQ(2, ndelete);
+	setprop(XA_STRING, "two", 3);
+	pastenotify(PropertyNotify);
+	setprop(XA_STRING, NULL, 0);
+	pastenotify(PropertyNotify);
+	ASSERT_EQ(PASTE_IDLE, paste.state);
+	ttydrain();
+	out[nout] = '\0';
+	ASSERT_STR_EQ("one\rtwo", out);
+
+	/* ^C takes back what is still queued, keys typed since stay */
+	nout = 0;
+	memset(big, 'x', sizeof(big));
+	setprop(XA_STRING, big, sizeof(big));
+	win.mode |= MODE_BRCKTPASTE;
+	pastenotify(SelectionNotify);
+	ASSERT(paste.len > 0);
+	ASSERT(ttypending() > 0);
+	ttywrite("k", 1, 0);
+	pasteabort();
+	ASSERT_EQ(0, (int)paste.len);
+	ASSERT_EQ(1, (int)ttypending());
+	ttydrain();
+	pastepump();
+	ASSERT_EQ(PASTE_IDLE, paste.state);
+	out[nout] = '\0';
+	ASSERT_STR_EQ("k", out);
+
+	/* once some went out, the rest is dropped and the bracket closed */
+	nout = 0;
+	pastenotify(SelectionNotify);
+	ttydrain();
+	sent = nout;
+	pasteabort();
+	win.mode &= ~MODE_BRCKTPASTE;
+	ttydrain();
+	pastepump();
+	ASSERT_EQ(PASTE_IDLE, paste.state);
+	ttydrain();
+	ASSERT_EQ(sent + 6, nout);
+	ASSERT(!memcmp(out, "\033[200~", 6));
+	ASSERT(!memcmp(out + nout - 6, "\033[201~", 6));
+	close(ttyout[0]);
+	close(ttyout[1]);
+}
+
+TEST_SUITE(glyphcache)
+{
+	RUN_TEST(glyph_cache_keeps_each_style);
+	RUN_TEST(glyph_cache_spares_xft);
+}
+
+TEST_SUITE(damage)
+{
+	RUN_TEST(damage_joins_runs_and_rows);
+	RUN_TEST(damage_falls_back_to_full_copy);
+	RUN_TEST(damage_waits_for_unlock_if_threaded);
+}
+
+TEST_SUITE(shadow)
+{
+	RUN_TEST(shadow_draws_only_changes);
+	RUN_TEST(shadow_draws_wide_chars_whole);
+	RUN_TEST(shadow_redraws_when_told);
+	RUN_TEST(shadow_follows_scrolls);
+}
+
+TEST_SUITE(paste)
+{
+	RUN_TEST(paste_keeps_pace_with_the_child);
+	RUN_TEST(paste_follows_incr_and_aborts);
+}
+
+TEST_SUITE(colorcache)
+{
+	RUN_TEST(color_cache_hits);
+	RUN_TEST(color_cache_evicts_the_oldest);
+	RUN_TEST(color_cache_keeps_held_colors);
+}
+
+int
+main(void)
+{
+	printf("st X frontend test suite\n");
+	printf("========================================\n");
+
+	RUN_SUITE(glyphcache);
+	RUN_SUITE(colorcache);
+	RUN_SUITE(damage);
+	RUN_SUITE(shadow);
+	RUN_SUITE(paste);
+
+	return test_summary();
+}
@@ -4,19 +4,16 @@
 #include <wctype.h>
 
 #include "st.h"
+#include "term.h"
 #include "vimnav.h"
+#include "search.h"
 
 /* X11 modifier masks (from X11/X.h) */
 #define ShiftMask   (1<<0)
 #define ControlMask (1<<2)
 
 /* Access to st.c internals */
-#define HISTSIZE      (1 << 15)
-#define IS_SET(flag)  ((term.mode & (flag)) != 0)
 #define ISDELIM(u)    (u && wcschr(worddelimiters, u))
-#define TLINE(y)      ((y) < term.scr ? term.hist[((y) + term.histi - \
-                      term.scr + HISTSIZE + 1) % HISTSIZE] : \
-                      term.line[(y) - term.scr])
 
 /* Vim navigation mode states (internal use) */
 enum vimnav_mode {
@@ -26,64 +23,7 @@ enum vimnav_mode {
 	VIMNAV_VISUAL_LINE = 3,
 };
 
-/* Terminal mode flags from st.c */
-enum term_mode {
-	MODE_WRAP        = 1 << 0,
-	MODE_INSERT      = 1 << 1,
-	MODE_ALTSCREEN   = 1 << 2,
-	MODE_CRLF        = 1 << 3,
-	MODE_ECHO        = 1 << 4,
-	MODE_PRINT       = 1 << 5,
-	MODE_UTF8        = 1 << 6,
-};
-
-/* Cursor structure */
-typedef struct {
-	Glyph attr;
-	int x;
-	int y;
-	char state;
-} TCursor;
-
-/* Selection structure */
-typedef struct {
-	int mode;
-	int type;
-	int snap;
-	struct {
-		int x, y;
-	} nb, ne, ob, oe;
-	int alt;
-} Selection;
-
-/* Terminal structure */
-typedef struct {
-	int row;
-	int col;
-	int maxcol;
-	Line *line;
-	Line *alt;
-	Line hist[HISTSIZE];
-	int histi;
-	int scr;
-	int *dirty;
-	TCursor c;
-	int ocx;
-	int ocy;
-	int top;
-	int bot;
-	int mode;
-	int esc;
-	char trantbl[4];
-	int charset;
-	int icharset;
-	int *tabs;
-	Rune lastc;
-} Term;
-
 /* Extern declarations for st.c globals */
-extern Term term;
-extern Selection sel;
 extern wchar_t *worddelimiters;
 
 /* Extern declarations for functions in st.c */
@@ -108,6 +48,7 @@ static void vimnav_update_selection(void);
 static void vimnav_notify_zsh_visual_end(void);
 static void vimnav_sync_to_zsh_cursor(void);
 static int vimnav_has_main_prompt(int screen_y);
+static void vimnav_goto(int x, int y);
 
 /* Notify zsh that visual mode selection has ended (send Escape) */
 static void
@@ -312,48 +253,43 @@ vimnav_move_right(void)
 static int
 vimnav_has_history_content(int scroll_offset)
 {
-	int i, idx;
+	int i;
 	/* Check up to 10 lines ahead in history for any content */
-	for (i = 0; i < 10 && scroll_offset + i < HISTSIZE; i++) {
-		/* Calculate the history index for this scroll position.
-		 * Must match TLINE macro: hist[(y + histi - scr + HISTSIZE + 1) % HISTSIZE]
-		 * For y=0 (top line) at scroll_offset, looking i lines further back: */
-		idx = (term.histi - scroll_offset - i + HISTSIZE + 1) % HISTSIZE;
-		if (term.hist[idx]) {
-			/* Check if this history line has content */
-			int j;
-			for (j = term.col - 1; j >= 0; j--) {
-				if (term.hist[idx][j].u != ' ' && term.hist[idx][j].u != 0) {
-					return 1;  /* Found content */
-				}
-			}
-		}
+	for (i = 0; i < 10 && scroll_offset + i <= term.histn + term.histdisk; i++) {
+		/* The top line at scroll_offset is TLINE(0), i.e.
+		 * thline(-scroll_offset); look i lines further back: */
+		if (thlinelen(-scroll_offset - i) > 0)
+			return 1;  /* Found content */
 	}
 	return 0;  /* No content found in lookahead */
 }
 
+/* Scroll the view back to scr lines, through kscrollup()/kscrolldown()
+ * so the move is noted for the scroll blit */
+static void
+vimnav_setscr(int scr)
+{
+	LIMIT(scr, 0, term.histn + term.histdisk);
+	if (scr > term.scr)
+		kscrollup(&(Arg){ .i = scr - term.scr });
+	else if (scr < term.scr)
+		kscrolldown(&(Arg){ .i = term.scr - scr });
+}
+
 /* Scroll helper that respects vim nav boundaries and moves cursor */
 static void
 vimnav_scroll_up(int n)
 {
-	int old_scr = term.scr;
 	int scrolled, remaining;
-	int i;
 	int linelen;
 
-	/* Scroll up incrementally, checking for content in history */
-	for (i = 0; i < n && term.scr < HISTSIZE - 1; i++) {
-		term.scr++;
-		/* Stop if there's no content anywhere in the history we'd scroll into */
-		if (!vimnav_has_history_content(term.scr)) {
-			term.scr--;
+	/* Stop where there's no content anywhere in the history we'd scroll into */
+	for (scrolled = 0; scrolled < n &&
+	     term.scr + scrolled < term.histn + term.histdisk; scrolled++) {
+		if (!vimnav_has_history_content(term.scr + scrolled + 1))
 			break;
-		}
-	}
-	scrolled = term.scr - old_scr;
-	if (scrolled > 0) {
-		tfulldirt();
 	}
+	vimnav_setscr(term.scr + scrolled);
 
 	/* Move cursor up by the amount we couldn't scroll */
 	remaining = n - scrolled;
@@ -432,13 +368,9 @@ vimnav_move_up(void)
 	} else if (!IS_SET(MODE_ALTSCREEN)) {
 		/* At top of screen, try to scroll up into history.
 		 * Skip on alt screen - history belongs to the main screen. */
-		term.scr++;
-		if (term.scr > HISTSIZE - 1 || !vimnav_has_history_content(term.scr)) {
-			/* Can't scroll or no content in history, revert */
-			term.scr = old_scr;
-		} else {
-			tfulldirt();
-		}
+		if (old_scr < term.histn + term.histdisk &&
+		    vimnav_has_history_content(old_scr + 1))
+			vimnav_setscr(old_scr + 1);
 		/* Cursor stays at row 0 */
 	}
 
@@ -1104,7 +1036,7 @@ vimnav_move_top(void)
 	int was_in_prompt_space = vimnav_is_prompt_space(vimnav.y);
 
 	/* Scroll to top of history, stopping at blank lines */
-	vimnav_scroll_up(HISTSIZE);
+	vimnav_scroll_up(term.histn + term.histdisk);
 	vimnav.y = 0;
 
 	/* Handoff: if we left prompt space with zsh in visual mode, inherit selection */
@@ -1153,34 +1085,26 @@ vimnav_move_bottom(void)
 static void
 vimnav_move_prev_prompt(void)
 {
-	int y;
+	int y = vimnav.y - term.scr;
 	int was_in_prompt_space = vimnav_is_prompt_space(vimnav.y);
 
-	/* First, scan within visible screen above cursor */
-	for (y = vimnav.y - 1; y >= 0; y--) {
-		if (vimnav_has_main_prompt(y))
-			goto found;
+	/* The prompt marks know where it is, scrolled up if above the screen */
+	if (tmarknext(&y, -1, MARK_PROMPT)) {
+		if (y + term.scr < 0)
+			vimnav_setscr(-y);
+		y += term.scr;
+		goto found;
 	}
 
-	/* Not found on screen. Scan into history by increasing term.scr. */
+	/* No prompt found above. Move to top of reachable history (like gg). */
 	if (!IS_SET(MODE_ALTSCREEN)) {
-		while (term.scr < HISTSIZE - 1) {
-			int old_scr = term.scr;
-			term.scr++;
-			if (!vimnav_has_history_content(term.scr)) {
-				term.scr = old_scr;
-				break;
-			}
-			/* The new line scrolled in at screen top is TLINE(0) */
-			if (vimnav_has_main_prompt(0)) {
-				y = 0;
-				tfulldirt();
-				goto found;
-			}
-		}
-	}
+		int scr = term.scr;
 
-	/* No prompt found above. Move to top of reachable history (like gg). */
+		while (scr < term.histn + term.histdisk &&
+		       vimnav_has_history_content(scr + 1))
+			scr++;
+		vimnav_setscr(scr);
+	}
 	vimnav.y = 0;
 	{
 		int linelen = tlinelen(vimnav.y);
@@ -1219,13 +1143,12 @@ handoff:
 static void
 vimnav_move_next_prompt(void)
 {
-	int y;
-	int max_valid_y = term.scr + term.c.y;
+	int y = vimnav.y - term.scr;
 
-	/* Scan downward from current position */
-	for (y = vimnav.y + 1; y <= max_valid_y; y++) {
-		if (vimnav_has_main_prompt(y))
-			goto found;
+	/* The next prompt mark, as far down as the current prompt */
+	if (tmarknext(&y, 1, MARK_PROMPT) && y <= term.c.y) {
+		y += term.scr;
+		goto found;
 	}
 
 	/* No prompt found below. Go to current active prompt (like G). */
@@ -1261,6 +1184,30 @@ found:
 	vimnav_update_selection();
 }
 
+/* go - select the output of the last command, the lines between its
+ * output mark (OSC 133;C) and the prompt after it */
+static void
+vimnav_select_output(void)
+{
+	int p = term.c.y + 1, q, o;
+
+	if (!tmarknext(&p, -1, MARK_PROMPT))
+		return;
+	q = p;
+	if (!tmarknext(&q, -1, MARK_PROMPT))
+		return;
+	o = p;
+	if (!tmarknext(&o, -1, MARK_OUTPUT) || o <= q)
+		o = q + 1;
+	if (o > p - 1)
+		return;
+
+	vimnav.mode = VIMNAV_VISUAL_LINE;
+	vimnav.anchor_abs_y = o;
+	vimnav_goto(0, p - 1);
+	tfulldirt();
+}
+
 /* H - move cursor to top line of current screen */
 static void
 vimnav_move_screen_top(void)
@@ -1429,12 +1376,17 @@ vimnav_yank_selection(void)
 static int
 vimnav_find_prompt_end(int screen_y)
 {
-	/* Find the end of the prompt on this line by looking for common prompt
+	/* Find the end of the prompt on this line: where the shell said the
+	 * command starts (OSC 133;B), else by looking for common prompt
 	 * delimiters: '% ', '$ ', '> ', '# ' (with trailing space).
 	 * Returns the x position after the delimiter, or 0 if not found. */
 	Line line = TLINE(screen_y);
 	int linelen = tlinelen(screen_y);
 	int last_delim = -1;
+	int mark = tmark(screen_y - term.scr);
+
+	if (mark & MARK_X)
+		return (mark & MARK_X) - 1;
 
 	for (int i = 0; i < linelen && i + 1 < term.col; i++) {
 		Rune c = line[i].u;
@@ -1449,16 +1401,21 @@ vimnav_find_prompt_end(int screen_y)
 
 static int
 vimnav_has_main_prompt(int screen_y)
+{
+	/* The shell's prompt marks, or vimnav_prompt_guess() where there are
+	 * none; the terminal keeps both with the line. */
+	return (tmark(screen_y - term.scr) & MARK_PROMPT) != 0;
+}
+
+int
+vimnav_prompt_guess(const Glyph *line, int linelen, int col)
 {
 	/* Check if this line has a main prompt (not a continuation prompt).
 	 * Main prompts typically have '% ' or '$ ' or '# ' at the start or after path.
 	 * Continuation prompts are just '> ' at the start.
 	 * For '%', require it to be preceded by ']' or at position 0 to avoid
 	 * false positives from command output (e.g. "25% /" in df output). */
-	Line line = TLINE(screen_y);
-	int linelen = tlinelen(screen_y);
-
-	for (int i = 0; i < linelen && i + 1 < term.col; i++) {
+	for (int i = 0; i < linelen && i + 1 < col; i++) {
 		Rune c = line[i].u;
 		Rune next = line[i + 1].u;
 		if (c == '%' && next == ' ' && (i == 0 || line[i - 1].u == ']')) {
@@ -1551,6 +1508,145 @@ vimnav_yank_line(void)
 	tfulldirt();
 }
 
+/* Search (/, ?, n, N): st.c searches the scrollback, a chunk of lines
+ * at a time from the main loop (see vimnav_searchstep()). */
+
+/* Lines the search looks at per main loop iteration */
+#define SEARCH_STEP 8192
+
+/* Move the cursor to column x of line y (y as for thline()),
+ * scrolling the line to the middle of the screen if it is not shown */
+static void
+vimnav_goto(int x, int y)
+{
+	if (y + term.scr < 0 || y + term.scr >= term.row) {
+		vimnav_setscr(term.row / 2 - y);
+	}
+	vimnav.y = y + term.scr;
+	vimnav.x = x;
+	vimnav.savedx = x;
+	vimnav_update_selection();
+}
+
+/* Jump to the next match in direction dir (1 down, -1 up). If the
+ * search hasn't got that far yet, vimnav_searchstep() jumps later. */
+static void
+vimnav_search_jump(int dir)
+{
+	int x = vimnav.x;
+	int y = vimnav.y - term.scr;
+	int found = tsearchnext(&x, &y, dir);
+
+	vimnav.search_pending = (found < 0) ? dir : 0;
+	if (found > 0)
+		vimnav_goto(x, y);
+}
+
+/* The pattern changed while typed: search again from where it started */
+static void
+vimnav_search_update(void)
+{
+	vimnav.search_pending = 0;
+	vimnav_setscr(vimnav.search_scr);
+	vimnav_goto(vimnav.search_x, vimnav.search_y);
+	if (vimnav.pattern[0] && tsearch(vimnav.pattern) == 0)
+		vimnav_search_jump(vimnav.search_forward ? 1 : -1);
+	else
+		tsearch(NULL);  /* empty or incomplete pattern: no matches */
+	tfulldirt();
+}
+
+static void
+vimnav_search_begin(int c)
+{
+	vimnav.searching = c;
+	vimnav.search_forward = (c == '/');
+	vimnav.search_x = vimnav.x;
+	vimnav.search_y = vimnav.y - term.scr;
+	vimnav.search_scr = term.scr;
+	vimnav.pattern[0] = '\0';
+	vimnav_search_update();
+}
+
+static void
+vimnav_search_cancel(void)
+{
+	vimnav.searching = 0;
+	vimnav.pattern[0] = '\0';
+	vimnav_search_update();
+}
+
+/* Keys while the pattern is typed */
+static int
+vimnav_search_key(ulong ksym, uint state)
+{
+	size_t len = strlen(vimnav.pattern);
+	char buf[UTF_SIZ];
+	size_t n;
+	Rune u;
+
+	switch (ksym) {
+	case 0xff1b: /* XK_Escape */
+		vimnav_search_cancel();
+		return 1;
+	case 0xff0d: /* XK_Return */
+	case 0xff8d: /* XK_KP_Enter */
+		vimnav.searching = 0;
+		tfulldirt();
+		return 1;
+	case 0xff08: /* XK_BackSpace */
+		/* Backspace on an empty pattern leaves the search, as in vim */
+		if (len == 0) {
+			vimnav_search_cancel();
+			return 1;
+		}
+		while (len > 0 && (vimnav.pattern[--len] & 0xc0) == 0x80)
+			;
+		vimnav.pattern[len] = '\0';
+		vimnav_search_update();
+		return 1;
+	}
+
+	if (state & ControlMask)
+		return 1;
+	/* Latin-1 keysyms are their code point, Unicode ones are offset */
+	if (ksym >= 0x20 && ksym <= 0xff && ksym != 0x7f)
+		u = ksym;
+	else if ((ksym & 0xff000000) == 0x01000000)
+		u = ksym & 0x00ffffff;
+	else
+		return 1;
+	n = utf8encode(u, buf);
+	if (len + n >= sizeof(vimnav.pattern))
+		return 1;
+	memcpy(vimnav.pattern + len, buf, n);
+	vimnav.pattern[len + n] = '\0';
+	vimnav_search_update();
+	return 1;
+}
+
+const char *
+vimnav_search_prompt(void)
+{
+	static char prompt[sizeof(vimnav.pattern) + 1];
+
+	if (vimnav.mode == VIMNAV_INACTIVE || !vimnav.searching)
+		return NULL;
+	prompt[0] = vimnav.searching;
+	memcpy(prompt + 1, vimnav.pattern, sizeof(vimnav.pattern));
+	return prompt;
+}
+
+int
+vimnav_searchstep(void)
+{
+	int more = tsearchstep(SEARCH_STEP);
+
+	if (vimnav.search_pending && vimnav.mode != VIMNAV_INACTIVE)
+		vimnav_search_jump(vimnav.search_pending);
+	return more;
+}
+
 void
 vimnav_enter(void)
 {
@@ -1633,6 +1729,11 @@ vimnav_exit(void)
 	vimnav.pending_find = 0;
 	vimnav.pending_g = 0;
 	vimnav.forced = 0;
+	/* Matches are only highlighted in nav mode */
+	vimnav.searching = 0;
+	vimnav.search_pending = 0;
+	vimnav.pattern[0] = '\0';
+	tsearch(NULL);
 	selclear();
 	tfulldirt();
 }
@@ -1646,6 +1747,10 @@ vimnav_handle_key(ulong ksym, uint state)
 	if (ksym >= 0xffe1 && ksym <= 0xffee)  /* XK_Shift_L to XK_Hyper_R */
 		return 1;
 
+	/* Typing a search pattern (after / or ?) */
+	if (vimnav.searching)
+		return vimnav_search_key(ksym, state);
+
 	/* Handle pending text object (after 'i' or 'a' was pressed) */
 	if (vimnav.pending_textobj) {
 		int inner = (vimnav.pending_textobj == 'i');
@@ -1673,6 +1778,10 @@ vimnav_handle_key(ulong ksym, uint state)
 			vimnav_move_top();
 			return 1;
 		}
+		if (ksym == 'o') {
+			vimnav_select_output();
+			return 1;
+		}
 		/* Any other key after g - ignore the g and process the key normally */
 	}
 
@@ -1873,6 +1982,23 @@ vimnav_handle_key(ulong ksym, uint state)
 		}
 		break;
 
+	/* Search (/ forward, ? backward) and repeat it (n same way, N other way) */
+	case '/':
+	case '?':
+		vimnav_search_begin(ksym);
+		break;
+	case 'n':
+	case 'N':
+		/* Without a search: same as any unknown key */
+		if (!vimnav.pattern[0]) {
+			handled = vimnav.mode == VIMNAV_VISUAL ||
+			          vimnav.mode == VIMNAV_VISUAL_LINE;
+			break;
+		}
+		vimnav_search_jump((vimnav.search_forward ? 1 : -1) *
+				(ksym == 'n' ? 1 : -1));
+		break;
+
 	/* Visual mode */
 	case 'v':
 		/* In prompt space: pass to zsh (zsh handles char selection) */
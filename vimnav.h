@@ -32,6 +32,13 @@ typedef struct {
 	int last_find_forward; /* 1 if last search was f (forward), 0 if F (backward) */
 	/* g command state (for gg) */
 	int pending_g;       /* 1 when waiting for second g, 0 otherwise */
+	/* / and ? search state */
+	int searching;       /* '/' or '?' while the pattern is typed, 0 otherwise */
+	char pattern[256];   /* pattern of the last search, UTF-8 */
+	int search_forward;  /* 1 if the last search was / (forward), 0 if ? */
+	int search_x, search_y; /* cursor when the pattern was begun (y as for thline) */
+	int search_scr;      /* scroll position then */
+	int search_pending;  /* direction of a jump waiting for the search, 0 if none */
 } VimNav;
 
 /* Global vim navigation state (defined in vimnav.c) */
@@ -47,6 +54,9 @@ void vimnav_paste_done(void);
 int vimnav_handle_key(ulong ksym, uint state);
 int vimnav_curline_y(void);  /* returns y to highlight, or -1 if none */
 void vimnav_prompt_line_range(int *start_y, int *end_y);
+const char *vimnav_search_prompt(void);  /* "/pattern" while typed, or NULL */
+int vimnav_searchstep(void);  /* returns 1 while the search has more to do */
+int vimnav_prompt_guess(const Glyph *line, int len, int col);  /* looks like a prompt */
 
 /* zsh cursor/visual sync functions (called from st.c OSC handler) */
 void vimnav_set_zsh_cursor(int pos);
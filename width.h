@@ -0,0 +1,11 @@
+/* See LICENSE for license details. */
+
+#ifndef WIDTH_H
+#define WIDTH_H
+
+#include "st.h"  /* for Rune */
+
+/* number of cells (0, 1 or 2) a rune occupies, independent of the locale */
+int runewidth(Rune u);
+
+#endif /* WIDTH_H */
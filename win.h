@@ -29,6 +29,8 @@ void clippaste(const Arg *);
 void xdrawcursor(int, int, Glyph, int, int, Glyph);
 void xdrawline(Line, int, int, int);
 void xfinishdraw(void);
+void xscroll(int, int, int);
+void xshadowclear(void);
 void xloadcols(void);
 int xsetcolorname(int, const char *);
 int xgetcolor(int, unsigned char *, unsigned char *, unsigned char *);
@@ -37,6 +39,7 @@ void xsettitle(char *);
 void xsetcwd(char *);
 int xgetcursor(void);
 int xsetcursor(int);
+int xgetmode(void);
 void xsetmode(int, unsigned int);
 void xsetpointermotion(int);
 void xsetsel(char *);
@@ -21,6 +21,8 @@ char *argv0;
 #include "st.h"
 #include "win.h"
 #include "persist.h"
+#include "style.h"
+#include "search.h"
 
 /* types used in config.h */
 typedef struct {
@@ -121,6 +123,43 @@ typedef struct {
 	struct timespec tclick2;
 } XSelection;
 
+/* clipboard paste on its way to the child, see pastepump() */
+enum paste_state {
+	PASTE_IDLE,
+	PASTE_READ,    /* data is waiting in the property at ofs */
+	PASTE_WAIT,    /* INCR transfer, waiting for the owner's next chunk */
+	PASTE_DONE,    /* everything received, buf still being written */
+};
+
+typedef struct {
+	int state;
+	Atom prop;
+	ulong ofs;
+	int incr, bracket, aborted;
+	char *buf;     /* translated data, not yet given to ttywrite() */
+	size_t off, len, siz;
+	size_t from, to; /* what of the tty queue it is, see ttyqueued() */
+} Paste;
+
+#define PASTEFETCH	(256 << 10)  /* bytes per XGetWindowProperty() */
+#define PASTECHUNK	(16 << 10)   /* bytes per ttywrite() */
+#define PASTEQUEUE	(64 << 10)   /* refill when less is queued for the tty */
+
+#define DAMAGEMAX	32           /* rectangles copied one by one */
+#define DAMAGEFULL	2            /* copy it all once 1/DAMAGEFULL changed */
+
+#define GLYPHCMP(a, b)	((a).u != (b).u || ATTRCMP(a, b))
+
+#define COLSETS		64           /* sets of the colour cache, a power of 2 */
+#define COLWAYS		4            /* colours in each */
+
+/* an allocated colour, see colcache */
+typedef struct {
+	Color col;
+	uint32_t used;               /* colclock then, 0 if the entry is free */
+	int ref;                     /* holds on it, see xcolorhold() */
+} ColorCache;
+
 /* Font structure */
 #define Font Font_
 typedef struct {
@@ -145,11 +184,28 @@ typedef struct {
 	GC gc;
 } DC;
 
+/* a rune's glyph, see gcbmp */
+typedef struct {
+	FT_UInt glyph;
+	ushort font;
+	ushort gen;
+} GlyphCache;
+
+typedef struct {
+	Rune key;                   /* rune | style << 21, 0 if free */
+	GlyphCache gc;
+} GlyphSlot;
+
 static inline ushort sixd_to_16bit(int);
 static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
-static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int);
-static void xdrawglyph(Glyph, int, int);
+static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, Style, int, int, int);
+static void xdrawglyph(Glyph, Style, int, int);
 static void xclear(int, int, int, int);
+static void xdamage(int, int, int, int);
+static void xshow(void);
+static void xshadowresize(int, int);
+static void xshadowdrop(int, int);
+static void xdrawcells(const Glyph *, int, int, int);
 static int xgeommasktogravity(int);
 static int ximopen(Display *);
 static void ximinstantiate(Display *, XPointer, XPointer);
@@ -160,10 +216,16 @@ static void cresize(int, int);
 static void xresize(int, int);
 static void xhints(void);
 static int xloadcolor(int, const char *, Color *);
+static int xcolorvalue(int, const char *, XRenderColor *);
+static Color *xcolorfind(const XRenderColor *, int);
+static Color *xcolorrgb(const XRenderColor *);
 static int xloadfont(Font *, FcPattern *);
 static void xloadfonts(const char *, double);
 static void xunloadfont(Font *);
 static void xunloadfonts(void);
+static GlyphSlot *xglyphslot(Rune);
+static GlyphCache *xglyphcache(Rune, int);
+static void xglyphcacheclear(void);
 static void xsetenv(void);
 static void xseturgency(int);
 static int evcol(XEvent *);
@@ -183,6 +245,9 @@ static void bpress(XEvent *);
 static void bmotion(XEvent *);
 static void propnotify(XEvent *);
 static void selnotify(XEvent *);
+static void pastefetch(void);
+static void pastepump(void);
+static void pasteabort(void);
 static void selclear_(XEvent *);
 static void selrequest(XEvent *);
 static void setsel(char *, Time);
@@ -193,6 +258,7 @@ static int match(uint, uint);
 
 static void run(void);
 static void usage(void);
+static unsigned int histarg(const char *);
 
 static void (*handler[LASTEvent])(XEvent *) = {
 	[KeyPress] = kpress,
@@ -224,6 +290,7 @@ static void (*handler[LASTEvent])(XEvent *) = {
 DC dc;               /* non-static for sshind.c access */
 XWindow xw;          /* non-static for sshind.c access */
 static XSelection xsel;
+static Paste paste;
 TermWindow win;      /* non-static for sshind.c access */
 
 /* Font Ring Cache */
@@ -244,6 +311,52 @@ typedef struct {
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+
+/*
+ * The glyph a rune is drawn with in each FRC style: those of the BMP in
+ * a table per style, the others hashed by rune and style. font is 0 if
+ * not known yet, 1 for the style's own font and 2 + i for frc[i]. All
+ * of it goes when the fonts are loaded again.
+ */
+static GlyphCache *gcbmp[4];
+static GlyphSlot *gchash;
+static int gchashlen = 0;
+static int gchashsiz = 0;       /* a power of 2 */
+static ushort gcgen = 1;        /* the gen of the BMP entries still good */
+
+/*
+ * What of xw.buf changed since the last xfinishdraw(), for it to copy
+ * only that to the window.
+ */
+static XRectangle damage[DAMAGEMAX];
+static int ndamage;
+static long damagearea;         /* pixels, or -1 for the whole window */
+
+/*
+ * What xfinishdraw() left for xshow() to copy, which with the threaded
+ * reader happens once the terminal is unlocked.
+ */
+static XRectangle shown[DAMAGEMAX];
+static int nshown;              /* -1 for the whole window */
+
+/*
+ * The cells last drawn to each row of xw.buf, with their selection and
+ * search marks, for xdrawline() to draw again only those that changed.
+ */
+enum { SHADOW_DRAWN = 1, SHADOW_CURLINE = 2 };
+static Glyph *shadow;
+static uchar *shadowrow;        /* SHADOW_* for each row, 0 to draw it all */
+static Glyph *shadowline;       /* the line being drawn */
+static int shadowcol, shadowrows;
+
+/*
+ * The truecolor and derived colours drawn, allocated once: a set of
+ * COLWAYS by the hash of the RGB, the least recently used one of which
+ * goes for a new colour unless sshind or notif hold on it.
+ */
+static ColorCache colcache[COLSETS][COLWAYS];
+static uint32_t colclock;
+
 char *usedfont = NULL;          /* non-static for sshind.c access */
 double usedfontsize = 0;        /* non-static for sshind.c access */
 static double defaultfontsize = 0;
@@ -553,14 +666,8 @@ propnotify(XEvent *e)
 void
 selnotify(XEvent *e)
 {
-	ulong nitems, ofs, rem;
-	int format;
-	uchar *data, *last, *repl;
-	Atom type, incratom, property = None;
+	Atom property = None;
 
-	incratom = XInternAtom(xw.dpy, "INCR", 0);
-
-	ofs = 0;
 	if (e->type == SelectionNotify)
 		property = e->xselection.property;
 	else if (e->type == PropertyNotify)
@@ -569,33 +676,75 @@ selnotify(XEvent *e)
 	if (property == None)
 		return;
 
-	do {
-		if (XGetWindowProperty(xw.dpy, xw.win, property, ofs,
-					BUFSIZ/4, False, AnyPropertyType,
-					&type, &format, &nitems, &rem,
-					&data)) {
-			fprintf(stderr, "Clipboard allocation failed\n");
-			return;
-		}
+	if (e->type == SelectionNotify) {
+		/* a new paste replaces whatever is left of the last one */
+		if (paste.state != PASTE_IDLE)
+			pasteabort();
+		paste.state = PASTE_READ;
+		paste.prop = property;
+		paste.ofs = 0;
+		paste.incr = paste.aborted = 0;
+		paste.off = paste.len = 0;
+		paste.bracket = IS_SET(MODE_BRCKTPASTE);
+		paste.from = ttyqueued();
+		if (paste.bracket)
+			ttywrite("\033[200~", 6, 0);
+		paste.to = ttyqueued();
+	} else if (paste.state == PASTE_WAIT && property == paste.prop) {
+		/* the owner has put the next INCR chunk in place */
+		paste.state = PASTE_READ;
+		paste.ofs = 0;
+	} else {
+		return;
+	}
 
-		if (e->type == PropertyNotify && nitems == 0 && rem == 0) {
-			/*
-			 * If there is some PropertyNotify with no data, then
-			 * this is the signal of the selection owner that all
-			 * data has been transferred. PropertyChangeMask stays
-			 * on for _ST_NOTIFY monitoring.
-			 */
-		}
+	pastepump();
+}
 
-		if (type == incratom) {
-			/*
-			 * PropertyChangeMask is always on (for _ST_NOTIFY),
-			 * so we just need to delete the property to signal
-			 * transfer start.
-			 */
-			XDeleteProperty(xw.dpy, xw.win, (int)property);
-			continue;
+/*
+ * Read the next piece of the selection property into paste.buf.
+ * Deleting the property is what asks an INCR owner for its next chunk,
+ * so that only happens once a chunk has been read completely: the
+ * owner cannot run ahead of a child that is slow to read.
+ */
+void
+pastefetch(void)
+{
+	ulong nitems, rem;
+	int format;
+	uchar *data;
+	char *p, *last;
+	size_t n;
+	Atom type;
+
+	if (XGetWindowProperty(xw.dpy, xw.win, paste.prop, paste.ofs,
+				PASTEFETCH/4, False, AnyPropertyType,
+				&type, &format, &nitems, &rem, &data)) {
+		fprintf(stderr, "Clipboard allocation failed\n");
+		paste.state = PASTE_DONE;
+		return;
+	}
+
+	if (type == XInternAtom(xw.dpy, "INCR", 0)) {
+		/* delete the property to signal transfer start */
+		XFree(data);
+		XDeleteProperty(xw.dpy, xw.win, paste.prop);
+		paste.incr = 1;
+		paste.state = PASTE_WAIT;
+		return;
+	}
+
+	n = nitems * format / 8;
+	if (!paste.aborted && n > 0) {
+		if (paste.off > 0) {
+			memmove(paste.buf, paste.buf + paste.off, paste.len);
+			paste.off = 0;
+		}
+		if (paste.len + n > paste.siz) {
+			paste.siz = paste.len + n;
+			paste.buf = xrealloc(paste.buf, paste.siz);
 		}
+		memcpy(paste.buf + paste.len, data, n);
 
 		/*
 		 * As seen in getsel:
@@ -604,39 +753,102 @@ selnotify(XEvent *e)
 		 * replace all '\n' with '\r'.
 		 * FIXME: Fix the computer world.
 		 */
-		repl = data;
-		last = data + nitems * format / 8;
-		while ((repl = memchr(repl, '\n', last - repl))) {
-			*repl++ = '\r';
-		}
+		p = paste.buf + paste.len;
+		last = p + n;
+		while ((p = memchr(p, '\n', last - p)))
+			*p++ = '\r';
+		paste.len += n;
+	}
+	XFree(data);
+	/* number of 32-bit chunks returned */
+	paste.ofs += nitems * format / 32;
+
+	if (rem > 0)
+		return;
+	XDeleteProperty(xw.dpy, xw.win, paste.prop);
+	/* an INCR transfer ends with an empty chunk */
+	paste.state = (paste.incr && n > 0) ? PASTE_WAIT : PASTE_DONE;
+}
+
+/*
+ * Feed the paste to the tty only as fast as the child reads it: called
+ * on every turn of the main loop, it tops the tty queue up to
+ * PASTEQUEUE bytes and fetches more of the selection when it runs dry.
+ */
+void
+pastepump(void)
+{
+	size_t n;
 
+	while (paste.state != PASTE_IDLE && ttypending() < PASTEQUEUE) {
+		n = paste.len;
 		/*
-		 * For vimnav paste, strip trailing carriage returns
-		 * (which were newlines before conversion).
+		 * For vimnav paste, strip trailing carriage returns (which
+		 * were newlines before conversion). Hold them back until it
+		 * is known whether more data follows.
 		 */
-		if (tisvimnav_paste() && rem == 0) {
-			while (last > data && *(last - 1) == '\r')
-				last--;
+		if (tisvimnav_paste()) {
+			while (n > 0 && paste.buf[paste.off + n - 1] == '\r')
+				n--;
+			if (paste.state == PASTE_DONE)
+				paste.len = n;
+		}
+		if (n > 0) {
+			n = MIN(n, PASTECHUNK);
+			ttywrite(paste.buf + paste.off, n, 1);
+			paste.to = ttyqueued();
+			paste.off += n;
+			paste.len -= n;
+			continue;
 		}
 
-		if (IS_SET(MODE_BRCKTPASTE) && ofs == 0)
-			ttywrite("\033[200~", 6, 0);
-		ttywrite((char *)data, last - data, 1);
-		if (IS_SET(MODE_BRCKTPASTE) && rem == 0)
-			ttywrite("\033[201~", 6, 0);
-		XFree(data);
-		/* number of 32-bit chunks returned */
-		ofs += nitems * format / 32;
-	} while (rem > 0);
+		if (paste.state == PASTE_READ) {
+			pastefetch();
+			continue;
+		}
+		if (paste.state == PASTE_WAIT)
+			break;
 
-	/*
-	 * Deleting the property again tells the selection owner to send the
-	 * next data chunk in the property.
-	 */
-	XDeleteProperty(xw.dpy, xw.win, (int)property);
+		/* PASTE_DONE and drained */
+		if (paste.bracket)
+			ttywrite("\033[201~", 6, 0);
+		paste.state = PASTE_IDLE;
+		paste.off = paste.len = 0;
+		if (paste.siz > PASTEFETCH) {
+			free(paste.buf);
+			paste.buf = NULL;
+			paste.siz = 0;
+		}
+		/* Clear vimnav paste mode flag */
+		vimnav_paste_done();
+	}
+}
 
-	/* Clear vimnav paste mode flag */
-	vimnav_paste_done();
+/*
+ * Drop what has not been written yet, also what waits in the tty queue
+ * so that a ^C gets there first. An INCR transfer still has to run to
+ * its end, so its remaining chunks are read and thrown away.
+ */
+void
+pasteabort(void)
+{
+	paste.off = paste.len = 0;
+	/* if none of it went out, not even the bracket needs closing */
+	if (ttyunqueue(paste.from, paste.to) == paste.to - paste.from)
+		paste.bracket = 0;
+	paste.from = paste.to = ttyqueued();
+	if (paste.bracket) {
+		ttywrite("\033[201~", 6, 0);
+		paste.bracket = 0;
+	}
+	if (paste.incr && paste.state != PASTE_DONE) {
+		paste.aborted = 1;
+		return;
+	}
+	if (paste.state == PASTE_READ)
+		XDeleteProperty(xw.dpy, xw.win, paste.prop);
+	paste.state = PASTE_DONE;
+	pastepump();
 }
 
 void
@@ -793,6 +1005,7 @@ xresize(int col, int row)
 
 	/* resize to new width */
 	xw.specbuf = xrealloc(xw.specbuf, col * sizeof(GlyphFontSpec));
+	xshadowresize(col, row);
 }
 
 ushort
@@ -801,53 +1014,184 @@ sixd_to_16bit(int x)
 	return x == 0 ? 0 : 0x3737 + 0x2828 * x;
 }
 
+/* the RGB colour i, or name, is; returns 0 if there is no such colour */
 int
-xloadcolor(int i, const char *name, Color *ncolor)
+xcolorvalue(int i, const char *name, XRenderColor *color)
 {
-	XRenderColor color = { .alpha = 0xffff };
+	XColor xc;
 
+	color->alpha = 0xffff;
 	if (!name) {
 		if (BETWEEN(i, 16, 255)) { /* 256 color */
 			if (i < 6*6*6+16) { /* same colors as xterm */
-				color.red   = sixd_to_16bit( ((i-16)/36)%6 );
-				color.green = sixd_to_16bit( ((i-16)/6) %6 );
-				color.blue  = sixd_to_16bit( ((i-16)/1) %6 );
+				color->red   = sixd_to_16bit( ((i-16)/36)%6 );
+				color->green = sixd_to_16bit( ((i-16)/6) %6 );
+				color->blue  = sixd_to_16bit( ((i-16)/1) %6 );
 			} else { /* greyscale */
-				color.red = 0x0808 + 0x0a0a * (i - (6*6*6+16));
-				color.green = color.blue = color.red;
+				color->red = 0x0808 + 0x0a0a * (i - (6*6*6+16));
+				color->green = color->blue = color->red;
 			}
-			return XftColorAllocValue(xw.dpy, xw.vis,
-			                          xw.cmap, &color, ncolor);
-		} else
-			name = colorname[i];
+			return 1;
+		}
+		name = colorname[i];
+	}
+	if (!name || !XParseColor(xw.dpy, xw.cmap, name, &xc))
+		return 0;
+	color->red = xc.red;
+	color->green = xc.green;
+	color->blue = xc.blue;
+	return 1;
+}
+
+int
+xloadcolor(int i, const char *name, Color *ncolor)
+{
+	XRenderColor color;
+
+	if (!name && BETWEEN(i, 16, 255)) {
+		xcolorvalue(i, NULL, &color);
+		return XftColorAllocValue(xw.dpy, xw.vis,
+		                          xw.cmap, &color, ncolor);
+	} else if (!name) {
+		name = colorname[i];
 	}
 
 	return XftColorAllocName(xw.dpy, xw.vis, xw.cmap, name, ncolor);
 }
 
+/*
+ * The cached colour c, allocated if it is not there yet; held ones stay
+ * until they are released. Others are good until COLWAYS more colours
+ * have been asked for, enough for the fg and bg of one draw.
+ */
+Color *
+xcolorfind(const XRenderColor *c, int hold)
+{
+	static Color spill[COLWAYS];
+	static int spilln, spilled;
+	ColorCache *set, *e, *lru = NULL;
+	uint32_t h;
+	int i;
+
+	h = (c->red * 31u + c->green) * 31u + c->blue;
+	set = colcache[(h ^ h >> 7 ^ h >> 14) & (COLSETS - 1)];
+	if (++colclock == 0) {
+		/* the clock went round: all are as old */
+		for (e = &colcache[0][0]; e < &colcache[0][0] + COLSETS * COLWAYS; e++)
+			e->used = !!e->used;
+		colclock = 2;
+	}
+	for (i = 0; i < COLWAYS; i++) {
+		e = &set[i];
+		if (e->used && e->col.color.red == c->red &&
+		    e->col.color.green == c->green &&
+		    e->col.color.blue == c->blue &&
+		    e->col.color.alpha == c->alpha)
+			goto found;
+		if (!e->ref && (!e->used || colclock - e->used >= COLWAYS) &&
+		    (!lru || e->used < lru->used))
+			lru = e;
+	}
+
+	if (!lru && !hold) {
+		/* the set is held or in use: not cached */
+		spilln = (spilln + 1) % COLWAYS;
+		if (spilled & 1 << spilln)
+			XftColorFree(xw.dpy, xw.vis, xw.cmap, &spill[spilln]);
+		if (!XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, c,
+		                        &spill[spilln])) {
+			spilled &= ~(1 << spilln);
+			return &dc.col[defaultfg];
+		}
+		spilled |= 1 << spilln;
+		return &spill[spilln];
+	}
+	if (!lru) {
+		/* a hold outlives this draw: take the oldest free one */
+		for (i = 0; i < COLWAYS; i++) {
+			if (!set[i].ref && (!lru || set[i].used < lru->used))
+				lru = &set[i];
+		}
+		if (!lru)
+			return &dc.col[defaultfg];
+	}
+	e = lru;
+	if (e->used)
+		XftColorFree(xw.dpy, xw.vis, xw.cmap, &e->col);
+	if (!XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, c, &e->col)) {
+		e->used = 0;
+		return &dc.col[defaultfg];
+	}
+found:
+	e->used = colclock;
+	e->ref += hold;
+	return &e->col;
+}
+
+/* the colour c for drawing this once */
+Color *
+xcolorrgb(const XRenderColor *c)
+{
+	return xcolorfind(c, 0);
+}
+
+/* the colour name in *col, kept until xcolorrelease(); 0 if there is none */
+int
+xcolorhold(const char *name, Color *col)
+{
+	XRenderColor c;
+
+	if (!xcolorvalue(-1, name, &c))
+		return 0;
+	*col = *xcolorfind(&c, 1);
+	return 1;
+}
+
+void
+xcolorrelease(const Color *col)
+{
+	ColorCache *e;
+
+	for (e = &colcache[0][0]; e < &colcache[0][0] + COLSETS * COLWAYS; e++) {
+		if (e->ref > 0 && e->col.pixel == col->pixel &&
+		    !memcmp(&e->col.color, &col->color, sizeof(col->color))) {
+			e->ref--;
+			return;
+		}
+	}
+}
+
 void
 xloadcols(void)
 {
 	int i;
 	static int loaded;
+	XRenderColor c;
 	Color *cp;
 
-	if (loaded) {
-		for (cp = dc.col; cp < &dc.col[dc.collen]; ++cp)
-			XftColorFree(xw.dpy, xw.vis, xw.cmap, cp);
-	} else {
+	if (!loaded) {
 		dc.collen = MAX(LEN(colorname), 256);
 		dc.col = xmalloc(dc.collen * sizeof(Color));
 	}
 
-	for (i = 0; i < dc.collen; i++)
-		if (!xloadcolor(i, NULL, &dc.col[i])) {
+	for (i = 0; i < dc.collen; i++) {
+		/* those that are what they were stay */
+		cp = &dc.col[i];
+		if (loaded && xcolorvalue(i, NULL, &c) &&
+		    c.red == cp->color.red && c.green == cp->color.green &&
+		    c.blue == cp->color.blue && c.alpha == cp->color.alpha)
+			continue;
+		if (loaded)
+			XftColorFree(xw.dpy, xw.vis, xw.cmap, cp);
+		if (!xloadcolor(i, NULL, cp)) {
 			if (colorname[i])
 				die("could not allocate color '%s'\n", colorname[i]);
 			else
 				die("could not allocate color %d\n", i);
 		}
+	}
 	loaded = 1;
+	xshadowclear();
 }
 
 int
@@ -876,6 +1220,7 @@ xsetcolorname(int x, const char *name)
 
 	XftColorFree(xw.dpy, xw.vis, xw.cmap, &dc.col[x]);
 	dc.col[x] = ncolor;
+	xshadowclear();
 
 	return 0;
 }
@@ -889,6 +1234,65 @@ xclear(int x1, int y1, int x2, int y2)
 	XftDrawRect(xw.draw,
 			&dc.col[IS_SET(MODE_REVERSE)? defaultfg : defaultbg],
 			x1, y1, x2-x1, y2-y1);
+	xdamage(x1, y1, x2-x1, y2-y1);
+}
+
+/*
+ * Note that the w by h pixels at x, y of xw.buf changed. Runs of a line
+ * join into one rectangle, and lines as wide join with the one above.
+ */
+void
+xdamage(int x, int y, int w, int h)
+{
+	XRectangle *r, *p;
+	int i;
+
+	if (damagearea < 0 || w <= 0 || h <= 0)
+		return;
+	damagearea += (long)w * h;
+	if (damagearea * DAMAGEFULL > (long)win.w * win.h)
+		goto full;
+
+	for (i = ndamage - 1; i >= 0; i--) {
+		r = &damage[i];
+		if (r->y == y && r->height == h &&
+		    x <= r->x + r->width && r->x <= x + w)
+			break;
+	}
+	if (i < 0) {
+		r = &damage[MAX(ndamage - 1, 0)];
+		if (ndamage > 0 && r->x == x && r->width == w &&
+		    y <= r->y + r->height && r->y <= y + h) {
+			h = MAX(y + h, r->y + r->height);
+			r->y = MIN(y, r->y);
+			r->height = h - r->y;
+		} else if (ndamage < DAMAGEMAX) {
+			damage[ndamage++] = (XRectangle){
+				.x = x, .y = y, .width = w, .height = h
+			};
+		} else {
+			goto full;
+		}
+		return;
+	}
+	w = MAX(x + w, r->x + r->width);
+	r->x = MIN(x, r->x);
+	r->width = w - r->x;
+
+	/* the last line may now be as wide as the one above it */
+	if (i == 0 || i != ndamage - 1)
+		return;
+	p = r - 1;
+	if (p->x == r->x && p->width == r->width &&
+	    r->y <= p->y + p->height && p->y <= r->y + r->height) {
+		h = MAX(r->y + r->height, p->y + p->height);
+		p->y = MIN(r->y, p->y);
+		p->height = h - p->y;
+		ndamage--;
+	}
+	return;
+full:
+	damagearea = -1;
 }
 
 void
@@ -1029,6 +1433,8 @@ xloadfonts(const char *fontstr, double fontsize)
 	if (!pattern)
 		die("can't open font %s\n", fontstr);
 
+	xglyphcacheclear();
+
 	if (fontsize > 1) {
 		FcPatternDel(pattern, FC_PIXEL_SIZE);
 		FcPatternDel(pattern, FC_SIZE);
@@ -1170,6 +1576,9 @@ xinit(int cols, int rows)
 	pid_t thispid = getpid();
 	XColor xmousefg, xmousebg;
 
+	/* the reader thread calls back into Xlib for titles, bells, etc. */
+	if (threadedreader && !XInitThreads())
+		die("XInitThreads failed\n");
 	if (!(xw.dpy = XOpenDisplay(NULL)))
 		die("can't open display\n");
 	xw.scr = XDefaultScreen(xw.dpy);
@@ -1225,6 +1634,7 @@ xinit(int cols, int rows)
 
 	/* font spec buffer */
 	xw.specbuf = xmalloc(cols * sizeof(GlyphFontSpec));
+	xshadowresize(cols, rows);
 
 	/* Xft rendering context */
 	xw.draw = XftDrawCreate(xw.dpy, xw.buf, xw.vis, xw.cmap);
@@ -1282,6 +1692,75 @@ xinit(int cols, int rows)
 		xsel.xtarget = XA_STRING;
 }
 
+/* the slot of key in gchash, a free one if it is not there */
+GlyphSlot *
+xglyphslot(Rune key)
+{
+	int i;
+
+	for (i = (key * 2654435761u) >> 8 & (gchashsiz - 1);
+	     gchash[i].key && gchash[i].key != key;
+	     i = (i + 1) & (gchashsiz - 1))
+		;
+	return &gchash[i];
+}
+
+/* the cached glyph of rune u in FRC style, font 0 if there is none yet */
+GlyphCache *
+xglyphcache(Rune u, int style)
+{
+	GlyphSlot *old, *gs;
+	int i, n;
+
+	if (u < 0x10000) {
+		if (!gcbmp[style]) {
+			gcbmp[style] = xmalloc(0x10000 * sizeof(GlyphCache));
+			memset(gcbmp[style], 0, 0x10000 * sizeof(GlyphCache));
+		}
+		if (gcbmp[style][u].gen != gcgen)
+			gcbmp[style][u] = (GlyphCache){ .gen = gcgen };
+		return &gcbmp[style][u];
+	}
+
+	if (2 * (gchashlen + 1) > gchashsiz) {
+		old = gchash;
+		n = gchashsiz;
+		gchashsiz = MAX(2 * n, 256);
+		gchash = xmalloc(gchashsiz * sizeof(GlyphSlot));
+		memset(gchash, 0, gchashsiz * sizeof(GlyphSlot));
+		for (i = 0; i < n; i++) {
+			if (old[i].key)
+				*xglyphslot(old[i].key) = old[i];
+		}
+		free(old);
+	}
+	gs = xglyphslot(u | (Rune)style << 21);
+	if (!gs->key) {
+		gs->key = u | (Rune)style << 21;
+		gs->gc = (GlyphCache){ 0 };
+		gchashlen++;
+	}
+	return &gs->gc;
+}
+
+/* forget the cached glyphs, as the fonts they are in go */
+void
+xglyphcacheclear(void)
+{
+	int i;
+
+	if (++gcgen == 0) {
+		for (i = 0; i < LEN(gcbmp); i++) {
+			if (gcbmp[i])
+				memset(gcbmp[i], 0, 0x10000 * sizeof(GlyphCache));
+		}
+		gcgen = 1;
+	}
+	if (gchash)
+		memset(gchash, 0, gchashsiz * sizeof(GlyphSlot));
+	gchashlen = 0;
+}
+
 int
 xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
 {
@@ -1296,6 +1775,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 	FcPattern *fcpattern, *fontpattern;
 	FcFontSet *fcsets[] = { NULL };
 	FcCharSet *fccharset;
+	GlyphCache *gc;
 	int i, f, numspecs = 0;
 
 	for (i = 0, xp = winx, yp = winy + font->ascent; i < len; ++i) {
@@ -1326,9 +1806,24 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 			yp = winy + font->ascent;
 		}
 
+		/* The font and glyph it had the last time, if it was drawn. */
+		gc = xglyphcache(rune, frcflags);
+		if (gc->font) {
+			specs[numspecs].font = gc->font == 1 ? font->match :
+			                       frc[gc->font - 2].font;
+			specs[numspecs].glyph = gc->glyph;
+			specs[numspecs].x = (short)xp;
+			specs[numspecs].y = (short)yp;
+			xp += runewidth;
+			numspecs++;
+			continue;
+		}
+
 		/* Lookup character index with default font. */
 		glyphidx = XftCharIndex(xw.dpy, font->match, rune);
 		if (glyphidx) {
+			gc->font = 1;
+			gc->glyph = glyphidx;
 			specs[numspecs].font = font->match;
 			specs[numspecs].glyph = glyphidx;
 			specs[numspecs].x = (short)xp;
@@ -1403,6 +1898,8 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 			FcCharSetDestroy(fccharset);
 		}
 
+		gc->font = f + 2;
+		gc->glyph = glyphidx;
 		specs[numspecs].font = frc[f].font;
 		specs[numspecs].glyph = glyphidx;
 		specs[numspecs].x = (short)xp;
@@ -1415,49 +1912,48 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 }
 
 void
-xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, int y)
+xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, Style sty,
+		int len, int x, int y)
 {
 	int charlen = len * ((base.mode & ATTR_WIDE) ? 2 : 1);
 	int winx = borderpx + x * win.cw, winy = borderpx + y * win.ch,
 	    width = charlen * win.cw;
-	Color *fg, *bg, *temp, revfg, revbg, truefg, truebg;
+	Color *fg, *bg, *temp;
 	XRenderColor colfg, colbg;
 	XRectangle r;
 
 	/* Fallback on color display for attributes not supported by the font */
 	if (base.mode & ATTR_ITALIC && base.mode & ATTR_BOLD) {
 		if (dc.ibfont.badslant || dc.ibfont.badweight)
-			base.fg = defaultattr;
+			sty.fg = defaultattr;
 	} else if ((base.mode & ATTR_ITALIC && dc.ifont.badslant) ||
 	    (base.mode & ATTR_BOLD && dc.bfont.badweight)) {
-		base.fg = defaultattr;
+		sty.fg = defaultattr;
 	}
 
-	if (IS_TRUECOL(base.fg)) {
+	if (IS_TRUECOL(sty.fg)) {
 		colfg.alpha = 0xffff;
-		colfg.red = TRUERED(base.fg);
-		colfg.green = TRUEGREEN(base.fg);
-		colfg.blue = TRUEBLUE(base.fg);
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg, &truefg);
-		fg = &truefg;
+		colfg.red = TRUERED(sty.fg);
+		colfg.green = TRUEGREEN(sty.fg);
+		colfg.blue = TRUEBLUE(sty.fg);
+		fg = xcolorrgb(&colfg);
 	} else {
-		fg = &dc.col[base.fg];
+		fg = &dc.col[sty.fg];
 	}
 
-	if (IS_TRUECOL(base.bg)) {
+	if (IS_TRUECOL(sty.bg)) {
 		colbg.alpha = 0xffff;
-		colbg.green = TRUEGREEN(base.bg);
-		colbg.red = TRUERED(base.bg);
-		colbg.blue = TRUEBLUE(base.bg);
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg, &truebg);
-		bg = &truebg;
+		colbg.green = TRUEGREEN(sty.bg);
+		colbg.red = TRUERED(sty.bg);
+		colbg.blue = TRUEBLUE(sty.bg);
+		bg = xcolorrgb(&colbg);
 	} else {
-		bg = &dc.col[base.bg];
+		bg = &dc.col[sty.bg];
 	}
 
 	/* Change basic system colors [0-7] to bright system colors [8-15] */
-	if ((base.mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(base.fg, 0, 7))
-		fg = &dc.col[base.fg + 8];
+	if ((base.mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(sty.fg, 0, 7))
+		fg = &dc.col[sty.fg + 8];
 
 	if (IS_SET(MODE_REVERSE)) {
 		if (fg == &dc.col[defaultfg]) {
@@ -1467,9 +1963,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 			colfg.green = ~fg->color.green;
 			colfg.blue = ~fg->color.blue;
 			colfg.alpha = fg->color.alpha;
-			XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg,
-					&revfg);
-			fg = &revfg;
+			fg = xcolorrgb(&colfg);
 		}
 
 		if (bg == &dc.col[defaultbg]) {
@@ -1479,26 +1973,26 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 			colbg.green = ~bg->color.green;
 			colbg.blue = ~bg->color.blue;
 			colbg.alpha = bg->color.alpha;
-			XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg,
-					&revbg);
-			bg = &revbg;
+			bg = xcolorrgb(&colbg);
 		}
 	}
 
 	/* Highlight current line in vim nav mode (outside prompt space).
 	 * Only apply to glyphs with the default background - preserves custom
 	 * backgrounds set by programs (fastfetch, etc.) and cursor colors. */
-	if (y == vimnav_curline_y() && base.bg == defaultbg)
+	if (y == vimnav_curline_y() && sty.bg == defaultbg)
 		bg = &dc.col[vimnav_curline_bg];
 
 	/* Debug mode: highlight prompt lines with yellow tinge */
-	if (debug_mode && base.bg == defaultbg) {
+	if (debug_mode && sty.bg == defaultbg) {
 		int ps, pe;
 		vimnav_prompt_line_range(&ps, &pe);
 		if (ps >= 0 && y >= ps && y <= pe)
 			bg = &dc.col[debug_prompt_bg];
 	}
 
+	if (base.mode & ATTR_FOUND)
+		bg = &dc.col[searchbg];
 	if (base.mode & ATTR_SELECTED)
 		bg = &dc.col[selectionbg];
 
@@ -1507,8 +2001,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 		colfg.green = fg->color.green / 2;
 		colfg.blue = fg->color.blue / 2;
 		colfg.alpha = fg->color.alpha;
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg, &revfg);
-		fg = &revfg;
+		fg = xcolorrgb(&colfg);
 	}
 
 	if (base.mode & ATTR_REVERSE) {
@@ -1540,6 +2033,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 
 	/* Clean up the region we want to draw to. */
 	XftDrawRect(xw.draw, bg, winx, winy, width, win.ch);
+	xdamage(winx, winy, width, win.ch);
 
 	/* Set the clip region because Xft is sometimes dirty. */
 	r.x = 0;
@@ -1548,8 +2042,9 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 	r.width = width;
 	XftDrawSetClipRectangles(xw.draw, winx, winy, &r, 1);
 
-	/* Render the glyphs. */
-	XftDrawGlyphFontSpec(xw.draw, fg, specs, len);
+	/* Render the glyphs, none for a blank run. */
+	if (specs)
+		XftDrawGlyphFontSpec(xw.draw, fg, specs, len);
 
 	/* Render underline and strikethrough. */
 	if (base.mode & ATTR_UNDERLINE) {
@@ -1567,27 +2062,34 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 }
 
 void
-xdrawglyph(Glyph g, int x, int y)
+xdrawglyph(Glyph g, Style sty, int x, int y)
 {
 	int numspecs;
 	XftGlyphFontSpec spec;
 
 	numspecs = xmakeglyphfontspecs(&spec, &g, 1, x, y);
-	xdrawglyphfontspecs(&spec, g, numspecs, x, y);
+	xdrawglyphfontspecs(&spec, g, sty, numspecs, x, y);
 }
 
 void
 xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 {
 	Color drawcol;
+	Style sty = styles[g.style];
 
 	/* remove the old cursor */
 	if (selected(ox, oy))
 		og.mode |= ATTR_SELECTED;
-	xdrawglyph(og, ox, oy);
+	xdrawglyph(og, styles[og.style], ox, oy);
 
 	if (IS_SET(MODE_HIDE) && !vimnav.forced)
 		return;
+	xdamage(borderpx + cx * win.cw, borderpx + cy * win.ch,
+			win.cw, win.ch);
+	/* the cursor is not what xdrawline() drew there */
+	xshadowdrop(cx, cy);
+	if (g.mode & ATTR_WIDE)
+		xshadowdrop(cx + 1, cy);
 
 	/*
 	 * Select the right color for the right mode.
@@ -1606,23 +2108,23 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 			allocated = 1;
 		}
 		drawcol = forcedcol;
-		g.fg = defaultbg;
-		g.bg = TRUECOLOR(0xff, 0x6b, 0x6b);
+		sty.fg = defaultbg;
+		sty.bg = TRUECOLOR(0xff, 0x6b, 0x6b);
 	} else if (IS_SET(MODE_REVERSE)) {
 		g.mode |= ATTR_REVERSE;
-		g.bg = defaultfg;
+		sty.bg = defaultfg;
 		if (selected(cx, cy)) {
 			drawcol = dc.col[defaultcs];
-			g.fg = defaultrcs;
+			sty.fg = defaultrcs;
 		} else {
 			drawcol = dc.col[defaultrcs];
-			g.fg = defaultcs;
+			sty.fg = defaultcs;
 		}
 	} else {
 		/* Always use defaultcs for cursor color, even when selected */
-		g.fg = defaultbg;
-		g.bg = defaultcs;
-		drawcol = dc.col[g.bg];
+		sty.fg = defaultbg;
+		sty.bg = defaultcs;
+		drawcol = dc.col[sty.bg];
 	}
 
 	/* draw the new one */
@@ -1634,7 +2136,7 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 		case 0: /* Blinking Block */
 		case 1: /* Blinking Block (Default) */
 		case 2: /* Steady Block */
-			xdrawglyph(g, cx, cy);
+			xdrawglyph(g, sty, cx, cy);
 			break;
 		case 3: /* Blinking Underline */
 		case 4: /* Steady Underline */
@@ -1739,23 +2241,48 @@ xstartdraw(void)
 	return IS_SET(MODE_VISIBLE);
 }
 
+/*
+ * Move rows top to bot of xw.buf up by n, down if n < 0, as the terminal
+ * did, and what was drawn there with them.
+ */
 void
-xdrawline(Line line, int x1, int y1, int x2)
+xscroll(int top, int bot, int n)
+{
+	int src = top, dst = top, rows = bot - top + 1 - abs(n);
+
+	if (top < 0 || bot >= shadowrows || rows <= 0)
+		return;
+	if (n > 0)
+		src += n;
+	else
+		dst -= n;
+
+	XCopyArea(xw.dpy, xw.buf, xw.buf, dc.gc,
+			borderpx, borderpx + src * win.ch, win.tw, rows * win.ch,
+			borderpx, borderpx + dst * win.ch);
+	xdamage(borderpx, borderpx + dst * win.ch, win.tw, rows * win.ch);
+	memmove(&shadow[dst * shadowcol], &shadow[src * shadowcol],
+			rows * shadowcol * sizeof(Glyph));
+	memmove(&shadowrow[dst], &shadowrow[src], rows);
+}
+
+/* draw the glyphs from x1 to x2, marked as selected or found */
+void
+xdrawcells(const Glyph *line, int x1, int y1, int x2)
 {
-	int i, x, ox, numspecs;
+	int i, x, ox, blank, numspecs;
 	Glyph base, new;
 	XftGlyphFontSpec *specs = xw.specbuf;
 
 	numspecs = xmakeglyphfontspecs(specs, &line[x1], x2 - x1, x1, y1);
-	i = ox = 0;
+	i = ox = blank = 0;
 	for (x = x1; x < x2 && i < numspecs; x++) {
 		new = line[x];
 		if (new.mode == ATTR_WDUMMY)
 			continue;
-		if (selected(x, y1))
-			new.mode |= ATTR_SELECTED;
 		if (i > 0 && ATTRCMP(base, new)) {
-			xdrawglyphfontspecs(specs, base, i, ox, y1);
+			xdrawglyphfontspecs(blank ? NULL : specs, base,
+					styles[base.style], i, ox, y1);
 			specs += i;
 			numspecs -= i;
 			i = 0;
@@ -1763,11 +2290,91 @@ xdrawline(Line line, int x1, int y1, int x2)
 		if (i == 0) {
 			ox = x;
 			base = new;
+			blank = 1;
 		}
+		blank &= new.u == ' ';
 		i++;
 	}
-	if (i > 0)
-		xdrawglyphfontspecs(specs, base, i, ox, y1);
+	if (i > 0) {
+		xdrawglyphfontspecs(blank ? NULL : specs, base,
+				styles[base.style], i, ox, y1);
+	}
+}
+
+void
+xshadowresize(int col, int row)
+{
+	shadow = xrealloc(shadow, col * row * sizeof(Glyph));
+	shadowrow = xrealloc(shadowrow, row);
+	shadowline = xrealloc(shadowline, col * sizeof(Glyph));
+	shadowcol = col;
+	shadowrows = row;
+	xshadowclear();
+}
+
+/* forget what was drawn, every cell is drawn again */
+void
+xshadowclear(void)
+{
+	memset(shadowrow, 0, shadowrows);
+}
+
+/* something else was drawn over cell x, y */
+void
+xshadowdrop(int x, int y)
+{
+	if (BETWEEN(x, 0, shadowcol - 1) && BETWEEN(y, 0, shadowrows - 1))
+		shadow[y * shadowcol + x].u = (Rune)-1;
+}
+
+/*
+ * Draw the line from x1 to x2 where it is not what was drawn there last,
+ * row y1 being drawn with the current line highlight or without it.
+ */
+void
+xdrawline(Line line, int x1, int y1, int x2)
+{
+	int j, x, ox, nfound, found[2 * 64], row;
+	Glyph *new = shadowline, *old = &shadow[y1 * shadowcol];
+
+	nfound = tsearchcells(line, found, LEN(found) / 2);
+	for (x = x1, j = 0; x < x2; x++) {
+		new[x] = line[x];
+		if (new[x].mode == ATTR_WDUMMY)
+			continue;
+		if (selected(x, y1))
+			new[x].mode |= ATTR_SELECTED;
+		while (j < nfound && x > found[2*j+1])
+			j++;
+		if (j < nfound && x >= found[2*j])
+			new[x].mode |= ATTR_FOUND;
+	}
+
+	row = SHADOW_DRAWN | (y1 == vimnav_curline_y() ? SHADOW_CURLINE : 0);
+	if (debug_mode || shadowrow[y1] != row) {
+		xdrawcells(new, x1, y1, x2);
+	} else {
+		for (x = x1; x < x2;) {
+			/* blinking ones change without a change of glyph */
+			if (!GLYPHCMP(old[x], new[x]) &&
+			    !(new[x].mode & ATTR_BLINK)) {
+				x++;
+				continue;
+			}
+			for (ox = x; x < x2 && (GLYPHCMP(old[x], new[x]) ||
+			     new[x].mode & ATTR_BLINK); x++)
+				;
+			/* whole wide characters */
+			if (ox > x1 && new[ox].mode & ATTR_WDUMMY)
+				ox--;
+			if (x < x2 && new[x].mode & ATTR_WDUMMY)
+				x++;
+			xdrawcells(new, ox, y1, x);
+		}
+	}
+	memcpy(&old[x1], &new[x1], (x2 - x1) * sizeof(Glyph));
+	/* the debug label goes over it */
+	shadowrow[y1] = debug_mode ? 0 : row;
 
 	/* Debug mode: draw "prompt line" hint text after content */
 	if (debug_mode) {
@@ -1785,6 +2392,8 @@ xdrawline(Line line, int x1, int y1, int x2)
 				XftDrawRect(xw.draw, &dc.col[debug_prompt_bg],
 						text_x, borderpx + y1 * win.ch,
 						label_width, win.ch);
+				xdamage(text_x, borderpx + y1 * win.ch,
+						label_width, win.ch);
 				XftDrawStringUtf8(xw.draw, &dc.col[debug_prompt_fg],
 						dc.font.match, text_x, text_y,
 						(const FcChar8 *)label, label_len);
@@ -1796,11 +2405,35 @@ xdrawline(Line line, int x1, int y1, int x2)
 void
 xfinishdraw(void)
 {
-	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
-			win.h, 0, 0);
+	if (damagearea < 0 || nshown < 0 || nshown + ndamage > DAMAGEMAX) {
+		nshown = -1;
+	} else {
+		memcpy(&shown[nshown], damage, ndamage * sizeof(*damage));
+		nshown += ndamage;
+	}
+	ndamage = damagearea = 0;
 	XSetForeground(xw.dpy, dc.gc,
 			dc.col[IS_SET(MODE_REVERSE)?
 				defaultfg : defaultbg].pixel);
+	if (!threadedreader)
+		xshow();
+}
+
+/* copy what was drawn to the window; needs only xw.buf, not the terminal */
+void
+xshow(void)
+{
+	XRectangle *r;
+
+	if (nshown < 0) {
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
+				win.h, 0, 0);
+	} else {
+		for (r = shown; r < &shown[nshown]; r++)
+			XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, r->x, r->y,
+					r->width, r->height, r->x, r->y);
+	}
+	nshown = 0;
 }
 
 void
@@ -1818,6 +2451,7 @@ xximspot(int x, int y)
 void
 expose(XEvent *ev)
 {
+	xshadowclear();
 	redraw();
 	sshind_draw();
 	notif_draw();
@@ -1849,8 +2483,10 @@ xsetmode(int set, unsigned int flags)
 {
 	int mode = win.mode;
 	MODBIT(win.mode, set, flags);
-	if ((win.mode & MODE_REVERSE) != (mode & MODE_REVERSE))
+	if ((win.mode & MODE_REVERSE) != (mode & MODE_REVERSE)) {
+		xshadowclear();
 		redraw();
+	}
 }
 
 int
@@ -1868,6 +2504,12 @@ xsetcursor(int cursor)
 	return 0;
 }
 
+int
+xgetmode(void)
+{
+	return win.mode;
+}
+
 void
 xseturgency(int add)
 {
@@ -1984,6 +2626,10 @@ kpress(XEvent *ev)
 		}
 	}
 
+	/* Ctrl+C interrupts a paste still on its way, then goes through */
+	if (paste.state != PASTE_IDLE && ksym == XK_c && (e->state & ControlMask))
+		pasteabort();
+
 	/* Shift+Escape: force-toggle vim nav mode */
 	if (ksym == XK_Escape && (e->state & ShiftMask)) {
 		if (vimnav.forced) {
@@ -2154,9 +2800,11 @@ run(void)
 {
 	XEvent ev;
 	int w = win.w, h = win.h;
-	fd_set rfd;
-	int xfd = XConnectionNumber(xw.dpy), ttyfd, xev, drawing;
-	struct timespec seltv, *tv, now, lastblink, trigger;
+	fd_set rfd, wfd;
+	int xfd = XConnectionNumber(xw.dpy), ttyfd, readfd, xev, drawing, sync;
+	int packing = 0, searching = 0;
+	struct timespec seltv, *tv, now, prev, lastblink, trigger;
+	struct timespec zerotv = {0};
 	double timeout;
 
 	/* Waiting for window mapping */
@@ -2192,27 +2840,41 @@ run(void)
 		ttywrite(msg, sizeof(msg) - 1, 1);
 	}
 
+	readfd = threadedreader ? ttythreadstart() : ttyfd;
+
 	struct timespec lastpersist = {0};
+	clock_gettime(CLOCK_MONOTONIC, &now);
 	for (timeout = -1, drawing = 0, lastblink = (struct timespec){0};;) {
 		FD_ZERO(&rfd);
-		FD_SET(ttyfd, &rfd);
+		FD_ZERO(&wfd);
+		FD_SET(readfd, &rfd);
 		FD_SET(xfd, &rfd);
-
+		tlock();
+		if (ttypending())
+			FD_SET(ttyfd, &wfd);
+		/* the reader may be in Xlib for a title or bell otherwise */
 		if (XPending(xw.dpy))
 			timeout = 0;  /* existing events might not set xfd */
+		tunlock();
 
 		seltv.tv_sec = timeout / 1E3;
 		seltv.tv_nsec = 1E6 * (timeout - 1E3 * seltv.tv_sec);
 		tv = timeout >= 0 ? &seltv : NULL;
+		if (packing || searching)
+			tv = &zerotv;
 
-		if (pselect(MAX(xfd, ttyfd)+1, &rfd, NULL, NULL, tv, NULL) < 0) {
+		if (pselect(MAX(xfd, MAX(ttyfd, readfd))+1, &rfd, &wfd, NULL,
+				tv, NULL) < 0) {
 			if (errno == EINTR)
 				continue;
 			die("select failed: %s\n", strerror(errno));
 		}
+		/* the terminal is ours until we sleep again */
+		tlock();
+		prev = now;
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
-		if (FD_ISSET(ttyfd, &rfd))
+		if (FD_ISSET(readfd, &rfd))
 			ttyread();
 
 		xev = 0;
@@ -2225,6 +2887,26 @@ run(void)
 				(handler[ev.type])(&ev);
 		}
 
+		/* everything queued for the child this round, in one write */
+		pastepump();
+		ttyflush();
+
+		/*
+		 * A wakeup that only made room for queued input, or that packs
+		 * and indexes cold history while idle, has nothing to draw;
+		 * sleep again for what the timers had left. A search going on
+		 * draws what it finds.
+		 */
+		if (!FD_ISSET(readfd, &rfd) && !xev && !searching &&
+		    (FD_ISSET(ttyfd, &wfd) || (packing && timeout != 0))) {
+			if (packing)
+				packing = thistcompact(256) | tindexstep(256);
+			if (timeout > 0)
+				timeout = MAX(timeout - TIMEDIFF(now, prev), 0);
+			tunlock();
+			continue;
+		}
+
 		/*
 		 * To reduce flicker and tearing, when new content or event
 		 * triggers drawing, we first wait a bit to ensure we got
@@ -2236,15 +2918,17 @@ run(void)
 		 * maximum latency intervals during `cat huge.txt`, and perfect
 		 * sync with periodic updates from animations/key-repeats/etc.
 		 */
-		if (FD_ISSET(ttyfd, &rfd) || xev) {
+		if (FD_ISSET(readfd, &rfd) || xev) {
 			if (!drawing) {
 				trigger = now;
 				drawing = 1;
 			}
 			timeout = (maxlatency - TIMEDIFF(now, trigger)) \
 			          / maxlatency * minlatency;
-			if (timeout > 0)
+			if (timeout > 0) {
+				tunlock();
 				continue;  /* we have time, try to find idle */
+			}
 		}
 
 		/* idle detected or maxlatency exhausted -> draw */
@@ -2281,23 +2965,47 @@ run(void)
 				timeout = persist_remain;
 		}
 
+		/* wake up to draw an update that doesn't end in time */
+		if ((sync = tsyncleft()) > 0 && (timeout < 0 || sync < timeout))
+			timeout = sync;
+
+		searching = vimnav_searchstep();
 		draw();
-		XFlush(xw.dpy);
 		drawing = 0;
+		packing = thistcompact(0) | tindexstep(0);
+		tunlock();
+
+		/* the parser can go on while the frame goes out */
+		xshow();
+		XFlush(xw.dpy);
 	}
 }
 
+/* the -s argument: 1 to HISTMAX lines, usage() for anything else */
+unsigned int
+histarg(const char *s)
+{
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(s, &end, 10);
+	if (errno || end == s || *end || !BETWEEN(n, 1, HISTMAX))
+		usage();
+	return n;
+}
+
 void
 usage(void)
 {
 	die("usage: %s [-adiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid]"
+	    "          [-s lines] [-T title] [-t title] [-w windowid]"
 	    " [--from-save dir]"
 	    " [[-e] command [args ...]]\n"
 	    "       %s [-adiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid] -l line"
+	    "          [-s lines] [-T title] [-t title] [-w windowid] -l line"
 	    " [stty_args ...]\n", argv0, argv0);
 }
 
@@ -2359,6 +3067,9 @@ main(int argc, char *argv[])
 	case 'n':
 		opt_name = EARGF(usage());
 		break;
+	case 's':
+		histsize = histarg(EARGF(usage()));
+		break;
 	case 't':
 	case 'T':
 		opt_title = EARGF(usage());